@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "board.h"
+#include "libyash_internal.h"
+
+/**
+ * YashBoard_t struct, the writer's side of a board file
+ */
+struct YashBoard_t{
+  char* path;
+  YashBoardFile_t* file;
+};
+
+/**
+ * Purpose:
+ *   Directory boards are kept in: $XDG_RUNTIME_DIR/yash, else
+ *   /tmp/yash-UID
+ *
+ * Args:
+ *   buf  (char*): Buffer for the path
+ *   size (size_t): Size of buf
+ *
+ * Returns:
+ *   (char*): buf
+ */
+char* boardDir(char* buf, size_t size){
+  char* env = getenv("XDG_RUNTIME_DIR");
+
+  if(env != NULL && *env != '\0'){
+    snprintf(buf, size, "%s/yash", env);
+  }
+  else{
+    snprintf(buf, size, "/tmp/yash-%d", (int)getuid());
+  }
+
+  return buf;
+}
+
+/**
+ * Purpose:
+ *   Create this shell's board file and map it
+ *
+ * Args:
+ *   dir (const char*): Board directory, created if needed
+ *
+ * Returns:
+ *   (YashBoard_t*): Board, or NULL with errno set
+ */
+YashBoard_t* boardOpen(const char* dir){
+  YashBoard_t* board = NULL;
+  YashBoardFile_t* file = NULL;
+  char path[PATH_MAX];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/jobs.%d", dir, (int)getpid());
+  if(makeDirs(dir) < 0 ||
+     (fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0){
+    return NULL;
+  }
+  if(ftruncate(fd, sizeof(YashBoardFile_t)) < 0 ||
+     (file = (YashBoardFile_t*)mmap(NULL, sizeof(YashBoardFile_t),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                                    0)) == MAP_FAILED){
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+  close(fd);
+
+  file->version = BOARD_VERSION;
+  file->maxJobs = BOARD_MAX_JOBS;
+  file->shellPid = getpid();
+  // Readers ignore the file until the magic is there
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(file->magic, BOARD_MAGIC, sizeof(file->magic));
+
+  board = (YashBoard_t*)malloc(sizeof(YashBoard_t));
+  board->path = strdup(path);
+  board->file = file;
+
+  return board;
+}
+
+/**
+ * Purpose:
+ *   Remove and unmap a board
+ *
+ * Args:
+ *   board (YashBoard_t*): Board, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void boardClose(YashBoard_t* board){
+  if(board == NULL){
+    return;
+  }
+
+  unlink(board->path);
+  munmap(board->file, sizeof(YashBoardFile_t));
+  free(board->path);
+  free(board);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Replace the job table on the board. The caller must not let another
+ *   publish (e.g. from a signal handler) interleave with this one.
+ *
+ * Args:
+ *   board         (YashBoard_t*): Board
+ *   jobs (const YashBoardJob_t*): Jobs to publish
+ *   numJobs                (int): Number of jobs, excess ones are dropped
+ *
+ * Returns:
+ *   None
+ */
+void boardPublish(YashBoard_t* board, const YashBoardJob_t* jobs,
+                  int numJobs){
+  YashBoardFile_t* file = board->file;
+  struct timespec now;
+  uint64_t seq = file->seq;
+
+  if(numJobs > BOARD_MAX_JOBS){
+    numJobs = BOARD_MAX_JOBS;
+  }
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  // Odd seq first, then the data, then the next even seq
+  __atomic_store_n(&file->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(file->jobs, jobs, numJobs * sizeof(YashBoardJob_t));
+  file->numJobs = numJobs;
+  file->updatedNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  __atomic_store_n(&file->seq, seq + 2, __ATOMIC_RELEASE);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   CPU time used so far by a running process, from /proc
+ *
+ * Args:
+ *   pid (int): PID
+ *
+ * Returns:
+ *   (int64_t): User plus system time in ns, 0 if it cannot be read
+ */
+int64_t boardProcCpuNs(int pid){
+  char path[64];
+  char buf[1024];
+  char* pos = NULL;
+  unsigned long long utime;
+  unsigned long long stime;
+  ssize_t len;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+    return 0;
+  }
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(len <= 0){
+    return 0;
+  }
+  buf[len] = '\0';
+
+  // The command name may hold spaces; fields restart after its ')'.
+  // utime and stime are fields 14 and 15, the 12th and 13th after it.
+  if((pos = strrchr(buf, ')')) == NULL ||
+     sscanf(pos + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+            &utime, &stime) != 2){
+    return 0;
+  }
+
+  return (int64_t)(utime + stime) * (1000000000 / sysconf(_SC_CLK_TCK));
+}
+
+/**
+ * Purpose:
+ *   Map a board file read-only, for readers
+ *
+ * Args:
+ *   path (const char*): Board file
+ *
+ * Returns:
+ *   (const YashBoardFile_t*): Mapping, or NULL if the file is not a board
+ */
+const YashBoardFile_t* boardMap(const char* path){
+  YashBoardFile_t* file = NULL;
+  struct stat st;
+  int fd;
+
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+    return NULL;
+  }
+  if(fstat(fd, &st) < 0 || st.st_size != sizeof(YashBoardFile_t) ||
+     (file = (YashBoardFile_t*)mmap(NULL, sizeof(YashBoardFile_t), PROT_READ,
+                                    MAP_SHARED, fd, 0)) == MAP_FAILED){
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  if(memcmp(file->magic, BOARD_MAGIC, sizeof(file->magic)) ||
+     file->version != BOARD_VERSION){
+    munmap(file, sizeof(YashBoardFile_t));
+    return NULL;
+  }
+
+  return file;
+}
+
+/**
+ * Purpose:
+ *   Unmap a board mapped by boardMap
+ *
+ * Args:
+ *   file (const YashBoardFile_t*): Mapping
+ *
+ * Returns:
+ *   None
+ */
+void boardUnmap(const YashBoardFile_t* file){
+  munmap((void*)file, sizeof(YashBoardFile_t));
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Take a consistent copy of a mapped board. No syscalls: the copy is
+ *   retried while the shell is writing.
+ *
+ * Args:
+ *   file (const YashBoardFile_t*): Mapping from boardMap
+ *   copy       (YashBoardFile_t*): Filled with the header and jobs
+ *
+ * Returns:
+ *   (int): Number of jobs, -1 if no consistent copy was seen in
+ *          BOARD_READ_TRIES tries
+ */
+int boardSnapshot(const YashBoardFile_t* file, YashBoardFile_t* copy){
+  uint64_t before;
+  uint64_t after;
+  uint32_t numJobs;
+  int tries;
+
+  for(tries = 0; tries < BOARD_READ_TRIES; tries++){
+    before = __atomic_load_n(&file->seq, __ATOMIC_ACQUIRE);
+    if(before & 1){
+      continue;
+    }
+    numJobs = file->numJobs;
+    if(numJobs > BOARD_MAX_JOBS){
+      continue;
+    }
+    memcpy(copy, file, offsetof(YashBoardFile_t, jobs) +
+                       numJobs * sizeof(YashBoardJob_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&file->seq, __ATOMIC_RELAXED);
+    if(before == after){
+      copy->numJobs = numJobs;
+      return numJobs;
+    }
+  }
+
+  return -1;
+}
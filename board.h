@@ -0,0 +1,71 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Job status board. With set -o board, a shell mirrors its job table into
+//
+//   $XDG_RUNTIME_DIR/yash/jobs.PID
+//
+// a fixed-size file that monitoring tools mmap read-only. The shell
+// rewrites the table under a seqlock: seq is odd while a write is in
+// progress and changes with every write, so a reader copies the table and
+// keeps the copy only if seq was even and unchanged around it. Readers
+// never make a syscall or take a lock, and never block the shell.
+
+#define BOARD_MAGIC "YASHJOB1"
+#define BOARD_VERSION 1
+#define BOARD_MAX_JOBS 64
+#define BOARD_CMD_LEN 224
+#define BOARD_READ_TRIES 1000
+
+/**
+ * Job states on the board
+ */
+enum{
+  BOARD_RUNNING,
+  BOARD_STOPPED,
+  BOARD_DONE
+};
+
+/**
+ * YashBoardJob_t struct, one job as published (256 bytes)
+ */
+typedef struct YashBoardJob_t{
+  int32_t jobId;
+  int32_t pgid;
+  int32_t state;
+  int32_t exitStatus;
+  int64_t startNs;
+  int64_t cpuNs;
+  char cmd[BOARD_CMD_LEN];
+}YashBoardJob_t;
+
+/**
+ * YashBoardFile_t struct, layout of a board file
+ */
+typedef struct YashBoardFile_t{
+  char magic[8];
+  uint32_t version;
+  uint32_t maxJobs;
+  int32_t shellPid;
+  uint32_t numJobs;
+  uint64_t seq;
+  int64_t updatedNs;
+  YashBoardJob_t jobs[BOARD_MAX_JOBS];
+}YashBoardFile_t;
+
+typedef struct YashBoard_t YashBoard_t;
+
+char* boardDir(char* buf, size_t size);
+YashBoard_t* boardOpen(const char* dir);
+void boardClose(YashBoard_t* board);
+void boardPublish(YashBoard_t* board, const YashBoardJob_t* jobs,
+                  int numJobs);
+int64_t boardProcCpuNs(int pid);
+const YashBoardFile_t* boardMap(const char* path);
+void boardUnmap(const YashBoardFile_t* file);
+int boardSnapshot(const YashBoardFile_t* file, YashBoardFile_t* copy);
+
+#endif
@@ -0,0 +1,679 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cache.h"
+#include "libyash_internal.h"
+
+#define CACHE_CHUNK (64 * 1024)
+
+/**
+ * Sha256_t struct, incremental SHA-256 state
+ */
+typedef struct Sha256_t{
+  uint32_t state[8];
+  uint64_t bits;
+  uint8_t buf[64];
+  size_t bufLen;
+}Sha256_t;
+
+/**
+ * CacheEntry_t struct, one file of the store considered for eviction
+ */
+typedef struct CacheEntry_t{
+  char* path;
+  time_t mtime;
+  long nsec;
+  off_t size;
+}CacheEntry_t;
+
+/**
+ * YashCache_t struct, an opened store
+ */
+struct YashCache_t{
+  char* dir;
+  long maxBytes;
+};
+
+static const uint32_t SHA_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * Purpose:
+ *   Start a SHA-256 computation
+ *
+ * Args:
+ *   sha (Sha256_t*): State to initialize
+ *
+ * Returns:
+ *   None
+ */
+void sha256Init(Sha256_t* sha){
+  static const uint32_t INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memcpy(sha->state, INIT, sizeof(INIT));
+  sha->bits = 0;
+  sha->bufLen = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Mix one 64 byte block into the state
+ *
+ * Args:
+ *   sha   (Sha256_t*): State
+ *   block (uint8_t*): 64 bytes
+ *
+ * Returns:
+ *   None
+ */
+void sha256Block(Sha256_t* sha, const uint8_t* block){
+  uint32_t w[64];
+  uint32_t v[8];
+  uint32_t t1;
+  uint32_t t2;
+  int index;
+
+  for(index = 0; index < 16; index++){
+    w[index] = ((uint32_t)block[4 * index] << 24) |
+               ((uint32_t)block[4 * index + 1] << 16) |
+               ((uint32_t)block[4 * index + 2] << 8) | block[4 * index + 3];
+  }
+  for(index = 16; index < 64; index++){
+    w[index] = w[index - 16] + w[index - 7] +
+               (ROTR(w[index - 15], 7) ^ ROTR(w[index - 15], 18) ^
+                (w[index - 15] >> 3)) +
+               (ROTR(w[index - 2], 17) ^ ROTR(w[index - 2], 19) ^
+                (w[index - 2] >> 10));
+  }
+
+  memcpy(v, sha->state, sizeof(v));
+  for(index = 0; index < 64; index++){
+    t1 = v[7] + (ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25)) +
+         ((v[4] & v[5]) ^ (~v[4] & v[6])) + SHA_K[index] + w[index];
+    t2 = (ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22)) +
+         ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for(index = 0; index < 8; index++){
+    sha->state[index] += v[index];
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Add bytes to a SHA-256 computation
+ *
+ * Args:
+ *   sha (Sha256_t*): State
+ *   data   (void*): Bytes to add
+ *   len   (size_t): Number of bytes
+ *
+ * Returns:
+ *   None
+ */
+void sha256Update(Sha256_t* sha, const void* data, size_t len){
+  const uint8_t* bytes = (const uint8_t*)data;
+  size_t take;
+
+  sha->bits += (uint64_t)len * 8;
+  while(len > 0){
+    if(sha->bufLen == 0 && len >= 64){
+      sha256Block(sha, bytes);
+      bytes += 64;
+      len -= 64;
+      continue;
+    }
+
+    take = 64 - sha->bufLen < len ? 64 - sha->bufLen : len;
+    memcpy(sha->buf + sha->bufLen, bytes, take);
+    sha->bufLen += take;
+    bytes += take;
+    len -= take;
+    if(sha->bufLen == 64){
+      sha256Block(sha, sha->buf);
+      sha->bufLen = 0;
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Finish a SHA-256 computation as a lowercase hex string
+ *
+ * Args:
+ *   sha (Sha256_t*): State
+ *   hex    (char*): Buffer of at least CACHE_KEY_LEN + 1 bytes
+ *
+ * Returns:
+ *   None
+ */
+void sha256Hex(Sha256_t* sha, char* hex){
+  uint64_t bits = sha->bits;
+  uint8_t pad = 0x80;
+  uint8_t lenBytes[8];
+  int index;
+
+  sha256Update(sha, &pad, 1);
+  pad = 0;
+  while(sha->bufLen != 56){
+    sha256Update(sha, &pad, 1);
+  }
+  for(index = 0; index < 8; index++){
+    lenBytes[index] = (uint8_t)(bits >> (56 - 8 * index));
+  }
+  sha256Update(sha, lenBytes, 8);
+
+  for(index = 0; index < 8; index++){
+    sprintf(hex + 8 * index, "%08x", sha->state[index]);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Hash the whole contents of a file without moving its offset
+ *
+ * Args:
+ *   fd   (int): Open file
+ *   hex (char*): Buffer of at least CACHE_KEY_LEN + 1 bytes
+ *
+ * Returns:
+ *   (int): 0 on success, -1 with errno set on a read error
+ */
+int hashFd(int fd, char* hex){
+  char* buf = (char*)malloc(CACHE_CHUNK);
+  Sha256_t sha;
+  off_t offset = 0;
+  ssize_t nread;
+
+  sha256Init(&sha);
+  while((nread = pread(fd, buf, CACHE_CHUNK, offset)) != 0){
+    if(nread < 0 && errno == EINTR){
+      continue;
+    }
+    else if(nread < 0){
+      free(buf);
+      return -1;
+    }
+    sha256Update(&sha, buf, nread);
+    offset += nread;
+  }
+  sha256Hex(&sha, hex);
+  free(buf);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Copy a whole file to another fd from offset 0. Uses sendfile, so the
+ *   data does not pass through user space; falls back to read/write.
+ *
+ * Args:
+ *   fd   (int): Source file
+ *   dest (int): Destination fd
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on error
+ */
+int cacheSend(int fd, int dest){
+  char* buf = NULL;
+  off_t offset = 0;
+  ssize_t nsent;
+  ssize_t nwrite;
+  ssize_t ret;
+  struct stat st;
+
+  if(fstat(fd, &st) < 0){
+    return -1;
+  }
+
+  while(offset < st.st_size){
+    nsent = sendfile(dest, fd, &offset, st.st_size - offset);
+    if(nsent < 0 && errno == EINTR){
+      continue;
+    }
+    else if(nsent <= 0){
+      break;
+    }
+  }
+  if(offset >= st.st_size){
+    return 0;
+  }
+
+  // Destination does not take sendfile
+  buf = (char*)malloc(CACHE_CHUNK);
+  while((nsent = pread(fd, buf, CACHE_CHUNK, offset)) > 0){
+    for(nwrite = 0; nwrite < nsent; ){
+      ret = write(dest, buf + nwrite, nsent - nwrite);
+      if(ret < 0 && errno == EINTR){
+        continue;
+      }
+      else if(ret < 0){
+        free(buf);
+        return -1;
+      }
+      nwrite += ret;
+    }
+    offset += nsent;
+  }
+  free(buf);
+
+  return (nsent < 0) ? -1 : 0;
+}
+
+/**
+ * Purpose:
+ *   Open a store, creating its directories if needed
+ *
+ * Args:
+ *   dir (const char*): Store directory
+ *   maxBytes  (long): Size bound of the store
+ *
+ * Returns:
+ *   (YashCache_t*): Handle, or NULL with errno set
+ */
+YashCache_t* cacheOpen(const char* dir, long maxBytes){
+  const char* SUBDIRS[] = {"objects", "keys", "tmp", NULL};
+
+  YashCache_t* cache = NULL;
+  char path[PATH_MAX];
+  int index;
+
+  for(index = 0; SUBDIRS[index] != NULL; index++){
+    snprintf(path, sizeof(path), "%s/%s", dir, SUBDIRS[index]);
+    if(makeDirs(path) < 0){
+      return NULL;
+    }
+  }
+
+  cache = (YashCache_t*)malloc(sizeof(YashCache_t));
+  cache->dir = strdup(dir);
+  cache->maxBytes = maxBytes;
+
+  return cache;
+}
+
+/**
+ * Purpose:
+ *   Free a store handle
+ *
+ * Args:
+ *   cache (YashCache_t*): Handle, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void cacheClose(YashCache_t* cache){
+  if(cache == NULL){
+    return;
+  }
+  free(cache->dir);
+  free(cache);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Compute the key of a command. Each part is tagged and NUL terminated
+ *   so different splits of the same bytes hash differently.
+ *
+ * Args:
+ *   argv     (char**): Command and arguments
+ *   envNames (char**): Environment variables that affect the result
+ *   numEnv      (int): Number of envNames
+ *   inputs   (char**): Files whose contents affect the result
+ *   numInputs   (int): Number of inputs
+ *   key       (char*): Buffer of at least CACHE_KEY_LEN + 1 bytes
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if an input could not be read
+ */
+int cacheKey(char** argv, char** envNames, int numEnv, char** inputs,
+             int numInputs, char* key){
+  char hex[CACHE_KEY_LEN + 1];
+  char* value = NULL;
+  Sha256_t sha;
+  int index;
+  int fd;
+
+  sha256Init(&sha);
+  for(index = 0; argv[index] != NULL; index++){
+    sha256Update(&sha, "a", 1);
+    sha256Update(&sha, argv[index], strlen(argv[index]) + 1);
+  }
+  for(index = 0; index < numEnv; index++){
+    // Unset and empty are different
+    value = getenv(envNames[index]);
+    sha256Update(&sha, value != NULL ? "e" : "u", 1);
+    sha256Update(&sha, envNames[index], strlen(envNames[index]) + 1);
+    if(value != NULL){
+      sha256Update(&sha, value, strlen(value) + 1);
+    }
+  }
+  for(index = 0; index < numInputs; index++){
+    if((fd = open(inputs[index], O_RDONLY | O_CLOEXEC)) < 0 ||
+       hashFd(fd, hex) < 0){
+      fprintf(stderr, "yash: cache: %s: %s\n", inputs[index],
+              strerror(errno));
+      if(fd >= 0)
+        close(fd);
+      return -1;
+    }
+    close(fd);
+    sha256Update(&sha, "i", 1);
+    sha256Update(&sha, inputs[index], strlen(inputs[index]) + 1);
+    sha256Update(&sha, hex, CACHE_KEY_LEN);
+  }
+  sha256Hex(&sha, key);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Replay a cached result: stream the stored stdout and stderr to the
+ *   given fds and refresh the entry's place in the LRU order
+ *
+ * Args:
+ *   cache (YashCache_t*): Store
+ *   key    (const char*): Key from cacheKey
+ *   outFd          (int): Where stdout is replayed
+ *   errFd          (int): Where stderr is replayed
+ *   status        (int*): Set to the stored wait status
+ *
+ * Returns:
+ *   (int): 1 on a hit, 0 on a miss
+ */
+int cacheReplay(YashCache_t* cache, const char* key, int outFd, int errFd,
+                int* status){
+  char keyPath[PATH_MAX];
+  char outPath[PATH_MAX];
+  char errPath[PATH_MAX];
+  char outHash[CACHE_KEY_LEN + 1];
+  char errHash[CACHE_KEY_LEN + 1];
+  FILE* file = NULL;
+  int objOut;
+  int objErr;
+  int found;
+
+  snprintf(keyPath, sizeof(keyPath), "%s/keys/%s", cache->dir, key);
+  if((file = fopen(keyPath, "re")) == NULL){
+    return 0;
+  }
+  found = fscanf(file, "%d %64s %64s", status, outHash, errHash);
+  fclose(file);
+  if(found != 3){
+    unlink(keyPath);
+    return 0;
+  }
+
+  snprintf(outPath, sizeof(outPath), "%s/objects/%s", cache->dir, outHash);
+  snprintf(errPath, sizeof(errPath), "%s/objects/%s", cache->dir, errHash);
+  objOut = open(outPath, O_RDONLY | O_CLOEXEC);
+  objErr = open(errPath, O_RDONLY | O_CLOEXEC);
+  if(objOut < 0 || objErr < 0){
+    // An object was evicted; the key is useless without it
+    if(objOut >= 0)
+      close(objOut);
+    if(objErr >= 0)
+      close(objErr);
+    unlink(keyPath);
+    return 0;
+  }
+
+  cacheSend(objOut, outFd);
+  cacheSend(objErr, errFd);
+  close(objOut);
+  close(objErr);
+
+  utimensat(AT_FDCWD, keyPath, NULL, 0);
+  utimensat(AT_FDCWD, outPath, NULL, 0);
+  utimensat(AT_FDCWD, errPath, NULL, 0);
+
+  return 1;
+}
+
+/**
+ * Purpose:
+ *   Create an anonymous file in the store to capture output into. It has
+ *   no name until cacheStore links it into objects/.
+ *
+ * Args:
+ *   cache (YashCache_t*): Store
+ *
+ * Returns:
+ *   (int): Read/write fd, or -1 with errno set
+ */
+int cacheTempFile(YashCache_t* cache){
+  char path[PATH_MAX];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/tmp", cache->dir);
+  if((fd = open(path, O_TMPFILE | O_RDWR | O_CLOEXEC, 0644)) >= 0){
+    return fd;
+  }
+
+  // No O_TMPFILE here; cacheStore copies instead of linking
+  snprintf(path, sizeof(path), "%s/tmp/blob.XXXXXX", cache->dir);
+  if((fd = mkostemp(path, O_CLOEXEC)) >= 0){
+    unlink(path);
+  }
+
+  return fd;
+}
+
+/**
+ * Purpose:
+ *   Put a captured blob into objects/ under the hash of its contents.
+ *   An identical blob that is already stored is shared.
+ *
+ * Args:
+ *   cache (YashCache_t*): Store
+ *   fd             (int): File from cacheTempFile
+ *   hex          (char*): Set to the blob's hash
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on failure
+ */
+int storeBlob(YashCache_t* cache, int fd, char* hex){
+  char objPath[PATH_MAX];
+  char procPath[64];
+  char tmpPath[PATH_MAX];
+  int tmpFd;
+  int ret;
+
+  if(hashFd(fd, hex) < 0){
+    return -1;
+  }
+  snprintf(objPath, sizeof(objPath), "%s/objects/%s", cache->dir, hex);
+  if(access(objPath, F_OK) == 0){
+    utimensat(AT_FDCWD, objPath, NULL, 0);
+    return 0;
+  }
+
+  snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+  if(linkat(AT_FDCWD, procPath, AT_FDCWD, objPath, AT_SYMLINK_FOLLOW) == 0 ||
+     errno == EEXIST){
+    return 0;
+  }
+
+  // Copy into a named temp file and rename it into place
+  snprintf(tmpPath, sizeof(tmpPath), "%s/tmp/blob.XXXXXX", cache->dir);
+  if((tmpFd = mkostemp(tmpPath, O_CLOEXEC)) < 0){
+    return -1;
+  }
+  ret = cacheSend(fd, tmpFd);
+  close(tmpFd);
+  if(ret < 0 || rename(tmpPath, objPath) < 0){
+    unlink(tmpPath);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   qsort comparator, oldest modification time first
+ */
+int compareEntries(const void* a, const void* b){
+  const CacheEntry_t* x = (const CacheEntry_t*)a;
+  const CacheEntry_t* y = (const CacheEntry_t*)b;
+
+  if(x->mtime != y->mtime){
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+  }
+  return (x->nsec > y->nsec) - (x->nsec < y->nsec);
+}
+
+/**
+ * Purpose:
+ *   Remove the least recently used keys and objects until the store is
+ *   within its size bound. A key that loses an object becomes a miss.
+ *
+ * Args:
+ *   cache (YashCache_t*): Store
+ *
+ * Returns:
+ *   None
+ */
+void cacheEvict(YashCache_t* cache){
+  const char* SUBDIRS[] = {"objects", "keys", NULL};
+
+  CacheEntry_t* entries = NULL;
+  struct dirent* ent = NULL;
+  struct stat st;
+  char path[PATH_MAX];
+  DIR* dir = NULL;
+  long total = 0;
+  int numEntries = 0;
+  int cap = 0;
+  int index;
+
+  for(index = 0; SUBDIRS[index] != NULL; index++){
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, SUBDIRS[index]);
+    if((dir = opendir(path)) == NULL){
+      continue;
+    }
+    while((ent = readdir(dir)) != NULL){
+      if(ent->d_name[0] == '.' ||
+         fstatat(dirfd(dir), ent->d_name, &st, 0) < 0){
+        continue;
+      }
+      if(numEntries == cap){
+        cap = cap ? 2 * cap : 256;
+        entries = (CacheEntry_t*)realloc(entries, cap * sizeof(CacheEntry_t));
+      }
+      snprintf(path, sizeof(path), "%s/%s/%s", cache->dir, SUBDIRS[index],
+               ent->d_name);
+      entries[numEntries].path = strdup(path);
+      entries[numEntries].mtime = st.st_mtim.tv_sec;
+      entries[numEntries].nsec = st.st_mtim.tv_nsec;
+      entries[numEntries].size = st.st_size;
+      total += st.st_size;
+      numEntries++;
+    }
+    closedir(dir);
+  }
+
+  if(total > cache->maxBytes){
+    qsort(entries, numEntries, sizeof(CacheEntry_t), compareEntries);
+    for(index = 0; index < numEntries && total > cache->maxBytes; index++){
+      if(unlink(entries[index].path) == 0){
+        total -= entries[index].size;
+      }
+    }
+  }
+
+  for(index = 0; index < numEntries; index++){
+    free(entries[index].path);
+  }
+  free(entries);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Store a finished run: link both blobs into objects/, then publish the
+ *   key atomically with a rename, then evict down to the size bound
+ *
+ * Args:
+ *   cache (YashCache_t*): Store
+ *   key    (const char*): Key from cacheKey
+ *   outFd          (int): Captured stdout from cacheTempFile
+ *   errFd          (int): Captured stderr from cacheTempFile
+ *   status         (int): Wait status of the run
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on failure
+ */
+int cacheStore(YashCache_t* cache, const char* key, int outFd, int errFd,
+               int status){
+  char outHash[CACHE_KEY_LEN + 1];
+  char errHash[CACHE_KEY_LEN + 1];
+  char tmpPath[PATH_MAX];
+  char keyPath[PATH_MAX];
+  FILE* file = NULL;
+  int fd;
+
+  if(storeBlob(cache, outFd, outHash) < 0 ||
+     storeBlob(cache, errFd, errHash) < 0){
+    return -1;
+  }
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s/tmp/key.XXXXXX", cache->dir);
+  snprintf(keyPath, sizeof(keyPath), "%s/keys/%s", cache->dir, key);
+  if((fd = mkostemp(tmpPath, O_CLOEXEC)) < 0){
+    return -1;
+  }
+  file = fdopen(fd, "w");
+  fprintf(file, "%d %s %s\n", status, outHash, errHash);
+  if(fclose(file) != 0 || rename(tmpPath, keyPath) < 0){
+    unlink(tmpPath);
+    return -1;
+  }
+
+  cacheEvict(cache);
+
+  return 0;
+}
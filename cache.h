@@ -0,0 +1,31 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// Result cache for deterministic commands. A key is the SHA-256 of the
+// argv, selected environment variables and the contents of declared input
+// files. The store is a directory:
+//
+//   objects/HASH   stdout/stderr blobs, named by the SHA-256 of their bytes
+//   keys/KEY       "STATUS OUTHASH ERRHASH" for one cached run
+//   tmp/           blobs being written
+//
+// Hits refresh the mtime of the key and its objects; when the store grows
+// past its size bound the least recently used files are removed.
+
+#define CACHE_KEY_LEN 64
+#define CACHE_DEFAULT_MB 256
+
+typedef struct YashCache_t YashCache_t;
+
+YashCache_t* cacheOpen(const char* dir, long maxBytes);
+void cacheClose(YashCache_t* cache);
+int cacheKey(char** argv, char** envNames, int numEnv, char** inputs,
+             int numInputs, char* key);
+int cacheReplay(YashCache_t* cache, const char* key, int outFd, int errFd,
+                int* status);
+int cacheTempFile(YashCache_t* cache);
+int cacheSend(int fd, int dest);
+int cacheStore(YashCache_t* cache, const char* key, int outFd, int errFd,
+               int status);
+
+#endif
@@ -0,0 +1,730 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "libyash_internal.h"
+#include "dag.h"
+
+/**
+ * Node states
+ */
+enum{
+  DAG_WAIT,
+  DAG_READY,
+  DAG_RUN,
+  DAG_OK,
+  DAG_FAIL,
+  DAG_SKIP
+};
+
+/**
+ * DagNode_t struct, one command of the graph. deps are indexes of the
+ * nodes it needs, users the indexes of the nodes that need it.
+ */
+typedef struct DagNode_t{
+  char* name;
+  char* depStr;
+  char* line;
+  int* deps;
+  int numDeps;
+  int* users;
+  int numUsers;
+  int waiting;
+  int state;
+  int status;
+  double start;
+  double end;
+  YashPipeline_t* pipeline;
+  YashRun_t* run;
+}DagNode_t;
+
+/**
+ * Dag_t struct, the whole graph and its ready queue
+ */
+typedef struct Dag_t{
+  DagNode_t* nodes;
+  int numNodes;
+  int cap;
+  int* ready;
+  int readyHead;
+  int readyTail;
+}Dag_t;
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double dagNow(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Strip leading and trailing whitespace in place
+ *
+ * Args:
+ *   str (char*): String to trim
+ *
+ * Returns:
+ *   (char*): Start of the trimmed string
+ */
+char* dagTrim(char* str){
+  char* end = NULL;
+
+  while(*str == ' ' || *str == '\t'){
+    str++;
+  }
+  end = str + strlen(str);
+  while(end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+                      end[-1] == '\n' || end[-1] == '\r')){
+    *--end = '\0';
+  }
+
+  return str;
+}
+
+/**
+ * Purpose:
+ *   Find a node by name
+ *
+ * Args:
+ *   dag (Dag_t*): Graph
+ *   name (char*): Node name
+ *
+ * Returns:
+ *   (int): Node index, or -1 if there is none
+ */
+int dagFind(Dag_t* dag, char* name){
+  int index;
+
+  for(index = 0; index < dag->numNodes; index++){
+    if(!strcmp(dag->nodes[index].name, name)){
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Purpose:
+ *   Parse one "name: deps: command" line into a new node
+ *
+ * Args:
+ *   dag  (Dag_t*): Graph to add the node to
+ *   line  (char*): Spec line, modified in place
+ *   lineNo  (int): Line number for error messages
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on a syntax error
+ */
+int dagParseLine(Dag_t* dag, char* line, int lineNo){
+  DagNode_t* node = NULL;
+  char* depStr = NULL;
+  char* cmdStr = NULL;
+  char* name = NULL;
+
+  if((depStr = strchr(line, ':')) == NULL ||
+     (cmdStr = strchr(depStr + 1, ':')) == NULL){
+    fprintf(stderr, "yash: dag: line %d: expected name: deps: command\n",
+            lineNo);
+    return -1;
+  }
+  *depStr++ = '\0';
+  *cmdStr++ = '\0';
+  name = dagTrim(line);
+  cmdStr = dagTrim(cmdStr);
+
+  if(*name == '\0' || strchr(name, ' ') != NULL){
+    fprintf(stderr, "yash: dag: line %d: bad node name\n", lineNo);
+    return -1;
+  }
+  if(dagFind(dag, name) >= 0){
+    fprintf(stderr, "yash: dag: line %d: %s defined twice\n", lineNo, name);
+    return -1;
+  }
+
+  if(dag->numNodes == dag->cap){
+    dag->cap = dag->cap ? 2 * dag->cap : 16;
+    dag->nodes = (DagNode_t*)realloc(dag->nodes,
+                                     dag->cap * sizeof(DagNode_t));
+  }
+  node = &dag->nodes[dag->numNodes];
+  memset(node, 0, sizeof(DagNode_t));
+  node->name = strdup(name);
+  node->depStr = strdup(depStr);
+  node->line = strdup(cmdStr);
+  if((node->pipeline = yashParse(cmdStr)) == NULL){
+    fprintf(stderr, "yash: dag: line %d: invalid command\n", lineNo);
+    free(node->name);
+    free(node->depStr);
+    free(node->line);
+    return -1;
+  }
+  dag->numNodes++;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Resolve dependency names to indexes and build the reverse edges.
+ *   Names may be separated by spaces or commas.
+ *
+ * Args:
+ *   dag (Dag_t*): Graph with every node parsed
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if a dependency does not exist
+ */
+int dagResolve(Dag_t* dag){
+  const char* DELIMS = " ,\t";
+
+  DagNode_t* node = NULL;
+  DagNode_t* dep = NULL;
+  char* save = NULL;
+  char* tok = NULL;
+  int index;
+  int depIndex;
+
+  for(index = 0; index < dag->numNodes; index++){
+    node = &dag->nodes[index];
+    node->deps = (int*)malloc((strlen(node->depStr) / 2 + 1) * sizeof(int));
+    for(tok = strtok_r(node->depStr, DELIMS, &save); tok != NULL;
+        tok = strtok_r(NULL, DELIMS, &save)){
+      if((depIndex = dagFind(dag, tok)) < 0){
+        fprintf(stderr, "yash: dag: %s: unknown dependency %s\n",
+                node->name, tok);
+        return -1;
+      }
+      node->deps[node->numDeps++] = depIndex;
+      dag->nodes[depIndex].numUsers++;
+    }
+    node->waiting = node->numDeps;
+  }
+
+  for(index = 0; index < dag->numNodes; index++){
+    dag->nodes[index].users = (int*)malloc(
+      (dag->nodes[index].numUsers + 1) * sizeof(int));
+    dag->nodes[index].numUsers = 0;
+  }
+  for(index = 0; index < dag->numNodes; index++){
+    node = &dag->nodes[index];
+    for(depIndex = 0; depIndex < node->numDeps; depIndex++){
+      dep = &dag->nodes[node->deps[depIndex]];
+      dep->users[dep->numUsers++] = index;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Check the graph for cycles with Kahn's algorithm, using the ready
+ *   queue as scratch space
+ *
+ * Args:
+ *   dag (Dag_t*): Resolved graph
+ *
+ * Returns:
+ *   (int): 0 if acyclic, -1 if some node can never start
+ */
+int dagCheckCycles(Dag_t* dag){
+  int* waiting = (int*)malloc((dag->numNodes + 1) * sizeof(int));
+  int head = 0;
+  int tail = 0;
+  int index;
+  int user;
+
+  for(index = 0; index < dag->numNodes; index++){
+    waiting[index] = dag->nodes[index].numDeps;
+    if(waiting[index] == 0){
+      dag->ready[tail++] = index;
+    }
+  }
+  while(head < tail){
+    index = dag->ready[head++];
+    for(user = 0; user < dag->nodes[index].numUsers; user++){
+      if(--waiting[dag->nodes[index].users[user]] == 0){
+        dag->ready[tail++] = dag->nodes[index].users[user];
+      }
+    }
+  }
+
+  for(index = 0; index < dag->numNodes && tail < dag->numNodes; index++){
+    if(waiting[index] > 0){
+      fprintf(stderr, "yash: dag: %s: dependency cycle\n",
+              dag->nodes[index].name);
+      break;
+    }
+  }
+  free(waiting);
+
+  return (tail == dag->numNodes) ? 0 : -1;
+}
+
+/**
+ * Purpose:
+ *   Read and check a spec file
+ *
+ * Args:
+ *   path (char*): Spec file
+ *   dag (Dag_t*): Graph to fill in
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on error
+ */
+int dagLoad(char* path, Dag_t* dag){
+  FILE* file = fopen(path, "r");
+  char* line = NULL;
+  char* start = NULL;
+  size_t lineCap = 0;
+  int lineNo = 0;
+  int ret = 0;
+
+  if(file == NULL){
+    fprintf(stderr, "yash: dag: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  while(!ret && getline(&line, &lineCap, file) >= 0){
+    lineNo++;
+    start = dagTrim(line);
+    if(*start != '\0' && *start != '#'){
+      ret = dagParseLine(dag, start, lineNo);
+    }
+  }
+  free(line);
+  fclose(file);
+
+  if(!ret && dag->numNodes == 0){
+    fprintf(stderr, "yash: dag: %s: no nodes\n", path);
+    ret = -1;
+  }
+  if(!ret){
+    dag->ready = (int*)malloc(dag->numNodes * sizeof(int));
+    ret = dagResolve(dag);
+  }
+  if(!ret){
+    ret = dagCheckCycles(dag);
+  }
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   Free a graph and any runs still attached to it
+ *
+ * Args:
+ *   dag (Dag_t*): Graph
+ *
+ * Returns:
+ *   None
+ */
+void dagFree(Dag_t* dag){
+  DagNode_t* node = NULL;
+  int index;
+
+  for(index = 0; index < dag->numNodes; index++){
+    node = &dag->nodes[index];
+    yashFreeRun(node->run);
+    yashFreePipeline(node->pipeline);
+    free(node->name);
+    free(node->depStr);
+    free(node->line);
+    free(node->deps);
+    free(node->users);
+  }
+  free(dag->nodes);
+  free(dag->ready);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Mark every node that depends on a failed or skipped node as skipped
+ *
+ * Args:
+ *   dag (Dag_t*): Graph
+ *   index (int): Failed or skipped node
+ *
+ * Returns:
+ *   None
+ */
+void dagSkipUsers(Dag_t* dag, int index){
+  DagNode_t* user = NULL;
+  int next;
+
+  for(next = 0; next < dag->nodes[index].numUsers; next++){
+    user = &dag->nodes[dag->nodes[index].users[next]];
+    if(user->state == DAG_WAIT){
+      user->state = DAG_SKIP;
+      dagSkipUsers(dag, dag->nodes[index].users[next]);
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Start a ready node and watch its completion fd
+ *
+ * Args:
+ *   dag (Dag_t*): Graph
+ *   index (int): Node to start
+ *   epfd  (int): epoll set
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the command could not start
+ */
+int dagStart(Dag_t* dag, int index, int epfd){
+  DagNode_t* node = &dag->nodes[index];
+  struct epoll_event ev;
+
+  node->start = dagNow();
+  if((node->run = yashStartFds(node->pipeline, -1, -1, -1)) == NULL){
+    fprintf(stderr, "yash: dag: %s: %s\n", node->name, strerror(errno));
+    node->end = node->start;
+    node->state = DAG_FAIL;
+    return -1;
+  }
+
+  node->state = DAG_RUN;
+  ev.events = EPOLLIN;
+  ev.data.ptr = node;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, yashRunFd(node->run), &ev);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Collect a finished node and queue the users it unblocked
+ *
+ * Args:
+ *   dag      (Dag_t*): Graph
+ *   node (DagNode_t*): Node whose completion fd became readable
+ *   epfd        (int): epoll set
+ *
+ * Returns:
+ *   (int): 0 if the node succeeded, -1 if it failed
+ */
+int dagFinish(Dag_t* dag, DagNode_t* node, int epfd){
+  DagNode_t* user = NULL;
+  int index;
+
+  node->end = dagNow();
+  epoll_ctl(epfd, EPOLL_CTL_DEL, yashRunFd(node->run), NULL);
+  node->status = yashWait(node->run, NULL, NULL);
+  yashFreeRun(node->run);
+  node->run = NULL;
+
+  if(WIFEXITED(node->status) && WEXITSTATUS(node->status) == 0){
+    node->state = DAG_OK;
+    for(index = 0; index < node->numUsers; index++){
+      user = &dag->nodes[node->users[index]];
+      if(--user->waiting == 0 && user->state == DAG_WAIT){
+        user->state = DAG_READY;
+        dag->ready[dag->readyTail++] = node->users[index];
+      }
+    }
+    return 0;
+  }
+
+  node->state = DAG_FAIL;
+  if(WIFEXITED(node->status)){
+    fprintf(stderr, "yash: dag: %s: exit %d\n", node->name,
+            WEXITSTATUS(node->status));
+  }
+  else if(WIFSIGNALED(node->status)){
+    fprintf(stderr, "yash: dag: %s: killed by signal %d\n", node->name,
+            WTERMSIG(node->status));
+  }
+
+  return -1;
+}
+
+/**
+ * Purpose:
+ *   Length of the longest chain of measured run times ending at a node,
+ *   memoized in len (negative until computed)
+ *
+ * Args:
+ *   dag  (Dag_t*): Graph after the run
+ *   index   (int): Node
+ *   len (double*): Chain length per node
+ *   prev   (int*): Previous node on the chain, -1 at its start
+ *
+ * Returns:
+ *   (double): Chain length in seconds
+ */
+double dagChain(Dag_t* dag, int index, double* len, int* prev){
+  DagNode_t* node = &dag->nodes[index];
+  double depLen;
+  int dep;
+
+  if(len[index] >= 0){
+    return len[index];
+  }
+
+  len[index] = 0;
+  prev[index] = -1;
+  for(dep = 0; dep < node->numDeps; dep++){
+    depLen = dagChain(dag, node->deps[dep], len, prev);
+    if(prev[index] < 0 || depLen > len[index]){
+      len[index] = depLen;
+      prev[index] = node->deps[dep];
+    }
+  }
+  if(node->state == DAG_OK || node->state == DAG_FAIL){
+    len[index] += node->end - node->start;
+  }
+
+  return len[index];
+}
+
+/**
+ * Purpose:
+ *   Print counts, wall time and the critical path, the chain of
+ *   dependencies whose run times add up to the most. With enough slots the
+ *   wall time approaches the critical path.
+ *
+ * Args:
+ *   dag  (Dag_t*): Graph after the run
+ *   begin (double): Start of the run
+ *   slots    (int): Number of job slots used
+ *
+ * Returns:
+ *   None
+ */
+void dagReport(Dag_t* dag, double begin, int slots){
+  DagNode_t* node = NULL;
+  double* len = (double*)malloc(dag->numNodes * sizeof(double));
+  int* prev = (int*)malloc(dag->numNodes * sizeof(int));
+  int* path = (int*)malloc(dag->numNodes * sizeof(int));
+  int counts[DAG_SKIP + 1] = {0};
+  int pathLen = 0;
+  int last = -1;
+  int index;
+
+  for(index = 0; index < dag->numNodes; index++){
+    len[index] = -1;
+  }
+  for(index = 0; index < dag->numNodes; index++){
+    counts[dag->nodes[index].state]++;
+    if(last < 0 || dagChain(dag, index, len, prev) > len[last]){
+      last = index;
+    }
+  }
+
+  fprintf(stderr, "dag: %d ok, %d failed, %d not run in %.2fs on %d slots\n",
+          counts[DAG_OK], counts[DAG_FAIL],
+          dag->numNodes - counts[DAG_OK] - counts[DAG_FAIL],
+          dagNow() - begin, slots);
+
+  fprintf(stderr, "dag: critical path %.2fs:", len[last]);
+  for(index = last; index >= 0; index = prev[index]){
+    path[pathLen++] = index;
+  }
+  while(pathLen > 0){
+    node = &dag->nodes[path[--pathLen]];
+    fprintf(stderr, " %s (%.2fs)%s", node->name,
+            (node->state == DAG_OK || node->state == DAG_FAIL) ?
+              node->end - node->start : 0.0,
+            pathLen > 0 ? " ->" : "\n");
+  }
+
+  free(len);
+  free(prev);
+  free(path);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Send a signal to every running node
+ *
+ * Args:
+ *   dag (Dag_t*): Graph
+ *   sig   (int): Signal number
+ *
+ * Returns:
+ *   None
+ */
+void dagKillAll(Dag_t* dag, int sig){
+  int index;
+
+  for(index = 0; index < dag->numNodes; index++){
+    if(dag->nodes[index].state == DAG_RUN){
+      yashKill(dag->nodes[index].run, sig);
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   dag builtin: run a dependency graph with a ready queue over SLOTS job
+ *   slots. Each node is a pipeline started through libyash, and the
+ *   scheduler sleeps in epoll on their completion fds. SIGINT and SIGCHLD
+ *   are blocked while it runs; SIGINT is read from a signalfd and stops
+ *   the run.
+ *
+ * Args:
+ *   cmd (char**): Tokens starting with "dag"
+ *
+ * Returns:
+ *   (int): 0 if every node succeeded, else 1
+ */
+int runDag(char** cmd){
+  const char* USAGE = "usage: dag [-j slots] [-k] file\n";
+
+  Dag_t dag;
+  DagNode_t* node = NULL;
+  struct epoll_event events[DAG_MAX_EVENTS];
+  struct signalfd_siginfo sigInfo;
+  struct epoll_event ev;
+  sigset_t mask;
+  sigset_t oldMask;
+  double begin;
+  char* path = NULL;
+  long slots = sysconf(_SC_NPROCESSORS_ONLN);
+  int keepGoing = 0;
+  int stop = 0;
+  int numRunning = 0;
+  int numEvents;
+  int failed = 0;
+  int sigFd;
+  int epfd;
+  int index;
+
+  for(index = 1; cmd[index] != NULL; index++){
+    if(!strcmp(cmd[index], "-k")){
+      keepGoing = 1;
+    }
+    else if(!strcmp(cmd[index], "-j") && cmd[index + 1] != NULL &&
+            atoi(cmd[index + 1]) > 0){
+      slots = atoi(cmd[++index]);
+    }
+    else if(path == NULL && cmd[index][0] != '-'){
+      path = cmd[index];
+    }
+    else{
+      path = NULL;
+      break;
+    }
+  }
+  if(path == NULL){
+    fprintf(stderr, "%s", USAGE);
+    return 1;
+  }
+  if(slots < 1){
+    slots = 1;
+  }
+
+  memset(&dag, 0, sizeof(dag));
+  if(dagLoad(path, &dag) < 0){
+    dagFree(&dag);
+    return 1;
+  }
+
+  for(index = 0; index < dag.numNodes; index++){
+    if(dag.nodes[index].numDeps == 0){
+      dag.nodes[index].state = DAG_READY;
+      dag.ready[dag.readyTail++] = index;
+    }
+  }
+
+  // Drain threads inherit this mask, so neither signal lands in them
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+  sigdelset(&mask, SIGCHLD);
+  sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, sigFd, &ev);
+
+  begin = dagNow();
+  while(numRunning > 0 || (!stop && dag.readyHead < dag.readyTail)){
+    while(!stop && numRunning < slots && dag.readyHead < dag.readyTail){
+      index = dag.ready[dag.readyHead++];
+      if(dagStart(&dag, index, epfd) == 0){
+        numRunning++;
+      }
+      else if(keepGoing){
+        failed = 1;
+        dagSkipUsers(&dag, index);
+      }
+      else{
+        failed = 1;
+        stop = 1;
+        dagKillAll(&dag, SIGTERM);
+      }
+    }
+    if(numRunning == 0){
+      continue;
+    }
+
+    numEvents = epoll_wait(epfd, events, DAG_MAX_EVENTS, -1);
+    for(index = 0; index < numEvents; index++){
+      node = (DagNode_t*)events[index].data.ptr;
+      if(node == NULL){
+        while(read(sigFd, &sigInfo, sizeof(sigInfo)) > 0);
+        fprintf(stderr, "\nyash: dag: interrupted\n");
+        failed = 1;
+        stop = 1;
+        dagKillAll(&dag, SIGINT);
+        continue;
+      }
+
+      numRunning--;
+      if(dagFinish(&dag, node, epfd) == 0){
+        continue;
+      }
+      failed = 1;
+      if(keepGoing){
+        dagSkipUsers(&dag, node - dag.nodes);
+      }
+      else if(!stop){
+        stop = 1;
+        dagKillAll(&dag, SIGTERM);
+      }
+    }
+  }
+
+  dagReport(&dag, begin, (int)slots);
+
+  close(epfd);
+  close(sigFd);
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+  dagFree(&dag);
+
+  return failed;
+}
@@ -0,0 +1,18 @@
+#ifndef DAG_H
+#define DAG_H
+
+// dag builtin: run a dependency graph of commands in parallel.
+//
+//   dag [-j SLOTS] [-k] FILE
+//
+// FILE has one node per line, "name: dep1 dep2 ...: command line". Blank
+// lines and lines starting with # are skipped. A node starts as soon as
+// every dependency has succeeded and a slot is free. Without -k the first
+// failure stops new nodes from starting and terminates running ones; with
+// -k only nodes depending on the failed one are skipped.
+
+#define DAG_MAX_EVENTS 32
+
+int runDag(char** cmd);
+
+#endif
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <readline/readline.h>
+
+#include "execindex.h"
+#include "libyash_internal.h"
+
+#define EXEC_EVENT_BUF 4096
+#define EXEC_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                         IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | \
+                         IN_MOVE_SELF)
+
+/**
+ * ExecDir_t struct, one PATH directory and its executables
+ */
+typedef struct ExecDir_t{
+  char* path;
+  int wd;
+  int dirty;
+  struct timespec mtime;
+  DirCache_t* listing;
+  const char** names;
+  long count;
+}ExecDir_t;
+
+/**
+ * YashExecIndex_t struct, merged index over every PATH directory
+ */
+struct YashExecIndex_t{
+  char* pathVar;
+  ExecDir_t* dirs;
+  int numDirs;
+  int inotifyFd;
+  int dirty;
+
+  const char** extra;
+  int numExtra;
+
+  const char** sorted;
+  long count;
+};
+
+YashExecIndex_t* rlIndex = NULL;
+
+/**
+ * Purpose:
+ *   Drop the watches and listings of every PATH directory
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *
+ * Returns:
+ *   None
+ */
+void execFreeDirs(YashExecIndex_t* index){
+  int pos;
+
+  for(pos = 0; pos < index->numDirs; pos++){
+    if(index->dirs[pos].wd >= 0){
+      inotify_rm_watch(index->inotifyFd, index->dirs[pos].wd);
+    }
+    freeDirCache(&index->dirs[pos].listing);
+    free(index->dirs[pos].names);
+    free(index->dirs[pos].path);
+  }
+  free(index->dirs);
+  index->dirs = NULL;
+  index->numDirs = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Split PATH into directories, skipping empty and repeated entries, and
+ *   watch each of them. Every directory starts out dirty.
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *   pathVar    (const char*): Value of PATH
+ *
+ * Returns:
+ *   None
+ */
+void execSetPath(YashExecIndex_t* index, const char* pathVar){
+  ExecDir_t* dir = NULL;
+  char* copy = strdup(pathVar);
+  char* save = NULL;
+  char* tok = NULL;
+  int cap = 0;
+  int pos;
+
+  execFreeDirs(index);
+  free(index->pathVar);
+  index->pathVar = strdup(pathVar);
+
+  for(tok = strtok_r(copy, ":", &save); tok != NULL;
+      tok = strtok_r(NULL, ":", &save)){
+    for(pos = 0; pos < index->numDirs; pos++){
+      if(!strcmp(index->dirs[pos].path, tok)){
+        break;
+      }
+    }
+    if(pos < index->numDirs){
+      continue;
+    }
+
+    if(index->numDirs == cap){
+      cap = cap ? 2 * cap : 16;
+      index->dirs = (ExecDir_t*)realloc(index->dirs, cap * sizeof(ExecDir_t));
+    }
+    dir = &index->dirs[index->numDirs++];
+    memset(dir, 0, sizeof(ExecDir_t));
+    dir->path = strdup(tok);
+    dir->dirty = 1;
+    dir->wd = (index->inotifyFd >= 0)
+              ? inotify_add_watch(index->inotifyFd, tok, EXEC_WATCH_MASK)
+              : -1;
+  }
+  free(copy);
+  index->dirty = 1;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Read pending inotify events and mark the directories they name dirty
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *
+ * Returns:
+ *   None
+ */
+void execDrainEvents(YashExecIndex_t* index){
+  char buf[EXEC_EVENT_BUF]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event* event = NULL;
+  ssize_t len;
+  ssize_t pos;
+  int dir;
+
+  while((len = read(index->inotifyFd, buf, sizeof(buf))) > 0){
+    for(pos = 0; pos < len; pos += sizeof(struct inotify_event) + event->len){
+      event = (const struct inotify_event*)(buf + pos);
+      for(dir = 0; dir < index->numDirs; dir++){
+        if(event->mask & IN_Q_OVERFLOW){
+          index->dirs[dir].dirty = 1;
+        }
+        else if(index->dirs[dir].wd == event->wd){
+          index->dirs[dir].dirty = 1;
+          if(event->mask & IN_IGNORED){
+            // Directory removed or moved; watch it again if it returns
+            index->dirs[dir].wd = -1;
+          }
+        }
+      }
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   List one directory again and keep its executable regular files
+ *
+ * Args:
+ *   dir (ExecDir_t*): Directory
+ *
+ * Returns:
+ *   None
+ */
+void execScanDir(ExecDir_t* dir){
+  DirCache_t* listing = NULL;
+  const char* name = NULL;
+  struct stat st;
+  int dirFd;
+  int pos;
+
+  freeDirCache(&dir->listing);
+  free(dir->names);
+  dir->names = NULL;
+  dir->count = 0;
+  dir->dirty = 0;
+
+  if((dirFd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0){
+    return;
+  }
+  listing = loadDir(&dir->listing, dir->path);
+  dir->names = (const char**)malloc((listing->count + 1) * sizeof(char*));
+  for(pos = 0; pos < listing->count; pos++){
+    name = listing->names + listing->offsets[pos];
+    if(listing->types[pos] == DT_DIR ||
+       faccessat(dirFd, name, X_OK, 0) != 0){
+      continue;
+    }
+    if(listing->types[pos] != DT_REG &&
+       (fstatat(dirFd, name, &st, 0) != 0 || !S_ISREG(st.st_mode))){
+      continue;
+    }
+    dir->names[dir->count++] = name;
+  }
+  close(dirFd);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   qsort comparison of two name pointers
+ *
+ * Args:
+ *   a (const void*): Pointer to a const char*
+ *   b (const void*): Pointer to a const char*
+ *
+ * Returns:
+ *   (int): strcmp order
+ */
+int execCompare(const void* a, const void* b){
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/**
+ * Purpose:
+ *   Create an index. Nothing is read until the first lookup.
+ *
+ * Args:
+ *   extraNames (const char**): NULL terminated names to include as well,
+ *                              such as builtins; kept, not copied
+ *
+ * Returns:
+ *   (YashExecIndex_t*): Index
+ */
+YashExecIndex_t* execIndexOpen(const char** extraNames){
+  YashExecIndex_t* index = NULL;
+
+  index = (YashExecIndex_t*)calloc(1, sizeof(YashExecIndex_t));
+  index->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  index->extra = extraNames;
+  while(extraNames != NULL && extraNames[index->numExtra] != NULL){
+    index->numExtra++;
+  }
+  index->dirty = 1;
+
+  return index;
+}
+
+/**
+ * Purpose:
+ *   Free an index and its watches
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void execIndexClose(YashExecIndex_t* index){
+  if(index == NULL){
+    return;
+  }
+  if(rlIndex == index){
+    rlIndex = NULL;
+  }
+
+  execFreeDirs(index);
+  if(index->inotifyFd >= 0){
+    close(index->inotifyFd);
+  }
+  free(index->pathVar);
+  free(index->sorted);
+  free(index);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Bring the index up to date: follow PATH changes, rescan directories
+ *   with pending events and rebuild the merged array if anything changed.
+ *   Without inotify, directory mtimes are compared instead.
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *
+ * Returns:
+ *   None
+ */
+void execIndexRefresh(YashExecIndex_t* index){
+  const char* pathVar = getenv("PATH");
+
+  ExecDir_t* dir = NULL;
+  struct stat st;
+  long total;
+  long pos;
+  long out;
+  int num;
+
+  if(pathVar == NULL){
+    pathVar = "";
+  }
+  if(index->pathVar == NULL || strcmp(index->pathVar, pathVar)){
+    execSetPath(index, pathVar);
+  }
+
+  if(index->inotifyFd >= 0){
+    execDrainEvents(index);
+  }
+  for(num = 0; num < index->numDirs; num++){
+    dir = &index->dirs[num];
+    if(index->inotifyFd >= 0 && dir->wd < 0 &&
+       (dir->wd = inotify_add_watch(index->inotifyFd, dir->path,
+                                    EXEC_WATCH_MASK)) >= 0){
+      dir->dirty = 1;
+    }
+    if(index->inotifyFd < 0 && stat(dir->path, &st) == 0 &&
+       (st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != dir->mtime.tv_nsec)){
+      dir->mtime = st.st_mtim;
+      dir->dirty = 1;
+    }
+    if(dir->dirty){
+      execScanDir(dir);
+      index->dirty = 1;
+    }
+  }
+  if(!index->dirty){
+    return;
+  }
+
+  total = index->numExtra;
+  for(num = 0; num < index->numDirs; num++){
+    total += index->dirs[num].count;
+  }
+  free(index->sorted);
+  index->sorted = (const char**)malloc((total + 1) * sizeof(char*));
+
+  memcpy(index->sorted, index->extra, index->numExtra * sizeof(char*));
+  total = index->numExtra;
+  for(num = 0; num < index->numDirs; num++){
+    memcpy(index->sorted + total, index->dirs[num].names,
+           index->dirs[num].count * sizeof(char*));
+    total += index->dirs[num].count;
+  }
+  qsort(index->sorted, total, sizeof(char*), execCompare);
+
+  // The same name in several directories completes once
+  out = 0;
+  for(pos = 0; pos < total; pos++){
+    if(out == 0 || strcmp(index->sorted[out - 1], index->sorted[pos])){
+      index->sorted[out++] = index->sorted[pos];
+    }
+  }
+  index->count = out;
+  index->dirty = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Find the names starting with a prefix
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index, refreshed first
+ *   prefix     (const char*): Prefix
+ *   count           (long*): Set to the number of matching names
+ *
+ * Returns:
+ *   (long): Position of the first match for execIndexName
+ */
+long execIndexLookup(YashExecIndex_t* index, const char* prefix, long* count){
+  const size_t prefixLen = strlen(prefix);
+
+  long low = 0;
+  long high;
+  long mid;
+  long end;
+
+  execIndexRefresh(index);
+
+  high = index->count;
+  while(low < high){
+    mid = low + (high - low) / 2;
+    if(strcmp(index->sorted[mid], prefix) < 0){
+      low = mid + 1;
+    }
+    else{
+      high = mid;
+    }
+  }
+
+  // Matches are contiguous; find their end the same way
+  high = index->count;
+  end = low;
+  while(end < high){
+    mid = end + (high - end) / 2;
+    if(!strncmp(index->sorted[mid], prefix, prefixLen)){
+      end = mid + 1;
+    }
+    else{
+      high = mid;
+    }
+  }
+  *count = end - low;
+
+  return low;
+}
+
+/**
+ * Purpose:
+ *   Name at a position. Valid until the next refresh.
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *   pos              (long): Position from execIndexLookup
+ *
+ * Returns:
+ *   (const char*): Name, or NULL past the end
+ */
+const char* execIndexName(YashExecIndex_t* index, long pos){
+  if(pos < 0 || pos >= index->count){
+    return NULL;
+  }
+
+  return index->sorted[pos];
+}
+
+/**
+ * Purpose:
+ *   Readline generator over the names matching the word being completed
+ *
+ * Args:
+ *   text (const char*): Word being completed
+ *   state       (int): 0 on the first call for this word
+ *
+ * Returns:
+ *   (char*): Next match, malloc'd for readline, or NULL when done
+ */
+char* execGenerator(const char* text, int state){
+  static long next = 0;
+  static long end = 0;
+
+  long count;
+
+  if(state == 0){
+    next = execIndexLookup(rlIndex, text, &count);
+    end = next + count;
+  }
+  if(next < end){
+    return strdup(execIndexName(rlIndex, next++));
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   rl_attempted_completion_function: complete command names from the
+ *   index in command position, and leave paths and arguments to
+ *   readline's filename completion
+ *
+ * Args:
+ *   text (const char*): Word being completed
+ *   start       (int): Start of the word in rl_line_buffer
+ *   end         (int): End of the word in rl_line_buffer
+ *
+ * Returns:
+ *   (char**): Matches, or NULL for the default completion
+ */
+char** execComplete(const char* text, int start, int end){
+  int pos = start;
+
+  while(pos > 0 && isspace((unsigned char)rl_line_buffer[pos - 1])){
+    pos--;
+  }
+  if(rlIndex == NULL || strchr(text, '/') != NULL ||
+     (pos > 0 && rl_line_buffer[pos - 1] != '|')){
+    return NULL;
+  }
+
+  return rl_completion_matches(text, execGenerator);
+}
+
+/**
+ * Purpose:
+ *   Serve readline's completion from an index
+ *
+ * Args:
+ *   index (YashExecIndex_t*): Index
+ *
+ * Returns:
+ *   None
+ */
+void execIndexReadlineInit(YashExecIndex_t* index){
+  rlIndex = index;
+  rl_attempted_completion_function = execComplete;
+
+  return;
+}
@@ -0,0 +1,18 @@
+#ifndef EXECINDEX_H
+#define EXECINDEX_H
+
+// Sorted index of the executable names on PATH, for command completion.
+// Every PATH directory is listed once and watched with inotify; a listing
+// is read again only after its directory reports a change, and the merged
+// array is rebuilt from the listings. Prefix lookups are a binary search.
+
+typedef struct YashExecIndex_t YashExecIndex_t;
+
+YashExecIndex_t* execIndexOpen(const char** extraNames);
+void execIndexClose(YashExecIndex_t* index);
+void execIndexRefresh(YashExecIndex_t* index);
+long execIndexLookup(YashExecIndex_t* index, const char* prefix, long* count);
+const char* execIndexName(YashExecIndex_t* index, long pos);
+void execIndexReadlineInit(YashExecIndex_t* index);
+
+#endif
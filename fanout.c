@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fanout.h"
+
+/**
+ * FanOut_t struct, one fan-out thread's pipes and destinations
+ */
+typedef struct FanOut_t{
+  int inFd;
+  int scratch[2];
+  int numDests;
+  int dests[FANOUT_MAX_DESTS];
+}FanOut_t;
+
+/**
+ * YashFanout_t struct, a started fan-out thread the shell may wait for
+ */
+struct YashFanout_t{
+  pthread_t thread;
+
+  struct YashFanout_t* next;
+};
+
+/**
+ * Purpose:
+ *   Splice exactly len bytes from a pipe to a destination
+ *
+ * Args:
+ *   fromFd  (int): Pipe to take the bytes from
+ *   toFd    (int): Destination
+ *   len  (size_t): Bytes to move
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the destination failed (EPIPE, full disk)
+ */
+int fanoutMove(int fromFd, int toFd, size_t len){
+  ssize_t moved;
+
+  while(len > 0){
+    moved = splice(fromFd, NULL, toFd, NULL, len, SPLICE_F_MOVE);
+    if(moved < 0 && errno == EINTR){
+      continue;
+    }
+    if(moved <= 0){
+      return -1;
+    }
+    len -= moved;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Thread body: wait for data with a first tee, give a copy of the same
+ *   bytes to every destination but the last through the scratch pipe, then
+ *   splice the original bytes to the last one. Ends at EOF, or when any
+ *   destination fails, as a tee process killed by SIGPIPE would.
+ *
+ * Args:
+ *   arg (void*): The FanOut_t
+ *
+ * Returns:
+ *   (void*): NULL
+ */
+void* fanoutRun(void* arg){
+  FanOut_t* fan = (FanOut_t*)arg;
+  ssize_t len;
+  ssize_t copied;
+  int failed = 0;
+  int dest;
+
+  while(!failed){
+    len = tee(fan->inFd, fan->scratch[1], FANOUT_CHUNK, 0);
+    if(len < 0 && errno == EINTR){
+      continue;
+    }
+    if(len <= 0){
+      break;
+    }
+
+    for(dest = 0; dest < fan->numDests - 1 && !failed; dest++){
+      // The scratch pipe is empty and as large as the input, so a tee
+      // after the first takes the same len bytes again
+      copied = len;
+      while(dest > 0 &&
+            (copied = tee(fan->inFd, fan->scratch[1], len, 0)) < 0 &&
+            errno == EINTR);
+      failed = fanoutMove(fan->scratch[0], fan->dests[dest],
+                          copied > 0 ? copied : 0) < 0;
+    }
+    failed = failed ||
+             fanoutMove(fan->inFd, fan->dests[fan->numDests - 1], len) < 0;
+  }
+
+  // Closing the input passes SIGPIPE back to the command
+  close(fan->inFd);
+  close(fan->scratch[0]);
+  close(fan->scratch[1]);
+  for(dest = 0; dest < fan->numDests; dest++){
+    close(fan->dests[dest]);
+  }
+  free(fan);
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Start a fan-out thread that copies everything written to a new pipe
+ *   to each destination. The thread owns the destinations and closes them
+ *   when the pipe's writers are all gone.
+ *
+ * Args:
+ *   dests             (int*): Destination fds: files, or pipes such as the
+ *                             next stage
+ *   numDests           (int): Number of destinations, at most
+ *                             FANOUT_MAX_DESTS
+ *   fans    (YashFanout_t**): Started thread is added here, for
+ *                             fanoutFinish; NULL to detach it
+ *
+ * Returns:
+ *   (int): Close-on-exec write end of the pipe, -1 with errno set on
+ *          failure (the destinations are closed)
+ */
+int fanoutStart(int* dests, int numDests, YashFanout_t** fans){
+  FanOut_t* fan = (FanOut_t*)calloc(1, sizeof(FanOut_t));
+  YashFanout_t* node = (YashFanout_t*)malloc(sizeof(YashFanout_t));
+  sigset_t allSigs;
+  sigset_t oldMask;
+  int pfd[2] = {-1, -1};
+  int err = 0;
+  int index;
+
+  fan->scratch[0] = fan->scratch[1] = -1;
+  if(pipe2(pfd, O_CLOEXEC) < 0 || pipe2(fan->scratch, O_CLOEXEC) < 0 ||
+     fcntl(fan->scratch[1], F_SETPIPE_SZ,
+           fcntl(pfd[0], F_GETPIPE_SZ)) < 0){
+    err = errno;
+  }
+  fan->inFd = pfd[0];
+  fan->numDests = numDests;
+  memcpy(fan->dests, dests, numDests * sizeof(int));
+
+  if(!err){
+    // Signals are for the shell's thread only; SIGPIPE stays pending here
+    sigfillset(&allSigs);
+    pthread_sigmask(SIG_BLOCK, &allSigs, &oldMask);
+    err = pthread_create(&node->thread, NULL, fanoutRun, fan);
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  }
+  if(err){
+    for(index = 0; index < 2; index++){
+      if(pfd[index] >= 0){
+        close(pfd[index]);
+      }
+      if(fan->scratch[index] >= 0){
+        close(fan->scratch[index]);
+      }
+    }
+    for(index = 0; index < numDests; index++){
+      close(dests[index]);
+    }
+    free(fan);
+    free(node);
+    errno = err;
+    return -1;
+  }
+
+  if(fans != NULL){
+    node->next = *fans;
+    *fans = node;
+  }
+  else{
+    pthread_detach(node->thread);
+    free(node);
+  }
+
+  return pfd[1];
+}
+
+/**
+ * Purpose:
+ *   Open the output files of every fd redirected more than once (counting
+ *   pipeFd as one more target of stdout) and replace those redirections
+ *   with one dup of a fan-out pipe. Like openRedirs, the new op keeps its
+ *   path so closeRedirs closes the shell's copy once the child has it.
+ *   Appending targets are opened at their end without O_APPEND, which
+ *   splice does not accept.
+ *
+ * Args:
+ *   redirs   (RedirList_t*): List of fd operations from parseRedirs
+ *   pipeFd            (int): Write end of the pipe to the next stage, -1
+ *                            if stdout is not piped
+ *   fans   (YashFanout_t**): Started threads are added here
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if a file could not be opened or the fan-out
+ *          could not start (a message is printed)
+ */
+int fanoutRedirs(RedirList_t* redirs, int pipeFd, YashFanout_t** fans){
+  const mode_t MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+  int dests[FANOUT_MAX_DESTS];
+  int numDests;
+  int first;
+  int index;
+  int keep;
+  int fd;
+  RedirOp_t* op = NULL;
+
+  for(first = 0; first < redirs->numOps; first++){
+    op = &redirs->ops[first];
+    if(op->type != REDIR_OPEN || op->both ||
+       (op->flags & O_ACCMODE) != O_WRONLY){
+      continue;
+    }
+
+    // Count this op's fd's other output files
+    fd = op->fd;
+    numDests = (fd == STDOUT_FILENO && pipeFd >= 0) ? 1 : 0;
+    for(index = first; index < redirs->numOps; index++){
+      op = &redirs->ops[index];
+      if(op->type == REDIR_OPEN && !op->both && op->fd == fd &&
+         (op->flags & O_ACCMODE) == O_WRONLY){
+        numDests++;
+      }
+    }
+    if(numDests < 2){
+      continue;
+    }
+
+    numDests = 0;
+    for(index = first; index < redirs->numOps; index++){
+      op = &redirs->ops[index];
+      if(op->type != REDIR_OPEN || op->both || op->fd != fd ||
+         (op->flags & O_ACCMODE) != O_WRONLY){
+        continue;
+      }
+      if((dests[numDests] = open(op->path,
+                                 (op->flags & ~O_APPEND) | O_CLOEXEC,
+                                 MODE)) < 0){
+        perror(op->path);
+        while(numDests > 0){
+          close(dests[--numDests]);
+        }
+        return -1;
+      }
+      if(op->flags & O_APPEND){
+        lseek(dests[numDests], 0, SEEK_END);
+      }
+      numDests++;
+    }
+    if(fd == STDOUT_FILENO && pipeFd >= 0){
+      dests[numDests++] = fcntl(pipeFd, F_DUPFD_CLOEXEC, 0);
+    }
+
+    op = &redirs->ops[first];
+    if((op->srcFd = fanoutStart(dests, numDests, fans)) < 0){
+      fprintf(stderr, "yash: %s: %s\n", op->path, strerror(errno));
+      return -1;
+    }
+    op->type = REDIR_DUP;
+
+    // The first op now stands for all of them; drop the rest
+    for(index = keep = first + 1; index < redirs->numOps; index++){
+      op = &redirs->ops[index];
+      if(op->type == REDIR_OPEN && !op->both && op->fd == fd &&
+         (op->flags & O_ACCMODE) == O_WRONLY){
+        continue;
+      }
+      redirs->ops[keep++] = *op;
+    }
+    redirs->numOps = keep;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Wait for or let go of fan-out threads, and free their handles
+ *
+ * Args:
+ *   fans (YashFanout_t*): Threads from fanoutRedirs, may be NULL
+ *   wait            (int): 1 to wait until each has passed on its last
+ *                          byte, 0 to detach them (background jobs)
+ *
+ * Returns:
+ *   None
+ */
+void fanoutFinish(YashFanout_t* fans, int wait){
+  YashFanout_t* next = NULL;
+
+  while(fans != NULL){
+    next = fans->next;
+    if(wait){
+      pthread_join(fans->thread, NULL);
+    }
+    else{
+      pthread_detach(fans->thread);
+    }
+    free(fans);
+    fans = next;
+  }
+
+  return;
+}
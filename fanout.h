@@ -0,0 +1,25 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "libyash_internal.h"
+
+// Output fan-out (multios). When one fd of a command is redirected to
+// several files, as in "cmd > a > b", or stage 1 of a pipeline also sends
+// its stdout to a file, as in "cmd > a | b", the command writes into one
+// pipe and a shell thread passes the data on: tee(2) duplicates the pipe's
+// pages into a scratch pipe that is spliced to each destination in turn,
+// and the last destination takes the original pages. No byte is copied in
+// user space, so each extra destination costs one tee and one splice. The
+// shell waits for the threads of a foreground command so every file is
+// complete when the prompt returns.
+
+#define FANOUT_CHUNK (1 << 20)
+#define FANOUT_MAX_DESTS (MAX_REDIRS + 1)
+
+typedef struct YashFanout_t YashFanout_t;
+
+int fanoutStart(int* dests, int numDests, YashFanout_t** fans);
+int fanoutRedirs(RedirList_t* redirs, int pipeFd, YashFanout_t** fans);
+void fanoutFinish(YashFanout_t* fans, int wait);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libyash_internal.h"
+
+// Benchmark for glob expansion. ENTRIES empty files are created in a
+// temporary directory, then each pattern is expanded by libyash and by
+// glob(3). libyash runs twice: cold, reading the directory with getdents64
+// as the first pattern on a line does, and from the dirent cache, as any
+// later pattern over the same directory on that line does. Match counts
+// must agree.
+//
+//   glob_bench [ENTRIES]
+
+#define BENCH_ENTRIES 1000000
+#define BENCH_RUNS 3
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Create or remove the entries f0000000, f0000001, ... in a directory
+ *
+ * Args:
+ *   dir (const char*): Directory
+ *   entries     (int): Number of entries
+ *   create      (int): 1 to create, 0 to remove
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on the first failure (a message is printed)
+ */
+int makeEntries(const char* dir, int entries, int create){
+  char name[32];
+  int dirFd;
+  int fd;
+  int index;
+
+  if((dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0){
+    perror(dir);
+    return -1;
+  }
+  for(index = 0; index < entries; index++){
+    snprintf(name, sizeof(name), "f%07d", index);
+    if(!create){
+      unlinkat(dirFd, name, 0);
+    }
+    else if((fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_CLOEXEC,
+                         0600)) < 0){
+      perror(name);
+      close(dirFd);
+      return -1;
+    }
+    else{
+      close(fd);
+    }
+  }
+  close(dirFd);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Expand a pattern once through libyash
+ *
+ * Args:
+ *   cache (DirCache_t**): Dirent cache, emptied first unless warm is set
+ *   pattern      (char*): Pattern
+ *   warm           (int): 1 to keep the cache from an earlier run
+ *   count         (int*): Set to the number of matches
+ *
+ * Returns:
+ *   (double): Seconds taken
+ */
+double runYash(DirCache_t** cache, char* pattern, int warm, int* count){
+  GlobResult_t res = {NULL, 0, 0};
+  double begin;
+  double secs;
+  int index;
+
+  if(!warm){
+    freeDirCache(cache);
+  }
+  begin = nowSec();
+  expandGlob(cache, pattern, &res);
+  secs = nowSec() - begin;
+
+  *count = res.count;
+  for(index = 0; index < res.count; index++){
+    free(res.paths[index]);
+  }
+  free(res.paths);
+
+  return secs;
+}
+
+/**
+ * Purpose:
+ *   Expand a pattern once through glob(3)
+ *
+ * Args:
+ *   pattern (char*): Pattern
+ *   count    (int*): Set to the number of matches
+ *
+ * Returns:
+ *   (double): Seconds taken
+ */
+double runLibc(char* pattern, int* count){
+  glob_t matches;
+  double begin;
+  double secs;
+
+  begin = nowSec();
+  *count = (glob(pattern, 0, NULL, &matches) == 0) ? matches.gl_pathc : 0;
+  secs = nowSec() - begin;
+  globfree(&matches);
+
+  return secs;
+}
+
+/**
+ * Purpose:
+ *   Best of BENCH_RUNS runs of one pattern in each mode, printed
+ *
+ * Args:
+ *   dir   (const char*): Directory of the entries
+ *   name  (const char*): Pattern below dir
+ *   entries       (int): Number of entries, for the rate
+ *
+ * Returns:
+ *   (int): 0 if the counts agree, -1 if not
+ */
+int report(const char* dir, const char* name, int entries){
+  char pattern[4096];
+  DirCache_t* cache = NULL;
+  double best[3] = {0, 0, 0};
+  double secs;
+  int counts[3];
+  int mode;
+  int run;
+
+  snprintf(pattern, sizeof(pattern), "%s/%s", dir, name);
+  for(run = 0; run < BENCH_RUNS; run++){
+    for(mode = 0; mode < 3; mode++){
+      if(mode == 2){
+        secs = runLibc(pattern, &counts[mode]);
+      }
+      else{
+        secs = runYash(&cache, pattern, mode, &counts[mode]);
+      }
+      if(run == 0 || secs < best[mode]){
+        best[mode] = secs;
+      }
+    }
+  }
+  freeDirCache(&cache);
+
+  printf("%-10s %8d  cold %8.1f ms  cached %8.1f ms  glob(3) %8.1f ms"
+         "  (%.1fM entries/s cold)\n", name, counts[0], best[0] * 1e3,
+         best[1] * 1e3, best[2] * 1e3, entries / best[0] / 1e6);
+  if(counts[0] != counts[2] || counts[1] != counts[2]){
+    fprintf(stderr, "glob_bench: %s: %d and %d matches, glob(3) has %d\n",
+            name, counts[0], counts[1], counts[2]);
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv){
+  const char* PATTERNS[] = {"*", "f*7", "f00[0-4]*", "f?????1?", "x*", NULL};
+
+  char dir[] = "/tmp/glob_bench.XXXXXX";
+  double begin;
+  int entries = BENCH_ENTRIES;
+  int failed = 0;
+  int index;
+
+  if(argc > 2 || (argc == 2 && (entries = atoi(argv[1])) <= 0)){
+    fprintf(stderr, "usage: glob_bench [ENTRIES]\n");
+    return 1;
+  }
+  if(mkdtemp(dir) == NULL){
+    perror(dir);
+    return 1;
+  }
+
+  begin = nowSec();
+  if(makeEntries(dir, entries, 1) < 0){
+    makeEntries(dir, entries, 0);
+    rmdir(dir);
+    return 1;
+  }
+  printf("%d entries in %s, created in %.1f s\n", entries, dir,
+         nowSec() - begin);
+
+  for(index = 0; PATTERNS[index] != NULL; index++){
+    failed |= report(dir, PATTERNS[index], entries);
+  }
+
+  makeEntries(dir, entries, 0);
+  rmdir(dir);
+
+  return failed ? 1 : 0;
+}
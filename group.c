@@ -0,0 +1,1028 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "group.h"
+#include "memstat.h"
+#include "plugin.h"
+#include "zpipe.h"
+
+#define GROUP_FD_BASE 10
+#define GROUP_EXEC_FAIL 127
+
+// Names of the shell's own builtins, set by the shell
+const char** groupShellBuiltins = NULL;
+
+/**
+ * Group token kinds; words carry the text
+ */
+enum{
+  GROUP_TOK_WORD,
+  GROUP_TOK_LPAREN,
+  GROUP_TOK_RPAREN,
+  GROUP_TOK_SEMI,
+  GROUP_TOK_AMP,
+  GROUP_TOK_AND,
+  GROUP_TOK_OR,
+  GROUP_TOK_PIPE,
+  GROUP_TOK_END
+};
+
+/**
+ * GroupTok_t struct, one token and where it is in the line
+ */
+typedef struct GroupTok_t{
+  int type;
+  int start;
+  int end;
+}GroupTok_t;
+
+/**
+ * GroupParser_t struct, state of one groupParse
+ */
+typedef struct GroupParser_t{
+  const char* line;
+  GroupTok_t* toks;
+  int numToks;
+  int pos;
+  DirCache_t* dirCache;
+  int failed;
+}GroupParser_t;
+
+/**
+ * Purpose:
+ *   Check whether a line uses grouping, so it is run through groupParse
+ *   rather than split on its pipe: it has a parenthesis or a { word
+ *
+ * Args:
+ *   line (const char*): Command line
+ *
+ * Returns:
+ *   (int): 1 if the line has a group, else 0
+ */
+int groupDetect(const char* line){
+  const char* at = NULL;
+
+  if(strpbrk(line, "()") != NULL){
+    return 1;
+  }
+  for(at = strchr(line, '{'); at != NULL; at = strchr(at + 1, '{')){
+    if((at == line || at[-1] == ' ' || at[-1] == '\t') &&
+       (at[1] == '\0' || at[1] == ' ' || at[1] == '\t')){
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Split a line into words and operators. ( ) ; | split words wherever
+ *   they are; & does too, except inside a redirection such as 2>&1 or
+ *   &>file. { and } are ordinary words here.
+ *
+ * Args:
+ *   line (const char*): Command line
+ *   toks (GroupTok_t*): Room for strlen(line) + 1 tokens
+ *
+ * Returns:
+ *   (int): Number of tokens, the last being GROUP_TOK_END
+ */
+int groupTokenize(const char* line, GroupTok_t* toks){
+  int numToks = 0;
+  int pos = 0;
+  int start;
+  char c;
+
+  while(line[pos] != '\0'){
+    c = line[pos];
+    if(c == ' ' || c == '\t'){
+      pos++;
+      continue;
+    }
+
+    start = pos;
+    if(c == '(' || c == ')' || c == ';'){
+      toks[numToks].type = (c == '(') ? GROUP_TOK_LPAREN :
+                           (c == ')') ? GROUP_TOK_RPAREN : GROUP_TOK_SEMI;
+      pos++;
+    }
+    else if(c == '|' && line[pos + 1] == '|'){
+      toks[numToks].type = GROUP_TOK_OR;
+      pos += 2;
+    }
+    else if(c == '|'){
+      // |~ meters a plain pipe; in a group it is an ordinary pipe
+      toks[numToks].type = GROUP_TOK_PIPE;
+      pos += (line[pos + 1] == '~') ? 2 : 1;
+    }
+    else if(c == '&' && line[pos + 1] == '&'){
+      toks[numToks].type = GROUP_TOK_AND;
+      pos += 2;
+    }
+    else if(c == '&' && line[pos + 1] != '>'){
+      toks[numToks].type = GROUP_TOK_AMP;
+      pos++;
+    }
+    else{
+      toks[numToks].type = GROUP_TOK_WORD;
+      while((c = line[pos]) != '\0' && c != ' ' && c != '\t' && c != '(' &&
+            c != ')' && c != ';' && c != '|'){
+        if(c == '&' && pos > start && line[pos - 1] != '>' &&
+           line[pos - 1] != '<'){
+          break;
+        }
+        pos++;
+      }
+    }
+    toks[numToks].start = start;
+    toks[numToks].end = pos;
+    numToks++;
+  }
+  toks[numToks].type = GROUP_TOK_END;
+  toks[numToks].start = pos;
+  toks[numToks].end = pos;
+
+  return numToks + 1;
+}
+
+/**
+ * Purpose:
+ *   Check whether the current token is a given word
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *   word      (const char*): Word to compare with
+ *
+ * Returns:
+ *   (int): 1 if it is, else 0
+ */
+int groupIsWord(GroupParser_t* parser, const char* word){
+  GroupTok_t* tok = &parser->toks[parser->pos];
+
+  return tok->type == GROUP_TOK_WORD &&
+         (size_t)(tok->end - tok->start) == strlen(word) &&
+         !strncmp(parser->line + tok->start, word, tok->end - tok->start);
+}
+
+/**
+ * Purpose:
+ *   Check whether the current token ends the list being parsed
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *   endType          (int): GROUP_TOK_RPAREN, GROUP_TOK_WORD for } or
+ *                           GROUP_TOK_END
+ *
+ * Returns:
+ *   (int): 1 if it does, else 0
+ */
+int groupAtEnd(GroupParser_t* parser, int endType){
+  return parser->toks[parser->pos].type == endType &&
+         (endType != GROUP_TOK_WORD || groupIsWord(parser, "}"));
+}
+
+/**
+ * Purpose:
+ *   Report a syntax error at the current token; only the first is printed
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *
+ * Returns:
+ *   None
+ */
+void groupSyntaxError(GroupParser_t* parser){
+  GroupTok_t* tok = &parser->toks[parser->pos];
+
+  if(!parser->failed){
+    if(tok->type == GROUP_TOK_END){
+      fprintf(stderr, "yash: syntax error near `newline'\n");
+    }
+    else{
+      fprintf(stderr, "yash: syntax error near `%.*s'\n",
+              tok->end - tok->start, parser->line + tok->start);
+    }
+  }
+  parser->failed = 1;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Copy tokens into a NULL terminated word array counted against the
+ *   parser, optionally expanding globs
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *   first            (int): Index of the first token
+ *   last             (int): Index past the last token
+ *   glob             (int): 1 to expand globs
+ *
+ * Returns:
+ *   (char**): Word array
+ */
+char** groupWords(GroupParser_t* parser, int first, int last, int glob){
+  char** words = (char**)malloc((last - first + 1) * sizeof(char*));
+  GroupTok_t* tok = NULL;
+  int index;
+
+  for(index = first; index < last; index++){
+    tok = &parser->toks[index];
+    words[index - first] = strndup(parser->line + tok->start,
+                                   tok->end - tok->start);
+  }
+  words[last - first] = NULL;
+  if(glob){
+    words = expandGlobs(words, &parser->dirCache);
+  }
+
+  for(index = 0; words[index] != NULL; index++){
+    memCharge(MEM_PARSER, words[index]);
+  }
+
+  return (char**)memCharge(MEM_PARSER, words);
+}
+
+/**
+ * Purpose:
+ *   Free a word array from groupWords
+ *
+ * Args:
+ *   words (char**): Word array, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void groupFreeWords(char** words){
+  int index;
+
+  if(words == NULL){
+    return;
+  }
+  for(index = 0; words[index] != NULL; index++){
+    memFree(MEM_PARSER, words[index]);
+  }
+  memFree(MEM_PARSER, words);
+
+  return;
+}
+
+GroupList_t* groupParseList(GroupParser_t* parser, int endType);
+void groupFreePipe(GroupPipe_t* pipe);
+
+/**
+ * Purpose:
+ *   Parse one pipeline stage: ( list ), { list; } or a simple command.
+ *   A simple command starting with while runs through its done, so the
+ *   while builtin gets its ; words.
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *
+ * Returns:
+ *   (GroupCmd_t*): Stage, NULL on a syntax error
+ */
+GroupCmd_t* groupParseCmd(GroupParser_t* parser){
+  GroupCmd_t* cmd = (GroupCmd_t*)memCalloc(MEM_PARSER, 1, sizeof(GroupCmd_t));
+  GroupTok_t* tok = &parser->toks[parser->pos];
+  int first = parser->pos;
+  int isWhile;
+
+  if(tok->type == GROUP_TOK_LPAREN || groupIsWord(parser, "{")){
+    cmd->type = (tok->type == GROUP_TOK_LPAREN) ? GROUP_SUBSHELL : GROUP_BRACE;
+    parser->pos++;
+    cmd->body = groupParseList(parser, cmd->type == GROUP_SUBSHELL ?
+                                       GROUP_TOK_RPAREN : GROUP_TOK_WORD);
+    if(cmd->body == NULL ||
+       (cmd->type == GROUP_SUBSHELL &&
+        parser->toks[parser->pos].type != GROUP_TOK_RPAREN) ||
+       (cmd->type == GROUP_BRACE && !groupIsWord(parser, "}"))){
+      groupSyntaxError(parser);
+      groupFree(cmd->body);
+      memFree(MEM_PARSER, cmd);
+      return NULL;
+    }
+    // Redirections of the whole group follow it
+    first = ++parser->pos;
+    while(parser->toks[parser->pos].type == GROUP_TOK_WORD){
+      parser->pos++;
+    }
+    cmd->words = groupWords(parser, first, parser->pos, 0);
+
+    return cmd;
+  }
+
+  cmd->type = GROUP_SIMPLE;
+  if(groupIsWord(parser, "}")){
+    // Reserved in command position, and no brace group is open
+    groupSyntaxError(parser);
+    memFree(MEM_PARSER, cmd);
+    return NULL;
+  }
+  isWhile = groupIsWord(parser, "while");
+  while(parser->toks[parser->pos].type == GROUP_TOK_WORD ||
+        (isWhile && parser->toks[parser->pos].type == GROUP_TOK_SEMI)){
+    if(isWhile && groupIsWord(parser, "done")){
+      isWhile = 0;
+    }
+    parser->pos++;
+  }
+  if(parser->pos == first){
+    groupSyntaxError(parser);
+    memFree(MEM_PARSER, cmd);
+    return NULL;
+  }
+  cmd->words = groupWords(parser, first, parser->pos, 1);
+
+  return cmd;
+}
+
+/**
+ * Purpose:
+ *   Parse stages separated by |
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *
+ * Returns:
+ *   (GroupPipe_t*): Pipeline, NULL on a syntax error
+ */
+GroupPipe_t* groupParsePipe(GroupParser_t* parser){
+  GroupPipe_t* pipe = (GroupPipe_t*)memCalloc(MEM_PARSER, 1,
+                                              sizeof(GroupPipe_t));
+  GroupCmd_t* cmd = NULL;
+  int start = parser->toks[parser->pos].start;
+  int end;
+
+  while(1){
+    if((cmd = groupParseCmd(parser)) == NULL){
+      groupFreePipe(pipe);
+      return NULL;
+    }
+    pipe->cmds = (GroupCmd_t**)memRealloc(MEM_PARSER, pipe->cmds,
+                                          (pipe->numCmds + 1) *
+                                          sizeof(GroupCmd_t*));
+    pipe->cmds[pipe->numCmds++] = cmd;
+    if(parser->toks[parser->pos].type != GROUP_TOK_PIPE){
+      break;
+    }
+    parser->pos++;
+  }
+  end = parser->toks[parser->pos - 1].end;
+  pipe->sep = GROUP_SEQ;
+  pipe->text = memStrndup(MEM_PARSER, parser->line + start, end - start);
+
+  return pipe;
+}
+
+/**
+ * Purpose:
+ *   Parse pipelines separated by ; & && || up to the end of a group or
+ *   of the line. A list ends before ) for a subshell and before a } in
+ *   command position for a brace group.
+ *
+ * Args:
+ *   parser (GroupParser_t*): Parser
+ *   endType          (int): GROUP_TOK_RPAREN, GROUP_TOK_WORD for } or
+ *                           GROUP_TOK_END
+ *
+ * Returns:
+ *   (GroupList_t*): List, NULL on a syntax error
+ */
+GroupList_t* groupParseList(GroupParser_t* parser, int endType){
+  GroupList_t* list = (GroupList_t*)memCalloc(MEM_PARSER, 1,
+                                              sizeof(GroupList_t));
+  GroupPipe_t* pipe = NULL;
+  GroupTok_t* tok = NULL;
+
+  while(!groupAtEnd(parser, endType)){
+    if((pipe = groupParsePipe(parser)) == NULL){
+      groupFree(list);
+      return NULL;
+    }
+    list->pipes = (GroupPipe_t**)memRealloc(MEM_PARSER, list->pipes,
+                                            (list->numPipes + 1) *
+                                            sizeof(GroupPipe_t*));
+    list->pipes[list->numPipes++] = pipe;
+
+    tok = &parser->toks[parser->pos];
+    if(tok->type == GROUP_TOK_SEMI || tok->type == GROUP_TOK_AMP){
+      pipe->sep = (tok->type == GROUP_TOK_SEMI) ? GROUP_SEQ : GROUP_BACK;
+    }
+    else if(tok->type == GROUP_TOK_AND || tok->type == GROUP_TOK_OR){
+      pipe->sep = (tok->type == GROUP_TOK_AND) ? GROUP_AND : GROUP_OR;
+    }
+    else{
+      break;
+    }
+    parser->pos++;
+  }
+
+  // Empty groups and a trailing && or || have nothing to run
+  if(list->numPipes == 0 || !groupAtEnd(parser, endType) ||
+     pipe->sep == GROUP_AND || pipe->sep == GROUP_OR){
+    groupSyntaxError(parser);
+    groupFree(list);
+    return NULL;
+  }
+
+  return list;
+}
+
+/**
+ * Purpose:
+ *   Parse a command line with groups into a list. Globs are expanded
+ *   here, once, like yashParse does.
+ *
+ * Args:
+ *   line (const char*): Command line
+ *
+ * Returns:
+ *   (GroupList_t*): List to run, NULL on a syntax error (a message is
+ *                   printed)
+ */
+GroupList_t* groupParse(const char* line){
+  GroupParser_t parser;
+  GroupList_t* list = NULL;
+
+  memset(&parser, 0, sizeof(parser));
+  parser.line = line;
+  parser.toks = (GroupTok_t*)malloc((strlen(line) + 1) * sizeof(GroupTok_t));
+  parser.numToks = groupTokenize(line, parser.toks);
+
+  list = groupParseList(&parser, GROUP_TOK_END);
+
+  freeDirCache(&parser.dirCache);
+  free(parser.toks);
+
+  return list;
+}
+
+/**
+ * Purpose:
+ *   Free a pipeline and its stages
+ *
+ * Args:
+ *   pipe (GroupPipe_t*): Pipeline
+ *
+ * Returns:
+ *   None
+ */
+void groupFreePipe(GroupPipe_t* pipe){
+  GroupCmd_t* cmd = NULL;
+  int index;
+
+  for(index = 0; index < pipe->numCmds; index++){
+    cmd = pipe->cmds[index];
+    groupFreeWords(cmd->words);
+    groupFree(cmd->body);
+    memFree(MEM_PARSER, cmd);
+  }
+  memFree(MEM_PARSER, pipe->cmds);
+  memFree(MEM_PARSER, pipe->text);
+  memFree(MEM_PARSER, pipe);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Free a list from groupParse
+ *
+ * Args:
+ *   list (GroupList_t*): List, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void groupFree(GroupList_t* list){
+  int index;
+
+  if(list == NULL){
+    return;
+  }
+  for(index = 0; index < list->numPipes; index++){
+    groupFreePipe(list->pipes[index]);
+  }
+  memFree(MEM_PARSER, list->pipes);
+  memFree(MEM_PARSER, list);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Keep a copy of an fd so groupRestore can put it back
+ *
+ * Args:
+ *   saved    (int*): (fd, copy) pairs
+ *   numSaved  (int): Pairs stored
+ *   fd        (int): fd about to change
+ *
+ * Returns:
+ *   (int): New number of pairs
+ */
+int groupSaveFd(int* saved, int numSaved, int fd){
+  int index;
+
+  for(index = 0; index < numSaved; index++){
+    if(saved[2 * index] == fd){
+      return numSaved;
+    }
+  }
+  saved[2 * numSaved] = fd;
+  // -1 when the fd was closed; it is closed again on restore
+  saved[2 * numSaved + 1] = fcntl(fd, F_DUPFD_CLOEXEC, GROUP_FD_BASE);
+
+  return numSaved + 1;
+}
+
+/**
+ * Purpose:
+ *   Apply redirections to the current process, saving each fd they
+ *   change. Codec ops must already be dups of their pipes (zpipeRedirs).
+ *
+ * Args:
+ *   redirs (RedirList_t*): fd operations from parseRedirs
+ *   saved          (int*): Room for 2 * GROUP_MAX_SAVED ints
+ *
+ * Returns:
+ *   (int): Pairs saved for groupRestore, -1 if a file could not be
+ *          opened (a message is printed and nothing is changed)
+ */
+int groupRedirect(RedirList_t* redirs, int* saved){
+  const int INVALID = -1;
+
+  RedirOp_t* op = NULL;
+  int numSaved = 0;
+  int index;
+
+  if(openRedirs(redirs) < 0){
+    return INVALID;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    numSaved = groupSaveFd(saved, numSaved, op->fd);
+    if(op->both){
+      numSaved = groupSaveFd(saved, numSaved, STDERR_FILENO);
+    }
+
+    if(op->type == REDIR_DUP && dup2(op->srcFd, op->fd) < 0){
+      fprintf(stderr, "yash: %d: %s\n", op->srcFd, strerror(errno));
+      groupRestore(saved, numSaved);
+      closeRedirs(redirs);
+      return INVALID;
+    }
+    else if(op->type == REDIR_CLOSE){
+      close(op->fd);
+    }
+    if(op->both){
+      dup2(op->fd, STDERR_FILENO);
+    }
+  }
+
+  return numSaved;
+}
+
+/**
+ * Purpose:
+ *   Put back the fds groupRedirect changed
+ *
+ * Args:
+ *   saved   (int*): Pairs from groupRedirect
+ *   numSaved (int): Number of pairs
+ *
+ * Returns:
+ *   None
+ */
+void groupRestore(int* saved, int numSaved){
+  int index;
+
+  fflush(stdout);
+  fflush(stderr);
+  for(index = numSaved - 1; index >= 0; index--){
+    if(saved[2 * index + 1] >= 0){
+      dup2(saved[2 * index + 1], saved[2 * index]);
+      close(saved[2 * index + 1]);
+    }
+    else{
+      close(saved[2 * index]);
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   cd [DIR]: change directory, to $HOME without an argument
+ *
+ * Args:
+ *   argv (char**): Arguments starting with "cd"
+ *
+ * Returns:
+ *   (int): Exit code
+ */
+int groupCd(char** argv){
+  char cwd[PATH_MAX];
+  const char* dir = (argv[1] != NULL) ? argv[1] : getenv("HOME");
+
+  if(dir == NULL || chdir(dir) < 0){
+    fprintf(stderr, "yash: cd: %s: %s\n", dir != NULL ? dir : "HOME",
+            dir != NULL ? strerror(errno) : "not set");
+    return 1;
+  }
+  if(getcwd(cwd, sizeof(cwd)) != NULL){
+    setenv("PWD", cwd, 1);
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Exit code of a waitpid status, as $? would show it
+ *
+ * Args:
+ *   status (int): waitpid status
+ *
+ * Returns:
+ *   (int): Exit status, or 128 + signal
+ */
+int groupExitCode(int status){
+  if(WIFEXITED(status)){
+    return WEXITSTATUS(status);
+  }
+  else if(WIFSIGNALED(status)){
+    return 128 + WTERMSIG(status);
+  }
+  else if(WIFSTOPPED(status)){
+    return 128 + WSTOPSIG(status);
+  }
+
+  return 1;
+}
+
+/**
+ * Purpose:
+ *   Wait for a child of a subshell
+ *
+ * Args:
+ *   pid (int): Child
+ *
+ * Returns:
+ *   (int): Its exit code
+ */
+int groupWait(int pid){
+  int status = 0;
+
+  while(waitpid(pid, &status, 0) < 0){
+    if(errno != EINTR){
+      return 1;
+    }
+  }
+
+  return groupExitCode(status);
+}
+
+/**
+ * Purpose:
+ *   Fork a process that runs one stage. With pgid >= 0 the shell is
+ *   forking a job: the child joins the job's process group, gets default
+ *   signal dispositions and closes every fd it did not ask for, as
+ *   pluginSpawn does. Inside a subshell (pgid -1) it stays in the group.
+ *
+ * Args:
+ *   cmd (GroupCmd_t*): Stage to run
+ *   inFd        (int): fd for stdin, -1 to inherit
+ *   outFd       (int): fd for stdout, -1 to inherit
+ *   closeFd     (int): Other pipe end to close in the child, -1 for none
+ *   pgid        (int): 0 for a new group, a job's pgid, or -1
+ *   pid        (int*): Set to the child's PID
+ *
+ * Returns:
+ *   (int): 0 on success, else an errno value (a message is printed)
+ */
+int groupSpawn(GroupCmd_t* cmd, int inFd, int outFd, int closeFd, int pgid,
+               int* pid){
+  RedirList_t none;
+  sigset_t mask;
+  int err;
+
+  fflush(stdout);
+  fflush(stderr);
+  if((*pid = fork()) < 0){
+    err = errno;
+    fprintf(stderr, "yash: fork: %s\n", strerror(err));
+    return err;
+  }
+  else if(*pid == 0){
+    if(pgid >= 0){
+      setpgid(0, pgid);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+    }
+    if(inFd >= 0){
+      dup2(inFd, STDIN_FILENO);
+      close(inFd);
+    }
+    if(outFd >= 0){
+      dup2(outFd, STDOUT_FILENO);
+      close(outFd);
+    }
+    if(closeFd >= 0){
+      close(closeFd);
+    }
+    if(pgid >= 0){
+      none.numOps = 0;
+      pluginCloseFds(&none);
+    }
+    _exit(groupRunCmd(cmd, 1));
+  }
+
+  if(pgid >= 0){
+    // Set it here too so the group exists before a second stage joins it
+    setpgid(*pid, pgid == 0 ? *pid : pgid);
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Check whether a name is one of the shell's own builtins. Those act on
+ *   the shell's job table and options, so a forked group cannot run them.
+ *
+ * Args:
+ *   name (const char*): Command name
+ *
+ * Returns:
+ *   (int): 1 if it is, else 0
+ */
+int groupIsShellBuiltin(const char* name){
+  int index;
+
+  for(index = 0; groupShellBuiltins != NULL &&
+      groupShellBuiltins[index] != NULL; index++){
+    if(!strcmp(groupShellBuiltins[index], name)){
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Check whether a command may be exec'd in place: its redirections need
+ *   no shell thread (codec) after the exec
+ *
+ * Args:
+ *   redirs (RedirList_t*): fd operations from parseRedirs
+ *
+ * Returns:
+ *   (int): 1 if it may, else 0
+ */
+int groupCanExec(RedirList_t* redirs){
+  int index;
+
+  for(index = 0; index < redirs->numOps; index++){
+    if(redirs->ops[index].codec != REDIR_PLAIN){
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Purpose:
+ *   Run one stage in the current process, which is a forked subshell or
+ *   stage, never the shell itself. Simple commands are forked and waited
+ *   for, or with mayExec exec'd in place; plugin builtins and cd run
+ *   here. A subshell forks unless mayExec lets it take this process; a
+ *   brace group runs here with its fds saved and restored.
+ *
+ * Args:
+ *   cmd (GroupCmd_t*): Stage
+ *   mayExec     (int): 1 if nothing runs in this process after the stage
+ *
+ * Returns:
+ *   (int): Exit code
+ */
+int groupRunCmd(GroupCmd_t* cmd, int mayExec){
+  const int SYNTAX = 2;
+
+  int saved[2 * GROUP_MAX_SAVED];
+  int numSaved;
+  int numWords = 0;
+  int status = 1;
+  int pid;
+  char** argv = NULL;
+  RedirList_t redirs;
+  YashBuiltin_t* builtin = NULL;
+  YashZpipe_t* zpipes = NULL;
+
+  while(cmd->words[numWords] != NULL){
+    numWords++;
+  }
+  argv = (char**)malloc((numWords + 1) * sizeof(char*));
+  if(parseRedirs(cmd->words, argv, &redirs) < 0){
+    free(argv);
+    return SYNTAX;
+  }
+  if(cmd->type != GROUP_SIMPLE && argv[0] != NULL){
+    fprintf(stderr, "yash: syntax error near `%s'\n", argv[0]);
+    free(argv);
+    return SYNTAX;
+  }
+
+  if(cmd->type == GROUP_SUBSHELL && !mayExec){
+    fflush(stdout);
+    fflush(stderr);
+    if((pid = fork()) == 0){
+      _exit(groupRunCmd(cmd, 1));
+    }
+    free(argv);
+    return pid < 0 ? 1 : groupWait(pid);
+  }
+  if(cmd->type != GROUP_SIMPLE){
+    // A subshell that owns this process, or a brace group
+    if(zpipeRedirs(&redirs, &zpipes) == 0 &&
+       (numSaved = groupRedirect(&redirs, saved)) >= 0){
+      status = groupRunList(cmd->body, mayExec && zpipes == NULL);
+      groupRestore(saved, numSaved);
+    }
+    closeRedirs(&redirs);
+    zpipeFinish(zpipes, 1);
+    free(argv);
+    return status;
+  }
+
+  if(argv[0] == NULL){
+    // Only redirections: create or check the files
+    status = (openRedirs(&redirs) < 0);
+    closeRedirs(&redirs);
+  }
+  else if(!strcmp(argv[0], "cd")){
+    status = groupCd(argv);
+  }
+  else if((builtin = pluginFind(argv[0])) == NULL &&
+          groupIsShellBuiltin(argv[0])){
+    fprintf(stderr, "yash: %s: shell builtin, not available in a subshell "
+            "or a pipeline group\n", argv[0]);
+    closeRedirs(&redirs);
+  }
+  else if(builtin == NULL && mayExec && groupCanExec(&redirs)){
+    redirectFile(&redirs);
+    execvp(argv[0], argv);
+    fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+    _exit(GROUP_EXEC_FAIL);
+  }
+  else if(zpipeRedirs(&redirs, &zpipes) < 0){
+    closeRedirs(&redirs);
+  }
+  else if(builtin != NULL){
+    status = pluginRun(builtin, argv, &redirs);
+  }
+  else{
+    fflush(stdout);
+    fflush(stderr);
+    if((pid = fork()) == 0){
+      redirectFile(&redirs);
+      execvp(argv[0], argv);
+      fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+      _exit(GROUP_EXEC_FAIL);
+    }
+    closeRedirs(&redirs);
+    status = pid < 0 ? 1 : groupWait(pid);
+  }
+  zpipeFinish(zpipes, 1);
+  free(argv);
+
+  return status;
+}
+
+/**
+ * Purpose:
+ *   Run a pipeline inside a subshell: each stage is forked into the
+ *   subshell's process group, and the last stage's code is returned
+ *
+ * Args:
+ *   pipe (GroupPipe_t*): Pipeline
+ *   mayExec       (int): 1 if nothing runs in this process afterwards
+ *
+ * Returns:
+ *   (int): Exit code
+ */
+int groupRunPipe(GroupPipe_t* pipe, int mayExec){
+  int pfd[2] = {-1, -1};
+  int* pids = NULL;
+  int prevIn = -1;
+  int status = 1;
+  int last;
+  int index;
+
+  if(pipe->numCmds == 1){
+    return groupRunCmd(pipe->cmds[0], mayExec);
+  }
+
+  pids = (int*)malloc(pipe->numCmds * sizeof(int));
+  for(index = 0; index < pipe->numCmds; index++){
+    pids[index] = -1;
+    last = (index == pipe->numCmds - 1);
+    if(!last && pipe2(pfd, O_CLOEXEC) < 0){
+      fprintf(stderr, "yash: pipe: %s\n", strerror(errno));
+      break;
+    }
+    groupSpawn(pipe->cmds[index], prevIn, last ? -1 : pfd[1],
+               last ? -1 : pfd[0], -1, &pids[index]);
+    if(prevIn >= 0){
+      close(prevIn);
+    }
+    if(!last){
+      close(pfd[1]);
+      prevIn = pfd[0];
+    }
+  }
+  if(index < pipe->numCmds && prevIn >= 0){
+    close(prevIn);
+  }
+
+  for(index = 0; index < pipe->numCmds; index++){
+    if(pids[index] > 0){
+      status = groupWait(pids[index]);
+    }
+    else{
+      status = 1;
+    }
+  }
+  free(pids);
+
+  return status;
+}
+
+/**
+ * Purpose:
+ *   Run a list inside a subshell. && and || skip a pipeline on the code of
+ *   the one before; & forks it without waiting. The last pipeline may exec
+ *   in place when mayExec is set.
+ *
+ * Args:
+ *   list (GroupList_t*): List
+ *   mayExec       (int): 1 if nothing runs in this process afterwards
+ *
+ * Returns:
+ *   (int): Code of the last pipeline run
+ */
+int groupRunList(GroupList_t* list, int mayExec){
+  GroupPipe_t* pipe = NULL;
+  int status = 0;
+  int prevSep = GROUP_SEQ;
+  int pid;
+  int index;
+
+  for(index = 0; index < list->numPipes; index++){
+    pipe = list->pipes[index];
+    if(index > 0){
+      prevSep = list->pipes[index - 1]->sep;
+    }
+    if((prevSep == GROUP_AND && status != 0) ||
+       (prevSep == GROUP_OR && status == 0)){
+      continue;
+    }
+
+    if(pipe->sep == GROUP_BACK){
+      fflush(stdout);
+      fflush(stderr);
+      if((pid = fork()) == 0){
+        _exit(groupRunPipe(pipe, 1));
+      }
+      status = (pid < 0);
+      continue;
+    }
+    status = groupRunPipe(pipe, mayExec && index == list->numPipes - 1);
+  }
+
+  return status;
+}
@@ -0,0 +1,86 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "libyash_internal.h"
+
+// Command grouping: ( list ) runs the list in a forked subshell and
+// { list; } runs it in the current process, and either takes redirections
+// and can be a pipeline stage, as in "{ a; b; } > out" or
+// "(cd dir && make) | tee log". Inside a group, commands are separated by
+// ;, &, && and ||. A line is parsed into a tree once; a subshell is a fork
+// that walks its part of the tree, with no exec of the shell and no parse.
+// The last command a forked subshell runs is exec'd in place of it, so
+// "(cmd) > out" costs a single process.
+
+/**
+ * Group command kinds
+ */
+enum{
+  GROUP_SIMPLE,
+  GROUP_SUBSHELL,
+  GROUP_BRACE
+};
+
+/**
+ * What ends a pipeline in a list
+ */
+enum{
+  GROUP_SEQ,
+  GROUP_AND,
+  GROUP_OR,
+  GROUP_BACK
+};
+
+#define GROUP_MAX_SAVED (2 * MAX_REDIRS)
+
+// NULL-terminated names of the shell's own builtins, which a forked group
+// reports instead of trying to exec; set by the shell at startup
+extern const char** groupShellBuiltins;
+
+struct GroupList_t;
+
+/**
+ * GroupCmd_t struct, one pipeline stage: a simple command with its words
+ * (redirections included, globs expanded), or a group with its body and
+ * the redirection words after the closing ) or }
+ */
+typedef struct GroupCmd_t{
+  int type;
+  char** words;
+  struct GroupList_t* body;
+}GroupCmd_t;
+
+/**
+ * GroupPipe_t struct, a pipeline of one or more stages and the operator
+ * after it; text is its source for the job table
+ */
+typedef struct GroupPipe_t{
+  GroupCmd_t** cmds;
+  int numCmds;
+  int sep;
+  char* text;
+}GroupPipe_t;
+
+/**
+ * GroupList_t struct, pipelines run one after another
+ */
+typedef struct GroupList_t{
+  GroupPipe_t** pipes;
+  int numPipes;
+}GroupList_t;
+
+int groupDetect(const char* line);
+GroupList_t* groupParse(const char* line);
+void groupFree(GroupList_t* list);
+int groupRedirect(RedirList_t* redirs, int* saved);
+void groupRestore(int* saved, int numSaved);
+int groupCd(char** argv);
+int groupIsShellBuiltin(const char* name);
+int groupSpawn(GroupCmd_t* cmd, int inFd, int outFd, int closeFd, int pgid,
+               int* pid);
+int groupRunCmd(GroupCmd_t* cmd, int mayExec);
+int groupRunPipe(GroupPipe_t* pipe, int mayExec);
+int groupRunList(GroupList_t* list, int mayExec);
+int groupExitCode(int status);
+
+#endif
@@ -0,0 +1,952 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "history.h"
+#include "libyash_internal.h"
+#include "memstat.h"
+
+#define HIST_MAGIC "YASHHIX1"
+#define HIST_QUERY_MAX 256
+#define HIST_RADIX_BITS 12
+#define HIST_MAX_GRAMS 4
+
+/**
+ * HistHeader_t struct, start of history.idx. It is followed by
+ * uint64_t offsets[numEntries + 1], HistGram_t grams[numGrams] sorted by
+ * gram, and uint32_t postings[numPostings] with each gram's line ids in
+ * ascending order.
+ */
+typedef struct HistHeader_t{
+  char magic[8];
+  uint64_t logBytes;
+  uint64_t numEntries;
+  uint64_t numGrams;
+  uint64_t numPostings;
+}HistHeader_t;
+
+/**
+ * HistGram_t struct, one trigram and its slice of the postings
+ */
+typedef struct HistGram_t{
+  uint32_t gram;
+  uint32_t count;
+  uint64_t start;
+}HistGram_t;
+
+/**
+ * YashHist_t struct, an opened history
+ */
+struct YashHist_t{
+  char* dir;
+  int logFd;
+  char* log;
+  size_t logSize;
+
+  void* idx;
+  size_t idxSize;
+  const uint64_t* offsets;
+  const HistGram_t* grams;
+  const uint32_t* postings;
+  long numGrams;
+  long numIndexed;
+
+  uint64_t* tail;
+  long numTail;
+  long tailCap;
+  uint64_t scanned;
+};
+
+YashHist_t* rlHist = NULL;
+
+/**
+ * Purpose:
+ *   Grow the log mapping to the current size of the file
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   None
+ */
+void histMapLog(YashHist_t* hist){
+  struct stat st;
+  char* map = NULL;
+
+  if(fstat(hist->logFd, &st) == 0 && (size_t)st.st_size > hist->logSize){
+    if(hist->log == NULL){
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist->logFd, 0);
+    }
+    else{
+      map = mremap(hist->log, hist->logSize, st.st_size, MREMAP_MAYMOVE);
+    }
+    if(map != MAP_FAILED){
+      hist->log = map;
+      hist->logSize = st.st_size;
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Map log bytes appended since the last call and split complete lines
+ *   past the indexed prefix into the tail
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   None
+ */
+void histRefresh(YashHist_t* hist){
+  char* nl = NULL;
+
+  histMapLog(hist);
+
+  // A line still being written has no newline yet; pick it up next time
+  while(hist->scanned < hist->logSize &&
+        (nl = memchr(hist->log + hist->scanned, '\n',
+                     hist->logSize - hist->scanned)) != NULL){
+    if(hist->numTail + 2 > hist->tailCap){
+      hist->tailCap = hist->tailCap ? 2 * hist->tailCap : 256;
+      hist->tail = (uint64_t*)memRealloc(MEM_HISTORY, hist->tail,
+                                         hist->tailCap * sizeof(uint64_t));
+    }
+    hist->tail[hist->numTail++] = hist->scanned;
+    hist->scanned = nl - hist->log + 1;
+    hist->tail[hist->numTail] = hist->scanned;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Drop the mapped index; every line becomes part of the tail
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   None
+ */
+void histUnloadIndex(YashHist_t* hist){
+  if(hist->idx != NULL){
+    munmap(hist->idx, hist->idxSize);
+  }
+  hist->idx = NULL;
+  hist->idxSize = 0;
+  hist->offsets = NULL;
+  hist->grams = NULL;
+  hist->postings = NULL;
+  hist->numGrams = 0;
+  hist->numIndexed = 0;
+  hist->numTail = 0;
+  hist->scanned = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Map history.idx if it is well formed and describes a prefix of the
+ *   mapped log, then split the rest of the log into the tail
+ *
+ * Args:
+ *   hist (YashHist_t*): History with the log mapped
+ *
+ * Returns:
+ *   None
+ */
+void histLoadIndex(YashHist_t* hist){
+  const HistHeader_t* hdr = NULL;
+  char path[PATH_MAX];
+  struct stat st;
+  uint64_t need;
+  void* map = NULL;
+  int fd;
+
+  histUnloadIndex(hist);
+
+  snprintf(path, sizeof(path), "%s/history.idx", hist->dir);
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0){
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(HistHeader_t)){
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+  }
+  if(map == NULL || map == MAP_FAILED){
+    histRefresh(hist);
+    return;
+  }
+
+  hdr = (const HistHeader_t*)map;
+  need = sizeof(HistHeader_t) + (hdr->numEntries + 1) * sizeof(uint64_t) +
+         hdr->numGrams * sizeof(HistGram_t) +
+         hdr->numPostings * sizeof(uint32_t);
+  if(memcmp(hdr->magic, HIST_MAGIC, sizeof(hdr->magic)) ||
+     need != (uint64_t)st.st_size || hdr->logBytes > hist->logSize ||
+     (hdr->logBytes > 0 && hist->log[hdr->logBytes - 1] != '\n')){
+    // Stale or foreign; ignore it until the next rebuild
+    munmap(map, st.st_size);
+    histRefresh(hist);
+    return;
+  }
+
+  hist->idx = map;
+  hist->idxSize = st.st_size;
+  hist->offsets = (const uint64_t*)(hdr + 1);
+  hist->grams = (const HistGram_t*)(hist->offsets + hdr->numEntries + 1);
+  hist->postings = (const uint32_t*)(hist->grams + hdr->numGrams);
+  hist->numGrams = hdr->numGrams;
+  hist->numIndexed = hdr->numEntries;
+  hist->scanned = hdr->logBytes;
+  histRefresh(hist);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Open a history directory, creating it if needed
+ *
+ * Args:
+ *   dir (const char*): Directory path
+ *
+ * Returns:
+ *   (YashHist_t*): History, or NULL with errno set
+ */
+YashHist_t* histOpen(const char* dir){
+  YashHist_t* hist = NULL;
+  char path[PATH_MAX];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/history.log", dir);
+  if(makeDirs(dir) < 0 ||
+     (fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0){
+    return NULL;
+  }
+
+  hist = (YashHist_t*)memCalloc(MEM_HISTORY, 1, sizeof(YashHist_t));
+  hist->dir = memStrdup(MEM_HISTORY, dir);
+  hist->logFd = fd;
+  histMapLog(hist);
+  histLoadIndex(hist);
+
+  if(hist->numTail > HIST_REINDEX_MAX){
+    histReindex(hist);
+  }
+
+  return hist;
+}
+
+/**
+ * Purpose:
+ *   Close a history, reindexing first if the tail has grown
+ *
+ * Args:
+ *   hist (YashHist_t*): History, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void histClose(YashHist_t* hist){
+  if(hist == NULL){
+    return;
+  }
+
+  if(rlHist == hist){
+    rlHist = NULL;
+  }
+  histRefresh(hist);
+  if(hist->numTail >= HIST_REINDEX_MIN){
+    histReindex(hist);
+  }
+
+  histUnloadIndex(hist);
+  if(hist->log != NULL){
+    munmap(hist->log, hist->logSize);
+  }
+  close(hist->logFd);
+  memFree(MEM_HISTORY, hist->tail);
+  memFree(MEM_HISTORY, hist->dir);
+  memFree(MEM_HISTORY, hist);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Number of complete lines in the log, including other shells' lines
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   (long): Line count; ids run from 0 to count - 1, oldest first
+ */
+long histCount(YashHist_t* hist){
+  histRefresh(hist);
+
+  return hist->numIndexed + hist->numTail;
+}
+
+/**
+ * Purpose:
+ *   Text of one line. It points into the mapped log and is only valid
+ *   until the next call on the history.
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *   id         (long): Line id
+ *   len     (size_t*): Set to the length, without the newline
+ *
+ * Returns:
+ *   (const char*): Line text, not NUL terminated, or NULL for a bad id
+ */
+const char* histEntry(YashHist_t* hist, long id, size_t* len){
+  const uint64_t* offsets = hist->offsets;
+
+  if(id < 0 || id >= hist->numIndexed + hist->numTail){
+    return NULL;
+  }
+  if(id >= hist->numIndexed){
+    offsets = hist->tail;
+    id -= hist->numIndexed;
+  }
+  *len = offsets[id + 1] - offsets[id] - 1;
+
+  return hist->log + offsets[id];
+}
+
+/**
+ * Purpose:
+ *   Append a line. Empty lines and repeats of the newest line are skipped.
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *   line (const char*): Command line, without a newline
+ *
+ * Returns:
+ *   (int): 0 on success or skip, -1 with errno set on a write error
+ */
+int histAdd(YashHist_t* hist, const char* line){
+  const size_t lineLen = strlen(line);
+
+  const char* last = NULL;
+  char* buf = NULL;
+  size_t lastLen;
+  ssize_t ret;
+  long count;
+
+  if(lineLen == 0 || memchr(line, '\n', lineLen) != NULL){
+    return 0;
+  }
+  count = histCount(hist);
+  if((last = histEntry(hist, count - 1, &lastLen)) != NULL &&
+     lastLen == lineLen && !memcmp(last, line, lineLen)){
+    return 0;
+  }
+
+  // One write per line so concurrent shells never interleave within it
+  buf = (char*)memAlloc(MEM_HISTORY, lineLen + 1);
+  memcpy(buf, line, lineLen);
+  buf[lineLen] = '\n';
+  ret = write(hist->logFd, buf, lineLen + 1);
+  memFree(MEM_HISTORY, buf);
+  if(ret != (ssize_t)(lineLen + 1)){
+    return -1;
+  }
+  histRefresh(hist);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Pack three bytes into a trigram key
+ *
+ * Args:
+ *   text (const char*): At least three bytes
+ *
+ * Returns:
+ *   (uint32_t): 24-bit key
+ */
+uint32_t histGram(const char* text){
+  return ((uint32_t)(unsigned char)text[0] << 16) |
+         ((uint32_t)(unsigned char)text[1] << 8) | (unsigned char)text[2];
+}
+
+/**
+ * Purpose:
+ *   Find a trigram in the mapped index
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *   gram   (uint32_t): Trigram key
+ *
+ * Returns:
+ *   (const HistGram_t*): Entry, or NULL if no indexed line has it
+ */
+const HistGram_t* histFindGram(YashHist_t* hist, uint32_t gram){
+  long low = 0;
+  long high = hist->numGrams;
+  long mid;
+
+  while(low < high){
+    mid = low + (high - low) / 2;
+    if(hist->grams[mid].gram < gram){
+      low = mid + 1;
+    }
+    else{
+      high = mid;
+    }
+  }
+  if(low < hist->numGrams && hist->grams[low].gram == gram){
+    return &hist->grams[low];
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   First position in an ascending id list whose id is not below a bound
+ *
+ * Args:
+ *   list (const uint32_t*): Ascending ids
+ *   count          (long): Number of ids to consider
+ *   id             (long): Bound
+ *
+ * Returns:
+ *   (long): Position, count if every id is below the bound
+ */
+long histLowerBound(const uint32_t* list, long count, long id){
+  long low = 0;
+  long high = count;
+  long mid;
+
+  while(low < high){
+    mid = low + (high - low) / 2;
+    if((long)list[mid] < id){
+      low = mid + 1;
+    }
+    else{
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+/**
+ * Purpose:
+ *   Check one line against a query
+ *
+ * Args:
+ *   hist  (YashHist_t*): History
+ *   id          (long): Line id
+ *   query (const char*): Text to find
+ *   queryLen  (size_t): Length of query
+ *   prefix       (int): Nonzero to match only at the start
+ *
+ * Returns:
+ *   (int): 1 on a match, 0 if not
+ */
+int histMatch(YashHist_t* hist, long id, const char* query, size_t queryLen,
+              int prefix){
+  const char* text = NULL;
+  size_t len = 0;
+
+  if((text = histEntry(hist, id, &len)) == NULL){
+    return 0;
+  }
+  if(prefix){
+    return len >= queryLen && !memcmp(text, query, queryLen);
+  }
+
+  return memmem(text, len, query, queryLen) != NULL;
+}
+
+/**
+ * Purpose:
+ *   Newest line older than a given id that contains (or starts with) a
+ *   query. Indexed lines are narrowed to those holding the query's rarest
+ *   trigrams first; the tail and queries under three bytes are scanned.
+ *
+ * Args:
+ *   hist  (YashHist_t*): History
+ *   query (const char*): Text to find
+ *   prefix       (int): Nonzero to match only at the start of a line
+ *   before      (long): Only consider ids below this; negative or past the
+ *                       end means all lines
+ *
+ * Returns:
+ *   (long): Line id, or -1 if nothing matches
+ */
+long histSearch(YashHist_t* hist, const char* query, int prefix, long before){
+  const size_t queryLen = strlen(query);
+
+  const HistGram_t* pick[HIST_MAX_GRAMS];
+  const HistGram_t* gram = NULL;
+  const uint32_t* list = NULL;
+  long high[HIST_MAX_GRAMS];
+  long count = histCount(hist);
+  long limit;
+  long bound;
+  long id;
+  size_t pos;
+  int numPick = 0;
+  int index;
+
+  if(before < 0 || before > count){
+    before = count;
+  }
+
+  for(id = before - 1; id >= hist->numIndexed; id--){
+    if(histMatch(hist, id, query, queryLen, prefix)){
+      return id;
+    }
+  }
+
+  limit = before < hist->numIndexed ? before : hist->numIndexed;
+  if(queryLen < 3){
+    for(id = limit - 1; id >= 0; id--){
+      if(histMatch(hist, id, query, queryLen, prefix)){
+        return id;
+      }
+    }
+    return -1;
+  }
+
+  // Candidates come from the rarest trigram and must be in the next
+  // rarest few as well before the text is compared
+  for(pos = 0; pos + 3 <= queryLen; pos++){
+    if((gram = histFindGram(hist, histGram(query + pos))) == NULL){
+      return -1;
+    }
+    for(index = 0; index < numPick && pick[index] != gram; index++);
+    if(index < numPick){
+      continue;
+    }
+    for(index = numPick; index > 0 && pick[index - 1]->count > gram->count;
+        index--){
+      if(index < HIST_MAX_GRAMS){
+        pick[index] = pick[index - 1];
+      }
+    }
+    if(index < HIST_MAX_GRAMS){
+      pick[index] = gram;
+      numPick += (numPick < HIST_MAX_GRAMS);
+    }
+  }
+
+  for(index = 0; index < numPick; index++){
+    high[index] = histLowerBound(hist->postings + pick[index]->start,
+                                 pick[index]->count, limit);
+  }
+  for(pos = high[0]; pos > 0; pos--){
+    id = hist->postings[pick[0]->start + pos - 1];
+    for(index = 1; index < numPick; index++){
+      // Ids only go down, so each list's bound only shrinks
+      list = hist->postings + pick[index]->start;
+      bound = high[index];
+      high[index] = histLowerBound(list, bound, id);
+      if(high[index] == bound || list[high[index]] != (uint32_t)id){
+        break;
+      }
+    }
+    if(index == numPick && histMatch(hist, id, query, queryLen, prefix)){
+      return id;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Purpose:
+ *   Stable sort of packed (gram << 32 | id) pairs by gram, so ids stay
+ *   ascending within each gram
+ *
+ * Args:
+ *   pairs (uint64_t*): Pairs to sort
+ *   tmp   (uint64_t*): Scratch space of the same size
+ *   num      (size_t): Number of pairs
+ *
+ * Returns:
+ *   None
+ */
+void histSortPairs(uint64_t* pairs, uint64_t* tmp, size_t num){
+  const int BUCKETS = 1 << HIST_RADIX_BITS;
+
+  size_t* counts = NULL;
+  uint64_t* swap = NULL;
+  size_t sum;
+  size_t next;
+  size_t index;
+  int shift;
+  int bucket;
+
+  counts = (size_t*)memAlloc(MEM_HISTORY, BUCKETS * sizeof(size_t));
+  for(shift = 32; shift < 56; shift += HIST_RADIX_BITS){
+    memset(counts, 0, BUCKETS * sizeof(size_t));
+    for(index = 0; index < num; index++){
+      counts[(pairs[index] >> shift) & (BUCKETS - 1)]++;
+    }
+    sum = 0;
+    for(bucket = 0; bucket < BUCKETS; bucket++){
+      next = sum + counts[bucket];
+      counts[bucket] = sum;
+      sum = next;
+    }
+    for(index = 0; index < num; index++){
+      tmp[counts[(pairs[index] >> shift) & (BUCKETS - 1)]++] = pairs[index];
+    }
+    swap = pairs;
+    pairs = tmp;
+    tmp = swap;
+  }
+  memFree(MEM_HISTORY, counts);
+
+  // An even number of passes leaves the result in the caller's array
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Rebuild history.idx over every complete line of the log and map it.
+ *   The new index is written to a temporary file and renamed into place,
+ *   so shells reading the old one are not disturbed. Skipped if another
+ *   shell is already rebuilding.
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   (int): 0 on success or skip, -1 with errno set on failure
+ */
+int histReindex(YashHist_t* hist){
+  HistHeader_t* hdr = NULL;
+  HistGram_t* grams = NULL;
+  uint64_t* offsets = NULL;
+  uint32_t* postings = NULL;
+  uint64_t* pairs = NULL;
+  uint64_t* tmp = NULL;
+  const char* text = NULL;
+  char lockPath[PATH_MAX];
+  char tmpPath[PATH_MAX];
+  char path[PATH_MAX];
+  void* map = NULL;
+  size_t numPairs = 0;
+  size_t numGrams = 0;
+  size_t numPostings = 0;
+  size_t size;
+  size_t len;
+  size_t index;
+  size_t pos;
+  long numEntries;
+  long id;
+  int lockFd;
+  int fd;
+  int ret = -1;
+
+  snprintf(lockPath, sizeof(lockPath), "%s/history.lock", hist->dir);
+  if((lockFd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0){
+    return -1;
+  }
+  if(flock(lockFd, LOCK_EX | LOCK_NB) < 0){
+    close(lockFd);
+    return errno == EWOULDBLOCK ? 0 : -1;
+  }
+
+  numEntries = histCount(hist);
+  for(id = 0; id < numEntries; id++){
+    histEntry(hist, id, &len);
+    numPairs += len > 2 ? len - 2 : 0;
+  }
+  pairs = (uint64_t*)memAlloc(MEM_HISTORY,
+                              (numPairs + 1) * sizeof(uint64_t));
+  tmp = (uint64_t*)memAlloc(MEM_HISTORY, (numPairs + 1) * sizeof(uint64_t));
+  numPairs = 0;
+  for(id = 0; id < numEntries; id++){
+    text = histEntry(hist, id, &len);
+    for(pos = 0; pos + 3 <= len; pos++){
+      pairs[numPairs++] = ((uint64_t)histGram(text + pos) << 32) |
+                          (uint64_t)id;
+    }
+  }
+  histSortPairs(pairs, tmp, numPairs);
+
+  // Repeats of a gram within one line are adjacent after the sort
+  for(index = 0; index < numPairs; index++){
+    if(index == 0 || pairs[index] != pairs[index - 1]){
+      numPostings++;
+      if(index == 0 || (pairs[index] >> 32) != (pairs[index - 1] >> 32)){
+        numGrams++;
+      }
+    }
+  }
+
+  size = sizeof(HistHeader_t) + (numEntries + 1) * sizeof(uint64_t) +
+         numGrams * sizeof(HistGram_t) + numPostings * sizeof(uint32_t);
+  snprintf(tmpPath, sizeof(tmpPath), "%s/history.idx.XXXXXX", hist->dir);
+  if((fd = mkostemp(tmpPath, O_CLOEXEC)) < 0){
+    goto out;
+  }
+  if(ftruncate(fd, size) < 0 ||
+     (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+       MAP_FAILED){
+    close(fd);
+    unlink(tmpPath);
+    goto out;
+  }
+  close(fd);
+
+  hdr = (HistHeader_t*)map;
+  offsets = (uint64_t*)(hdr + 1);
+  grams = (HistGram_t*)(offsets + numEntries + 1);
+  postings = (uint32_t*)(grams + numGrams);
+  memcpy(hdr->magic, HIST_MAGIC, sizeof(hdr->magic));
+  hdr->numEntries = numEntries;
+  hdr->numGrams = numGrams;
+  hdr->numPostings = numPostings;
+  for(id = 0; id < numEntries; id++){
+    offsets[id] = histEntry(hist, id, &len) - hist->log;
+  }
+  offsets[numEntries] = numEntries > 0 ? offsets[numEntries - 1] + len + 1
+                                       : 0;
+  hdr->logBytes = offsets[numEntries];
+
+  numGrams = 0;
+  numPostings = 0;
+  for(index = 0; index < numPairs; index++){
+    if(index > 0 && pairs[index] == pairs[index - 1]){
+      continue;
+    }
+    if(index == 0 || (pairs[index] >> 32) != (pairs[index - 1] >> 32)){
+      grams[numGrams].gram = pairs[index] >> 32;
+      grams[numGrams].count = 0;
+      grams[numGrams].start = numPostings;
+      numGrams++;
+    }
+    grams[numGrams - 1].count++;
+    postings[numPostings++] = (uint32_t)pairs[index];
+  }
+  munmap(map, size);
+
+  snprintf(path, sizeof(path), "%s/history.idx", hist->dir);
+  if(rename(tmpPath, path) < 0){
+    unlink(tmpPath);
+    goto out;
+  }
+  ret = 0;
+
+out:
+  memFree(MEM_HISTORY, pairs);
+  memFree(MEM_HISTORY, tmp);
+  close(lockFd);
+  if(ret == 0){
+    histLoadIndex(hist);
+  }
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   Show the search prompt and put a line in the readline buffer
+ *
+ * Args:
+ *   query (const char*): Current query
+ *   failed       (int): Nonzero if the query has no match
+ *   text  (const char*): Line to show
+ *   len       (size_t): Length of text
+ *
+ * Returns:
+ *   None
+ */
+void histShowMatch(const char* query, int failed, const char* text,
+                   size_t len){
+  char* line = memStrndup(MEM_HISTORY, text, len);
+  char* at = NULL;
+
+  rl_replace_line(line, 0);
+  at = (*query != '\0') ? strstr(line, query) : NULL;
+  rl_point = at != NULL ? at - line : (int)len;
+  memFree(MEM_HISTORY, line);
+  rl_message("(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Compare the text of two lines
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *   id1        (long): Line id
+ *   id2        (long): Line id
+ *
+ * Returns:
+ *   (int): 1 if the lines are equal, 0 if not
+ */
+int histSameLine(YashHist_t* hist, long id1, long id2){
+  const char* text1 = NULL;
+  const char* text2 = NULL;
+  size_t len1 = 0;
+  size_t len2 = 0;
+
+  text1 = histEntry(hist, id1, &len1);
+  text2 = histEntry(hist, id2, &len2);
+  if(text1 == NULL || text2 == NULL){
+    return 0;
+  }
+
+  return len1 == len2 && !memcmp(text1, text2, len1);
+}
+
+/**
+ * Purpose:
+ *   Incremental reverse search bound to C-r, run against the persistent
+ *   history instead of readline's list. C-r steps to older matches, C-g
+ *   restores the original line and any other key ends the search and is
+ *   then handled as usual.
+ *
+ * Args:
+ *   count (int): Readline numeric argument, unused
+ *   key   (int): Key that invoked the search
+ *
+ * Returns:
+ *   (int): 0
+ */
+int histIsearch(int count, int key){
+  const int CTRL_G = 7;
+  const int CTRL_H = 8;
+  const int CTRL_R = 18;
+  const int DELETE = 127;
+
+  char query[HIST_QUERY_MAX];
+  char* saved = memStrdup(MEM_HISTORY, rl_line_buffer);
+  const char* text = NULL;
+  size_t queryLen = 0;
+  size_t len;
+  long found = -1;
+  long next;
+  int savedPoint = rl_point;
+  int failed = 0;
+  int c;
+
+  if(rlHist == NULL){
+    memFree(MEM_HISTORY, saved);
+    return 0;
+  }
+
+  query[0] = '\0';
+  rl_save_prompt();
+  histShowMatch(query, 0, saved, strlen(saved));
+
+  while(1){
+    if((c = rl_read_key()) < 0 || c == CTRL_G){
+      rl_replace_line(saved, 0);
+      rl_point = savedPoint;
+      break;
+    }
+
+    if(c == CTRL_R && queryLen > 0){
+      // Skip older lines identical to the one shown
+      next = found;
+      do{
+        next = (next == 0) ? -1 : histSearch(rlHist, query, 0, next);
+      }while(next >= 0 && found >= 0 && histSameLine(rlHist, next, found));
+      failed = (next < 0);
+      if(next >= 0){
+        found = next;
+      }
+    }
+    else if(c == DELETE || c == CTRL_H){
+      if(queryLen > 0){
+        query[--queryLen] = '\0';
+      }
+      found = (queryLen > 0) ? histSearch(rlHist, query, 0, -1) : -1;
+      failed = (queryLen > 0 && found < 0);
+    }
+    else if(c >= ' ' && queryLen + 1 < HIST_QUERY_MAX){
+      query[queryLen++] = c;
+      query[queryLen] = '\0';
+      next = histSearch(rlHist, query, 0, found >= 0 ? found + 1 : -1);
+      failed = (next < 0);
+      if(next >= 0){
+        found = next;
+      }
+    }
+    else{
+      // Accept the line shown and let readline handle the key
+      rl_execute_next(c);
+      break;
+    }
+
+    if(found >= 0 && (text = histEntry(rlHist, found, &len)) != NULL){
+      histShowMatch(query, failed, text, len);
+    }
+    else{
+      histShowMatch(query, failed, saved, strlen(saved));
+    }
+  }
+
+  rl_restore_prompt();
+  rl_clear_message();
+  memFree(MEM_HISTORY, saved);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Bind C-r to histIsearch and load the newest HIST_PRELOAD lines into
+ *   readline's list for the arrow keys
+ *
+ * Args:
+ *   hist (YashHist_t*): History
+ *
+ * Returns:
+ *   None
+ */
+void histReadlineInit(YashHist_t* hist){
+  const int CTRL_R = 18;
+
+  const char* text = NULL;
+  char* line = NULL;
+  size_t len;
+  long count = histCount(hist);
+  long id;
+
+  rlHist = hist;
+  rl_bind_key(CTRL_R, histIsearch);
+
+  for(id = count > HIST_PRELOAD ? count - HIST_PRELOAD : 0; id < count; id++){
+    text = histEntry(hist, id, &len);
+    line = memStrndup(MEM_HISTORY, text, len);
+    add_history(line);
+    memFree(MEM_HISTORY, line);
+  }
+
+  return;
+}
@@ -0,0 +1,34 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+// Persistent command history. A directory holds
+//
+//   history.log    one command per line, only ever appended to
+//   history.idx    index of a prefix of the log: line offsets and a
+//                  trigram -> line id posting table
+//   history.lock   flock'd while the index is rebuilt
+//
+// Both files are mmap'd as they are; nothing is parsed at startup. Shells
+// append whole lines with single O_APPEND writes, so several can share a
+// log. Lines past the indexed prefix (the tail) are found with memchr and
+// searched linearly; the index is rebuilt into a new file and renamed over
+// the old one once the tail grows.
+
+#define HIST_REINDEX_MIN 256
+#define HIST_REINDEX_MAX 8192
+#define HIST_PRELOAD 1000
+
+typedef struct YashHist_t YashHist_t;
+
+YashHist_t* histOpen(const char* dir);
+void histClose(YashHist_t* hist);
+int histAdd(YashHist_t* hist, const char* line);
+long histCount(YashHist_t* hist);
+const char* histEntry(YashHist_t* hist, long id, size_t* len);
+long histSearch(YashHist_t* hist, const char* query, int prefix, long before);
+int histReindex(YashHist_t* hist);
+void histReadlineInit(YashHist_t* hist);
+
+#endif
@@ -0,0 +1,1616 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "libyash_internal.h"
+
+/** 
+ * Purpose:
+ *   Verify that tokens in input line do not exceed maximum token length
+ * 
+ * Args:
+ *   input      (char*): Input C-string
+ *   maxLineLen   (int): Maximum length of input
+ *   maxTokenLen  (int): Maximum length of tokens
+ * 
+ * Returns:
+ *   (int): Returns 1 if all tokens are within maximum limit
+ */
+int checkTokens(char* input, int maxLineLen, int maxTokenLen){
+  const int VALID = 1;
+  const int INVALID = 0;
+  const char SPACE_CHAR = ' ';
+
+  int tokenLen = 0;
+  int k = 0;
+
+  while(k < strlen(input)){
+    if(tokenLen >= maxTokenLen){
+      return INVALID;
+    }
+    else if((tokenLen < maxTokenLen) && (input[k] == SPACE_CHAR)){
+      tokenLen = 0;
+    }
+    else{
+      tokenLen++;
+    }
+    k++;
+  }
+
+  return VALID;
+}
+
+/**
+ * Purpose:
+ *   Read in a line of input from stdin and verify that input line length and
+ *   token length is valid
+ * 
+ * Args:
+ *   input      (char*): Input C-string
+ * 
+ * Returns:
+ *   (int): Returns 1 if string is valid, 0 if string is invalid
+ */
+int checkInput(char* input){
+  // TODO: Protect against these cases < ls, > ls, 2> ls, | ls, & ls
+  // TODO: Add function to ensure file redir goes to a file e.g.:# cat hello.txt >
+  // TODO: Add function to ensure pipe goes to a valid command e.g.:# ls |
+  // TODO: Add input verification to ensure that bg, fg, & are at expected indices
+  const int MAX_LINE_LEN = 2001;
+  const int MAX_TOKEN_LEN = 31;
+  const int INVALID = 0;
+  const int VALID = 1;
+
+  if(strlen(input) > MAX_LINE_LEN){
+    return INVALID;
+  }
+  else if(strlen(input) == 0){
+    return INVALID;
+  }
+  else if(!checkTokens(input, MAX_LINE_LEN, MAX_TOKEN_LEN)){
+    return INVALID;
+  }
+  return VALID;
+}
+
+/**
+ * Purpose:
+ *   Create array of token C-strings from input line split on input delimiter
+ * 
+ * Args:
+ *   input (char*): Pointer to input c-string
+ *   delim   (int): Delimiter to split on
+ *  
+ * Returns:
+ *   (char**): Returns array of token c-strings
+ * 
+ */
+char** splitStrArray(char* input, const char* delim){
+  // Sized from the input: the shell checks its own limits with checkInput,
+  // library callers have none
+  char* inputCopy = strdup(input);
+  
+  char** splitted = NULL;
+  int numElements = 0;
+
+  char* save = NULL;
+  char* entry = NULL;
+  char* token = strtok_r(inputCopy, delim, &save);
+
+  while(token != NULL){
+    entry = strdup(token);
+
+    numElements++;
+    splitted = realloc(splitted, numElements * sizeof(char*));
+    splitted[numElements - 1] = entry;
+
+    token = strtok_r(NULL, delim, &save);
+  }
+
+  // Assign NULL to last index
+  numElements++;
+  splitted = realloc(splitted, numElements * sizeof(char*));
+  splitted[numElements - 1] = 0;
+
+  if(inputCopy != NULL)
+    free(inputCopy);
+  return splitted;
+}
+
+/**
+ * Purpose:
+ *   Check if a token contains unescaped glob metacharacters
+ * 
+ * Args:
+ *   tok (char*): Token to check
+ * 
+ * Returns:
+ *   (int): 1 if tok should be glob expanded, else 0
+ */
+int hasGlobMeta(char* tok){
+  int index = 0;
+
+  while(tok[index] != '\0'){
+    if(tok[index] == '\\' && tok[index + 1] != '\0'){
+      index++;
+    }
+    else if(tok[index] == '*' || tok[index] == '?' || tok[index] == '['){
+      return 1;
+    }
+    index++;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Compile one path component of a glob pattern into a node array. Runs of
+ *   * collapse into one node and [...] classes become 256-bit sets, so
+ *   matching never re-parses the pattern.
+ * 
+ * Args:
+ *   pattern  (char*): Pattern component, no '/' characters
+ *   pat (GlobPat_t*): Compiled pattern to fill in
+ * 
+ * Returns:
+ *   None
+ */
+void compileGlob(char* pattern, GlobPat_t* pat){
+  const char* curr = pattern;
+  const char* end = NULL;
+  GlobNode_t* node = NULL;
+  int lo;
+  int hi;
+  int ch;
+
+  pat->nodes = (GlobNode_t*)malloc((strlen(pattern) + 1) * sizeof(GlobNode_t));
+  pat->numNodes = 0;
+  pat->literal = 1;
+
+  while(*curr != '\0'){
+    node = &pat->nodes[pat->numNodes];
+    if(*curr == '*'){
+      pat->literal = 0;
+      while(*curr == '*'){
+        curr++;
+      }
+      node->type = GLOB_STAR;
+      pat->numNodes++;
+      continue;
+    }
+    else if(*curr == '?'){
+      pat->literal = 0;
+      node->type = GLOB_ANY;
+      curr++;
+    }
+    else if(*curr == '['){
+      // Find the closing bracket; a ']' right after '[' or '[!' is literal
+      end = curr + 1;
+      if(*end == '!' || *end == '^'){
+        end++;
+      }
+      if(*end == ']'){
+        end++;
+      }
+      while(*end != '\0' && *end != ']'){
+        end++;
+      }
+      if(*end != ']'){
+        node->type = GLOB_LIT;
+        node->ch = '[';
+        curr++;
+        pat->numNodes++;
+        continue;
+      }
+
+      pat->literal = 0;
+      node->type = GLOB_CLASS;
+      memset(node->set, 0, sizeof(node->set));
+      curr++;
+      node->negate = (*curr == '!' || *curr == '^');
+      if(node->negate){
+        curr++;
+      }
+      do{
+        lo = (unsigned char)*curr;
+        hi = lo;
+        if(curr[1] == '-' && curr + 2 < end){
+          hi = (unsigned char)curr[2];
+          curr += 2;
+        }
+        for(ch = lo; ch <= hi; ch++){
+          node->set[ch >> 3] |= (unsigned char)(1 << (ch & 7));
+        }
+        curr++;
+      }while(curr < end);
+      curr = end + 1;
+    }
+    else{
+      if(*curr == '\\' && curr[1] != '\0'){
+        curr++;
+      }
+      node->type = GLOB_LIT;
+      node->ch = (unsigned char)*curr;
+      curr++;
+    }
+    pat->numNodes++;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Match a file name against a compiled pattern. A * node records a single
+ *   restart point, so matching is linear in practice and never recurses.
+ * 
+ * Args:
+ *   pat (GlobPat_t*): Compiled pattern
+ *   name     (char*): File name to match
+ * 
+ * Returns:
+ *   (int): 1 on match, else 0
+ */
+int matchGlob(GlobPat_t* pat, char* name){
+  GlobNode_t* node = NULL;
+  int nodeIdx = 0;
+  int strIdx = 0;
+  int starNode = -1;
+  int starStr = 0;
+  int ok;
+  unsigned char ch;
+
+  // Leading dots must be matched explicitly
+  if(name[0] == '.' &&
+     (pat->numNodes == 0 || pat->nodes[0].type != GLOB_LIT ||
+      pat->nodes[0].ch != '.')){
+    return 0;
+  }
+
+  while(name[strIdx] != '\0'){
+    ch = (unsigned char)name[strIdx];
+    if(nodeIdx < pat->numNodes){
+      node = &pat->nodes[nodeIdx];
+      if(node->type == GLOB_STAR){
+        starNode = nodeIdx++;
+        starStr = strIdx;
+        continue;
+      }
+
+      if(node->type == GLOB_LIT){
+        ok = (node->ch == ch);
+      }
+      else if(node->type == GLOB_ANY){
+        ok = 1;
+      }
+      else{
+        ok = ((node->set[ch >> 3] >> (ch & 7)) & 1) != node->negate;
+      }
+      if(ok){
+        nodeIdx++;
+        strIdx++;
+        continue;
+      }
+    }
+    if(starNode >= 0){
+      nodeIdx = starNode + 1;
+      strIdx = ++starStr;
+      continue;
+    }
+    return 0;
+  }
+
+  while(nodeIdx < pat->numNodes && pat->nodes[nodeIdx].type == GLOB_STAR){
+    nodeIdx++;
+  }
+
+  return nodeIdx == pat->numNodes;
+}
+
+/**
+ * Purpose:
+ *   Return the listing of a directory, reading it with getdents64 into
+ *   large buffers the first time and from the cache afterwards
+ * 
+ * Args:
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer
+ *   path         (char*): Directory path
+ * 
+ * Returns:
+ *   (DirCache_t*): Cached listing, with count 0 if unreadable
+ */
+DirCache_t* loadDir(DirCache_t** cache, char* path){
+  const int INVALID = -1;
+
+  DirCache_t* curr = *cache;
+  struct LinuxDirent64_t* ent = NULL;
+  char* buf = NULL;
+  size_t namesLen = 0;
+  size_t namesCap = 0;
+  size_t len;
+  int cap = 0;
+  int fd;
+  long nread;
+  long pos;
+
+  while(curr != NULL){
+    if(!strcmp(curr->path, path)){
+      return curr;
+    }
+    curr = curr->next;
+  }
+
+  curr = (DirCache_t*)malloc(sizeof(DirCache_t));
+  curr->path = strdup(path);
+  curr->names = NULL;
+  curr->offsets = NULL;
+  curr->types = NULL;
+  curr->count = 0;
+  curr->next = *cache;
+  *cache = curr;
+
+  if((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == INVALID){
+    return curr;
+  }
+
+  buf = (char*)malloc(GLOB_BUF_SIZE);
+  while((nread = syscall(SYS_getdents64, fd, buf, GLOB_BUF_SIZE)) > 0){
+    for(pos = 0; pos < nread; pos += ent->d_reclen){
+      ent = (struct LinuxDirent64_t*)(buf + pos);
+      if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")){
+        continue;
+      }
+
+      len = strlen(ent->d_name) + 1;
+      if(namesLen + len > namesCap){
+        namesCap = (namesCap + len) * 2;
+        curr->names = (char*)realloc(curr->names, namesCap);
+      }
+      if(curr->count == cap){
+        cap = cap ? cap * 2 : 256;
+        curr->offsets = (size_t*)realloc(curr->offsets, cap * sizeof(size_t));
+        curr->types = (unsigned char*)realloc(curr->types, cap);
+      }
+      memcpy(curr->names + namesLen, ent->d_name, len);
+      curr->offsets[curr->count] = namesLen;
+      curr->types[curr->count] = ent->d_type;
+      curr->count++;
+      namesLen += len;
+    }
+  }
+  free(buf);
+  close(fd);
+
+  return curr;
+}
+
+/**
+ * Purpose:
+ *   Free every directory listing in the dirent cache
+ * 
+ * Args:
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void freeDirCache(DirCache_t** cache){
+  DirCache_t* curr = *cache;
+  DirCache_t* temp = NULL;
+
+  while(curr != NULL){
+    temp = curr;
+    curr = curr->next;
+    free(temp->path);
+    free(temp->names);
+    free(temp->offsets);
+    free(temp->types);
+    free(temp);
+  }
+  *cache = NULL;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Append a path to a glob result list
+ * 
+ * Args:
+ *   res (GlobResult_t*): Result list
+ *   path        (char*): Path to copy in
+ * 
+ * Returns:
+ *   None
+ */
+void pushGlobResult(GlobResult_t* res, char* path){
+  if(res->count == res->cap){
+    res->cap = res->cap ? res->cap * 2 : 16;
+    res->paths = (char**)realloc(res->paths, res->cap * sizeof(char*));
+  }
+  res->paths[res->count++] = strdup(path);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Match remaining pattern components below a directory prefix. d_type is
+ *   trusted for directories, stat is only needed for links and unknowns.
+ * 
+ * Args:
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer
+ *   prefix       (char*): Path matched so far, "" or ending in '/'
+ *   pats     (GlobPat_t*): Compiled components
+ *   numPats        (int): Number of components
+ *   index          (int): Component to match next
+ *   dirOnly        (int): Final component must be a directory
+ *   res (GlobResult_t*): Result list
+ * 
+ * Returns:
+ *   None
+ */
+void expandGlobDir(DirCache_t** cache, char* prefix, GlobPat_t* pats,
+                   int numPats, int index, int dirOnly, GlobResult_t* res){
+  DirCache_t* dir = NULL;
+  struct stat sb;
+  char* name = NULL;
+  char* path = NULL;
+  int last = (index == numPats - 1);
+  int needDir = !last || dirOnly;
+  int isDir;
+  int entry;
+
+  if(pats[index].literal){
+    // No metacharacters; check the one name instead of listing the dir
+    path = (char*)malloc(strlen(prefix) + pats[index].numNodes + 2);
+    strcpy(path, prefix);
+    name = path + strlen(prefix);
+    for(entry = 0; entry < pats[index].numNodes; entry++){
+      name[entry] = (char)pats[index].nodes[entry].ch;
+    }
+    name[entry] = '\0';
+    if(stat(path, &sb) == 0 && (!needDir || S_ISDIR(sb.st_mode))){
+      if(needDir){
+        strcat(path, "/");
+      }
+      if(last){
+        pushGlobResult(res, path);
+      }
+      else{
+        expandGlobDir(cache, path, pats, numPats, index + 1, dirOnly, res);
+      }
+    }
+    free(path);
+    return;
+  }
+
+  dir = loadDir(cache, prefix[0] == '\0' ? "." : prefix);
+  for(entry = 0; entry < dir->count; entry++){
+    name = dir->names + dir->offsets[entry];
+    if(!matchGlob(&pats[index], name)){
+      continue;
+    }
+
+    path = (char*)malloc(strlen(prefix) + strlen(name) + 2);
+    sprintf(path, "%s%s", prefix, name);
+    if(needDir){
+      isDir = (dir->types[entry] == DT_DIR);
+      if(dir->types[entry] == DT_LNK || dir->types[entry] == DT_UNKNOWN){
+        isDir = (stat(path, &sb) == 0) && S_ISDIR(sb.st_mode);
+      }
+      if(!isDir){
+        free(path);
+        continue;
+      }
+      strcat(path, "/");
+    }
+
+    if(last){
+      pushGlobResult(res, path);
+    }
+    else{
+      expandGlobDir(cache, path, pats, numPats, index + 1, dirOnly, res);
+    }
+    free(path);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   qsort comparator for glob results
+ */
+int compareGlobPaths(const void* a, const void* b){
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Purpose:
+ *   Expand one glob pattern into sorted matching paths
+ * 
+ * Args:
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer
+ *   pattern      (char*): Pattern token
+ *   res (GlobResult_t*): Result list to append to
+ * 
+ * Returns:
+ *   None
+ */
+void expandGlob(DirCache_t** cache, char* pattern, GlobResult_t* res){
+  char* copy = strdup(pattern);
+  char* save = NULL;
+  char* comp = NULL;
+  GlobPat_t* pats = NULL;
+  int numPats = 0;
+  int dirOnly = 0;
+  int first = res->count;
+  int index;
+
+  dirOnly = (pattern[strlen(pattern) - 1] == '/');
+  pats = (GlobPat_t*)malloc((strlen(pattern) / 2 + 1) * sizeof(GlobPat_t));
+  for(comp = strtok_r(copy, "/", &save); comp != NULL;
+      comp = strtok_r(NULL, "/", &save)){
+    compileGlob(comp, &pats[numPats++]);
+  }
+
+  if(numPats > 0){
+    expandGlobDir(cache, pattern[0] == '/' ? "/" : "", pats, numPats, 0,
+                  dirOnly, res);
+  }
+  if(res->count - first > 1){
+    qsort(res->paths + first, res->count - first, sizeof(char*),
+          compareGlobPaths);
+  }
+
+  for(index = 0; index < numPats; index++){
+    free(pats[index].nodes);
+  }
+  free(pats);
+  free(copy);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Replace glob patterns in a token array with their matches. Patterns
+ *   with no match are kept as-is. The old array and its tokens are freed.
+ * 
+ * Args:
+ *   cmd         (char**): NULL terminated token array
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer for this line
+ * 
+ * Returns:
+ *   (char**): New NULL terminated token array
+ */
+char** expandGlobs(char** cmd, DirCache_t** cache){
+  return expandGlobsFrom(cmd, 0, cache);
+}
+
+/**
+ * Purpose:
+ *   Replace glob patterns in a token array with their matches, leaving the
+ *   tokens before from as they are. The old array and its tokens are freed.
+ * 
+ * Args:
+ *   cmd         (char**): NULL terminated token array
+ *   from           (int): Index of the first token to expand
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer for this line
+ * 
+ * Returns:
+ *   (char**): New NULL terminated token array
+ */
+char** expandGlobsFrom(char** cmd, int from, DirCache_t** cache){
+  GlobResult_t res = {NULL, 0, 0};
+  int index = 0;
+  int before;
+
+  while(cmd[index] != NULL){
+    if(index >= from && hasGlobMeta(cmd[index])){
+      before = res.count;
+      expandGlob(cache, cmd[index], &res);
+      if(res.count == before){
+        pushGlobResult(&res, cmd[index]);
+      }
+    }
+    else{
+      pushGlobResult(&res, cmd[index]);
+    }
+    free(cmd[index]);
+    index++;
+  }
+  free(cmd);
+
+  // Assign NULL to last index
+  res.paths = (char**)realloc(res.paths, (res.count + 1) * sizeof(char*));
+  res.paths[res.count] = NULL;
+
+  return res.paths;
+}
+
+/**
+ * Purpose:
+ *   Parse a single token as a redirection operator. Accepts an optional
+ *   leading fd number followed by <, >, >>, <>, <&, >&, &> or &>>. The word
+ *   may be attached to the operator (2>&1, >out) or be the next token.
+ *   <z, >z and >>z (gzip streams) take the word as the next token only.
+ * 
+ * Args:
+ *   tok     (char*): Token to parse
+ *   next    (char*): Token following tok, may be NULL
+ *   op (RedirOp_t*): Operation to fill in
+ *   used     (int*): Set to 1 if next was consumed as the word
+ * 
+ * Returns:
+ *   (int): 1 if tok is a redirection, 0 if not, -1 on syntax error
+ */
+int parseRedirTok(char* tok, char* next, RedirOp_t* op, int* used){
+  const int IS_REDIR = 1;
+  const int NOT_REDIR = 0;
+  const int SYNTAX_ERR = -1;
+
+  char* curr = tok;
+  char* word = NULL;
+  int fd = -1;
+  int isDup = 0;
+
+  *used = 0;
+  op->codec = REDIR_PLAIN;
+  while(isdigit((unsigned char)*curr)){
+    fd = (fd < 0 ? 0 : fd * 10) + (*curr - '0');
+    curr++;
+  }
+
+  op->both = 0;
+  if(curr[0] == '&' && curr[1] == '>' && fd < 0){
+    // &> and &>> send stdout and stderr to the same file
+    op->both = 1;
+    op->fd = STDOUT_FILENO;
+    if(curr[2] == '>'){
+      op->flags = O_CREAT | O_WRONLY | O_APPEND;
+      curr += 3;
+    }
+    else{
+      op->flags = O_CREAT | O_WRONLY | O_TRUNC;
+      curr += 2;
+    }
+  }
+  else if(curr[0] == '<'){
+    op->fd = (fd < 0) ? STDIN_FILENO : fd;
+    if(curr[1] == '>'){
+      op->flags = O_CREAT | O_RDWR;
+      curr += 2;
+    }
+    else if(curr[1] == '&'){
+      isDup = 1;
+      curr += 2;
+    }
+    else{
+      op->flags = O_RDONLY;
+      curr += 1;
+    }
+  }
+  else if(curr[0] == '>'){
+    op->fd = (fd < 0) ? STDOUT_FILENO : fd;
+    if(curr[1] == '>'){
+      op->flags = O_CREAT | O_WRONLY | O_APPEND;
+      curr += 2;
+    }
+    else if(curr[1] == '&'){
+      isDup = 1;
+      curr += 2;
+    }
+    else{
+      op->flags = O_CREAT | O_WRONLY | O_TRUNC;
+      curr += 1;
+    }
+  }
+  else{
+    return NOT_REDIR;
+  }
+
+  if(!isDup && !op->both && curr[0] == 'z' && curr[1] == '\0' &&
+     (op->flags & O_ACCMODE) != O_RDWR){
+    op->codec = REDIR_GZIP;
+    curr++;
+  }
+
+  if(*curr != '\0'){
+    word = curr;
+  }
+  else if(next != NULL){
+    word = next;
+    *used = 1;
+  }
+  else{
+    return SYNTAX_ERR;
+  }
+
+  if(isDup){
+    if(!strcmp(word, "-")){
+      op->type = REDIR_CLOSE;
+      op->srcFd = -1;
+    }
+    else{
+      op->type = REDIR_DUP;
+      op->srcFd = 0;
+      for(curr = word; *curr != '\0'; curr++){
+        if(!isdigit((unsigned char)*curr)){
+          return SYNTAX_ERR;
+        }
+        op->srcFd = op->srcFd * 10 + (*curr - '0');
+      }
+    }
+    op->path = NULL;
+  }
+  else{
+    op->type = REDIR_OPEN;
+    op->path = word;
+  }
+
+  return IS_REDIR;
+}
+
+/**
+ * Purpose:
+ *   Split a command token array into exec arguments and an ordered list of
+ *   fd operations. cmd is left untouched so its tokens can still be freed.
+ * 
+ * Args:
+ *   cmd         (char**): Array of tokens from command
+ *   argv        (char**): Output argument array, sized for every token + 1
+ *   redirs (RedirList_t*): Output list of fd operations
+ *   
+ * Returns:
+ *   (int): 0 on success, -1 on syntax error or too many redirections
+ */ 
+int parseRedirs(char** cmd, char** argv, RedirList_t* redirs){
+  const int VALID = 0;
+  const int INVALID = -1;
+  const char* SYNTAX_MSG = "yash: syntax error near `%s'\n";
+
+  int index = 0;
+  int argc = 0;
+  int used = 0;
+  int isRedir;
+  RedirOp_t op;
+
+  redirs->numOps = 0;
+  while(cmd[index] != NULL){
+    // Parsed aside, so only a redirection counts against MAX_REDIRS
+    isRedir = parseRedirTok(cmd[index], cmd[index + 1], &op, &used);
+    if(isRedir < 0 || (isRedir && redirs->numOps >= MAX_REDIRS)){
+      fprintf(stderr, SYNTAX_MSG, cmd[index]);
+      return INVALID;
+    }
+    else if(isRedir){
+      redirs->ops[redirs->numOps++] = op;
+      index += used;
+    }
+    else{
+      argv[argc++] = cmd[index];
+    }
+    index++;
+  }
+  argv[argc] = NULL;
+
+  return VALID;
+}
+
+/**
+ * Purpose:
+ *   Apply fd operations in order, to be called in the child before exec
+ * 
+ * Args:
+ *   redirs (RedirList_t*): List of fd operations from parseRedirs
+ *   
+ * Returns:
+ *   None
+ */
+void redirectFile(RedirList_t* redirs){
+  const int INVALID = -1;
+  const mode_t MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+  int index;
+  int fd;
+  RedirOp_t* op = NULL;
+
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    if(op->type == REDIR_OPEN && op->codec != REDIR_PLAIN){
+      fprintf(stderr, "yash: %s: %s\n", op->path, strerror(ENOTSUP));
+      exit(EXIT_FAILURE);
+    }
+    if(op->type == REDIR_OPEN){
+      if((fd = open(op->path, op->flags, MODE)) == INVALID){
+        perror(op->path);
+        exit(EXIT_FAILURE);
+      }
+      if(fd != op->fd){
+        dup2(fd, op->fd);
+        close(fd);
+      }
+      if(op->both){
+        dup2(op->fd, STDERR_FILENO);
+      }
+    }
+    else if(op->type == REDIR_DUP){
+      if(dup2(op->srcFd, op->fd) == INVALID){
+        fprintf(stderr, "yash: %d: %s\n", op->srcFd, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+      if(op->both){
+        dup2(op->fd, STDERR_FILENO);
+      }
+    }
+    else if(op->type == REDIR_CLOSE){
+      close(op->fd);
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Close fds opened by openRedirs
+ * 
+ * Args:
+ *   redirs (RedirList_t*): List of fd operations from openRedirs
+ *   
+ * Returns:
+ *   None
+ */
+void closeRedirs(RedirList_t* redirs){
+  int index;
+  RedirOp_t* op = NULL;
+
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    if(op->type == REDIR_DUP && op->path != NULL){
+      close(op->srcFd);
+      op->type = REDIR_OPEN;
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Open the files of a redirection list in the shell and turn each open
+ *   into a dup of the new fd, so several children share one open file
+ *   instead of each truncating it again
+ * 
+ * Args:
+ *   redirs (RedirList_t*): List of fd operations from parseRedirs
+ *   
+ * Returns:
+ *   (int): 0 on success, -1 if a file could not be opened
+ */
+int openRedirs(RedirList_t* redirs){
+  const int INVALID = -1;
+  const mode_t MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+  int index;
+  int fd;
+  RedirOp_t* op = NULL;
+
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    if(op->type == REDIR_OPEN && op->codec != REDIR_PLAIN){
+      fprintf(stderr, "yash: %s: %s\n", op->path, strerror(ENOTSUP));
+      closeRedirs(redirs);
+      return INVALID;
+    }
+    if(op->type == REDIR_OPEN){
+      if((fd = open(op->path, op->flags | O_CLOEXEC, MODE)) == INVALID){
+        perror(op->path);
+        closeRedirs(redirs);
+        return INVALID;
+      }
+      op->type = REDIR_DUP;
+      op->srcFd = fd;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Translate fd operations into posix_spawn file actions
+ * 
+ * Args:
+ *   redirs       (RedirList_t*): List of fd operations from parseRedirs
+ *   actions (posix_spawn_file_actions_t*): Initialized file actions to fill
+ *   
+ * Returns:
+ *   (int): 0 on success, else error number from posix_spawn_file_actions_*
+ */
+int redirSpawnActions(RedirList_t* redirs, posix_spawn_file_actions_t* actions){
+  const mode_t MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+  int index;
+  int err = 0;
+  RedirOp_t* op = NULL;
+
+  for(index = 0; (index < redirs->numOps) && !err; index++){
+    op = &redirs->ops[index];
+    if(op->type == REDIR_OPEN && op->codec != REDIR_PLAIN){
+      err = ENOTSUP;
+    }
+    else if(op->type == REDIR_OPEN){
+      err = posix_spawn_file_actions_addopen(actions, op->fd, op->path,
+                                             op->flags, MODE);
+      if(!err && op->both){
+        err = posix_spawn_file_actions_adddup2(actions, op->fd, STDERR_FILENO);
+      }
+    }
+    else if(op->type == REDIR_DUP){
+      err = posix_spawn_file_actions_adddup2(actions, op->srcFd, op->fd);
+      if(!err && op->both){
+        err = posix_spawn_file_actions_adddup2(actions, op->fd, STDERR_FILENO);
+      }
+    }
+    else if(op->type == REDIR_CLOSE){
+      err = posix_spawn_file_actions_addclose(actions, op->fd);
+    }
+  }
+
+  return err;
+}
+
+/**
+ * Purpose:
+ *   Spawn a command in its own process group with its redirections applied
+ * 
+ * Args:
+ *   argv        (char**): Exec arguments from parseRedirs
+ *   redirs (RedirList_t*): fd operations from parseRedirs
+ *   pid           (int*): Set to the PID of the new child
+ * 
+ * Returns:
+ *   (int): 0 on success, else error number; an error message is printed
+ */
+int spawnCommand(char** argv, RedirList_t* redirs, int* pid){
+  int err;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+
+  // Spawn directly; the child joins its own process group
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  err = redirSpawnActions(redirs, &actions);
+  if(!err){
+    err = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  if(err){
+    fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(err));
+  }
+
+  return err;
+}
+
+/**
+ * YashPipeline_t struct, token arrays own the strings that argvs and the
+ * redirection paths point into
+ */
+struct YashPipeline_t{
+  int numStages;
+  char*** cmds;
+  char*** argvs;
+  RedirList_t* redirs;
+};
+
+/**
+ * YashRun_t struct, pids of one execution and the capture state that the
+ * drain thread fills in
+ */
+struct YashRun_t{
+  int* pids;
+  int numStages;
+  int outFd;
+  int errFd;
+  int doneFd;
+  int status;
+  int joined;
+  char* outBuf;
+  size_t outCap;
+  size_t outLen;
+  char* errBuf;
+  size_t errCap;
+  size_t errLen;
+  pthread_t thread;
+};
+
+/**
+ * Purpose:
+ *   Free a NULL terminated token array and its tokens
+ * 
+ * Args:
+ *   cmd (char**): Token array
+ * 
+ * Returns:
+ *   None
+ */
+void freeTokens(char** cmd){
+  int index = 0;
+
+  if(cmd == NULL){
+    return;
+  }
+  while(cmd[index] != NULL){
+    free(cmd[index]);
+    index++;
+  }
+  free(cmd);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Parse a command line with any number of | stages into a pipeline.
+ *   Globs are expanded here, so every run sees the same arguments. The
+ *   interactive shell's line and token length limits do not apply.
+ * 
+ * Args:
+ *   line (const char*): Command line
+ * 
+ * Returns:
+ *   (YashPipeline_t*): Parsed pipeline, or NULL with errno set to EINVAL
+ */
+YashPipeline_t* yashParse(const char* line){
+  const char* PIPE = "|";
+  const char* SPACE_CHAR = " ";
+
+  YashPipeline_t* pipeline = NULL;
+  DirCache_t* dirCache = NULL;
+  char** stages = NULL;
+  char* input = strdup(line);
+  int numToks;
+  int index;
+  int valid;
+
+  valid = (input[strspn(input, SPACE_CHAR)] != '\0');
+  if(valid){
+    stages = splitStrArray(input, PIPE);
+  }
+  free(input);
+  if(!valid || stages[0] == NULL){
+    freeTokens(stages);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  pipeline = (YashPipeline_t*)calloc(1, sizeof(YashPipeline_t));
+  while(stages[pipeline->numStages] != NULL){
+    pipeline->numStages++;
+  }
+  pipeline->cmds = (char***)calloc(pipeline->numStages, sizeof(char**));
+  pipeline->argvs = (char***)calloc(pipeline->numStages, sizeof(char**));
+  pipeline->redirs = (RedirList_t*)calloc(pipeline->numStages,
+                                          sizeof(RedirList_t));
+
+  for(index = 0; index < pipeline->numStages; index++){
+    pipeline->cmds[index] = expandGlobs(splitStrArray(stages[index], SPACE_CHAR),
+                                        &dirCache);
+    for(numToks = 0; pipeline->cmds[index][numToks] != NULL; numToks++);
+    pipeline->argvs[index] = (char**)malloc((numToks + 1) * sizeof(char*));
+    if(parseRedirs(pipeline->cmds[index], pipeline->argvs[index],
+                   &pipeline->redirs[index]) < 0 ||
+       pipeline->argvs[index][0] == NULL){
+      pipeline->numStages = index + 1;
+      yashFreePipeline(pipeline);
+      pipeline = NULL;
+      break;
+    }
+  }
+
+  freeDirCache(&dirCache);
+  freeTokens(stages);
+  if(pipeline == NULL){
+    errno = EINVAL;
+  }
+
+  return pipeline;
+}
+
+/**
+ * Purpose:
+ *   Free a pipeline from yashParse
+ * 
+ * Args:
+ *   pipeline (YashPipeline_t*): Pipeline to free
+ * 
+ * Returns:
+ *   None
+ */
+void yashFreePipeline(YashPipeline_t* pipeline){
+  int index;
+
+  if(pipeline == NULL){
+    return;
+  }
+  for(index = 0; index < pipeline->numStages; index++){
+    freeTokens(pipeline->cmds[index]);
+    free(pipeline->argvs[index]);
+  }
+  free(pipeline->cmds);
+  free(pipeline->argvs);
+  free(pipeline->redirs);
+  free(pipeline);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Read whatever is available on fd into a capture buffer, discarding
+ *   bytes past its capacity so the writer never blocks
+ * 
+ * Args:
+ *   fd     (int): Pipe read end
+ *   buf  (char*): Capture buffer, may be NULL
+ *   cap (size_t): Capacity of buf
+ *   len (size_t*): Bytes stored so far
+ * 
+ * Returns:
+ *   (int): 0 at end of file, 1 if the pipe is still open
+ */
+int drainFd(int fd, char* buf, size_t cap, size_t* len){
+  char scratch[4096];
+  ssize_t nread;
+
+  if(buf != NULL && *len < cap){
+    nread = read(fd, buf + *len, cap - *len);
+  }
+  else{
+    nread = read(fd, scratch, sizeof(scratch));
+  }
+
+  if(nread > 0 && buf != NULL && *len < cap){
+    *len += nread;
+  }
+  if(nread < 0 && (errno == EINTR || errno == EAGAIN)){
+    return 1;
+  }
+
+  return nread > 0;
+}
+
+/**
+ * Purpose:
+ *   Drain thread body: capture output until both pipes close, reap every
+ *   stage, then signal completion on the eventfd
+ * 
+ * Args:
+ *   arg (void*): YashRun_t of the run
+ * 
+ * Returns:
+ *   (void*): NULL
+ */
+void* drainRun(void* arg){
+  YashRun_t* run = (YashRun_t*)arg;
+  struct pollfd fds[2];
+  uint64_t one = 1;
+  int status;
+  int index;
+
+  fds[0].fd = run->outFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = run->errFd;
+  fds[1].events = POLLIN;
+
+  while(fds[0].fd >= 0 || fds[1].fd >= 0){
+    if(poll(fds, 2, -1) < 0){
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    if(fds[0].revents && !drainFd(run->outFd, run->outBuf, run->outCap,
+                                  &run->outLen)){
+      fds[0].fd = -1;
+    }
+    if(fds[1].revents && !drainFd(run->errFd, run->errBuf, run->errCap,
+                                  &run->errLen)){
+      fds[1].fd = -1;
+    }
+  }
+
+  // The pipeline's status is the status of its last stage
+  for(index = 0; index < run->numStages; index++){
+    while(waitpid(run->pids[index], &status, 0) < 0 && errno == EINTR);
+    if(index == run->numStages - 1){
+      run->status = status;
+    }
+  }
+
+  write(run->doneFd, &one, sizeof(one));
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Allocate a run handle with no stages started
+ * 
+ * Args:
+ *   pipeline (YashPipeline_t*): Pipeline the run belongs to
+ * 
+ * Returns:
+ *   (YashRun_t*): Run handle, or NULL with errno set
+ */
+YashRun_t* newRun(YashPipeline_t* pipeline){
+  const int INVALID = -1;
+
+  YashRun_t* run = (YashRun_t*)calloc(1, sizeof(YashRun_t));
+
+  run->pids = (int*)calloc(pipeline->numStages, sizeof(int));
+  run->outFd = INVALID;
+  run->errFd = INVALID;
+  // No drain thread to join until startDrain creates one
+  run->joined = 1;
+  if((run->doneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == INVALID){
+    free(run->pids);
+    free(run);
+    return NULL;
+  }
+
+  return run;
+}
+
+/**
+ * Purpose:
+ *   Spawn every stage of a pipeline into one new process group, linked by
+ *   pipes. Stages that did start are killed if a later one fails.
+ * 
+ * Args:
+ *   run           (YashRun_t*): Run handle from newRun
+ *   pipeline (YashPipeline_t*): Pipeline from yashParse
+ *   inFd                 (int): stdin of the first stage, -1 for /dev/null
+ *   outFd                (int): stdout of the last stage, -1 to inherit
+ *   errFd                (int): stderr of every stage, -1 to inherit
+ * 
+ * Returns:
+ *   (int): 0 on success, else error number
+ */
+int spawnStages(YashRun_t* run, YashPipeline_t* pipeline, int inFd, int outFd,
+                int errFd){
+  const int INVALID = -1;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t noMask;
+  sigset_t allSigs;
+  int linkPipe[2] = {INVALID, INVALID};
+  int stageIn;
+  int err = 0;
+  int index;
+
+  if(inFd == INVALID){
+    if((stageIn = open("/dev/null", O_RDONLY | O_CLOEXEC)) == INVALID){
+      return errno;
+    }
+  }
+  else if((stageIn = fcntl(inFd, F_DUPFD_CLOEXEC, 0)) == INVALID){
+    return errno;
+  }
+
+  sigemptyset(&noMask);
+  sigfillset(&allSigs);
+  for(index = 0; index < pipeline->numStages && !err; index++){
+    if(index < pipeline->numStages - 1 && pipe2(linkPipe, O_CLOEXEC) < 0){
+      err = errno;
+      break;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                             POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, index == 0 ? 0 : run->pids[0]);
+    posix_spawnattr_setsigmask(&attr, &noMask);
+    posix_spawnattr_setsigdefault(&attr, &allSigs);
+
+    posix_spawn_file_actions_adddup2(&actions, stageIn, STDIN_FILENO);
+    if(index < pipeline->numStages - 1){
+      posix_spawn_file_actions_adddup2(&actions, linkPipe[1], STDOUT_FILENO);
+    }
+    else if(outFd != INVALID){
+      posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO);
+    }
+    if(errFd != INVALID){
+      posix_spawn_file_actions_adddup2(&actions, errFd, STDERR_FILENO);
+    }
+
+    err = redirSpawnActions(&pipeline->redirs[index], &actions);
+    if(!err){
+      err = posix_spawnp(&run->pids[index], pipeline->argvs[index][0],
+                         &actions, &attr, pipeline->argvs[index], environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    close(stageIn);
+    stageIn = INVALID;
+    if(index < pipeline->numStages - 1){
+      close(linkPipe[1]);
+      stageIn = linkPipe[0];
+    }
+    if(!err){
+      run->numStages++;
+    }
+  }
+  if(stageIn != INVALID){
+    close(stageIn);
+  }
+
+  if(err && run->numStages > 0){
+    killpg(run->pids[0], SIGKILL);
+  }
+
+  return err;
+}
+
+/**
+ * Purpose:
+ *   Start the thread that captures output and reaps the stages. If no
+ *   thread can be created the run is killed and reaped inline.
+ * 
+ * Args:
+ *   run (YashRun_t*): Run handle with its stages spawned
+ *   err        (int): Error from spawnStages
+ * 
+ * Returns:
+ *   (int): 0 on success, else error number
+ */
+int startDrain(YashRun_t* run, int err){
+  if(pthread_create(&run->thread, NULL, drainRun, run) == 0){
+    run->joined = 0;
+    return err;
+  }
+
+  // Nothing else will reap the stages; do it here
+  if(!err && run->numStages > 0){
+    err = EAGAIN;
+    killpg(run->pids[0], SIGKILL);
+  }
+  drainRun(run);
+
+  return err;
+}
+
+/**
+ * Purpose:
+ *   Start a parsed pipeline on caller-supplied fds without capturing. All
+ *   stages share one new process group; the fds are only borrowed.
+ * 
+ * Args:
+ *   pipeline (YashPipeline_t*): Pipeline from yashParse
+ *   inFd                 (int): stdin of the first stage, -1 for /dev/null
+ *   outFd                (int): stdout of the last stage, -1 to inherit
+ *   errFd                (int): stderr of every stage, -1 to inherit
+ * 
+ * Returns:
+ *   (YashRun_t*): Run handle, or NULL with errno set
+ */
+YashRun_t* yashStartFds(YashPipeline_t* pipeline, int inFd, int outFd,
+                        int errFd){
+  YashRun_t* run = NULL;
+  int err;
+
+  if((run = newRun(pipeline)) == NULL){
+    return NULL;
+  }
+
+  err = spawnStages(run, pipeline, inFd, outFd, errFd);
+  if((err = startDrain(run, err))){
+    yashFreeRun(run);
+    errno = err;
+    return NULL;
+  }
+
+  return run;
+}
+
+/**
+ * Purpose:
+ *   Start a parsed pipeline. All stages share one new process group, stdin
+ *   is /dev/null unless redirected, and stdout/stderr of the pipeline are
+ *   captured into the caller's buffers (a NULL buffer inherits the fd).
+ * 
+ * Args:
+ *   pipeline (YashPipeline_t*): Pipeline from yashParse
+ *   outBuf             (char*): Buffer for stdout, may be NULL
+ *   outCap            (size_t): Capacity of outBuf
+ *   errBuf             (char*): Buffer for stderr, may be NULL
+ *   errCap            (size_t): Capacity of errBuf
+ * 
+ * Returns:
+ *   (YashRun_t*): Run handle, or NULL with errno set
+ */
+YashRun_t* yashStart(YashPipeline_t* pipeline, char* outBuf, size_t outCap,
+                     char* errBuf, size_t errCap){
+  const int INVALID = -1;
+
+  YashRun_t* run = NULL;
+  int outPipe[2] = {INVALID, INVALID};
+  int errPipe[2] = {INVALID, INVALID};
+  int err;
+
+  if((run = newRun(pipeline)) == NULL){
+    return NULL;
+  }
+  run->outBuf = outBuf;
+  run->outCap = outCap;
+  run->errBuf = errBuf;
+  run->errCap = errCap;
+
+  if(pipe2(outPipe, O_CLOEXEC) == INVALID ||
+     pipe2(errPipe, O_CLOEXEC) == INVALID){
+    err = errno;
+    if(outPipe[0] != INVALID){
+      close(outPipe[0]);
+      close(outPipe[1]);
+    }
+    yashFreeRun(run);
+    errno = err;
+    return NULL;
+  }
+
+  err = spawnStages(run, pipeline, INVALID,
+                    outBuf != NULL ? outPipe[1] : INVALID,
+                    errBuf != NULL ? errPipe[1] : INVALID);
+  close(outPipe[1]);
+  close(errPipe[1]);
+  run->outFd = outPipe[0];
+  run->errFd = errPipe[0];
+
+  if((err = startDrain(run, err))){
+    yashFreeRun(run);
+    errno = err;
+    return NULL;
+  }
+
+  return run;
+}
+
+/**
+ * Purpose:
+ *   Completion fd of a run, readable once the pipeline has finished and
+ *   been reaped; suitable for epoll or poll
+ * 
+ * Args:
+ *   run (YashRun_t*): Run handle
+ * 
+ * Returns:
+ *   (int): eventfd owned by the run
+ */
+int yashRunFd(YashRun_t* run){
+  return run->doneFd;
+}
+
+/**
+ * Purpose:
+ *   Send a signal to every stage of a running pipeline
+ * 
+ * Args:
+ *   run (YashRun_t*): Run handle
+ *   sig        (int): Signal number
+ * 
+ * Returns:
+ *   (int): 0 on success, -1 with errno set on failure
+ */
+int yashKill(YashRun_t* run, int sig){
+  return killpg(run->pids[0], sig);
+}
+
+/**
+ * Purpose:
+ *   Wait for a run to finish and collect its results
+ * 
+ * Args:
+ *   run (YashRun_t*): Run handle
+ *   outLen (size_t*): Set to bytes captured in outBuf, may be NULL
+ *   errLen (size_t*): Set to bytes captured in errBuf, may be NULL
+ * 
+ * Returns:
+ *   (int): waitpid status of the last stage
+ */
+int yashWait(YashRun_t* run, size_t* outLen, size_t* errLen){
+  if(!run->joined){
+    pthread_join(run->thread, NULL);
+    run->joined = 1;
+  }
+  if(outLen != NULL)
+    *outLen = run->outLen;
+  if(errLen != NULL)
+    *errLen = run->errLen;
+
+  return run->status;
+}
+
+/**
+ * Purpose:
+ *   Wait for and free a run handle
+ * 
+ * Args:
+ *   run (YashRun_t*): Run handle
+ * 
+ * Returns:
+ *   None
+ */
+void yashFreeRun(YashRun_t* run){
+  if(run == NULL){
+    return;
+  }
+  yashWait(run, NULL, NULL);
+  if(run->outFd >= 0)
+    close(run->outFd);
+  if(run->errFd >= 0)
+    close(run->errFd);
+  close(run->doneFd);
+  free(run->pids);
+  free(run);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Create a directory and any missing parents
+ *
+ * Args:
+ *   path (const char*): Directory path
+ *
+ * Returns:
+ *   (int): 0 on success, -1 with errno set on failure
+ */
+int makeDirs(const char* path){
+  char buf[PATH_MAX];
+  char* slash = NULL;
+
+  snprintf(buf, sizeof(buf), "%s", path);
+  for(slash = strchr(buf + 1, '/'); slash != NULL;
+      slash = strchr(slash + 1, '/')){
+    *slash = '\0';
+    if(mkdir(buf, 0755) < 0 && errno != EEXIST){
+      return -1;
+    }
+    *slash = '/';
+  }
+  if(mkdir(buf, 0755) < 0 && errno != EEXIST){
+    return -1;
+  }
+
+  return 0;
+}
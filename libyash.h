@@ -0,0 +1,40 @@
+#ifndef LIBYASH_H
+#define LIBYASH_H
+
+#include <stddef.h>
+
+// libyash: parsing, redirection and spawning core of yash. Nothing here
+// touches global state, so every function is safe to call from several
+// threads as long as each thread uses its own objects. This header is the
+// library's API; the shell's own modules use libyash_internal.h.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * YashPipeline_t struct, parsed pipeline that can be run many times
+ */
+typedef struct YashPipeline_t YashPipeline_t;
+
+/**
+ * YashRun_t struct, one execution of a pipeline
+ */
+typedef struct YashRun_t YashRun_t;
+
+YashPipeline_t* yashParse(const char* line);
+void yashFreePipeline(YashPipeline_t* pipeline);
+YashRun_t* yashStart(YashPipeline_t* pipeline, char* outBuf, size_t outCap,
+                     char* errBuf, size_t errCap);
+YashRun_t* yashStartFds(YashPipeline_t* pipeline, int inFd, int outFd,
+                        int errFd);
+int yashRunFd(YashRun_t* run);
+int yashKill(YashRun_t* run, int sig);
+int yashWait(YashRun_t* run, size_t* outLen, size_t* errLen);
+void yashFreeRun(YashRun_t* run);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
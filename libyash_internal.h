@@ -0,0 +1,145 @@
+#ifndef LIBYASH_INTERNAL_H
+#define LIBYASH_INTERNAL_H
+
+#include <spawn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libyash.h"
+
+// Parts of libyash shared with the shell's own modules: tokenizing, globs,
+// redirection lists and spawning. Not part of the library's API.
+
+#define MAX_REDIRS 16
+#define GLOB_BUF_SIZE (1 << 20)
+
+extern char** environ;
+
+/**
+ * Redirection operation kinds
+ */
+enum{
+  REDIR_OPEN,
+  REDIR_DUP,
+  REDIR_CLOSE
+};
+
+/**
+ * Redirection stream codecs (>z, >>z, <z)
+ */
+enum{
+  REDIR_PLAIN,
+  REDIR_GZIP
+};
+
+/**
+ * RedirOp_t struct, one fd operation applied in the child. An open with a
+ * codec must be turned into a dup of a codec pipe by the shell first.
+ */
+typedef struct RedirOp_t{
+  int type;
+  int fd;
+  int srcFd;
+  int flags;
+  int both;
+  int codec;
+  char* path;
+}RedirOp_t;
+
+/**
+ * RedirList_t struct, redirections of one command in source order
+ */
+typedef struct RedirList_t{
+  RedirOp_t ops[MAX_REDIRS];
+  int numOps;
+}RedirList_t;
+
+/**
+ * Glob pattern node kinds
+ */
+enum{
+  GLOB_LIT,
+  GLOB_ANY,
+  GLOB_STAR,
+  GLOB_CLASS
+};
+
+/**
+ * GlobNode_t struct, one step of a compiled glob pattern
+ */
+typedef struct GlobNode_t{
+  int type;
+  int negate;
+  unsigned char ch;
+  unsigned char set[32];
+}GlobNode_t;
+
+/**
+ * GlobPat_t struct, compiled pattern for one path component
+ */
+typedef struct GlobPat_t{
+  GlobNode_t* nodes;
+  int numNodes;
+  int literal;
+}GlobPat_t;
+
+/**
+ * GlobResult_t struct, growable list of matched paths
+ */
+typedef struct GlobResult_t{
+  char** paths;
+  int count;
+  int cap;
+}GlobResult_t;
+
+/**
+ * LinuxDirent64_t struct, record layout returned by getdents64
+ */
+struct LinuxDirent64_t{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/**
+ * DirCache_t struct, directory listing cached for one command line
+ */
+typedef struct DirCache_t{
+  char* path;
+  char* names;
+  size_t* offsets;
+  unsigned char* types;
+  int count;
+
+  struct DirCache_t* next;
+}DirCache_t;
+
+// Input checks and tokenizing
+int checkTokens(char* input, int maxLineLen, int maxTokenLen);
+int checkInput(char* input);
+char** splitStrArray(char* input, const char* delim);
+
+// Glob expansion
+int hasGlobMeta(char* tok);
+void compileGlob(char* pattern, GlobPat_t* pat);
+int matchGlob(GlobPat_t* pat, char* name);
+DirCache_t* loadDir(DirCache_t** cache, char* path);
+void freeDirCache(DirCache_t** cache);
+void expandGlob(DirCache_t** cache, char* pattern, GlobResult_t* res);
+char** expandGlobs(char** cmd, DirCache_t** cache);
+char** expandGlobsFrom(char** cmd, int from, DirCache_t** cache);
+
+// Redirections and spawning
+int parseRedirs(char** cmd, char** argv, RedirList_t* redirs);
+void redirectFile(RedirList_t* redirs);
+int openRedirs(RedirList_t* redirs);
+void closeRedirs(RedirList_t* redirs);
+int redirSpawnActions(RedirList_t* redirs, posix_spawn_file_actions_t* actions);
+int spawnCommand(char** argv, RedirList_t* redirs, int* pid);
+
+// Files
+int makeDirs(const char* path);
+
+#endif
@@ -0,0 +1,728 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "lineread.h"
+
+extern char** environ;
+
+/**
+ * How a reader gets its input, see lineread.h
+ */
+enum{
+  LINE_BLOCK,
+  LINE_SEEK,
+  LINE_TEE,
+  LINE_BYTE
+};
+
+/**
+ * YashLineReader_t struct, an fd and the input read from it but not yet
+ * returned as lines. Returned lines are buf[0, pos), lines to come
+ * buf[pos, len); a newline search resumes at scan. A shared reader reads
+ * want bytes at a time, starting small after each sync since the rest is
+ * dropped then.
+ */
+struct YashLineReader_t{
+  int fd;
+  int mode;
+  int scratch[2];
+  char* buf;
+  size_t cap;
+  size_t pos;
+  size_t len;
+  size_t scan;
+  size_t peeked;
+  size_t want;
+  int eof;
+};
+
+/**
+ * Purpose:
+ *   Read exactly len bytes, resuming after short reads
+ *
+ * Args:
+ *   fd     (int): Input fd
+ *   buf  (char*): Destination
+ *   len (size_t): Bytes to read
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on error or early EOF
+ */
+int lineReadFull(int fd, char* buf, size_t len){
+  ssize_t ret;
+
+  while(len > 0){
+    if((ret = read(fd, buf, len)) < 0 && errno == EINTR){
+      continue;
+    }
+    if(ret <= 0){
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Start reading lines from an fd
+ *
+ * Args:
+ *   fd     (int): Input fd, left open by the reader
+ *   shared (int): 1 if another process may read fd after a line is
+ *                 returned (see lineReaderSync), 0 if the reader is its
+ *                 only reader
+ *
+ * Returns:
+ *   (YashLineReader_t*): Reader
+ */
+YashLineReader_t* lineReaderOpen(int fd, int shared){
+  YashLineReader_t* reader =
+    (YashLineReader_t*)calloc(1, sizeof(YashLineReader_t));
+  struct stat st;
+
+  reader->fd = fd;
+  reader->scratch[0] = reader->scratch[1] = -1;
+  reader->cap = LINEREAD_BLOCK + 1;
+  reader->buf = (char*)malloc(reader->cap);
+
+  reader->want = shared ? LINEREAD_PEEK : LINEREAD_BLOCK;
+  if(!shared){
+    reader->mode = LINE_BLOCK;
+  }
+  else if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+          lseek(fd, 0, SEEK_CUR) >= 0){
+    reader->mode = LINE_SEEK;
+  }
+  else if(S_ISFIFO(st.st_mode) && pipe2(reader->scratch, O_CLOEXEC) == 0){
+    reader->mode = LINE_TEE;
+  }
+  else{
+    reader->mode = LINE_BYTE;
+  }
+
+  return reader;
+}
+
+/**
+ * Purpose:
+ *   Read more input after buf[len]. Lines already returned are dropped
+ *   from the buffer first.
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader
+ *
+ * Returns:
+ *   (ssize_t): Bytes added, 0 at EOF, -1 on error
+ */
+ssize_t lineReaderFill(YashLineReader_t* reader){
+  size_t room;
+  ssize_t ret;
+
+  // A pipe is looked at with tee, which always starts at its head, so
+  // what was looked at before has to be consumed first. These bytes are
+  // already in the buffer; reading them over themselves is harmless.
+  if(reader->mode == LINE_TEE && reader->peeked > 0){
+    if(lineReadFull(reader->fd, reader->buf + reader->len - reader->peeked,
+                    reader->peeked) < 0){
+      return -1;
+    }
+    reader->peeked = 0;
+  }
+
+  if(reader->pos > 0){
+    memmove(reader->buf, reader->buf + reader->pos,
+            reader->len - reader->pos);
+    reader->len -= reader->pos;
+    reader->scan -= reader->pos;
+    reader->pos = 0;
+  }
+  if(reader->len + 1 >= reader->cap){
+    reader->cap *= 2;
+    reader->buf = (char*)realloc(reader->buf, reader->cap);
+  }
+  // One byte is kept for the terminator of a last line without a newline
+  room = reader->cap - reader->len - 1;
+  if(room > reader->want){
+    room = reader->want;
+  }
+  if(reader->len > 0 && reader->want < LINEREAD_BLOCK){
+    // A long line: look further ahead next time
+    reader->want *= 2;
+  }
+
+  for(;;){
+    if(reader->mode == LINE_TEE){
+      ret = tee(reader->fd, reader->scratch[1], room, 0);
+      if(ret < 0 && errno == EINVAL){
+        // Not a pipe tee accepts after all
+        reader->mode = LINE_BYTE;
+        continue;
+      }
+      if(ret > 0 &&
+         lineReadFull(reader->scratch[0], reader->buf + reader->len,
+                      ret) < 0){
+        return -1;
+      }
+      reader->peeked = (ret > 0) ? ret : 0;
+    }
+    else{
+      ret = read(reader->fd, reader->buf + reader->len,
+                 reader->mode == LINE_BYTE ? 1 : room);
+    }
+    if(ret < 0 && errno == EINTR){
+      continue;
+    }
+    break;
+  }
+  if(ret > 0){
+    reader->len += ret;
+  }
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   Return the next line, without its newline. A last line without a
+ *   newline is returned too.
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader
+ *   len               (size_t*): Set to the length of the line, may be
+ *                                NULL
+ *
+ * Returns:
+ *   (char*): NUL terminated line, valid until the next call; NULL at EOF
+ *            or on error
+ */
+char* lineReaderNext(YashLineReader_t* reader, size_t* len){
+  char* line = NULL;
+  char* end = NULL;
+  size_t next;
+
+  for(;;){
+    end = (char*)memchr(reader->buf + reader->scan, '\n',
+                        reader->len - reader->scan);
+    if(end != NULL){
+      next = end + 1 - reader->buf;
+      break;
+    }
+    reader->scan = reader->len;
+    if(reader->eof || lineReaderFill(reader) <= 0){
+      reader->eof = 1;
+      if(reader->pos == reader->len){
+        return NULL;
+      }
+      // Fill always leaves room for this terminator
+      end = reader->buf + reader->len;
+      next = reader->len;
+      break;
+    }
+  }
+
+  line = reader->buf + reader->pos;
+  *end = '\0';
+  if(len != NULL){
+    *len = end - line;
+  }
+  reader->pos = reader->scan = next;
+
+  return line;
+}
+
+/**
+ * Purpose:
+ *   Leave the fd just after the last line returned, so another process
+ *   reading it next sees the following line. Buffered input is dropped
+ *   unless the reader is the fd's only reader.
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader
+ *
+ * Returns:
+ *   None
+ */
+void lineReaderSync(YashLineReader_t* reader){
+  size_t inPipe;
+
+  if(reader->mode == LINE_BLOCK){
+    return;
+  }
+
+  if(reader->mode == LINE_SEEK && reader->len > reader->pos){
+    lseek(reader->fd, -(off_t)(reader->len - reader->pos), SEEK_CUR);
+  }
+  else if(reader->mode == LINE_TEE &&
+          reader->pos > reader->len - reader->peeked){
+    // Consume the returned lines that were only looked at
+    inPipe = reader->pos - (reader->len - reader->peeked);
+    lineReadFull(reader->fd, reader->buf + reader->len - reader->peeked,
+                 inPipe);
+  }
+  reader->pos = reader->len = reader->scan = reader->peeked = 0;
+  reader->want = LINEREAD_PEEK;
+  reader->eof = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Sync and free a reader. The fd stays open.
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void lineReaderClose(YashLineReader_t* reader){
+  if(reader == NULL){
+    return;
+  }
+
+  lineReaderSync(reader);
+  if(reader->scratch[0] >= 0){
+    close(reader->scratch[0]);
+    close(reader->scratch[1]);
+  }
+  free(reader->buf);
+  free(reader);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Name of the way a reader gets its input
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader
+ *
+ * Returns:
+ *   (const char*): "block", "seek", "tee" or "byte"
+ */
+const char* lineReaderMode(YashLineReader_t* reader){
+  const char* NAMES[] = {"block", "seek", "tee", "byte"};
+
+  return NAMES[reader->mode];
+}
+
+/**
+ * Purpose:
+ *   Read one input record as read does: unless raw, a backslash quotes the
+ *   next character and a backslash at the end of a line joins the next one
+ *
+ * Args:
+ *   reader (YashLineReader_t*): Reader
+ *   raw                  (int): 1 for read -r
+ *   store              (char**): Growable buffer for cooked records
+ *   cap               (size_t*): Size of *store
+ *
+ * Returns:
+ *   (char*): Record, NULL at EOF
+ */
+char* lineRecord(YashLineReader_t* reader, int raw, char** store,
+                 size_t* cap){
+  char* line = NULL;
+  size_t len;
+  size_t out = 0;
+  size_t index;
+  int more = 1;
+
+  if((line = lineReaderNext(reader, &len)) == NULL){
+    return NULL;
+  }
+  if(raw || memchr(line, '\\', len) == NULL){
+    return line;
+  }
+
+  while(more){
+    more = 0;
+    if(out + len + 1 > *cap){
+      *cap = 2 * (out + len + 1);
+      *store = (char*)realloc(*store, *cap);
+    }
+    for(index = 0; index < len; index++){
+      if(line[index] != '\\'){
+        (*store)[out++] = line[index];
+      }
+      else if(index + 1 < len){
+        (*store)[out++] = line[++index];
+      }
+      else{
+        more = ((line = lineReaderNext(reader, &len)) != NULL);
+        break;
+      }
+    }
+  }
+  (*store)[out] = '\0';
+
+  return *store;
+}
+
+/**
+ * Purpose:
+ *   Split a record on blanks into variables; the last one gets the rest of
+ *   the record. Variables are environment variables, the only kind the
+ *   shell has.
+ *
+ * Args:
+ *   record  (char*): Record, split in place
+ *   names  (char**): Variable names
+ *   numNames  (int): Number of names
+ *   errFd     (int): fd for messages
+ *
+ * Returns:
+ *   (int): 0 on success, 1 if a name is not valid
+ */
+int lineSetFields(char* record, char** names, int numNames, int errFd){
+  const char* BLANKS = " \t";
+
+  char* value = NULL;
+  char* end = NULL;
+  int index;
+
+  record += strspn(record, BLANKS);
+  for(index = 0; index < numNames; index++){
+    value = record;
+    if(index == numNames - 1){
+      end = value + strlen(value);
+      while(end > value && strchr(BLANKS, end[-1]) != NULL){
+        end--;
+      }
+      *end = '\0';
+    }
+    else{
+      record += strcspn(record, BLANKS);
+      if(*record != '\0'){
+        *record++ = '\0';
+        record += strspn(record, BLANKS);
+      }
+    }
+    if(setenv(names[index], value, 1) < 0){
+      dprintf(errFd, "yash: read: %s: not a valid name\n", names[index]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   read builtin:
+ *     read [-r] NAME...
+ *   Read a line from stdin and split it into the named variables. Runs in
+ *   the shell process, so unlike a plugin builtin it changes the
+ *   environment; later commands see the variables.
+ *
+ * Args:
+ *   ctx (YashBuiltinCtx_t*): fds of the builtin
+ *   argc              (int): Number of arguments
+ *   argv           (char**): Arguments, argv[0] is "read"
+ *
+ * Returns:
+ *   (int): 0 if a line was read, 1 at EOF, 2 on a usage error
+ */
+int lineReadBuiltin(YashBuiltinCtx_t* ctx, int argc, char** argv){
+  YashLineReader_t* reader = NULL;
+  char* store = NULL;
+  char* record = NULL;
+  size_t cap = 0;
+  int raw = 0;
+  int index = 1;
+  int status;
+
+  if(argc > 1 && !strcmp(argv[1], "-r")){
+    raw = 1;
+    index++;
+  }
+  if(index >= argc){
+    dprintf(ctx->errFd, "usage: read [-r] name...\n");
+    return 2;
+  }
+
+  // Only stdin is read again afterwards, by the shell or by another
+  // command; an fd from a redirection is closed after this line
+  reader = lineReaderOpen(ctx->inFd, ctx->inFd == STDIN_FILENO);
+  if((record = lineRecord(reader, raw, &store, &cap)) == NULL){
+    status = 1;
+  }
+  else{
+    status = lineSetFields(record, argv + index, argc - index, ctx->errFd);
+  }
+  lineReaderClose(reader);
+  free(store);
+
+  return status;
+}
+
+/**
+ * Purpose:
+ *   Value of a word that is exactly $NAME or ${NAME}
+ *
+ * Args:
+ *   word (const char*): Word
+ *   isVar       (int*): Set to 1 if the word names a variable
+ *
+ * Returns:
+ *   (char*): Value, NULL if the word is not a variable or it is unset
+ */
+char* lineVar(const char* word, int* isVar){
+  char name[256];
+  size_t len = strlen(word);
+
+  *isVar = 0;
+  if(word[0] != '$' || len < 2){
+    return NULL;
+  }
+  if(word[1] == '{'){
+    if(len < 4 || word[len - 1] != '}' || len - 3 >= sizeof(name)){
+      return NULL;
+    }
+    memcpy(name, word + 2, len - 3);
+    name[len - 3] = '\0';
+    *isVar = 1;
+    return getenv(name);
+  }
+  *isVar = 1;
+
+  return getenv(word + 1);
+}
+
+/**
+ * Purpose:
+ *   Build the argv of one run of a loop body: a word that is exactly
+ *   $NAME or ${NAME} is replaced by the words of that variable, and
+ *   disappears if it is unset or empty
+ *
+ * Args:
+ *   body  (char**): Body words
+ *   argv (char***): Growable argv, NULL terminated on return
+ *   cap     (int*): Size of *argv
+ *   copy  (char**): Set to storage argv points into, for free()
+ *
+ * Returns:
+ *   (int): Number of words
+ */
+int lineExpand(char** body, char*** argv, int* cap, char** copy){
+  const char* BLANKS = " \t\n";
+
+  size_t size = 0;
+  char* value = NULL;
+  char* save = NULL;
+  char* word = NULL;
+  char* out = NULL;
+  int numWords = 0;
+  int isVar;
+  int index;
+
+  // One buffer holds every expanded value
+  for(index = 0; body[index] != NULL; index++){
+    if((value = lineVar(body[index], &isVar)) != NULL){
+      size += strlen(value) + 1;
+    }
+  }
+  *copy = out = (char*)malloc(size + 1);
+
+  for(index = 0; body[index] != NULL; index++){
+    word = body[index];
+    if((value = lineVar(word, &isVar)) != NULL){
+      // Split on blanks, as an unquoted expansion is
+      strcpy(out, value);
+      for(word = strtok_r(out, BLANKS, &save); word != NULL;
+          word = strtok_r(NULL, BLANKS, &save)){
+        if(numWords + 2 > *cap){
+          *cap = 2 * (numWords + 2);
+          *argv = (char**)realloc(*argv, *cap * sizeof(char*));
+        }
+        (*argv)[numWords++] = word;
+      }
+      out += strlen(value) + 1;
+      continue;
+    }
+    if(isVar){
+      continue;
+    }
+    if(numWords + 2 > *cap){
+      *cap = 2 * (numWords + 2);
+      *argv = (char**)realloc(*argv, *cap * sizeof(char*));
+    }
+    (*argv)[numWords++] = word;
+  }
+  if(*cap == 0){
+    *cap = 1;
+    *argv = (char**)malloc(sizeof(char*));
+  }
+  (*argv)[numWords] = NULL;
+
+  return numWords;
+}
+
+/**
+ * Purpose:
+ *   Copy a word without a trailing ';'
+ *
+ * Args:
+ *   word (const char*): Word
+ *   ended      (int*): Set to 1 if the word ended with ';'
+ *
+ * Returns:
+ *   (char*): Copy, for free()
+ */
+char* lineWord(const char* word, int* ended){
+  size_t len = strlen(word);
+
+  *ended = (len > 0 && word[len - 1] == ';');
+
+  return strndup(word, len - *ended);
+}
+
+/**
+ * Purpose:
+ *   while builtin, a read loop over stdin:
+ *     while read [-r] NAME... ; do COMMAND [ARG...] ; done
+ *   For each line the variables are set as read sets them and COMMAND is
+ *   run with $NAME words expanded. COMMAND shares stdin with the loop, so
+ *   the reader is synced before each run. Redirections anywhere on the
+ *   line apply to the whole loop. Always runs in a child of its own, so
+ *   the loop and its commands are one job in one process group.
+ *
+ * Args:
+ *   ctx (YashBuiltinCtx_t*): fds of the builtin
+ *   argc              (int): Number of arguments
+ *   argv           (char**): Arguments, argv[0] is "while"
+ *
+ * Returns:
+ *   (int): Status of the last COMMAND run, 0 if none, 2 on a syntax error
+ */
+int lineWhileBuiltin(YashBuiltinCtx_t* ctx, int argc, char** argv){
+  const char* USAGE =
+    "usage: while read [-r] name...; do command [arg...]; done\n";
+
+  YashLineReader_t* reader = NULL;
+  posix_spawn_file_actions_t actions;
+  char** names = (char**)calloc(argc + 1, sizeof(char*));
+  char** body = (char**)calloc(argc + 1, sizeof(char*));
+  char** runArgv = NULL;
+  char* store = NULL;
+  char* record = NULL;
+  char* copy = NULL;
+  char* word = NULL;
+  size_t cap = 0;
+  int runCap = 0;
+  int numNames = 0;
+  int numBody = 0;
+  int ended = 0;
+  int raw = 0;
+  int status = 0;
+  int index = 2;
+  int wstatus;
+  int err;
+  int pid;
+
+  // Parse the loop; words may carry the ';' that ends a list
+  if(argc > 2 && !strcmp(argv[2], "-r")){
+    raw = 1;
+    index++;
+  }
+  // A ';' standing alone reduces to an empty word, which is dropped
+  while(argc > 1 && !strcmp(argv[1], "read") && index < argc && !ended){
+    word = lineWord(argv[index++], &ended);
+    if(word[0] != '\0'){
+      names[numNames++] = word;
+    }
+    else{
+      free(word);
+    }
+  }
+  if(ended && index < argc && !strcmp(argv[index], "do")){
+    for(index++; index < argc && strcmp(argv[index], "done"); index++){
+      word = lineWord(argv[index], &ended);
+      if(word[0] != '\0'){
+        body[numBody++] = word;
+      }
+      else{
+        free(word);
+      }
+    }
+  }
+  if(numNames == 0 || numBody == 0 || index != argc - 1){
+    dprintf(ctx->errFd, "%s", USAGE);
+    status = 2;
+  }
+
+  posix_spawn_file_actions_init(&actions);
+  if(ctx->inFd != STDIN_FILENO){
+    posix_spawn_file_actions_adddup2(&actions, ctx->inFd, STDIN_FILENO);
+  }
+  if(ctx->outFd != STDOUT_FILENO){
+    posix_spawn_file_actions_adddup2(&actions, ctx->outFd, STDOUT_FILENO);
+  }
+  if(ctx->errFd != STDERR_FILENO){
+    posix_spawn_file_actions_adddup2(&actions, ctx->errFd, STDERR_FILENO);
+  }
+
+  reader = lineReaderOpen(ctx->inFd, 1);
+  while(status != 2 &&
+        (record = lineRecord(reader, raw, &store, &cap)) != NULL){
+    if(lineSetFields(record, names, numNames, ctx->errFd)){
+      status = 1;
+      break;
+    }
+    if(lineExpand(body, &runArgv, &runCap, &copy) == 0){
+      free(copy);
+      continue;
+    }
+
+    // The command may read the rest of stdin itself
+    lineReaderSync(reader);
+    err = posix_spawnp(&pid, runArgv[0], &actions, NULL, runArgv, environ);
+    if(err){
+      dprintf(ctx->errFd, "yash: %s: %s\n", runArgv[0], strerror(err));
+      status = 127;
+      free(copy);
+      continue;
+    }
+    while(waitpid(pid, &wstatus, 0) < 0 && errno == EINTR);
+    free(copy);
+    if(WIFSIGNALED(wstatus)){
+      status = 128 + WTERMSIG(wstatus);
+      if(WTERMSIG(wstatus) == SIGINT || WTERMSIG(wstatus) == SIGQUIT){
+        break;
+      }
+    }
+    else{
+      status = WEXITSTATUS(wstatus);
+    }
+  }
+  lineReaderClose(reader);
+  posix_spawn_file_actions_destroy(&actions);
+
+  for(index = 0; index < numNames; index++){
+    free(names[index]);
+  }
+  for(index = 0; index < numBody; index++){
+    free(body[index]);
+  }
+  free(names);
+  free(body);
+  free(runArgv);
+  free(store);
+
+  return status;
+}
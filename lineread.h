@@ -0,0 +1,34 @@
+#ifndef LINEREAD_H
+#define LINEREAD_H
+
+#include <stddef.h>
+
+#include "yash_plugin.h"
+
+// Line input for the read and while builtins. A shell reading lines from
+// an fd that other processes also read (the body of a while loop inherits
+// it) must not consume past the line it returns, which is why most shells
+// read one byte at a time. Here input is read in blocks and the reader is
+// synced before another process can see the fd:
+//   regular file   read blocks, lseek back to the end of the last line
+//   pipe           tee(2) a block into a scratch pipe to look at it, then
+//                  consume exactly the lines returned
+//   other          one byte at a time
+// Reads after a sync start at LINEREAD_PEEK bytes and grow while a line
+// does not fit. An fd no other process reads is read in plain blocks.
+
+#define LINEREAD_BLOCK (64 * 1024)
+#define LINEREAD_PEEK 256
+
+typedef struct YashLineReader_t YashLineReader_t;
+
+YashLineReader_t* lineReaderOpen(int fd, int shared);
+char* lineReaderNext(YashLineReader_t* reader, size_t* len);
+void lineReaderSync(YashLineReader_t* reader);
+void lineReaderClose(YashLineReader_t* reader);
+const char* lineReaderMode(YashLineReader_t* reader);
+
+int lineReadBuiltin(YashBuiltinCtx_t* ctx, int argc, char** argv);
+int lineWhileBuiltin(YashBuiltinCtx_t* ctx, int argc, char** argv);
+
+#endif
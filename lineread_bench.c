@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lineread.h"
+
+// Benchmark for the line reader behind read and while. LINES lines are
+// written to a temporary file and read back from the file and from a pipe
+// fed by a child, once one byte per read(2) as a shell that cannot look
+// ahead does, and once through the reader: shared, synced after every line
+// as the while loop does before each command, and unshared.
+//
+//   lineread_bench [LINES]
+
+#define BENCH_LINES 10000000
+#define BENCH_CHUNK (64 * 1024)
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Open the input: the file itself, or a pipe a child copies it into
+ *
+ * Args:
+ *   path (const char*): Input file
+ *   viaPipe      (int): 1 for a pipe
+ *
+ * Returns:
+ *   (int): fd to read
+ */
+int openInput(const char* path, int viaPipe){
+  char buf[BENCH_CHUNK];
+  ssize_t len;
+  int pfd[2];
+  int fd = open(path, O_RDONLY);
+
+  if(!viaPipe){
+    return fd;
+  }
+  pipe(pfd);
+  if(fork() == 0){
+    close(pfd[0]);
+    while((len = read(fd, buf, sizeof(buf))) > 0 &&
+          write(pfd[1], buf, len) == len);
+    _exit(0);
+  }
+  close(fd);
+  close(pfd[1]);
+
+  return pfd[0];
+}
+
+/**
+ * Purpose:
+ *   Count lines reading one byte at a time
+ *
+ * Args:
+ *   fd (int): Input fd
+ *
+ * Returns:
+ *   (long): Lines
+ */
+long countBytewise(int fd){
+  long lines = 0;
+  char c;
+
+  while(read(fd, &c, 1) == 1){
+    lines += (c == '\n');
+  }
+
+  return lines;
+}
+
+/**
+ * Purpose:
+ *   Count lines through a reader
+ *
+ * Args:
+ *   fd     (int): Input fd
+ *   shared (int): Passed to lineReaderOpen; a shared reader is synced
+ *                 after every line
+ *   mode (const char**): Set to the reader's mode
+ *
+ * Returns:
+ *   (long): Lines
+ */
+long countReader(int fd, int shared, const char** mode){
+  YashLineReader_t* reader = lineReaderOpen(fd, shared);
+  long lines = 0;
+
+  *mode = lineReaderMode(reader);
+  while(lineReaderNext(reader, NULL) != NULL){
+    lines++;
+    if(shared){
+      lineReaderSync(reader);
+    }
+  }
+  lineReaderClose(reader);
+
+  return lines;
+}
+
+/**
+ * Purpose:
+ *   Run one way of reading and print its rate
+ *
+ * Args:
+ *   path (const char*): Input file
+ *   expected    (long): Lines in the file
+ *   viaPipe      (int): 1 to read through a pipe
+ *   how          (int): 0 bytewise, 1 shared reader, 2 unshared reader
+ *
+ * Returns:
+ *   None
+ */
+void report(const char* path, long expected, int viaPipe, int how){
+  const char* mode = "byte/read";
+  double begin;
+  double secs;
+  long lines;
+  int fd;
+
+  fd = openInput(path, viaPipe);
+  begin = nowSec();
+  if(how == 0){
+    lines = countBytewise(fd);
+  }
+  else{
+    lines = countReader(fd, how == 1, &mode);
+  }
+  secs = nowSec() - begin;
+  close(fd);
+  while(wait(NULL) > 0);
+
+  printf("%-5s %-9s %-6s %10ld lines %7.2f s %8.2f Mlines/s%s\n",
+         viaPipe ? "pipe" : "file", mode,
+         how == 0 ? "" : (how == 1 ? "shared" : "owned"), lines, secs,
+         lines / secs / 1e6, lines == expected ? "" : "  WRONG COUNT");
+
+  return;
+}
+
+int main(int argc, char** argv){
+  char path[] = "/tmp/lineread_bench.XXXXXX";
+  FILE* out = NULL;
+  long numLines = BENCH_LINES;
+  long index;
+  int viaPipe;
+  int how;
+
+  if(argc > 2 || (argc == 2 && (numLines = atol(argv[1])) <= 0)){
+    fprintf(stderr, "usage: lineread_bench [LINES]\n");
+    return 1;
+  }
+  out = fdopen(mkstemp(path), "w");
+  for(index = 0; index < numLines; index++){
+    fprintf(out, "%ld record-%ld %s\n", index, index % 977,
+            (index % 3) ? "ok" : "retry");
+  }
+  fclose(out);
+
+  for(viaPipe = 0; viaPipe < 2; viaPipe++){
+    for(how = 0; how < 3; how++){
+      report(path, numLines, viaPipe, how);
+    }
+  }
+  unlink(path);
+
+  return 0;
+}
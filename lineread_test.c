@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "lineread.h"
+
+// Checks for the while builtin's loop parsing. Each case runs the builtin
+// over the same two input lines and compares what it wrote. The ';' that
+// ends a list may be attached to a word or stand alone, as it does on a
+// line with a group. Build with -fsanitize=address to catch bad reads of
+// the parsed words.
+//
+//   lineread_test
+
+#define TEST_INPUT "1\n2\n"
+#define TEST_OUT_MAX 4096
+
+/**
+ * TestCase_t struct, a loop and the output it must produce
+ */
+typedef struct TestCase_t{
+  const char* words[16];
+  const char* expect;
+  int status;
+}TestCase_t;
+
+/**
+ * Purpose:
+ *   Run the while builtin on one case
+ *
+ * Args:
+ *   test (TestCase_t*): Case
+ *
+ * Returns:
+ *   (int): 0 if it passed, 1 if not
+ */
+int runCase(TestCase_t* test){
+  char out[TEST_OUT_MAX];
+  char* argv[16];
+  YashBuiltinCtx_t ctx;
+  ssize_t len;
+  int inFd = memfd_create("in", 0);
+  int outFd = memfd_create("out", 0);
+  int argc = 0;
+  int status;
+
+  while(test->words[argc] != NULL){
+    argv[argc] = (char*)test->words[argc];
+    argc++;
+  }
+  argv[argc] = NULL;
+
+  write(inFd, TEST_INPUT, strlen(TEST_INPUT));
+  lseek(inFd, 0, SEEK_SET);
+  ctx.abi = YASH_PLUGIN_ABI;
+  ctx.inFd = inFd;
+  ctx.outFd = outFd;
+  ctx.errFd = outFd;
+  ctx.alloc = malloc;
+  ctx.free = free;
+  status = lineWhileBuiltin(&ctx, argc, argv);
+
+  len = pread(outFd, out, sizeof(out) - 1, 0);
+  out[len < 0 ? 0 : len] = '\0';
+  close(inFd);
+  close(outFd);
+  if(status != test->status || strcmp(out, test->expect)){
+    printf("FAIL:");
+    for(argc = 0; argv[argc] != NULL; argc++){
+      printf(" %s", argv[argc]);
+    }
+    printf("\n  status %d, want %d\n  output \"%s\"\n  want   \"%s\"\n",
+           status, test->status, out, test->expect);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(void){
+  TestCase_t tests[] = {
+    {{"while", "read", "X;", "do", "echo", "A", "$X;", "done", NULL},
+     "A 1\nA 2\n", 0},
+    {{"while", "read", "X", ";", "do", "echo", "A", "$X", ";", "done", NULL},
+     "A 1\nA 2\n", 0},
+    {{"while", "read", "-r", "X", ";", "do", "echo", "${X}", ";", "done",
+      NULL}, "1\n2\n", 0},
+    {{"while", "read", "X", "Y", ";", "do", "echo", "$X", ";", "done", NULL},
+     "1\n2\n", 0},
+    {{"while", "read", ";", "do", "echo", ";", "done", NULL},
+     "usage: while read [-r] name...; do command [arg...]; done\n", 2},
+    {{"while", "read", "X", ";", "do", ";", "done", NULL},
+     "usage: while read [-r] name...; do command [arg...]; done\n", 2}
+  };
+  int numTests = sizeof(tests) / sizeof(tests[0]);
+  int failed = 0;
+  int index;
+
+  for(index = 0; index < numTests; index++){
+    failed += runCase(&tests[index]);
+  }
+  printf("%d of %d passed\n", numTests - failed, numTests);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
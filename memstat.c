@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memstat.h"
+
+#define MEM_DEBUG_BUCKETS 4096
+#define MEM_DEBUG_SHOWN 32
+
+static const char* MEM_TAG_NAMES[MEM_NUM_TAGS] = {"parser", "jobs",
+                                                  "history", "notify"};
+
+// Counters are updated with atomics: a shell thread may free a block
+static YashMemStats_t memTags[MEM_NUM_TAGS];
+static int64_t memStartNs = 0;
+static int64_t memLastNs = 0;
+static uint64_t memLastAllocs[MEM_NUM_TAGS];
+
+#ifdef YASH_MEM_DEBUG
+/**
+ * MemBlock_t struct, a live block and where it was allocated
+ */
+typedef struct MemBlock_t{
+  void* ptr;
+  size_t size;
+  int tag;
+  const char* file;
+  int line;
+
+  struct MemBlock_t* next;
+}MemBlock_t;
+
+static MemBlock_t* memBlocks[MEM_DEBUG_BUCKETS];
+static pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t memOwner = 0;
+#endif
+
+/**
+ * Purpose:
+ *   CLOCK_MONOTONIC in ns
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (int64_t): Nanoseconds
+ */
+int64_t memNowNs(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Purpose:
+ *   Format a byte count with a unit
+ *
+ * Args:
+ *   bytes (uint64_t): Byte count
+ *   buf      (char*): Output buffer
+ *   size    (size_t): Size of buf
+ *
+ * Returns:
+ *   (char*): buf
+ */
+char* memFormatBytes(uint64_t bytes, char* buf, size_t size){
+  const char* UNITS[] = {"B", "KB", "MB", "GB", "TB"};
+
+  double volume = bytes;
+  int unit = 0;
+
+  while(volume >= 1024 && unit < 4){
+    volume /= 1024;
+    unit++;
+  }
+  snprintf(buf, size, "%.*f %s", unit > 0 ? 1 : 0, volume, UNITS[unit]);
+
+  return buf;
+}
+
+#ifdef YASH_MEM_DEBUG
+/**
+ * Purpose:
+ *   List the blocks still live when the shell exits. Children that exit
+ *   through exit(3) inherited the table and stay quiet.
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   None
+ */
+void memAtExit(void){
+  if(getpid() == memOwner){
+    memLeaks(stderr);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Bucket of a block in the debug table
+ *
+ * Args:
+ *   ptr (void*): Block
+ *
+ * Returns:
+ *   (size_t): Bucket index
+ */
+size_t memBucket(void* ptr){
+  return ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 52;
+}
+#endif
+
+/**
+ * Purpose:
+ *   Count a new block against a tag
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   ptr        (void*): Block, may be NULL
+ *   file (const char*): Allocating source file
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   None
+ */
+void memCount(int tag, void* ptr, const char* file, int line){
+  YashMemStats_t* stats = &memTags[tag];
+  uint64_t size;
+  uint64_t live;
+  uint64_t peak;
+
+  if(ptr == NULL){
+    return;
+  }
+  size = malloc_usable_size(ptr);
+
+  __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->allocBytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->liveBlocks, 1, __ATOMIC_RELAXED);
+  live = __atomic_add_fetch(&stats->liveBytes, size, __ATOMIC_RELAXED);
+  peak = __atomic_load_n(&stats->peakBytes, __ATOMIC_RELAXED);
+  while(live > peak &&
+        !__atomic_compare_exchange_n(&stats->peakBytes, &peak, live, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+#ifdef YASH_MEM_DEBUG
+  MemBlock_t* block = (MemBlock_t*)malloc(sizeof(MemBlock_t));
+  size_t bucket = memBucket(ptr);
+
+  block->ptr = ptr;
+  block->size = size;
+  block->tag = tag;
+  block->file = file;
+  block->line = line;
+  pthread_mutex_lock(&memLock);
+  block->next = memBlocks[bucket];
+  memBlocks[bucket] = block;
+  pthread_mutex_unlock(&memLock);
+#else
+  (void)file;
+  (void)line;
+#endif
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Stop counting a block that is about to be freed or reallocated
+ *
+ * Args:
+ *   tag   (int): Subsystem it was counted against
+ *   ptr (void*): Block, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void memUncount(int tag, void* ptr){
+  YashMemStats_t* stats = &memTags[tag];
+  uint64_t size;
+
+  if(ptr == NULL){
+    return;
+  }
+  size = malloc_usable_size(ptr);
+
+#ifdef YASH_MEM_DEBUG
+  MemBlock_t** link = &memBlocks[memBucket(ptr)];
+  MemBlock_t* block = NULL;
+
+  pthread_mutex_lock(&memLock);
+  while(*link != NULL && (*link)->ptr != ptr){
+    link = &(*link)->next;
+  }
+  if((block = *link) != NULL){
+    *link = block->next;
+  }
+  pthread_mutex_unlock(&memLock);
+
+  if(block == NULL){
+    fprintf(stderr, "yash: mem: %s: freeing untracked block %p\n",
+            MEM_TAG_NAMES[tag], ptr);
+    return;
+  }
+  if(block->tag != tag){
+    fprintf(stderr, "yash: mem: %s block from %s:%d freed as %s\n",
+            MEM_TAG_NAMES[block->tag], block->file, block->line,
+            MEM_TAG_NAMES[tag]);
+    stats = &memTags[block->tag];
+  }
+  free(block);
+#endif
+
+  __atomic_sub_fetch(&stats->liveBlocks, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&stats->liveBytes, size, __ATOMIC_RELAXED);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   malloc counted against a tag
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   size      (size_t): Bytes
+ *   file (const char*): Allocating source file (memAlloc passes __FILE__)
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   (void*): Block to release with memFree or free
+ */
+void* memAllocAt(int tag, size_t size, const char* file, int line){
+  void* ptr = malloc(size);
+
+  memCount(tag, ptr, file, line);
+  return ptr;
+}
+
+/**
+ * Purpose:
+ *   calloc counted against a tag
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   num       (size_t): Elements
+ *   size      (size_t): Bytes per element
+ *   file (const char*): Allocating source file
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   (void*): Zeroed block
+ */
+void* memCallocAt(int tag, size_t num, size_t size, const char* file,
+                  int line){
+  void* ptr = calloc(num, size);
+
+  memCount(tag, ptr, file, line);
+  return ptr;
+}
+
+/**
+ * Purpose:
+ *   realloc counted against a tag; the block is counted as a new
+ *   allocation
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   ptr        (void*): Block counted against tag, may be NULL
+ *   size      (size_t): New size in bytes
+ *   file (const char*): Allocating source file
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   (void*): Resized block, NULL on failure with ptr still counted
+ */
+void* memReallocAt(int tag, void* ptr, size_t size, const char* file,
+                   int line){
+  void* grown = NULL;
+
+  memUncount(tag, ptr);
+  if((grown = realloc(ptr, size)) == NULL){
+    memCount(tag, ptr, file, line);
+    return NULL;
+  }
+  memCount(tag, grown, file, line);
+
+  return grown;
+}
+
+/**
+ * Purpose:
+ *   strdup counted against a tag
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   str  (const char*): String to copy
+ *   file (const char*): Allocating source file
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   (char*): Copy
+ */
+char* memStrdupAt(int tag, const char* str, const char* file, int line){
+  char* copy = strdup(str);
+
+  memCount(tag, copy, file, line);
+  return copy;
+}
+
+/**
+ * Purpose:
+ *   strndup counted against a tag
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   str  (const char*): String to copy
+ *   len       (size_t): At most this many bytes
+ *   file (const char*): Allocating source file
+ *   line         (int): Allocating line
+ *
+ * Returns:
+ *   (char*): Copy
+ */
+char* memStrndupAt(int tag, const char* str, size_t len, const char* file,
+                   int line){
+  char* copy = strndup(str, len);
+
+  memCount(tag, copy, file, line);
+  return copy;
+}
+
+/**
+ * Purpose:
+ *   Start counting a block malloc'd by code that does not use tags, such
+ *   as a token array from libyash or a line from readline
+ *
+ * Args:
+ *   tag          (int): Subsystem
+ *   ptr        (void*): malloc'd block, may be NULL
+ *   file (const char*): Source file taking the block over
+ *   line         (int): Line taking the block over
+ *
+ * Returns:
+ *   (void*): ptr
+ */
+void* memChargeAt(int tag, void* ptr, const char* file, int line){
+  memCount(tag, ptr, file, line);
+  return ptr;
+}
+
+/**
+ * Purpose:
+ *   Free a block counted against a tag
+ *
+ * Args:
+ *   tag   (int): Subsystem
+ *   ptr (void*): Block, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void memFree(int tag, void* ptr){
+  memUncount(tag, ptr);
+  free(ptr);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Name of a tag
+ *
+ * Args:
+ *   tag (int): Subsystem
+ *
+ * Returns:
+ *   (const char*): Name
+ */
+const char* memTagName(int tag){
+  return MEM_TAG_NAMES[tag];
+}
+
+/**
+ * Purpose:
+ *   Copy the counters of a tag
+ *
+ * Args:
+ *   tag                (int): Subsystem
+ *   stats (YashMemStats_t*): Set to the counters
+ *
+ * Returns:
+ *   None
+ */
+void memStats(int tag, YashMemStats_t* stats){
+  YashMemStats_t* curr = &memTags[tag];
+
+  stats->liveBytes = __atomic_load_n(&curr->liveBytes, __ATOMIC_RELAXED);
+  stats->liveBlocks = __atomic_load_n(&curr->liveBlocks, __ATOMIC_RELAXED);
+  stats->peakBytes = __atomic_load_n(&curr->peakBytes, __ATOMIC_RELAXED);
+  stats->allocs = __atomic_load_n(&curr->allocs, __ATOMIC_RELAXED);
+  stats->allocBytes = __atomic_load_n(&curr->allocBytes, __ATOMIC_RELAXED);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Start the clock for allocation rates and, in a YASH_MEM_DEBUG build,
+ *   the report at exit
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   None
+ */
+void memInit(void){
+  memStartNs = memNowNs();
+  memLastNs = memStartNs;
+#ifdef YASH_MEM_DEBUG
+  memOwner = getpid();
+  atexit(memAtExit);
+#endif
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Print a table of the counters: live bytes and blocks, peak, and
+ *   allocations per second since the shell started and since the last
+ *   call, then the whole heap in use as malloc sees it
+ *
+ * Args:
+ *   out (FILE*): Stream to print to
+ *
+ * Returns:
+ *   None
+ */
+void memPrint(FILE* out){
+  const char* HEAD_FMT = "%-9s %10s %8s %10s %10s %10s %10s\n";
+  const char* ROW_FMT = "%-9s %10s %8llu %10s %10llu %10.1f %10.1f\n";
+
+  char live[32];
+  char peak[32];
+  char total[32];
+  YashMemStats_t stats;
+  YashMemStats_t sum;
+  struct mallinfo2 info = mallinfo2();
+  int64_t now = memNowNs();
+  double sinceStart = (now - memStartNs) / 1e9;
+  double sinceLast = (now - memLastNs) / 1e9;
+  int tag;
+
+  memset(&sum, 0, sizeof(sum));
+  fprintf(out, HEAD_FMT, "subsystem", "live", "blocks", "peak", "allocs",
+          "allocs/s", "recent/s");
+  for(tag = 0; tag < MEM_NUM_TAGS; tag++){
+    memStats(tag, &stats);
+    fprintf(out, ROW_FMT, MEM_TAG_NAMES[tag],
+            memFormatBytes(stats.liveBytes, live, sizeof(live)),
+            (unsigned long long)stats.liveBlocks,
+            memFormatBytes(stats.peakBytes, peak, sizeof(peak)),
+            (unsigned long long)stats.allocs,
+            sinceStart > 0 ? stats.allocs / sinceStart : 0,
+            sinceLast > 0 ?
+              (stats.allocs - memLastAllocs[tag]) / sinceLast : 0);
+    memLastAllocs[tag] = stats.allocs;
+    sum.liveBytes += stats.liveBytes;
+    sum.liveBlocks += stats.liveBlocks;
+  }
+  memLastNs = now;
+
+  fprintf(out, "tagged %s in %llu blocks; heap in use %s, free %s\n",
+          memFormatBytes(sum.liveBytes, live, sizeof(live)),
+          (unsigned long long)sum.liveBlocks,
+          memFormatBytes(info.uordblks + info.hblkhd, total, sizeof(total)),
+          memFormatBytes(info.fordblks, peak, sizeof(peak)));
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Report blocks still counted against a tag. A YASH_MEM_DEBUG build
+ *   lists each with the line that allocated it; otherwise the totals per
+ *   tag are printed.
+ *
+ * Args:
+ *   out (FILE*): Stream to print to
+ *
+ * Returns:
+ *   (int): Number of live blocks
+ */
+int memLeaks(FILE* out){
+  char bytes[32];
+  YashMemStats_t stats;
+  uint64_t numBlocks = 0;
+  uint64_t numBytes = 0;
+  int tag;
+
+  for(tag = 0; tag < MEM_NUM_TAGS; tag++){
+    memStats(tag, &stats);
+    numBlocks += stats.liveBlocks;
+    numBytes += stats.liveBytes;
+  }
+  if(numBlocks == 0){
+    return 0;
+  }
+  fprintf(out, "yash: mem: %llu blocks (%s) still allocated\n",
+          (unsigned long long)numBlocks,
+          memFormatBytes(numBytes, bytes, sizeof(bytes)));
+
+#ifdef YASH_MEM_DEBUG
+  MemBlock_t* block = NULL;
+  size_t bucket;
+  int shown = 0;
+
+  pthread_mutex_lock(&memLock);
+  for(bucket = 0; bucket < MEM_DEBUG_BUCKETS; bucket++){
+    for(block = memBlocks[bucket]; block != NULL; block = block->next){
+      if(shown++ < MEM_DEBUG_SHOWN){
+        fprintf(out, "yash: mem:   %-8s %10zu B  %s:%d\n",
+                MEM_TAG_NAMES[block->tag], block->size, block->file,
+                block->line);
+      }
+    }
+  }
+  pthread_mutex_unlock(&memLock);
+  if(shown > MEM_DEBUG_SHOWN){
+    fprintf(out, "yash: mem:   ... %d more\n", shown - MEM_DEBUG_SHOWN);
+  }
+#else
+  for(tag = 0; tag < MEM_NUM_TAGS; tag++){
+    memStats(tag, &stats);
+    if(stats.liveBlocks > 0){
+      fprintf(out, "yash: mem:   %-8s %llu blocks (%s)\n",
+              MEM_TAG_NAMES[tag], (unsigned long long)stats.liveBlocks,
+              memFormatBytes(stats.liveBytes, bytes, sizeof(bytes)));
+    }
+  }
+#endif
+
+  return (int)numBlocks;
+}
@@ -0,0 +1,65 @@
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Accounting for the shell's own heap. The parser, job table, history and
+// notifications allocate through memAlloc and friends with a tag naming the
+// subsystem. Blocks stay ordinary malloc blocks and are counted by
+// malloc_usable_size, so a block allocated elsewhere (a token array from
+// libyash) can be taken over with memCharge and any block given to memFree.
+// `memstat` prints the counters.
+//
+// Built with -DYASH_MEM_DEBUG, every block is also kept in a table with the
+// file and line that allocated it, and blocks still live when the shell
+// exits are listed on stderr.
+
+enum{
+  MEM_PARSER,
+  MEM_JOBS,
+  MEM_HISTORY,
+  MEM_NOTIFY,
+  MEM_NUM_TAGS
+};
+
+/**
+ * YashMemStats_t struct, counters of one tag
+ */
+typedef struct YashMemStats_t{
+  uint64_t liveBytes;
+  uint64_t liveBlocks;
+  uint64_t peakBytes;
+  uint64_t allocs;
+  uint64_t allocBytes;
+}YashMemStats_t;
+
+void* memAllocAt(int tag, size_t size, const char* file, int line);
+void* memCallocAt(int tag, size_t num, size_t size, const char* file,
+                  int line);
+void* memReallocAt(int tag, void* ptr, size_t size, const char* file,
+                   int line);
+char* memStrdupAt(int tag, const char* str, const char* file, int line);
+char* memStrndupAt(int tag, const char* str, size_t len, const char* file,
+                   int line);
+void* memChargeAt(int tag, void* ptr, const char* file, int line);
+void memFree(int tag, void* ptr);
+
+#define memAlloc(tag, size) memAllocAt(tag, size, __FILE__, __LINE__)
+#define memCalloc(tag, num, size) \
+  memCallocAt(tag, num, size, __FILE__, __LINE__)
+#define memRealloc(tag, ptr, size) \
+  memReallocAt(tag, ptr, size, __FILE__, __LINE__)
+#define memStrdup(tag, str) memStrdupAt(tag, str, __FILE__, __LINE__)
+#define memStrndup(tag, str, len) \
+  memStrndupAt(tag, str, len, __FILE__, __LINE__)
+#define memCharge(tag, ptr) memChargeAt(tag, ptr, __FILE__, __LINE__)
+
+void memInit(void);
+const char* memTagName(int tag);
+void memStats(int tag, YashMemStats_t* stats);
+void memPrint(FILE* out);
+int memLeaks(FILE* out);
+
+#endif
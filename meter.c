@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "meter.h"
+
+/**
+ * YashMeter_t struct, a metered pipe and the thread moving its data.
+ * Counters are written by the thread and read by the shell atomically.
+ */
+struct YashMeter_t{
+  int inFd;
+  int outFd;
+  int stopFd;
+  int doneFd;
+  int64_t startNs;
+  uint64_t bytes;
+  int64_t elapsedNs;
+  int64_t inWaitNs;
+  int64_t outWaitNs;
+  int done;
+  pthread_t thread;
+};
+
+/**
+ * Purpose:
+ *   CLOCK_MONOTONIC in ns
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (int64_t): Time in ns
+ */
+int64_t meterNow(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Purpose:
+ *   Thread body: splice from the producer's pipe to the consumer's until
+ *   EOF, a closed consumer or meterStop. When a splice cannot move data,
+ *   the side that is not ready is waited for and the wait is charged to it.
+ *
+ * Args:
+ *   arg (void*): The YashMeter_t
+ *
+ * Returns:
+ *   (void*): NULL
+ */
+void* meterRun(void* arg){
+  YashMeter_t* meter = (YashMeter_t*)arg;
+  struct pollfd fds[2];
+  uint64_t one = 1;
+  int64_t begin;
+  int64_t* waited = NULL;
+  ssize_t moved;
+
+  fds[1].fd = meter->stopFd;
+  fds[1].events = POLLIN;
+  for(;;){
+    moved = splice(meter->inFd, NULL, meter->outFd, NULL, METER_CHUNK,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(moved > 0){
+      __atomic_add_fetch(&meter->bytes, moved, __ATOMIC_RELAXED);
+      continue;
+    }
+    if(moved == 0 || (errno != EAGAIN && errno != EINTR)){
+      // EOF from the producer, or EPIPE from a consumer that is gone
+      break;
+    }
+    if(errno == EINTR){
+      continue;
+    }
+
+    // Input empty: the producer is behind. Else the output is full.
+    fds[0].fd = meter->inFd;
+    fds[0].events = POLLIN;
+    if(poll(fds, 1, 0) > 0){
+      fds[0].fd = meter->outFd;
+      fds[0].events = POLLOUT;
+      waited = &meter->outWaitNs;
+    }
+    else{
+      waited = &meter->inWaitNs;
+    }
+    begin = meterNow();
+    while(poll(fds, 2, -1) < 0 && errno == EINTR);
+    __atomic_add_fetch(waited, meterNow() - begin, __ATOMIC_RELAXED);
+    if(fds[1].revents & POLLIN){
+      break;
+    }
+  }
+
+  // Closing both ends passes EOF on and SIGPIPE back
+  close(meter->inFd);
+  close(meter->outFd);
+  __atomic_store_n(&meter->elapsedNs, meterNow() - meter->startNs,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&meter->done, 1, __ATOMIC_RELEASE);
+  write(meter->doneFd, &one, sizeof(one));
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Make a metered pipe and start its thread
+ *
+ * Args:
+ *   pfd (int*): Set like pipe(): pfd[0] for stage 2 to read, pfd[1] for
+ *               stage 1 to write. Both are close-on-exec.
+ *
+ * Returns:
+ *   (YashMeter_t*): Meter, or NULL with errno set
+ */
+YashMeter_t* meterStart(int* pfd){
+  YashMeter_t* meter = (YashMeter_t*)calloc(1, sizeof(YashMeter_t));
+  sigset_t allSigs;
+  sigset_t oldMask;
+  int upstream[2];
+  int downstream[2];
+  int err;
+
+  if(pipe2(upstream, O_CLOEXEC) < 0){
+    free(meter);
+    return NULL;
+  }
+  if(pipe2(downstream, O_CLOEXEC) < 0){
+    close(upstream[0]);
+    close(upstream[1]);
+    free(meter);
+    return NULL;
+  }
+  meter->inFd = upstream[0];
+  meter->outFd = downstream[1];
+  meter->stopFd = eventfd(0, EFD_CLOEXEC);
+  meter->doneFd = eventfd(0, EFD_CLOEXEC);
+  meter->startNs = meterNow();
+
+  // Signals are for the shell's thread only; SIGPIPE stays pending here
+  sigfillset(&allSigs);
+  pthread_sigmask(SIG_BLOCK, &allSigs, &oldMask);
+  err = pthread_create(&meter->thread, NULL, meterRun, meter);
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  if(err){
+    close(upstream[0]);
+    close(upstream[1]);
+    close(downstream[0]);
+    close(downstream[1]);
+    close(meter->stopFd);
+    close(meter->doneFd);
+    free(meter);
+    errno = err;
+    return NULL;
+  }
+
+  pfd[0] = downstream[0];
+  pfd[1] = upstream[1];
+
+  return meter;
+}
+
+/**
+ * Purpose:
+ *   Read a meter's counters
+ *
+ * Args:
+ *   meter     (YashMeter_t*): Meter
+ *   stats (YashMeterStats_t*): Filled with the counters so far
+ *
+ * Returns:
+ *   None
+ */
+void meterStats(YashMeter_t* meter, YashMeterStats_t* stats){
+  stats->done = __atomic_load_n(&meter->done, __ATOMIC_ACQUIRE);
+  stats->bytes = __atomic_load_n(&meter->bytes, __ATOMIC_RELAXED);
+  stats->inWaitNs = __atomic_load_n(&meter->inWaitNs, __ATOMIC_RELAXED);
+  stats->outWaitNs = __atomic_load_n(&meter->outWaitNs, __ATOMIC_RELAXED);
+  stats->elapsedNs = stats->done ?
+                     __atomic_load_n(&meter->elapsedNs, __ATOMIC_RELAXED) :
+                     meterNow() - meter->startNs;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Wait for a meter's thread to finish moving data
+ *
+ * Args:
+ *   meter (YashMeter_t*): Meter
+ *   timeoutMs      (int): Longest wait, 0 to poll, -1 for no limit
+ *
+ * Returns:
+ *   (int): 1 if the thread has finished, else 0
+ */
+int meterWait(YashMeter_t* meter, int timeoutMs){
+  struct pollfd fd;
+
+  fd.fd = meter->doneFd;
+  fd.events = POLLIN;
+  while(!__atomic_load_n(&meter->done, __ATOMIC_ACQUIRE) &&
+        poll(&fd, 1, timeoutMs) < 0 && errno == EINTR);
+
+  return __atomic_load_n(&meter->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Purpose:
+ *   Stop a meter's thread if it is still running, then free the meter
+ *
+ * Args:
+ *   meter (YashMeter_t*): Meter, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void meterStop(YashMeter_t* meter){
+  uint64_t one = 1;
+
+  if(meter == NULL){
+    return;
+  }
+
+  write(meter->stopFd, &one, sizeof(one));
+  pthread_join(meter->thread, NULL);
+  close(meter->stopFd);
+  close(meter->doneFd);
+  free(meter);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Describe a meter's counters in one line: volume, rate and which stage
+ *   the pipe waited on
+ *
+ * Args:
+ *   stats (const YashMeterStats_t*): Counters
+ *   buf                     (char*): Buffer for the line
+ *   size                   (size_t): Size of buf
+ *
+ * Returns:
+ *   None
+ */
+void meterFormat(const YashMeterStats_t* stats, char* buf, size_t size){
+  const char* UNITS[] = {"B", "KB", "MB", "GB", "TB"};
+
+  double secs = stats->elapsedNs / 1e9;
+  double volume = stats->bytes;
+  double rate;
+  int unit = 0;
+
+  while(volume >= 1024 && unit < 4){
+    volume /= 1024;
+    unit++;
+  }
+  rate = secs > 0 ? stats->bytes / secs / (1024 * 1024) : 0;
+
+  snprintf(buf, size, "%.*f %s in %.2f s, %.1f MB/s; waited %.2f s on "
+           "stage 1, %.2f s on stage 2 (stage %d slower)", unit > 0 ? 1 : 0,
+           volume, UNITS[unit], secs, rate, stats->inWaitNs / 1e9,
+           stats->outWaitNs / 1e9, stats->outWaitNs > stats->inWaitNs ? 2 : 1);
+
+  return;
+}
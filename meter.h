@@ -0,0 +1,34 @@
+#ifndef METER_H
+#define METER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pipe throughput meter. With set -o pipemeter, or a |~ pipe, stage 1
+// writes into one pipe and stage 2 reads from another, and a thread moves
+// the data between them with splice, so no byte is copied. It counts the
+// bytes and the time it waited on each side: waiting for input means the
+// producer is the slower stage, waiting for room means the consumer is.
+
+#define METER_CHUNK (1 << 20)
+
+/**
+ * YashMeterStats_t struct, counters of one metered pipe
+ */
+typedef struct YashMeterStats_t{
+  uint64_t bytes;
+  int64_t elapsedNs;
+  int64_t inWaitNs;
+  int64_t outWaitNs;
+  int done;
+}YashMeterStats_t;
+
+typedef struct YashMeter_t YashMeter_t;
+
+YashMeter_t* meterStart(int* pfd);
+void meterStats(YashMeter_t* meter, YashMeterStats_t* stats);
+int meterWait(YashMeter_t* meter, int timeoutMs);
+void meterStop(YashMeter_t* meter);
+void meterFormat(const YashMeterStats_t* stats, char* buf, size_t size);
+
+#endif
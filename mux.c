@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "mux.h"
+
+/**
+ * MuxStream_t struct, one pipe being drained. buf holds data read but not
+ * yet written; bytes before sent are already queued for this drain.
+ */
+typedef struct MuxStream_t{
+  int fd;
+  int dest;
+  int eof;
+  int prefixLen;
+  char prefix[16];
+  char* buf;
+  size_t len;
+  size_t sent;
+}MuxStream_t;
+
+/**
+ * MuxBatch_t struct, iovecs gathered for one destination fd
+ */
+typedef struct MuxBatch_t{
+  int fd;
+  int count;
+  struct iovec iov[MUX_MAX_IOV];
+}MuxBatch_t;
+
+/**
+ * YashMux_t struct, the drain thread and its epoll set
+ */
+struct YashMux_t{
+  int epfd;
+  int wakeFd;
+  int outFd;
+  int errFd;
+  int numStreams;
+  pthread_mutex_t lock;
+  pthread_t thread;
+};
+
+/**
+ * Purpose:
+ *   writev every iovec, resuming after short writes
+ *
+ * Args:
+ *   fd             (int): Destination fd
+ *   iov (struct iovec*): iovecs, modified as they are consumed
+ *   count          (int): Number of iovecs
+ *
+ * Returns:
+ *   None
+ */
+void muxWriteAll(int fd, struct iovec* iov, int count){
+  ssize_t nwrite;
+
+  while(count > 0){
+    nwrite = writev(fd, iov, count);
+    if(nwrite < 0 && errno == EINTR){
+      continue;
+    }
+    else if(nwrite < 0){
+      return;
+    }
+
+    while(count > 0 && (size_t)nwrite >= iov->iov_len){
+      nwrite -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count > 0){
+      iov->iov_base = (char*)iov->iov_base + nwrite;
+      iov->iov_len -= nwrite;
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Write out a batch and empty it
+ *
+ * Args:
+ *   batch (MuxBatch_t*): Batch to flush
+ *
+ * Returns:
+ *   None
+ */
+void muxFlush(MuxBatch_t* batch){
+  muxWriteAll(batch->fd, batch->iov, batch->count);
+  batch->count = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Queue one prefixed line of a stream, flushing first if the batch is
+ *   full
+ *
+ * Args:
+ *   batch   (MuxBatch_t*): Batch for the stream's destination
+ *   stream (MuxStream_t*): Stream the line belongs to
+ *   line          (char*): Start of the line
+ *   len          (size_t): Bytes in the line, including any newline
+ *   addNewline      (int): 1 to end the line with a newline of our own
+ *
+ * Returns:
+ *   None
+ */
+void muxQueueLine(MuxBatch_t* batch, MuxStream_t* stream, char* line,
+                  size_t len, int addNewline){
+  static char newline[] = "\n";
+
+  if(batch->count + 3 > MUX_MAX_IOV){
+    muxFlush(batch);
+  }
+
+  batch->iov[batch->count].iov_base = stream->prefix;
+  batch->iov[batch->count++].iov_len = stream->prefixLen;
+  batch->iov[batch->count].iov_base = line;
+  batch->iov[batch->count++].iov_len = len;
+  if(addNewline){
+    batch->iov[batch->count].iov_base = newline;
+    batch->iov[batch->count++].iov_len = 1;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Read what a stream has ready and queue its complete lines. At end of
+ *   file a trailing partial line is queued too; a full buffer with no
+ *   newline is queued as one line so a long line cannot stall the job.
+ *
+ * Args:
+ *   stream (MuxStream_t*): Readable stream
+ *   batch   (MuxBatch_t*): Batch for the stream's destination
+ *
+ * Returns:
+ *   None
+ */
+void muxDrainStream(MuxStream_t* stream, MuxBatch_t* batch){
+  char* start = NULL;
+  char* end = NULL;
+  char* newline = NULL;
+  ssize_t nread;
+
+  nread = read(stream->fd, stream->buf + stream->len,
+               MUX_BUF_SIZE - stream->len);
+  if(nread > 0){
+    stream->len += nread;
+  }
+  else if(nread == 0 || (errno != EAGAIN && errno != EINTR)){
+    stream->eof = 1;
+  }
+
+  start = stream->buf;
+  end = stream->buf + stream->len;
+  while(start < end && (newline = memchr(start, '\n', end - start)) != NULL){
+    muxQueueLine(batch, stream, start, newline + 1 - start, 0);
+    start = newline + 1;
+  }
+  if(start < end && (stream->eof || (start == stream->buf &&
+                                     stream->len == MUX_BUF_SIZE))){
+    muxQueueLine(batch, stream, start, end - start, 1);
+    start = end;
+  }
+  stream->sent = start - stream->buf;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Drain thread body. Each wakeup reads every ready stream, writes the
+ *   lines with one writev per destination, then keeps partial lines for
+ *   the next round. Exits once muxStop was called and every stream closed.
+ *
+ * Args:
+ *   arg (void*): YashMux_t
+ *
+ * Returns:
+ *   (void*): NULL
+ */
+void* muxRun(void* arg){
+  YashMux_t* mux = (YashMux_t*)arg;
+  MuxBatch_t* out = (MuxBatch_t*)malloc(sizeof(MuxBatch_t));
+  MuxBatch_t* err = (MuxBatch_t*)malloc(sizeof(MuxBatch_t));
+  MuxStream_t* stream = NULL;
+  struct epoll_event events[MUX_MAX_EVENTS];
+  uint64_t value;
+  int stopping = 0;
+  int numEvents;
+  int index;
+
+  out->fd = mux->outFd;
+  out->count = 0;
+  err->fd = mux->errFd;
+  err->count = 0;
+
+  while(1){
+    numEvents = epoll_wait(mux->epfd, events, MUX_MAX_EVENTS, -1);
+    if(numEvents < 0 && errno == EINTR){
+      continue;
+    }
+    else if(numEvents < 0){
+      break;
+    }
+
+    for(index = 0; index < numEvents; index++){
+      stream = (MuxStream_t*)events[index].data.ptr;
+      if(stream == NULL){
+        read(mux->wakeFd, &value, sizeof(value));
+        stopping = 1;
+        continue;
+      }
+      muxDrainStream(stream, stream->dest == mux->outFd ? out : err);
+    }
+    muxFlush(out);
+    muxFlush(err);
+
+    for(index = 0; index < numEvents; index++){
+      stream = (MuxStream_t*)events[index].data.ptr;
+      if(stream == NULL){
+        continue;
+      }
+      if(stream->eof){
+        epoll_ctl(mux->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+        close(stream->fd);
+        free(stream->buf);
+        free(stream);
+        pthread_mutex_lock(&mux->lock);
+        mux->numStreams--;
+        pthread_mutex_unlock(&mux->lock);
+        continue;
+      }
+      memmove(stream->buf, stream->buf + stream->sent,
+              stream->len - stream->sent);
+      stream->len -= stream->sent;
+      stream->sent = 0;
+    }
+
+    pthread_mutex_lock(&mux->lock);
+    index = mux->numStreams;
+    pthread_mutex_unlock(&mux->lock);
+    if(stopping && index == 0){
+      break;
+    }
+  }
+
+  free(out);
+  free(err);
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Start the output multiplexer
+ *
+ * Args:
+ *   outFd (int): Where job stdout lines are written
+ *   errFd (int): Where job stderr lines are written
+ *
+ * Returns:
+ *   (YashMux_t*): Handle, or NULL with errno set
+ */
+YashMux_t* muxStart(int outFd, int errFd){
+  YashMux_t* mux = (YashMux_t*)calloc(1, sizeof(YashMux_t));
+  struct epoll_event ev;
+  sigset_t allSigs;
+  sigset_t oldMask;
+  int err;
+
+  mux->outFd = outFd;
+  mux->errFd = errFd;
+  mux->epfd = epoll_create1(EPOLL_CLOEXEC);
+  mux->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(mux->epfd < 0 || mux->wakeFd < 0){
+    err = errno;
+    close(mux->epfd);
+    close(mux->wakeFd);
+    free(mux);
+    errno = err;
+    return NULL;
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(mux->epfd, EPOLL_CTL_ADD, mux->wakeFd, &ev);
+  pthread_mutex_init(&mux->lock, NULL);
+
+  // Signals are for the shell's thread only
+  sigfillset(&allSigs);
+  pthread_sigmask(SIG_BLOCK, &allSigs, &oldMask);
+  err = pthread_create(&mux->thread, NULL, muxRun, mux);
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  if(err){
+    close(mux->epfd);
+    close(mux->wakeFd);
+    pthread_mutex_destroy(&mux->lock);
+    free(mux);
+    errno = err;
+    return NULL;
+  }
+
+  return mux;
+}
+
+/**
+ * Purpose:
+ *   Hand the read ends of a job's output pipes to the multiplexer, which
+ *   closes them at end of file
+ *
+ * Args:
+ *   mux (YashMux_t*): Multiplexer handle
+ *   jobId      (int): Job number used as the line prefix
+ *   outFd      (int): Read end of the job's stdout pipe, -1 for none
+ *   errFd      (int): Read end of the job's stderr pipe, -1 for none
+ *
+ * Returns:
+ *   (int): 0 on success, -1 with errno set on failure
+ */
+int muxAdd(YashMux_t* mux, int jobId, int outFd, int errFd){
+  MuxStream_t* stream = NULL;
+  struct epoll_event ev;
+  int fds[2] = {outFd, errFd};
+  int dests[2] = {mux->outFd, mux->errFd};
+  int index;
+
+  for(index = 0; index < 2; index++){
+    if(fds[index] < 0){
+      continue;
+    }
+
+    stream = (MuxStream_t*)calloc(1, sizeof(MuxStream_t));
+    stream->fd = fds[index];
+    stream->dest = dests[index];
+    stream->prefixLen = snprintf(stream->prefix, sizeof(stream->prefix),
+                                 "[%d] ", jobId);
+    stream->buf = (char*)malloc(MUX_BUF_SIZE);
+    fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_lock(&mux->lock);
+    mux->numStreams++;
+    pthread_mutex_unlock(&mux->lock);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = stream;
+    if(epoll_ctl(mux->epfd, EPOLL_CTL_ADD, stream->fd, &ev) < 0){
+      pthread_mutex_lock(&mux->lock);
+      mux->numStreams--;
+      pthread_mutex_unlock(&mux->lock);
+      close(stream->fd);
+      free(stream->buf);
+      free(stream);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Wait until every stream has reached end of file and been written out,
+ *   then stop the drain thread and free the handle
+ *
+ * Args:
+ *   mux (YashMux_t*): Multiplexer handle, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void muxStop(YashMux_t* mux){
+  uint64_t one = 1;
+
+  if(mux == NULL){
+    return;
+  }
+
+  write(mux->wakeFd, &one, sizeof(one));
+  pthread_join(mux->thread, NULL);
+  close(mux->epfd);
+  close(mux->wakeFd);
+  pthread_mutex_destroy(&mux->lock);
+  free(mux);
+
+  return;
+}
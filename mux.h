@@ -0,0 +1,19 @@
+#ifndef MUX_H
+#define MUX_H
+
+// Output multiplexer for background jobs. Each job's stdout and stderr go
+// to pipes that one drain thread reads with epoll. Output is passed on in
+// whole lines prefixed with "[jobId] ", gathered into one writev per
+// destination per drain, so concurrent jobs never interleave mid-line.
+
+#define MUX_BUF_SIZE (64 * 1024)
+#define MUX_MAX_EVENTS 32
+#define MUX_MAX_IOV 1024
+
+typedef struct YashMux_t YashMux_t;
+
+YashMux_t* muxStart(int outFd, int errFd);
+int muxAdd(YashMux_t* mux, int jobId, int outFd, int errFd);
+void muxStop(YashMux_t* mux);
+
+#endif
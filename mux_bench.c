@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mux.h"
+
+// Benchmark for the output multiplexer. PRODUCERS processes each write
+// MBYTES of 80 byte lines as fast as they can into a pipe. In the baseline
+// run every pipe has its own reader process that discards the data; in the
+// second run all pipes go through one multiplexer writing to /dev/null. If
+// the multiplexer keeps up, producer throughput is close in both runs.
+//
+//   mux_bench PRODUCERS MBYTES
+
+#define BENCH_LINE_LEN 80
+#define BENCH_CHUNK (64 * 1024)
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Producer body: write bytes of whole lines to fd, then exit
+ *
+ * Args:
+ *   fd     (int): Output fd
+ *   bytes (long): Bytes to write
+ *
+ * Returns:
+ *   None
+ */
+void produce(int fd, long bytes){
+  char* chunk = (char*)malloc(BENCH_CHUNK);
+  long len = BENCH_CHUNK - BENCH_CHUNK % BENCH_LINE_LEN;
+  long index;
+  ssize_t nwrite;
+
+  memset(chunk, 'x', len);
+  for(index = BENCH_LINE_LEN - 1; index < len; index += BENCH_LINE_LEN){
+    chunk[index] = '\n';
+  }
+
+  while(bytes > 0){
+    nwrite = write(fd, chunk, bytes < len ? bytes : len);
+    if(nwrite <= 0){
+      _exit(EXIT_FAILURE);
+    }
+    bytes -= nwrite;
+  }
+
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+ * Purpose:
+ *   Reader body: read fd until end of file and discard the data
+ *
+ * Args:
+ *   fd (int): Read end of a producer's pipe
+ *
+ * Returns:
+ *   None
+ */
+void discard(int fd){
+  char* buf = (char*)malloc(BENCH_CHUNK);
+
+  while(read(fd, buf, BENCH_CHUNK) > 0);
+
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+ * Purpose:
+ *   Run the producers once and time them
+ *
+ * Args:
+ *   numProducers   (int): Number of producer processes
+ *   bytes         (long): Bytes per producer
+ *   mux     (YashMux_t*): Multiplexer, or NULL for one reader per pipe
+ *   drained    (double*): Set to the time until every byte was read
+ *
+ * Returns:
+ *   (double): Seconds until every producer exited
+ */
+double runProducers(int numProducers, long bytes, YashMux_t* mux,
+                    double* drained){
+  double begin = nowSec();
+  double elapsed;
+  int* pids = (int*)malloc(numProducers * sizeof(int));
+  int pipeFd[2];
+  int index;
+
+  for(index = 0; index < numProducers; index++){
+    pipe2(pipeFd, O_CLOEXEC);
+    if((pids[index] = fork()) == 0){
+      produce(pipeFd[1], bytes);
+    }
+    close(pipeFd[1]);
+    if(mux != NULL){
+      muxAdd(mux, index + 1, pipeFd[0], -1);
+    }
+    else{
+      if(fork() == 0){
+        discard(pipeFd[0]);
+      }
+      close(pipeFd[0]);
+    }
+  }
+
+  for(index = 0; index < numProducers; index++){
+    waitpid(pids[index], NULL, 0);
+  }
+  elapsed = nowSec() - begin;
+  while(wait(NULL) > 0);
+  free(pids);
+  if(mux != NULL){
+    muxStop(mux);
+  }
+  *drained = nowSec() - begin;
+
+  return elapsed;
+}
+
+int main(int argc, char** argv){
+  const char* USAGE = "usage: mux_bench PRODUCERS MBYTES\n";
+
+  double direct;
+  double muxed;
+  double drained;
+  double totalMb;
+  long bytes;
+  int numProducers;
+  int nullFd;
+
+  if(argc != 3 || (numProducers = atoi(argv[1])) < 1 || atol(argv[2]) < 1){
+    fprintf(stderr, "%s", USAGE);
+    return EXIT_FAILURE;
+  }
+  bytes = atol(argv[2]) * 1024 * 1024;
+  totalMb = (double)numProducers * atol(argv[2]);
+  nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  direct = runProducers(numProducers, bytes, NULL, &drained);
+  muxed = runProducers(numProducers, bytes, muxStart(nullFd, nullFd),
+                       &drained);
+
+  printf("producers %d  %.0f MB total  %.0f lines\n", numProducers, totalMb,
+         totalMb * 1024 * 1024 / BENCH_LINE_LEN);
+  printf("readers  %8.1f MB/s\n", totalMb / direct);
+  printf("mux      %8.1f MB/s  (drained %.1f MB/s, %.0f%% of readers)\n",
+         totalMb / muxed, totalMb / drained, 100.0 * direct / muxed);
+
+  close(nullFd);
+
+  return 0;
+}
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "placement.h"
+#include "plugin.h"
+
+#define PLACE_SYSFS_CPU "/sys/devices/system/cpu"
+
+/**
+ * Purpose:
+ *   Parse a CPU list such as "0-3,8,10-11"
+ *
+ * Args:
+ *   str (const char*): List
+ *   set  (cpu_set_t*): Set to fill
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the list is malformed
+ */
+int placeParseCpus(const char* str, cpu_set_t* set){
+  const char* pos = str;
+  char* end = NULL;
+  long first;
+  long last;
+
+  CPU_ZERO(set);
+  while(*pos != '\0' && *pos != '\n'){
+    first = strtol(pos, &end, 10);
+    if(end == pos || first < 0 || first >= CPU_SETSIZE){
+      return -1;
+    }
+    last = first;
+    if(*end == '-'){
+      pos = end + 1;
+      last = strtol(pos, &end, 10);
+      if(end == pos || last < first || last >= CPU_SETSIZE){
+        return -1;
+      }
+    }
+    for(; first <= last; first++){
+      CPU_SET(first, set);
+    }
+    pos = end;
+    if(*pos == ','){
+      pos++;
+    }
+    else if(*pos != '\0' && *pos != '\n'){
+      return -1;
+    }
+  }
+
+  return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/**
+ * Purpose:
+ *   Parse the options of a "sched" prefix
+ *
+ * Args:
+ *   argv     (char**): Arguments of the stage, starting at "sched"
+ *   place (YashPlace_t*): Filled in
+ *
+ * Returns:
+ *   (int): Number of tokens the prefix used, -1 on a bad prefix (a
+ *          message is printed)
+ */
+int placeParseSched(char** argv, YashPlace_t* place){
+  const char* USAGE =
+    "usage: sched [-c cpus] [-n nice] [-p other|batch|idle] [-a] cmd...\n";
+  const char* POLICIES[] = {"other", "batch", "idle", NULL};
+  const int POLICY_VALUES[] = {SCHED_OTHER, SCHED_BATCH, SCHED_IDLE};
+
+  char* end = NULL;
+  int pos = 1;
+  int index;
+
+  while(argv[pos] != NULL && argv[pos][0] == '-'){
+    if(!strcmp(argv[pos], "-a")){
+      place->adjacent = 1;
+      pos++;
+      continue;
+    }
+    if(argv[pos + 1] == NULL){
+      break;
+    }
+    if(!strcmp(argv[pos], "-c")){
+      if(placeParseCpus(argv[pos + 1], &place->cpus) < 0){
+        fprintf(stderr, "yash: sched: %s: bad cpu list\n", argv[pos + 1]);
+        return -1;
+      }
+      place->hasCpus = 1;
+    }
+    else if(!strcmp(argv[pos], "-n")){
+      place->nice = strtol(argv[pos + 1], &end, 10);
+      if(*end != '\0' || place->nice < -20 || place->nice > 19){
+        fprintf(stderr, "yash: sched: %s: bad nice value\n", argv[pos + 1]);
+        return -1;
+      }
+      place->hasNice = 1;
+    }
+    else if(!strcmp(argv[pos], "-p")){
+      for(index = 0; POLICIES[index] != NULL; index++){
+        if(!strcmp(argv[pos + 1], POLICIES[index])){
+          break;
+        }
+      }
+      if(POLICIES[index] == NULL){
+        fprintf(stderr, "yash: sched: %s: bad policy\n", argv[pos + 1]);
+        return -1;
+      }
+      place->policy = POLICY_VALUES[index];
+      place->hasPolicy = 1;
+    }
+    else{
+      break;
+    }
+    pos += 2;
+  }
+
+  if(argv[pos] == NULL || argv[pos][0] == '-'){
+    fprintf(stderr, "%s", USAGE);
+    return -1;
+  }
+
+  return pos;
+}
+
+/**
+ * Purpose:
+ *   Parse the "sched" and "limit" prefixes at the start of a stage, in
+ *   either order
+ *
+ * Args:
+ *   argv     (char**): Arguments of the stage
+ *   place (YashPlace_t*): Filled in; place->set is 0 without a prefix
+ *
+ * Returns:
+ *   (int): Number of tokens the prefixes used, 0 without a prefix, -1 on
+ *          a bad prefix (a message is printed)
+ */
+int placeParse(char** argv, YashPlace_t* place){
+  YashLimits_t limits;
+  int pos = 0;
+  int used;
+
+  memset(place, 0, sizeof(YashPlace_t));
+  while(argv[pos] != NULL){
+    if(!strcmp(argv[pos], "sched")){
+      used = placeParseSched(argv + pos, place);
+    }
+    else if(!strcmp(argv[pos], "limit")){
+      used = limitParse(argv + pos, &limits);
+      place->limits = limits;
+    }
+    else{
+      break;
+    }
+    if(used < 0){
+      return -1;
+    }
+    pos += used;
+    place->set = 1;
+  }
+
+  return pos;
+}
+
+/**
+ * Purpose:
+ *   CPUs sharing a cache level with a CPU, from sysfs
+ *
+ * Args:
+ *   cpu      (int): CPU
+ *   level    (int): Cache level, 2 or 3
+ *   set (cpu_set_t*): Set to fill
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if sysfs does not describe that cache
+ */
+int placeCacheShared(int cpu, int level, cpu_set_t* set){
+  char path[PATH_MAX];
+  char buf[256];
+  FILE* file = NULL;
+  int index;
+  int found;
+
+  for(index = 0; ; index++){
+    snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/level",
+             PLACE_SYSFS_CPU, cpu, index);
+    if((file = fopen(path, "r")) == NULL){
+      return -1;
+    }
+    found = (fscanf(file, "%d", &found) == 1 && found == level);
+    fclose(file);
+    if(found){
+      break;
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/shared_cpu_list",
+           PLACE_SYSFS_CPU, cpu, index);
+  if((file = fopen(path, "r")) == NULL){
+    return -1;
+  }
+  found = (fgets(buf, sizeof(buf), file) != NULL);
+  fclose(file);
+
+  return (found && placeParseCpus(buf, set) == 0) ? 0 : -1;
+}
+
+/**
+ * Purpose:
+ *   Pick one CPU per stage so that neighbouring stages share the closest
+ *   cache available: L2 first, then L3, then simply the next CPU. Each
+ *   call starts after the CPU the previous call ended on, so several
+ *   pipelines spread out instead of piling onto CPU 0.
+ *
+ * Args:
+ *   numStages (int): Number of stages, at most PLACE_MAX_STAGES
+ *   cpus     (int*): Set to the CPU of each stage
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the allowed CPUs cannot be read
+ */
+int placeAdjacent(int numStages, int* cpus){
+  const int LEVELS[] = {2, 3};
+  static int nextCpu = 0;
+
+  cpu_set_t allowed;
+  cpu_set_t used;
+  cpu_set_t shared;
+  int stage;
+  int level;
+  int cpu;
+  int step;
+
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0 ||
+     CPU_COUNT(&allowed) == 0){
+    return -1;
+  }
+
+  CPU_ZERO(&used);
+  for(stage = 0; stage < numStages; stage++){
+    cpu = -1;
+    for(level = 0; stage > 0 && cpu < 0 && level < 2; level++){
+      if(placeCacheShared(cpus[stage - 1], LEVELS[level], &shared) < 0){
+        continue;
+      }
+      // Nearest unused CPU above the previous stage, wrapping around
+      for(step = 1; step < CPU_SETSIZE; step++){
+        cpu = (cpus[stage - 1] + step) % CPU_SETSIZE;
+        if(CPU_ISSET(cpu, &shared) && CPU_ISSET(cpu, &allowed) &&
+           !CPU_ISSET(cpu, &used)){
+          break;
+        }
+        cpu = -1;
+      }
+    }
+
+    // No cache neighbour left: the next allowed CPU, reusing if needed
+    for(step = 0; cpu < 0 && step < 2 * CPU_SETSIZE; step++){
+      cpu = (stage > 0 ? cpus[stage - 1] + 1 + step : nextCpu + step) %
+            CPU_SETSIZE;
+      if(!CPU_ISSET(cpu, &allowed) ||
+         (step < CPU_SETSIZE && CPU_ISSET(cpu, &used))){
+        cpu = -1;
+      }
+    }
+    cpus[stage] = cpu;
+    CPU_SET(cpu, &used);
+  }
+  nextCpu = (cpus[numStages - 1] + 1) % CPU_SETSIZE;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Pin a stage to one CPU unless it already has a CPU list
+ *
+ * Args:
+ *   place (YashPlace_t*): Placement of the stage
+ *   cpu           (int): CPU
+ *
+ * Returns:
+ *   None
+ */
+void placePin(YashPlace_t* place, int cpu){
+  if(place->hasCpus || cpu < 0){
+    return;
+  }
+  CPU_ZERO(&place->cpus);
+  CPU_SET(cpu, &place->cpus);
+  place->hasCpus = 1;
+  place->set = 1;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Apply a placement to the calling process
+ *
+ * Args:
+ *   place (const YashPlace_t*): Placement
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on the first failure (a message is printed)
+ */
+int placeApply(const YashPlace_t* place){
+  struct sched_param param;
+
+  if(place->hasCpus &&
+     sched_setaffinity(0, sizeof(cpu_set_t), &place->cpus) < 0){
+    fprintf(stderr, "yash: sched: affinity: %s\n", strerror(errno));
+    return -1;
+  }
+  if(place->hasPolicy){
+    memset(&param, 0, sizeof(param));
+    if(sched_setscheduler(0, place->policy, &param) < 0){
+      fprintf(stderr, "yash: sched: policy: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  if(place->hasNice && setpriority(PRIO_PROCESS, 0, place->nice) < 0){
+    fprintf(stderr, "yash: sched: nice: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Fork a stage, apply its placement and limits between setpgid and exec,
+ *   and exec it (or call it, for a plugin builtin). Mirrors zygoteSpawn so
+ *   callers can use either.
+ *
+ * Args:
+ *   argv              (char**): Arguments from parseRedirs, without the
+ *                               sched and limit prefixes
+ *   redirs      (RedirList_t*): fd operations from parseRedirs
+ *   fdMap               (int*): (target, source) fd pairs applied first
+ *   numMap               (int): Number of pairs in fdMap
+ *   pgid                 (int): Process group to join, 0 for a new one
+ *   place (const YashPlace_t*): Placement
+ *   pid                 (int*): Set to the PID of the new child
+ *
+ * Returns:
+ *   (int): 0 on success, else error number; a message is printed
+ */
+int placeSpawn(char** argv, RedirList_t* redirs, int* fdMap, int numMap,
+               int pgid, const YashPlace_t* place, int* pid){
+  const int CANNOT_EXEC = 126;
+  const int NOT_FOUND = 127;
+
+  YashBuiltin_t* builtin = pluginFind(argv[0]);
+  int index;
+
+  fflush(stdout);
+  fflush(stderr);
+  if((*pid = fork()) < 0){
+    fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+    return errno;
+  }
+  else if(*pid == 0){
+    setpgid(0, pgid);
+    if(placeApply(place) < 0 || limitApply(&place->limits) < 0){
+      _exit(CANNOT_EXEC);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    for(index = 0; index < numMap; index++){
+      dup2(fdMap[2 * index + 1], fdMap[2 * index]);
+    }
+    redirectFile(redirs);
+    pluginCloseFds(redirs);
+    if(builtin != NULL){
+      _exit(pluginCall(builtin, argv, STDIN_FILENO, STDOUT_FILENO,
+                       STDERR_FILENO));
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+    _exit(errno == ENOENT ? NOT_FOUND : CANNOT_EXEC);
+  }
+
+  setpgid(*pid, pgid == 0 ? *pid : pgid);
+
+  return 0;
+}
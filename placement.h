@@ -0,0 +1,47 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+
+#include "libyash_internal.h"
+#include "rlimit.h"
+
+// CPU placement of jobs and pipeline stages. A stage prefixed with
+//
+//   sched [-c CPULIST] [-n NICE] [-p other|batch|idle] [-a] cmd args...
+//
+// is forked by the shell, which sets its affinity, nice value and policy
+// after setpgid and before exec. -a places the stages of a pipeline on
+// cores that share a cache, starting on the next core each time. A "limit"
+// prefix (rlimit.h) goes the same way, before or after "sched".
+
+#define PLACE_MAX_STAGES 8
+
+/**
+ * YashPlace_t struct, placement of one stage
+ */
+typedef struct YashPlace_t{
+  int set;
+  int hasCpus;
+  cpu_set_t cpus;
+  int hasNice;
+  int nice;
+  int hasPolicy;
+  int policy;
+  int adjacent;
+  YashLimits_t limits;
+}YashPlace_t;
+
+int placeParse(char** argv, YashPlace_t* place);
+int placeCacheShared(int cpu, int level, cpu_set_t* set);
+int placeAdjacent(int numStages, int* cpus);
+void placePin(YashPlace_t* place, int cpu);
+int placeApply(const YashPlace_t* place);
+int placeSpawn(char** argv, RedirList_t* redirs, int* fdMap, int numMap,
+               int pgid, const YashPlace_t* place, int* pid);
+
+#endif
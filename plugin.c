@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "plugin.h"
+
+/**
+ * PluginLoad_t struct, state of one enable -f while the plugin registers
+ */
+typedef struct PluginLoad_t{
+  const char* path;
+  char** names;
+  int numNames;
+  int* found;
+}PluginLoad_t;
+
+YashBuiltin_t* builtinList = NULL;
+
+/**
+ * Purpose:
+ *   Allocator handed to builtins
+ *
+ * Args:
+ *   size (size_t): Bytes to allocate
+ *
+ * Returns:
+ *   (void*): Memory, or NULL
+ */
+void* pluginAlloc(size_t size){
+  return malloc(size);
+}
+
+/**
+ * Purpose:
+ *   Free memory from pluginAlloc
+ *
+ * Args:
+ *   ptr (void*): Memory, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void pluginFree(void* ptr){
+  free(ptr);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Find an enabled builtin by name
+ *
+ * Args:
+ *   name (const char*): Command name
+ *
+ * Returns:
+ *   (YashBuiltin_t*): Builtin, or NULL if there is none
+ */
+YashBuiltin_t* pluginFind(const char* name){
+  YashBuiltin_t* curr = builtinList;
+
+  while(curr != NULL){
+    if(!strcmp(curr->name, name)){
+      return curr;
+    }
+    curr = curr->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   registerBuiltin callback: enable the builtin if it was asked for,
+ *   replacing an earlier one of the same name
+ *
+ * Args:
+ *   host (YashPluginHost_t*): Host passed to yashPluginInit
+ *   name       (const char*): Builtin name
+ *   fn     (YashBuiltinFn_t): Entry point
+ *
+ * Returns:
+ *   (int): 0 if enabled, 1 if not asked for, -1 on a bad name
+ */
+int pluginRegister(YashPluginHost_t* host, const char* name,
+                   YashBuiltinFn_t fn){
+  PluginLoad_t* load = (PluginLoad_t*)host->hostData;
+  YashBuiltin_t* builtin = NULL;
+  int index;
+
+  if(name == NULL || *name == '\0' || fn == NULL){
+    return -1;
+  }
+
+  for(index = 0; index < load->numNames; index++){
+    if(!strcmp(load->names[index], name)){
+      break;
+    }
+  }
+  if(load->numNames > 0 && index == load->numNames){
+    return 1;
+  }
+  if(load->numNames > 0){
+    load->found[index] = 1;
+  }
+
+  if((builtin = pluginFind(name)) == NULL){
+    builtin = (YashBuiltin_t*)calloc(1, sizeof(YashBuiltin_t));
+    builtin->name = strdup(name);
+    builtin->next = builtinList;
+    builtinList = builtin;
+  }
+  else{
+    free(builtin->path);
+  }
+  builtin->path = strdup(load->path);
+  builtin->fn = fn;
+  builtin->forked = 0;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Enable a builtin that comes with the shell. Unlike a plugin it may
+ *   change shell state when run in-process.
+ *
+ * Args:
+ *   name     (const char*): Builtin name
+ *   fn   (YashBuiltinFn_t): Entry point
+ *   forked           (int): 1 if it must always run in a child, as a
+ *                           builtin that starts processes must for job
+ *                           control
+ *
+ * Returns:
+ *   None
+ */
+void pluginAddInternal(const char* name, YashBuiltinFn_t fn, int forked){
+  YashBuiltin_t* builtin = (YashBuiltin_t*)calloc(1, sizeof(YashBuiltin_t));
+
+  builtin->name = strdup(name);
+  builtin->fn = fn;
+  builtin->forked = forked;
+  builtin->next = builtinList;
+  builtinList = builtin;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Load a plugin and enable the named builtins it registers, or all of
+ *   them when no names are given. The library stays loaded.
+ *
+ * Args:
+ *   path (const char*): Shared object to dlopen
+ *   names     (char**): Builtins to enable
+ *   numNames     (int): Number of names
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on failure; a message is printed
+ */
+int pluginLoad(const char* path, char** names, int numNames){
+  YashPluginHost_t host;
+  YashPluginInitFn_t init = NULL;
+  PluginLoad_t load;
+  void* handle = NULL;
+  int ret = 0;
+  int index;
+
+  if((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL){
+    fprintf(stderr, "yash: enable: %s\n", dlerror());
+    return -1;
+  }
+  if((init = (YashPluginInitFn_t)dlsym(handle, YASH_PLUGIN_INIT)) == NULL){
+    fprintf(stderr, "yash: enable: %s: no %s\n", path, YASH_PLUGIN_INIT);
+    dlclose(handle);
+    return -1;
+  }
+
+  load.path = path;
+  load.names = names;
+  load.numNames = numNames;
+  load.found = (int*)calloc(numNames + 1, sizeof(int));
+  host.abi = YASH_PLUGIN_ABI;
+  host.registerBuiltin = pluginRegister;
+  host.hostData = &load;
+
+  if(init(&host) != 0){
+    fprintf(stderr, "yash: enable: %s: initialization failed\n", path);
+    ret = -1;
+  }
+  for(index = 0; index < numNames; index++){
+    if(!load.found[index]){
+      fprintf(stderr, "yash: enable: %s: not found in %s\n", names[index],
+              path);
+      ret = -1;
+    }
+  }
+  free(load.found);
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   Disable a builtin. Its library stays loaded.
+ *
+ * Args:
+ *   name (const char*): Builtin name
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if it was not enabled
+ */
+int pluginDisable(const char* name){
+  YashBuiltin_t** link = &builtinList;
+  YashBuiltin_t* builtin = NULL;
+
+  while(*link != NULL && strcmp((*link)->name, name)){
+    link = &(*link)->next;
+  }
+  if((builtin = *link) == NULL){
+    return -1;
+  }
+
+  *link = builtin->next;
+  free(builtin->name);
+  free(builtin->path);
+  free(builtin);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Print the enabled builtins, one "enable -f path name" per line
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   None
+ */
+void pluginList(void){
+  YashBuiltin_t* curr = builtinList;
+
+  while(curr != NULL){
+    if(curr->path != NULL){
+      printf("enable -f %s %s\n", curr->path, curr->name);
+    }
+    curr = curr->next;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Call a builtin with the given fds
+ *
+ * Args:
+ *   builtin (YashBuiltin_t*): Builtin
+ *   argv            (char**): Arguments, argv[0] is the builtin name
+ *   inFd               (int): stdin of the builtin
+ *   outFd              (int): stdout of the builtin
+ *   errFd              (int): stderr of the builtin
+ *
+ * Returns:
+ *   (int): Exit status returned by the builtin
+ */
+int pluginCall(YashBuiltin_t* builtin, char** argv, int inFd, int outFd,
+               int errFd){
+  YashBuiltinCtx_t ctx;
+  int argc = 0;
+
+  while(argv[argc] != NULL){
+    argc++;
+  }
+
+  ctx.abi = YASH_PLUGIN_ABI;
+  ctx.inFd = inFd;
+  ctx.outFd = outFd;
+  ctx.errFd = errFd;
+  ctx.alloc = pluginAlloc;
+  ctx.free = pluginFree;
+
+  return builtin->fn(&ctx, argc, argv);
+}
+
+/**
+ * Purpose:
+ *   Run a builtin in the shell process. Redirection files are opened here
+ *   and passed as the builtin's fds; the shell's own 0, 1 and 2 are never
+ *   touched.
+ *
+ * Args:
+ *   builtin (YashBuiltin_t*): Builtin
+ *   argv            (char**): Arguments from parseRedirs
+ *   redirs     (RedirList_t*): fd operations from parseRedirs
+ *
+ * Returns:
+ *   (int): Exit status, or 1 if a redirection failed
+ */
+int pluginRun(YashBuiltin_t* builtin, char** argv, RedirList_t* redirs){
+  const int INVALID = -1;
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  RedirOp_t* op = NULL;
+  int status;
+  int index;
+
+  if(openRedirs(redirs) < 0){
+    return 1;
+  }
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    if(op->fd < 0 || op->fd > STDERR_FILENO){
+      continue;
+    }
+    if(op->type == REDIR_DUP){
+      fds[op->fd] = (op->srcFd >= 0 && op->srcFd <= STDERR_FILENO &&
+                     op->path == NULL) ? fds[op->srcFd] : op->srcFd;
+      if(op->both){
+        fds[STDERR_FILENO] = fds[op->fd];
+      }
+    }
+    else if(op->type == REDIR_CLOSE){
+      fds[op->fd] = INVALID;
+    }
+  }
+
+  // Keep the shell's buffered output ahead of the builtin's
+  fflush(stdout);
+  fflush(stderr);
+  status = pluginCall(builtin, argv, fds[0], fds[1], fds[2]);
+  closeRedirs(redirs);
+
+  return status;
+}
+
+/**
+ * Purpose:
+ *   Close every fd above stderr except redirection targets. A child that
+ *   does not exec would otherwise keep the shell's pipe ends, epoll and
+ *   signal fds, and a pipe reader would never see EOF.
+ *
+ * Args:
+ *   redirs (RedirList_t*): fd operations already applied
+ *
+ * Returns:
+ *   None
+ */
+void pluginCloseFds(RedirList_t* redirs){
+  int keep[MAX_REDIRS];
+  int numKeep = 0;
+  int low = STDERR_FILENO + 1;
+  int index;
+  int pos;
+  int fd;
+
+  // Insertion sort of the targets above stderr
+  for(index = 0; index < redirs->numOps; index++){
+    if((fd = redirs->ops[index].fd) <= STDERR_FILENO ||
+       redirs->ops[index].type == REDIR_CLOSE){
+      continue;
+    }
+    for(pos = numKeep; pos > 0 && keep[pos - 1] > fd; pos--){
+      keep[pos] = keep[pos - 1];
+    }
+    keep[pos] = fd;
+    numKeep++;
+  }
+
+  for(index = 0; index < numKeep; index++){
+    if(keep[index] > low){
+      close_range(low, keep[index] - 1, 0);
+    }
+    if(keep[index] >= low){
+      low = keep[index] + 1;
+    }
+  }
+  close_range(low, ~0U, 0);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Run a builtin in a forked child that does not exec, for pipelines and
+ *   background jobs. Mirrors zygoteSpawn so callers can use either.
+ *
+ * Args:
+ *   builtin (YashBuiltin_t*): Builtin
+ *   argv            (char**): Arguments from parseRedirs
+ *   redirs     (RedirList_t*): fd operations from parseRedirs
+ *   fdMap             (int*): (target, source) fd pairs applied first
+ *   numMap             (int): Number of pairs in fdMap
+ *   pgid               (int): Process group to join, 0 for a new one
+ *   pid               (int*): Set to the PID of the new child
+ *
+ * Returns:
+ *   (int): 0 on success, else error number; a message is printed
+ */
+int pluginSpawn(YashBuiltin_t* builtin, char** argv, RedirList_t* redirs,
+                int* fdMap, int numMap, int pgid, int* pid){
+  int index;
+
+  fflush(stdout);
+  fflush(stderr);
+  if((*pid = fork()) < 0){
+    fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+    return errno;
+  }
+  else if(*pid == 0){
+    setpgid(0, pgid);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    for(index = 0; index < numMap; index++){
+      dup2(fdMap[2 * index + 1], fdMap[2 * index]);
+    }
+    redirectFile(redirs);
+    pluginCloseFds(redirs);
+    _exit(pluginCall(builtin, argv, STDIN_FILENO, STDOUT_FILENO,
+                     STDERR_FILENO));
+  }
+
+  // Set it here too so the group exists before a second stage joins it
+  setpgid(*pid, pgid == 0 ? *pid : pgid);
+
+  return 0;
+}
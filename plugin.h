@@ -0,0 +1,35 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "libyash_internal.h"
+#include "yash_plugin.h"
+
+// Shell side of loadable builtins: loading, lookup and placement. See
+// yash_plugin.h for the plugin side.
+
+/**
+ * YashBuiltin_t struct, one enabled plugin builtin. Builtins that come
+ * with the shell have no path; forked ones always run in a child.
+ */
+typedef struct YashBuiltin_t{
+  char* name;
+  char* path;
+  YashBuiltinFn_t fn;
+  int forked;
+
+  struct YashBuiltin_t* next;
+}YashBuiltin_t;
+
+int pluginLoad(const char* path, char** names, int numNames);
+void pluginAddInternal(const char* name, YashBuiltinFn_t fn, int forked);
+YashBuiltin_t* pluginFind(const char* name);
+int pluginDisable(const char* name);
+void pluginList(void);
+int pluginCall(YashBuiltin_t* builtin, char** argv, int inFd, int outFd,
+               int errFd);
+void pluginCloseFds(RedirList_t* redirs);
+int pluginRun(YashBuiltin_t* builtin, char** argv, RedirList_t* redirs);
+int pluginSpawn(YashBuiltin_t* builtin, char** argv, RedirList_t* redirs,
+                int* fdMap, int numMap, int pgid, int* pid);
+
+#endif
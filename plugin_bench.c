@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "plugin.h"
+
+// Benchmark: cost of one command run as an in-process plugin builtin, as a
+// builtin in a forked child (how pipeline stages run), and as a separate
+// program with fork+exec.
+//
+//   gcc -Wall -O2 -shared -fPIC -o yashext.so yashext.c
+//   gcc -Wall -O2 -DYASH_PLUGIN_MAIN -o yashext yashext.c
+//   gcc -Wall -O2 -o plugin_bench plugin_bench.c plugin.c libyash.c
+//   ./plugin_bench -n 2000 -i events.json ./yashext.so ./yashext jget id
+
+/**
+ * Purpose:
+ *   Seconds since an arbitrary point
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): CLOCK_MONOTONIC in seconds
+ */
+double benchNow(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Print one result line
+ *
+ * Args:
+ *   label (const char*): What was timed
+ *   calls         (int): Number of calls
+ *   secs       (double): Elapsed seconds
+ *
+ * Returns:
+ *   None
+ */
+void benchReport(const char* label, int calls, double secs){
+  printf("%-22s %8.1f us/call %10.0f calls/s\n", label, secs * 1e6 / calls,
+         calls / secs);
+
+  return;
+}
+
+int main(int argc, char** argv){
+  const char* USAGE =
+    "usage: plugin_bench [-n CALLS] [-i INPUT] LIB.so EXE NAME [args...]\n";
+
+  YashBuiltin_t* builtin = NULL;
+  const char* input = "/dev/null";
+  char** spawnArgv = NULL;
+  char** callArgv = NULL;
+  double start;
+  int calls = 1000;
+  int nullFd;
+  int inFd;
+  int opt;
+  int pid;
+  int status;
+  int index;
+  posix_spawn_file_actions_t actions;
+
+  while((opt = getopt(argc, argv, "n:i:")) != -1){
+    if(opt == 'n' && (calls = atoi(optarg)) > 0){
+      continue;
+    }
+    if(opt == 'i'){
+      input = optarg;
+      continue;
+    }
+    fprintf(stderr, "%s", USAGE);
+    return 1;
+  }
+  if(argc - optind < 3){
+    fprintf(stderr, "%s", USAGE);
+    return 1;
+  }
+
+  if(pluginLoad(argv[optind], argv + optind + 2, 1) < 0 ||
+     (builtin = pluginFind(argv[optind + 2])) == NULL){
+    return 1;
+  }
+  if((nullFd = open("/dev/null", O_WRONLY)) < 0 ||
+     (inFd = open(input, O_RDONLY)) < 0){
+    perror(input);
+    return 1;
+  }
+  close(inFd);
+
+  // EXE NAME args... for exec, NAME args... for the builtin
+  spawnArgv = argv + optind + 1;
+  callArgv = argv + optind + 2;
+
+  start = benchNow();
+  for(index = 0; index < calls; index++){
+    inFd = open(input, O_RDONLY);
+    pluginCall(builtin, callArgv, inFd, nullFd, STDERR_FILENO);
+    close(inFd);
+  }
+  benchReport("plugin in-process", calls, benchNow() - start);
+
+  start = benchNow();
+  for(index = 0; index < calls; index++){
+    inFd = open(input, O_RDONLY);
+    if((pid = fork()) == 0){
+      _exit(pluginCall(builtin, callArgv, inFd, nullFd, STDERR_FILENO));
+    }
+    close(inFd);
+    waitpid(pid, &status, 0);
+  }
+  benchReport("plugin forked stage", calls, benchNow() - start);
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input, O_RDONLY,
+                                   0);
+  posix_spawn_file_actions_adddup2(&actions, nullFd, STDOUT_FILENO);
+  start = benchNow();
+  for(index = 0; index < calls; index++){
+    if(posix_spawnp(&pid, spawnArgv[0], &actions, NULL, spawnArgv,
+                    environ) != 0){
+      perror(spawnArgv[0]);
+      return 1;
+    }
+    waitpid(pid, &status, 0);
+  }
+  benchReport("posix_spawn+exec", calls, benchNow() - start);
+  posix_spawn_file_actions_destroy(&actions);
+
+  close(nullFd);
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "rlimit.h"
+
+/**
+ * Purpose:
+ *   Parse a limit value: a count, seconds, or a size in KB with an
+ *   optional M or G suffix
+ *
+ * Args:
+ *   str (const char*): Value
+ *   isSize     (int): 1 if the value is a size
+ *   value  (rlim_t*): Set to the value in the unit setrlimit takes
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the value is malformed or too large
+ */
+int limitParseValue(const char* str, int isSize, rlim_t* value){
+  const unsigned long long KB = 1024;
+
+  unsigned long long num;
+  unsigned long long scale = 1;
+  char* end = NULL;
+
+  if(str[0] < '0' || str[0] > '9'){
+    return -1;
+  }
+  errno = 0;
+  num = strtoull(str, &end, 10);
+  if(isSize){
+    scale = KB;
+    if(*end == 'M'){
+      scale *= KB;
+      end++;
+    }
+    else if(*end == 'G'){
+      scale *= KB * KB;
+      end++;
+    }
+  }
+  // A value that wraps would set a tiny limit, and one that reaches
+  // RLIM_INFINITY would set none
+  if(*end != '\0' || errno == ERANGE ||
+     num > ((unsigned long long)RLIM_INFINITY - 1) / scale){
+    return -1;
+  }
+  num *= scale;
+  *value = (rlim_t)num;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Parse a "limit" prefix at the start of a stage
+ *
+ * Args:
+ *   argv          (char**): Arguments of the stage
+ *   limits (YashLimits_t*): Filled in; limits->set is 0 without a prefix
+ *
+ * Returns:
+ *   (int): Number of tokens the prefix used, 0 without a prefix, -1 on
+ *          a bad prefix (a message is printed)
+ */
+int limitParse(char** argv, YashLimits_t* limits){
+  const char* USAGE =
+    "usage: limit [-v kb] [-t secs] [-n files] [-c kb] [-u procs] cmd...\n";
+  const char* FLAGS[] = {"-v", "-t", "-n", "-c", "-u", NULL};
+  const int KINDS[] = {LIMIT_AS, LIMIT_CPU, LIMIT_NOFILE, LIMIT_CORE,
+                       LIMIT_NPROC};
+
+  int pos = 1;
+  int kind;
+  int index;
+
+  memset(limits, 0, sizeof(YashLimits_t));
+  if(argv[0] == NULL || strcmp(argv[0], "limit")){
+    return 0;
+  }
+
+  while(argv[pos] != NULL && argv[pos][0] == '-' && argv[pos + 1] != NULL){
+    for(index = 0; FLAGS[index] != NULL; index++){
+      if(!strcmp(argv[pos], FLAGS[index])){
+        break;
+      }
+    }
+    if(FLAGS[index] == NULL){
+      break;
+    }
+    kind = KINDS[index];
+    if(limitParseValue(argv[pos + 1], kind == LIMIT_AS || kind == LIMIT_CORE,
+                       &limits->value[kind]) < 0){
+      fprintf(stderr, "yash: limit: %s: bad value\n", argv[pos + 1]);
+      return -1;
+    }
+    limits->has[kind] = 1;
+    pos += 2;
+  }
+
+  if(argv[pos] == NULL || argv[pos][0] == '-'){
+    fprintf(stderr, "%s", USAGE);
+    return -1;
+  }
+  limits->set = 1;
+
+  return pos;
+}
+
+/**
+ * Purpose:
+ *   Apply limits to the calling process. Soft and hard limits are both
+ *   lowered so the job cannot raise them again; the CPU hard limit is one
+ *   second above the soft one so SIGXCPU arrives before SIGKILL.
+ *
+ * Args:
+ *   limits (const YashLimits_t*): Limits
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on the first failure (a message is printed)
+ */
+int limitApply(const YashLimits_t* limits){
+  const int RESOURCES[] = {RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_CORE,
+                           RLIMIT_NPROC};
+  const char* NAMES[] = {"as", "cpu", "nofile", "core", "nproc"};
+
+  struct rlimit old;
+  struct rlimit new;
+  int kind;
+
+  for(kind = 0; kind < LIMIT_COUNT; kind++){
+    if(!limits->has[kind]){
+      continue;
+    }
+    getrlimit(RESOURCES[kind], &old);
+    new.rlim_cur = limits->value[kind];
+    new.rlim_max = limits->value[kind];
+    if(kind == LIMIT_CPU){
+      new.rlim_max++;
+    }
+    if(old.rlim_max != RLIM_INFINITY && new.rlim_max > old.rlim_max){
+      new.rlim_max = old.rlim_max;
+    }
+    if(new.rlim_cur > new.rlim_max){
+      fprintf(stderr, "yash: limit: %s: above the hard limit %llu\n",
+              NAMES[kind], (unsigned long long)old.rlim_max);
+      return -1;
+    }
+    if(setrlimit(RESOURCES[kind], &new) < 0){
+      fprintf(stderr, "yash: limit: %s: %s\n", NAMES[kind], strerror(errno));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Name the limit that killed a job. SIGXCPU, or SIGKILL once the CPU
+ *   time reached the limit, is the CPU limit; SIGSEGV, SIGBUS or SIGABRT
+ *   under an address space limit is taken to be that limit, since stack
+ *   growth and failed allocations end that way. Open file, process and
+ *   core limits only make calls fail inside the job and never kill it.
+ *
+ * Args:
+ *   limits (const YashLimits_t*): Limits the job ran under
+ *   status                 (int): waitpid style status of the job
+ *   usage (const struct rusage*): Resource usage of the job
+ *
+ * Returns:
+ *   (const char*): "cpu" or "as", NULL if no limit killed the job
+ */
+const char* limitViolated(const YashLimits_t* limits, int status,
+                          const struct rusage* usage){
+  long cpuSecs;
+  int sig;
+
+  if(!limits->set || !WIFSIGNALED(status)){
+    return NULL;
+  }
+  sig = WTERMSIG(status);
+  cpuSecs = usage->ru_utime.tv_sec + usage->ru_stime.tv_sec;
+
+  if(limits->has[LIMIT_CPU] &&
+     (sig == SIGXCPU ||
+      (sig == SIGKILL && cpuSecs >= (long)limits->value[LIMIT_CPU]))){
+    return "cpu";
+  }
+  if(limits->has[LIMIT_AS] &&
+     (sig == SIGSEGV || sig == SIGBUS || sig == SIGABRT)){
+    return "as";
+  }
+
+  return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef RLIMIT_H
+#define RLIMIT_H
+
+#include <sys/resource.h>
+
+// Resource limits of jobs. A stage prefixed with
+//
+//   limit [-v KB] [-t SECS] [-n FILES] [-c KB] [-u PROCS] cmd args...
+//
+// is forked by the shell, which lowers the soft and hard limits with
+// setrlimit after setpgid and before exec. The letters follow ulimit;
+// sizes are in KB unless they end in M or G. When the job dies, the signal
+// and rusage the reaper collects tell which limit killed it.
+
+/**
+ * Limits a job can be given
+ */
+enum{
+  LIMIT_AS,
+  LIMIT_CPU,
+  LIMIT_NOFILE,
+  LIMIT_CORE,
+  LIMIT_NPROC,
+  LIMIT_COUNT
+};
+
+/**
+ * YashLimits_t struct, resource limits of one stage
+ */
+typedef struct YashLimits_t{
+  int set;
+  int has[LIMIT_COUNT];
+  rlim_t value[LIMIT_COUNT];
+}YashLimits_t;
+
+int limitParse(char** argv, YashLimits_t* limits);
+int limitApply(const YashLimits_t* limits);
+const char* limitViolated(const YashLimits_t* limits, int status,
+                          const struct rusage* usage);
+
+#endif
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "placement.h"
+
+// Benchmark: pipe throughput between a producer and a consumer process
+// under different placements of the two.
+//
+//   gcc -Wall -O2 -o sched_bench sched_bench.c placement.c rlimit.c plugin.c
+//       libyash.c -ldl
+//   ./sched_bench 2048
+
+#define BENCH_CHUNK (64 * 1024)
+#define BENCH_RUNS 3
+
+/**
+ * Purpose:
+ *   Seconds since an arbitrary point
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): CLOCK_MONOTONIC in seconds
+ */
+double nowSec(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Push bytes through one pipe between two placed processes
+ *
+ * Args:
+ *   bytes          (long): Bytes to send
+ *   producer (YashPlace_t*): Placement of the writer
+ *   consumer (YashPlace_t*): Placement of the reader
+ *
+ * Returns:
+ *   (double): Seconds until both exited
+ */
+double runPair(long bytes, YashPlace_t* producer, YashPlace_t* consumer){
+  char* buf = NULL;
+  double begin;
+  long left;
+  ssize_t ret;
+  int pfd[2];
+  int pid;
+
+  pipe(pfd);
+  begin = nowSec();
+  if((pid = fork()) == 0){
+    close(pfd[0]);
+    placeApply(producer);
+    buf = (char*)calloc(1, BENCH_CHUNK);
+    for(left = bytes; left > 0; left -= ret){
+      if((ret = write(pfd[1], buf, left < BENCH_CHUNK ? left : BENCH_CHUNK))
+         <= 0){
+        _exit(1);
+      }
+    }
+    _exit(0);
+  }
+  if(fork() == 0){
+    close(pfd[1]);
+    placeApply(consumer);
+    buf = (char*)malloc(BENCH_CHUNK);
+    while(read(pfd[0], buf, BENCH_CHUNK) > 0);
+    _exit(0);
+  }
+  close(pfd[0]);
+  close(pfd[1]);
+  while(wait(NULL) > 0);
+
+  return nowSec() - begin;
+}
+
+/**
+ * Purpose:
+ *   Best of BENCH_RUNS runs of one placement, printed
+ *
+ * Args:
+ *   label  (const char*): Name of the placement
+ *   bytes         (long): Bytes per run
+ *   cpu0           (int): Producer CPU, -1 for unpinned
+ *   cpu1           (int): Consumer CPU, -1 for unpinned
+ *
+ * Returns:
+ *   None
+ */
+void report(const char* label, long bytes, int cpu0, int cpu1){
+  YashPlace_t producer;
+  YashPlace_t consumer;
+  double best = 0;
+  double secs;
+  int run;
+
+  memset(&producer, 0, sizeof(producer));
+  memset(&consumer, 0, sizeof(consumer));
+  placePin(&producer, cpu0);
+  placePin(&consumer, cpu1);
+
+  for(run = 0; run < BENCH_RUNS; run++){
+    secs = runPair(bytes, &producer, &consumer);
+    if(run == 0 || secs < best){
+      best = secs;
+    }
+  }
+  if(cpu0 < 0){
+    printf("%-10s           %7.2f GB/s\n", label, bytes / best / 1e9);
+  }
+  else{
+    printf("%-10s cpu %3d,%3d %7.2f GB/s\n", label, cpu0, cpu1,
+           bytes / best / 1e9);
+  }
+
+  return;
+}
+
+int main(int argc, char** argv){
+  cpu_set_t allowed;
+  cpu_set_t shared;
+  long bytes;
+  int cpus[2];
+  int far = -1;
+  int level;
+  int cpu;
+
+  if(argc != 2 || (bytes = atol(argv[1]) * 1024 * 1024) <= 0){
+    fprintf(stderr, "usage: sched_bench MBYTES\n");
+    return 1;
+  }
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  if(placeAdjacent(2, cpus) < 0){
+    fprintf(stderr, "sched_bench: cannot read allowed cpus\n");
+    return 1;
+  }
+
+  // Farthest allowed CPU: outside the L3 of the producer if there is one
+  for(level = 3; far < 0 && level >= 2; level--){
+    if(placeCacheShared(cpus[0], level, &shared) < 0){
+      continue;
+    }
+    for(cpu = CPU_SETSIZE - 1; cpu >= 0 && far < 0; cpu--){
+      if(CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &shared)){
+        far = cpu;
+      }
+    }
+  }
+
+  printf("%d allowed cpus, %ld MB per run\n", CPU_COUNT(&allowed),
+         bytes >> 20);
+  report("unpinned", bytes, -1, -1);
+  report("same-cpu", bytes, cpus[0], cpus[0]);
+  if(cpus[1] != cpus[0]){
+    report("adjacent", bytes, cpus[0], cpus[1]);
+  }
+  if(far >= 0 && far != cpus[1]){
+    report("far", bytes, cpus[0], far);
+  }
+
+  return 0;
+}
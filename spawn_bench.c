@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+
+// Benchmark for spawn latency as the shell's heap grows. The zygote is
+// started first, as yash -z does, then the heap is grown step by step to
+// MBYTES of touched memory. At each step /bin/true is spawned and reaped
+// SPAWNS times by fork and exec, as the shell does without the zygote, by
+// posix_spawn, as libyash does, and through the zygote. fork copies the
+// page tables of the whole heap; the zygote was forked while it was small.
+//
+//   spawn_bench [-n SPAWNS] [MBYTES]
+
+#define BENCH_SPAWNS 200
+#define BENCH_MBYTES 2048
+#define BENCH_STEP_MB 256
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Resident set size of this process
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (long): RSS in MB, -1 if it could not be read
+ */
+long rssMb(void){
+  FILE* statm = NULL;
+  long size;
+  long resident = -1;
+
+  if((statm = fopen("/proc/self/statm", "r")) != NULL){
+    if(fscanf(statm, "%ld %ld", &size, &resident) != 2){
+      resident = -1;
+    }
+    fclose(statm);
+  }
+
+  return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+/**
+ * Purpose:
+ *   Spawn /bin/true and reap it, spawns times
+ *
+ * Args:
+ *   mode              (int): 0 for fork and exec, 1 for posix_spawn, 2 for
+ *                            the zygote
+ *   zygote (YashZygote_t*): Zygote handle, for mode 2
+ *   spawns            (int): Number of spawns
+ *
+ * Returns:
+ *   (double): Mean microseconds per spawn, -1 if a spawn failed
+ */
+double runSpawns(int mode, YashZygote_t* zygote, int spawns){
+  char* argv[] = {"/bin/true", NULL};
+  RedirList_t redirs;
+  double begin;
+  int status;
+  int pid = -1;
+  int err;
+  int index;
+
+  redirs.numOps = 0;
+  begin = nowSec();
+  for(index = 0; index < spawns; index++){
+    if(mode == 0){
+      if((pid = fork()) == 0){
+        execv(argv[0], argv);
+        _exit(127);
+      }
+      err = (pid < 0);
+    }
+    else if(mode == 1){
+      err = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+    }
+    else{
+      err = zygoteSpawn(zygote, argv, &redirs, NULL, 0, 0, &pid);
+    }
+    if(err || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+       WEXITSTATUS(status) != 0){
+      return -1;
+    }
+  }
+
+  return (nowSec() - begin) / spawns * 1e6;
+}
+
+int main(int argc, char** argv){
+  const char* LABELS[] = {"fork", "posix_spawn", "zygote"};
+  const long STEP = (long)BENCH_STEP_MB << 20;
+
+  YashZygote_t* zygote = NULL;
+  char** blocks = NULL;
+  double usec[3];
+  long mbytes = BENCH_MBYTES;
+  int spawns = BENCH_SPAWNS;
+  int numBlocks = 0;
+  int argi = 1;
+  int mode;
+
+  if(argc > argi + 1 && !strcmp(argv[argi], "-n")){
+    spawns = atoi(argv[argi + 1]);
+    argi += 2;
+  }
+  if(argi < argc){
+    mbytes = atol(argv[argi++]);
+  }
+  if(argi != argc || spawns < 1 || mbytes < 0){
+    fprintf(stderr, "usage: spawn_bench [-n SPAWNS] [MBYTES]\n");
+    return 1;
+  }
+
+  if((zygote = zygoteStart()) == NULL){
+    fprintf(stderr, "spawn_bench: zygote did not start\n");
+    return 1;
+  }
+  blocks = (char**)calloc(mbytes / BENCH_STEP_MB + 1, sizeof(char*));
+
+  printf("%d spawns of /bin/true per step, mean latency\n", spawns);
+  printf("%8s %12s %12s %12s\n", "RSS MB", LABELS[0], LABELS[1], LABELS[2]);
+  while(1){
+    for(mode = 0; mode < 3; mode++){
+      if((usec[mode] = runSpawns(mode, zygote, spawns)) < 0){
+        fprintf(stderr, "spawn_bench: %s: spawn failed\n", LABELS[mode]);
+        zygoteStop(zygote);
+        return 1;
+      }
+    }
+    printf("%8ld %9.1f us %9.1f us %9.1f us\n", rssMb(), usec[0], usec[1],
+           usec[2]);
+    fflush(stdout);
+
+    if((long)(numBlocks + 1) * BENCH_STEP_MB > mbytes){
+      break;
+    }
+    // Touch every page so the heap is resident, as a long-lived shell's is
+    if((blocks[numBlocks] = (char*)malloc(STEP)) == NULL){
+      break;
+    }
+    memset(blocks[numBlocks++], 1, STEP);
+  }
+
+  zygoteStop(zygote);
+  while(numBlocks > 0){
+    free(blocks[--numBlocks]);
+  }
+  free(blocks);
+
+  return 0;
+}
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "watch.h"
+
+#define WATCH_EVENT_BUF 4096
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * WatchDir_t struct, one inotify watch and the path it was added for
+ */
+typedef struct WatchDir_t{
+  int wd;
+  char* path;
+}WatchDir_t;
+
+/**
+ * YashWatch_t struct, the watches of one watch-run
+ */
+struct YashWatch_t{
+  int inotifyFd;
+  WatchDir_t* dirs;
+  int numDirs;
+  int cap;
+  char** excludes;
+  int warned;
+};
+
+/**
+ * Purpose:
+ *   Check whether changes to a name are ignored: dot names and names
+ *   matching an exclude glob
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set
+ *   name   (const char*): Last component of a path
+ *
+ * Returns:
+ *   (int): 1 if ignored, else 0
+ */
+int watchIgnored(YashWatch_t* watch, const char* name){
+  int index;
+
+  if(name[0] == '.'){
+    return 1;
+  }
+  for(index = 0; watch->excludes != NULL && watch->excludes[index] != NULL;
+      index++){
+    if(fnmatch(watch->excludes[index], name, 0) == 0){
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Find the watch with a descriptor
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set
+ *   wd            (int): inotify watch descriptor
+ *
+ * Returns:
+ *   (int): Index in watch->dirs, -1 if not found
+ */
+int watchFind(YashWatch_t* watch, int wd){
+  int index;
+
+  for(index = 0; index < watch->numDirs; index++){
+    if(watch->dirs[index].wd == wd){
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Purpose:
+ *   Watch a path and, if it is a directory, every directory below it that
+ *   is not ignored. Symlinks are not followed below the top.
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set
+ *   path   (const char*): File or directory
+ *
+ * Returns:
+ *   None
+ */
+void watchTree(YashWatch_t* watch, const char* path){
+  char child[PATH_MAX];
+  struct dirent* entry = NULL;
+  struct stat st;
+  DIR* dir = NULL;
+  int isDir;
+  int wd;
+
+  if((wd = inotify_add_watch(watch->inotifyFd, path, WATCH_MASK)) < 0){
+    if(!watch->warned){
+      // Usually fs.inotify.max_user_watches; the rest is still watched
+      fprintf(stderr, "yash: watch-run: %s: %s\n", path, strerror(errno));
+      watch->warned = 1;
+    }
+    return;
+  }
+  if(watchFind(watch, wd) < 0){
+    if(watch->numDirs == watch->cap){
+      watch->cap = watch->cap ? 2 * watch->cap : 64;
+      watch->dirs = (WatchDir_t*)realloc(watch->dirs,
+                                         watch->cap * sizeof(WatchDir_t));
+    }
+    watch->dirs[watch->numDirs].wd = wd;
+    watch->dirs[watch->numDirs++].path = strdup(path);
+  }
+
+  if((dir = opendir(path)) == NULL){
+    return;
+  }
+  while((entry = readdir(dir)) != NULL){
+    if(watchIgnored(watch, entry->d_name)){
+      continue;
+    }
+    if(snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >=
+       (int)sizeof(child)){
+      continue;
+    }
+    isDir = (entry->d_type == DT_DIR);
+    if(entry->d_type == DT_UNKNOWN && lstat(child, &st) == 0){
+      isDir = S_ISDIR(st.st_mode);
+    }
+    if(isDir){
+      watchTree(watch, child);
+    }
+  }
+  closedir(dir);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Start watching paths recursively
+ *
+ * Args:
+ *   paths    (char**): NULL terminated files and directories
+ *   excludes (char**): NULL terminated globs of names to ignore, may be
+ *                      NULL; must outlive the watch set
+ *
+ * Returns:
+ *   (YashWatch_t*): Watch set, NULL if a path does not exist or inotify is
+ *                   not available (a message is printed)
+ */
+YashWatch_t* watchOpen(char** paths, char** excludes){
+  YashWatch_t* watch = (YashWatch_t*)calloc(1, sizeof(YashWatch_t));
+  struct stat st;
+  int index;
+
+  watch->excludes = excludes;
+  if((watch->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0){
+    fprintf(stderr, "yash: watch-run: %s\n", strerror(errno));
+    free(watch);
+    return NULL;
+  }
+  for(index = 0; paths[index] != NULL; index++){
+    if(stat(paths[index], &st) < 0){
+      fprintf(stderr, "yash: watch-run: %s: %s\n", paths[index],
+              strerror(errno));
+      watchClose(watch);
+      return NULL;
+    }
+    watchTree(watch, paths[index]);
+  }
+
+  return watch;
+}
+
+/**
+ * Purpose:
+ *   Drop every watch
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void watchClose(YashWatch_t* watch){
+  int index;
+
+  if(watch == NULL){
+    return;
+  }
+
+  close(watch->inotifyFd);
+  for(index = 0; index < watch->numDirs; index++){
+    free(watch->dirs[index].path);
+  }
+  free(watch->dirs);
+  free(watch);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   fd that becomes readable when a watched path changes
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set
+ *
+ * Returns:
+ *   (int): inotify fd
+ */
+int watchFd(YashWatch_t* watch){
+  return watch->inotifyFd;
+}
+
+/**
+ * Purpose:
+ *   Read pending events without blocking. New directories are watched,
+ *   and a watched file replaced by rename (as editors save) is watched
+ *   again under its path.
+ *
+ * Args:
+ *   watch (YashWatch_t*): Watch set
+ *   changed      (char*): Set to the last changed path, may be NULL
+ *   size        (size_t): Size of changed
+ *
+ * Returns:
+ *   (int): Number of changes that are not ignored
+ */
+int watchRead(YashWatch_t* watch, char* changed, size_t size){
+  char buf[WATCH_EVENT_BUF]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event* event = NULL;
+  char path[PATH_MAX];
+  struct stat st;
+  ssize_t len;
+  ssize_t pos;
+  int count = 0;
+  int index;
+
+  while((len = read(watch->inotifyFd, buf, sizeof(buf))) > 0){
+    for(pos = 0; pos < len; pos += sizeof(struct inotify_event) + event->len){
+      event = (const struct inotify_event*)(buf + pos);
+      if(event->mask & IN_Q_OVERFLOW){
+        count++;
+        continue;
+      }
+      if((index = watchFind(watch, event->wd)) < 0){
+        continue;
+      }
+      if(event->len > 0 && watchIgnored(watch, event->name)){
+        continue;
+      }
+      if(event->len > 0){
+        snprintf(path, sizeof(path), "%s/%s", watch->dirs[index].path,
+                 event->name);
+      }
+      else{
+        snprintf(path, sizeof(path), "%s", watch->dirs[index].path);
+      }
+
+      if(event->mask & IN_IGNORED){
+        // The watched inode is gone; watch whatever now has its path
+        free(watch->dirs[index].path);
+        watch->dirs[index] = watch->dirs[--watch->numDirs];
+        if(stat(path, &st) == 0){
+          watchTree(watch, path);
+        }
+        continue;
+      }
+      if((event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+         (event->mask & IN_ISDIR)){
+        watchTree(watch, path);
+      }
+      if(changed != NULL){
+        snprintf(changed, size, "%s", path);
+      }
+      count++;
+    }
+  }
+
+  return count;
+}
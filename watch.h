@@ -0,0 +1,20 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+// File-change watches for watch-run. Every directory under the given paths
+// is watched with inotify, and directories created later are added as
+// their events arrive, so a change anywhere below a path wakes the shell
+// without polling. Names starting with '.' (.git, editor swap files) and
+// names matching an exclude glob are ignored, so a command's own outputs
+// can be kept from retriggering it.
+
+typedef struct YashWatch_t YashWatch_t;
+
+YashWatch_t* watchOpen(char** paths, char** excludes);
+void watchClose(YashWatch_t* watch);
+int watchFd(YashWatch_t* watch);
+int watchRead(YashWatch_t* watch, char* changed, size_t size);
+
+#endif
@@ -1,25 +1,58 @@
+#define _GNU_SOURCE
+
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
+#include "libyash_internal.h"
+#include "board.h"
+#include "cache.h"
+#include "dag.h"
+#include "execindex.h"
+#include "fanout.h"
+#include "group.h"
+#include "history.h"
+#include "lineread.h"
+#include "memstat.h"
+#include "meter.h"
+#include "mux.h"
+#include "placement.h"
+#include "plugin.h"
+#include "watch.h"
+#include "yashd.h"
+#include "zygote.h"
+#include "zpipe.h"
+
 // Used for debugging
 #include <errno.h>
 
 // Directions here:
 // https://docs.google.com/document/d/1LBMJslvYvw59uZ_8DNiiPzsp0heW3qesaalOo31IGYg/edit
 
-// TODO: Refactor into several .c and .h files, separating read, parse, and
-//       execute would be a good place to start
+// TODO: Keep refactoring into several .c and .h files; parsing, redirection
+//       and spawning live in libyash.c, job control is still here
 // haha I'm sorry about this
 
+#define MAX_REAP_EVENTS 32
+#define JOB_STAGES 2
+
 typedef struct StrNode_t{
   char* jobStr;
 
@@ -35,6 +68,13 @@ typedef struct Job_t{
   int pgid;
   int inFG;
   int status;
+  int exitStatus;
+  int timedOut;
+  int stagePids[JOB_STAGES];
+  YashLimits_t limits[JOB_STAGES];
+  const char* limitHit;
+  int64_t startNs;
+  int64_t cpuNs;
 }Job_t;
 
 /**
@@ -46,11 +86,66 @@ typedef struct JobNode_t{
   struct JobNode_t* next;
 }JobNode_t;
 
+/**
+ * TrackNode_t struct, a child of the shell and its pidfd. A child may also
+ * carry its job's timeout timerfd, registered under the same node: the
+ * leader's at first, then that of a stage still running when it exits.
+ */
+typedef struct TrackNode_t{
+  int pid;
+  int pidfd;
+  int timerFd;
+  int timerPgid;
+  int timeoutSig;
+  long killAfterMs;
+
+  struct TrackNode_t* next;
+}TrackNode_t;
+
+/**
+ * Timeout_t struct, timeout to arm on the next job started
+ */
+typedef struct Timeout_t{
+  long durationMs;
+  int sig;
+  long killAfterMs;
+}Timeout_t;
+
+/**
+ * MeterNode_t struct, a metered pipe and the job it was started for. It
+ * outlives the job until its thread has passed on the last byte.
+ */
+typedef struct MeterNode_t{
+  YashMeter_t* meter;
+  int jobId;
+  int pgid;
+
+  struct MeterNode_t* next;
+}MeterNode_t;
+
 JobNode_t** jobStack = NULL;
+TrackNode_t* trackList = NULL;
+MeterNode_t* meterList = NULL;
+Timeout_t jobTimeout = {0, SIGTERM, 0};
+int childEpfd = -1;
+int sigchldFd = -1;
 int fgExist = 0;
 int fromFG = 0;
 int pgrp = -1;
 char* fgProc;
+YashZygote_t* zygote = NULL;
+YashMux_t* mux = NULL;
+YashHist_t* hist = NULL;
+YashExecIndex_t* execIndex = NULL;
+YashBoard_t* board = NULL;
+int muxOutput = 0;
+int jobBoard = 0;
+int pipeMeter = 0;
+int meterNext = 0;
+// Set by watch-run: foreground jobs are started but not waited for
+int fgNoWait = 0;
+// Exit code of the last foreground job, for && and || in a group line
+int lastStatus = 0;
 
 /**
  * Purpose:
@@ -63,9 +158,9 @@ char* fgProc;
  *   None 
  */ 
 void pushStr(StrNode_t** head, char* str){
-  StrNode_t* curr = (StrNode_t*)malloc(sizeof(StrNode_t));
+  StrNode_t* curr = (StrNode_t*)memAlloc(MEM_NOTIFY, sizeof(StrNode_t));
   
-  curr->jobStr = (char*)malloc(2001 * sizeof(char));
+  curr->jobStr = (char*)memAlloc(MEM_NOTIFY, 2001 * sizeof(char));
   strcpy(curr->jobStr, str);
 
   curr->next = (*head);
@@ -94,14 +189,148 @@ void popStr(StrNode_t** head){
   temp = (*head)->next;
   if((*head)->jobStr != NULL){
     printf("%s", (*head)->jobStr);
-    free((*head)->jobStr);
+    memFree(MEM_NOTIFY, (*head)->jobStr);
   }
-  free(*head);
+  memFree(MEM_NOTIFY, *head);
   (*head) = temp;
 
   return;
 }
 
+/**
+ * Purpose:
+ *   Keep a metered pipe until its final report
+ * 
+ * Args:
+ *   meter (YashMeter_t*): Meter of the job's pipe
+ *   jobId          (int): Job ID
+ *   pgid           (int): Process group ID of the job
+ * 
+ * Returns:
+ *   None
+ */
+void addMeter(YashMeter_t* meter, int jobId, int pgid){
+  MeterNode_t* node = (MeterNode_t*)malloc(sizeof(MeterNode_t));
+
+  node->meter = meter;
+  node->jobId = jobId;
+  node->pgid = pgid;
+  node->next = meterList;
+  meterList = node;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Find the meter of a job
+ * 
+ * Args:
+ *   pgid (int): Process group ID of the job
+ * 
+ * Returns:
+ *   (YashMeter_t*): Meter, or NULL if the job's pipe is not metered
+ */
+YashMeter_t* findMeter(int pgid){
+  MeterNode_t* curr = meterList;
+
+  while(curr != NULL){
+    if(curr->pgid == pgid){
+      return curr->meter;
+    }
+    curr = curr->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Print the final report of every metered pipe whose data has all been
+ *   passed on, and free its meter
+ * 
+ * Args:
+ *   stopAll (int): 1 to also stop meters that are still running, without
+ *                  a report (the shell is exiting)
+ * 
+ * Returns:
+ *   None
+ */
+void reportMeters(int stopAll){
+  const char* FORMAT = "[%d]   pipe: %s\n";
+
+  MeterNode_t** link = &meterList;
+  MeterNode_t* node = NULL;
+  YashMeterStats_t stats;
+  char line[256];
+
+  while((node = *link) != NULL){
+    if(!meterWait(node->meter, 0) && !stopAll){
+      link = &node->next;
+      continue;
+    }
+    meterStats(node->meter, &stats);
+    if(stats.done){
+      meterFormat(&stats, line, sizeof(line));
+      printf(FORMAT, node->jobId, line);
+    }
+    meterStop(node->meter);
+    *link = node->next;
+    free(node);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Mirror the job stack onto the status board, if set -o board is on.
+ *   SIGCHLD is blocked so a reap cannot publish in the middle of this.
+ * 
+ * Args:
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void syncBoard(JobNode_t** head){
+  const int STATES[] = {BOARD_RUNNING, BOARD_STOPPED, BOARD_DONE};
+  const int DONE_VAL = 2;
+
+  YashBoardJob_t jobs[BOARD_MAX_JOBS];
+  JobNode_t* curr = NULL;
+  Job_t* job = NULL;
+  sigset_t mask;
+  sigset_t oldMask;
+  int numJobs = 0;
+
+  if(board == NULL || head == NULL){
+    return;
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+  for(curr = *head; curr != NULL && numJobs < BOARD_MAX_JOBS;
+      curr = curr->next){
+    job = curr->job;
+    memset(&jobs[numJobs], 0, sizeof(YashBoardJob_t));
+    jobs[numJobs].jobId = job->jobId;
+    jobs[numJobs].pgid = job->pgid;
+    jobs[numJobs].state = STATES[job->status];
+    jobs[numJobs].exitStatus = job->exitStatus;
+    jobs[numJobs].startNs = job->startNs;
+    jobs[numJobs].cpuNs = job->status == DONE_VAL ? job->cpuNs :
+                          boardProcCpuNs(job->pgid);
+    snprintf(jobs[numJobs].cmd, BOARD_CMD_LEN, "%s", job->jobStr);
+    numJobs++;
+  }
+  boardPublish(board, jobs, numJobs);
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+  return;
+}
+
 /**
  * Purpose:
  *   Push JobNode to background stack
@@ -117,10 +346,11 @@ void popStr(StrNode_t** head){
  *   None
  */ 
 void pushNode(JobNode_t** head, char* jobStr, int pgid, int status, int inFG){
-  Job_t* job = (Job_t*)malloc(sizeof(Job_t));
-  JobNode_t* curr = (JobNode_t*)malloc(sizeof(JobNode_t));
+  Job_t* job = (Job_t*)memAlloc(MEM_JOBS, sizeof(Job_t));
+  JobNode_t* curr = (JobNode_t*)memAlloc(MEM_JOBS, sizeof(JobNode_t));
+  struct timespec now;
   
-  job->jobStr = (char*)malloc(2001 * sizeof(char));
+  job->jobStr = (char*)memAlloc(MEM_JOBS, 2001 * sizeof(char));
   strcpy(job->jobStr, jobStr);
   job->pgid = pgid;
   if(*head == NULL){
@@ -131,11 +361,41 @@ void pushNode(JobNode_t** head, char* jobStr, int pgid, int status, int inFG){
   }  
   job->status = status;
   job->inFG = inFG;
+  job->exitStatus = 0;
+  job->timedOut = 0;
+  memset(job->stagePids, 0, sizeof(job->stagePids));
+  memset(job->limits, 0, sizeof(job->limits));
+  job->limitHit = NULL;
+  clock_gettime(CLOCK_REALTIME, &now);
+  job->startNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  job->cpuNs = 0;
 
   curr->job = job;
 
   curr->next = *head;
   *head = curr;
+  syncBoard(head);
+  return;
+}
+
+/**
+ * Purpose:
+ *   Free a job stack node and its job
+ * 
+ * Args:
+ *   node (JobNode_t*): Node already unlinked from the stack
+ * 
+ * Returns:
+ *   None
+ */ 
+void freeJobNode(JobNode_t* node){
+  if(node->job != NULL){
+    if(node->job->jobStr != NULL)
+      memFree(MEM_JOBS, node->job->jobStr);
+    memFree(MEM_JOBS, node->job);
+  }
+  memFree(MEM_JOBS, node);
+
   return;
 }
 
@@ -156,12 +416,7 @@ void freeJobStack(JobNode_t** head){
   while(curr != NULL){
     temp = curr;
     curr = curr->next;
-    if(temp->job != NULL){
-      if(temp->job->jobStr != NULL)
-        free(temp->job->jobStr);
-      free(temp->job);
-    }
-    free(temp);
+    freeJobNode(temp);
   }
 
   return;
@@ -368,6 +623,10 @@ void printDoneJobs(JobNode_t** head){
   const char BACK = '-';
   const char* DONE_TXT = "Done";
   const char* FORMAT = "[%d]%c  %s            %s\n";
+  const char* EXIT_FMT = "[%d]%c  Exit %-10d %s\n";
+  const char* TIMEOUT_TXT = "Timeout";
+  const char* TIMEOUT_FMT = "[%d]%c  %s         %s\n";
+  const char* LIMIT_FMT = "[%d]%c  Limit %-9s %s\n";
 
   int currentJobID;
   char currentJob;
@@ -375,7 +634,8 @@ void printDoneJobs(JobNode_t** head){
   
   JobNode_t* curr = *head;
   Job_t* currJob = NULL;
-  StrNode_t** strHead = (StrNode_t**)malloc(sizeof(StrNode_t*));
+  StrNode_t** strHead = (StrNode_t**)memAlloc(MEM_NOTIFY,
+                                               sizeof(StrNode_t*));
   *strHead = NULL;
 
   if(curr != NULL){
@@ -393,11 +653,25 @@ void printDoneJobs(JobNode_t** head){
     }
 
     if(currJob->status == DONE_VAL){
-      strEntry = (char*)malloc(MAX_PRINT_LEN * sizeof(char));
-      sprintf(strEntry, FORMAT, currJob->jobId, currentJob, DONE_TXT,
-             currJob->jobStr);
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
+      if(currJob->timedOut){
+        sprintf(strEntry, TIMEOUT_FMT, currJob->jobId, currentJob,
+                TIMEOUT_TXT, currJob->jobStr);
+      }
+      else if(currJob->limitHit != NULL){
+        sprintf(strEntry, LIMIT_FMT, currJob->jobId, currentJob,
+                currJob->limitHit, currJob->jobStr);
+      }
+      else if(currJob->exitStatus != 0){
+        sprintf(strEntry, EXIT_FMT, currJob->jobId, currentJob,
+                currJob->exitStatus, currJob->jobStr);
+      }
+      else{
+        sprintf(strEntry, FORMAT, currJob->jobId, currentJob, DONE_TXT,
+               currJob->jobStr);
+      }
       pushStr(strHead, strEntry);
-      free(strEntry);
+      memFree(MEM_NOTIFY, strEntry);
     }
 
     curr = curr->next;
@@ -406,7 +680,7 @@ void printDoneJobs(JobNode_t** head){
   while((*strHead) != NULL){
     popStr(strHead);
   }
-  free(strHead);
+  memFree(MEM_NOTIFY, strHead);
 
   return;
 }
@@ -417,11 +691,12 @@ void printDoneJobs(JobNode_t** head){
  * 
  * Args:
  *   head (JobNode_t**): Pointer to job stack head pointer
+ *   verbose      (int): 1 to add live pipe meter counters (jobs -v)
  * 
  * Returns:
  *   None
  */
-void printStack(JobNode_t** head){
+void printStack(JobNode_t** head, int verbose){
   const int MAX_PRINT_LEN = 2023;
   const int RUN_VAL = 0;
   const int STOPPED_VAL = 1;
@@ -431,16 +706,24 @@ void printStack(JobNode_t** head){
   const char* RUN_TXT = "Running";
   const char* STOP_TXT = "Stopped";
   const char* DONE_TXT = "Done";
+  const char* TIMEOUT_TXT = "Timeout";
   const char* OTHR_FMT = "[%d]%c  %s         %s\n";
   const char* DONE_FMT = "[%d]%c  %s            %s\n";
+  const char* EXIT_FMT = "[%d]%c  Exit %-10d %s\n";
+  const char* LIMIT_FMT = "[%d]%c  Limit %-9s %s\n";
+  const char* METER_FMT = "      pipe: %s\n";
   
   int currentID;
   char currentJob;
   char* strEntry;
+  char meterLine[256];
+  YashMeter_t* meter = NULL;
+  YashMeterStats_t stats;
 
   JobNode_t* curr = *head;
   Job_t* currJob = NULL;
-  StrNode_t** strHead = (StrNode_t**)malloc(sizeof(StrNode_t*));
+  StrNode_t** strHead = (StrNode_t**)memAlloc(MEM_NOTIFY,
+                                               sizeof(StrNode_t*));
   *strHead = NULL;
   
   if(curr != NULL){
@@ -457,29 +740,65 @@ void printStack(JobNode_t** head){
       currentJob = BACK;
     }
 
-    if(currJob->status == RUN_VAL){
-      strEntry = (char*)malloc(MAX_PRINT_LEN * sizeof(char));
+    if(verbose && (meter = findMeter(currJob->pgid)) != NULL){
+      // Pushed first so it is printed under the job's line
+      meterStats(meter, &stats);
+      meterFormat(&stats, meterLine, sizeof(meterLine));
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
+      sprintf(strEntry, METER_FMT, meterLine);
+
+      pushStr(strHead, strEntry);
+      memFree(MEM_NOTIFY, strEntry);
+    }
+
+    if(currJob->timedOut){
+      // Signalled by its timeout, whether or not it has exited yet
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
+      sprintf(strEntry, OTHR_FMT, currJob->jobId, currentJob, TIMEOUT_TXT,
+           currJob->jobStr);
+
+      pushStr(strHead, strEntry);
+      memFree(MEM_NOTIFY, strEntry);
+    }
+    else if(currJob->status == DONE_VAL && currJob->limitHit != NULL){
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
+      sprintf(strEntry, LIMIT_FMT, currJob->jobId, currentJob,
+           currJob->limitHit, currJob->jobStr);
+
+      pushStr(strHead, strEntry);
+      memFree(MEM_NOTIFY, strEntry);
+    }
+    else if(currJob->status == RUN_VAL){
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
       sprintf(strEntry, OTHR_FMT, currJob->jobId, currentJob, RUN_TXT,
            currJob->jobStr);
 
       pushStr(strHead, strEntry);
-      free(strEntry);
+      memFree(MEM_NOTIFY, strEntry);
     }
     else if(currJob->status == STOPPED_VAL){
-      strEntry = (char*)malloc(MAX_PRINT_LEN * sizeof(char));
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
       sprintf(strEntry, OTHR_FMT, currJob->jobId, currentJob, STOP_TXT,
            currJob->jobStr);
 
       pushStr(strHead, strEntry);
-      free(strEntry);
+      memFree(MEM_NOTIFY, strEntry);
+    }
+    else if(currJob->status == DONE_VAL && currJob->exitStatus != 0){
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
+      sprintf(strEntry, EXIT_FMT, currJob->jobId, currentJob,
+           currJob->exitStatus, currJob->jobStr);
+
+      pushStr(strHead, strEntry);
+      memFree(MEM_NOTIFY, strEntry);
     }
     else if(currJob->status == DONE_VAL){
-      strEntry = (char*)malloc(MAX_PRINT_LEN * sizeof(char));
+      strEntry = (char*)memAlloc(MEM_NOTIFY, MAX_PRINT_LEN * sizeof(char));
       sprintf(strEntry, DONE_FMT, currJob->jobId, currentJob, DONE_TXT,
            currJob->jobStr);
 
       pushStr(strHead, strEntry);
-      free(strEntry);
+      memFree(MEM_NOTIFY, strEntry);
     }
     curr = curr->next;
   }
@@ -487,7 +806,7 @@ void printStack(JobNode_t** head){
   while((*strHead) != NULL){
     popStr(strHead);
   }
-  free(strHead);
+  memFree(MEM_NOTIFY, strHead);
 
   return;
 }
@@ -552,67 +871,104 @@ void changeJobFGState(JobNode_t** head, int pgid, int newFGStat){
 
 /**
  * Purpose:
- *   Remove job by pid from job stack
+ *   Record the exit status of a job in job stack
  * 
  * Args:
- *   head (JobNode_t**): Pointer to job stack head pointer
- *   pgid         (int): PGID of process to remove
+ *   head   (JobNode_t**): Pointer to job stack head pointer
+ *   pgid           (int): Process group ID
+ *   exitStatus     (int): Exit status of the job's leader
  * 
  * Returns:
  *   None
  */ 
-void removeJob(JobNode_t** head, int pgid){
-  JobNode_t* curr = *head;
-  JobNode_t* temp = NULL;
+void changeJobExit(JobNode_t** head, int pgid, int exitStatus){
+  JobNode_t* temp = *head;
   Job_t* currJob = NULL;
 
-  if(curr == NULL){
-    return;
-  }
-  else if(curr->job->pgid == pgid){
-    (*head) = curr->next;
+  while(temp != NULL){
+    currJob = temp->job;
+    if(currJob->pgid == pgid){
+      currJob->exitStatus = exitStatus;
 
-    currJob = curr->job;
-    if(currJob != NULL){
-      if((currJob->jobStr) != NULL)
-        free(currJob->jobStr);
-      free(currJob);
+      return;
     }
-    if(curr != NULL)
-      free(curr);
-
-    return;
+    temp = temp->next;
   }
-  temp = curr->next;
-  currJob = curr->job;
-  if(currJob->pgid == pgid){
-    if(currJob != NULL){
-      if((currJob->jobStr) != NULL)
-        free(currJob->jobStr);
-      free(currJob);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Find job by job number
+ * 
+ * Args:
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ *   jobId        (int): Job number shown by jobs
+ * 
+ * Returns:
+ *   (Job_t*): Pointer to job, or NULL if there is none
+ */ 
+Job_t* findJobById(JobNode_t** head, int jobId){
+  JobNode_t* curr = *head;
+
+  while(curr != NULL){
+    if(curr->job->jobId == jobId){
+      return curr->job;
     }
-    if(curr != NULL)
-      free(curr);
+    curr = curr->next;
+  }
 
-    *head = temp;
-    return;
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Find job by process group ID
+ * 
+ * Args:
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ *   pgid         (int): Process group ID
+ * 
+ * Returns:
+ *   (Job_t*): Pointer to job, or NULL if there is none
+ */ 
+Job_t* findJobByPgid(JobNode_t** head, int pgid){
+  JobNode_t* curr = *head;
+
+  while(curr != NULL){
+    if(curr->job->pgid == pgid){
+      return curr->job;
+    }
+    curr = curr->next;
   }
-  while(temp != NULL){
-    currJob = temp->job;
 
-    if(currJob->pgid == pgid){
-      (*head)->next = temp->next;
+  return NULL;
+}
 
-      if(currJob != NULL){
-        if(currJob->jobStr != NULL)
-          free(currJob->jobStr);
-      }
-      if(temp != NULL)
-        free(temp);
+/**
+ * Purpose:
+ *   Remove job by pid from job stack
+ * 
+ * Args:
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ *   pgid         (int): PGID of process to remove
+ * 
+ * Returns:
+ *   None
+ */ 
+void removeJob(JobNode_t** head, int pgid){
+  JobNode_t** link = head;
+  JobNode_t* curr = NULL;
+
+  while((curr = *link) != NULL){
+    if(curr->job->pgid == pgid){
+      *link = curr->next;
+      freeJobNode(curr);
 
       return;
     }
-    temp = temp->next;
+    link = &curr->next;
   }
   return;
 }
@@ -643,17 +999,10 @@ void removeDoneJobs(JobNode_t** head){
     (*head) = curr->next;
     curr = (*head);
     
-    currJob = temp->job;
-    if(currJob != NULL){
-      if((currJob->jobStr) != NULL)
-        free(currJob->jobStr);
-      free(currJob);
-    }
-    if(temp != NULL)
-      free(temp);
+    freeJobNode(temp);
 
     if(curr != NULL){
-      temp = curr->next;
+      currJob = curr->job;
     }
   }
 
@@ -669,14 +1018,7 @@ void removeDoneJobs(JobNode_t** head){
       currJob = temp->job;
       if(currJob->status == DONE){
         curr->next = temp->next;
-
-        if(currJob != NULL){
-          if(currJob->jobStr != NULL)
-            free(currJob->jobStr);
-          free(currJob);
-        }
-        if(temp != NULL)
-          free(temp);
+        freeJobNode(temp);
 
         temp = curr->next;
       }
@@ -692,530 +1034,2469 @@ void removeDoneJobs(JobNode_t** head){
 
 /**
  * Purpose:
- *   Handler for SIGKILL signal
+ *   Update the job stack from a status returned by waitpid
  * 
  * Args:
- *   sigNum (int): Signal number
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ *   pid          (int): PID the status belongs to
+ *   status       (int): Status from waitpid
  * 
  * Returns:
  *   None
  */
-static void sigintHandler(int sigNum){
-  const char* PROMPT = "# ";
-  Job_t* fgJob = findFGProc(jobStack);
+void updateJobStatus(JobNode_t** head, int pid, int status){
+  const int STOPPED = 1;
+  const int DONE = 2;
+  const int IN_BG = 0;
 
-	if(fgJob != NULL){
-    pgrp = fgJob->pgid;
-    // printf("SIGINT: %d\n", pgrp);
-    killpg(pgrp, SIGINT);
-	}
-  else{
-    printf("\n%s", PROMPT);
+  int exists = 0;
+  Job_t* job = findJobByPgid(head, pid);
+
+  if(job != NULL && job->inFG){
+    lastStatus = groupExitCode(status);
+  }
+  if(WIFEXITED(status)){
+    // Child exited normally
+    exists = findID(head, pid);
+    if(exists){
+      changeJobStatus(head, pid, DONE);
+      changeJobExit(head, pid, WEXITSTATUS(status));
+      if(job->timedOut || job->limitHit != NULL)
+        changeJobFGState(head, pid, IN_BG);
+      else if(isInFG(head, pid))
+        removeJob(head, pid);
+    }
+  }
+  else if(WIFSIGNALED(status)){
+    // Child killed by signal; jobs killed by their timeout or a limit stay
+    // until reported as Done
+    exists = findID(head, pid);
+    if(exists && (job->timedOut || job->limitHit != NULL)){
+      changeJobStatus(head, pid, DONE);
+      changeJobFGState(head, pid, IN_BG);
+    }
+    else if(exists)
+      removeJob(head, pid);
+  }
+  else if(WIFSTOPPED(status)){
+    // Child stopped by signal
+    exists = findID(head, pid);
+    if(exists)
+      changeJobStatus(head, pid, STOPPED);
+    else if(!findID(head, getpgid(pid))){
+      // A later pipeline stage stops with its leader, which already has
+      // the job's entry
+      pushNode(head, fgProc, pid, STOPPED, IN_BG);
+    }
   }
+  syncBoard(head);
 
-  // reset handler
-  signal(SIGINT, sigintHandler);
   return;
 }
 
 /**
  * Purpose:
- *   Handler for SIGTSTP signal
+ *   Convert a waitid result to the status format waitpid returns
  * 
  * Args:
- *   sigNum (int): Signal number
+ *   info (siginfo_t*): Result filled in by waitid
  * 
  * Returns:
- *   None
+ *   (int): Status usable with WIFEXITED, WIFSIGNALED and WIFSTOPPED
  */
-static void sigtstpHandler(int sigNum){
-  const int IN_BG = 0;
-  const char* PROMPT = "# ";
-  Job_t* fgJob = findFGProc(jobStack);
-  // printf("TSTP Handler run!\n");
+int siginfoToStatus(siginfo_t* info){
+  const int CORE_FLAG = 0x80;
+  const int STOP_FLAG = 0x7f;
 
-	if(fgJob != NULL){
-    pgrp = fgJob->pgid;
-    // printf("SIGTSTP: %d\n", pgrp);
-    changeJobFGState(jobStack, pgrp, IN_BG);
-    kill(-pgrp, SIGTSTP);
-	}
-  else{
-    printf("\n%s", PROMPT);
+  if(info->si_code == CLD_EXITED){
+    return (info->si_status & 0xff) << 8;
+  }
+  else if(info->si_code == CLD_KILLED){
+    return info->si_status & 0x7f;
+  }
+  else if(info->si_code == CLD_DUMPED){
+    return (info->si_status & 0x7f) | CORE_FLAG;
+  }
+  else if(info->si_code == CLD_STOPPED || info->si_code == CLD_TRAPPED){
+    return ((info->si_status & 0xff) << 8) | STOP_FLAG;
   }
 
-  // reset handler
-  signal(SIGTSTP, sigtstpHandler);
-  return;
+  return 0xffff;
 }
 
 /**
  * Purpose:
- *   Handler for SIGCHLD signals
+ *   Set up the epoll set that child pidfds and the SIGCHLD signalfd are
+ *   registered in
  * 
  * Args:
+ *   None
  * 
  * Returns:
  *   None
  */
-static void sigchldHandler(int sigNum){
-  if(signal(SIGINT, sigintHandler) == SIG_ERR){
-    printf("signal(SIGINT) error");
-  }
-  if(signal(SIGTSTP, sigtstpHandler) == SIG_ERR){
-    printf("signal(SIGTSTP) error");
-  } 
-  if(signal(SIGCHLD, sigchldHandler) == SIG_ERR){
-    printf("signal(SIGCHLD) error");
-  } 
+void initChildTracking(void){
+  struct epoll_event ev;
+  sigset_t mask;
 
-  const int STOPPED = 1;
-  const int DONE = 2;
-  const int IN_BG = 0;
-  int status;
-  int waitRet;
-  int exists = 0;
+  childEpfd = epoll_create1(EPOLL_CLOEXEC);
 
-  while ((waitRet = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-    // Reaping function
-    if (WIFEXITED(status)){
-      // Child exited normally
-      exists = findID(jobStack, waitRet);
-	    if(exists){
-        changeJobStatus(jobStack, waitRet, DONE);
-        if(isInFG(jobStack, waitRet))
-          removeJob(jobStack, waitRet);
+  // Only readable while SIGCHLD is blocked, i.e. while the shell waits
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigchldFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(childEpfd, EPOLL_CTL_ADD, sigchldFd, &ev);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Start tracking a child by pidfd. The pidfd is taken while the child is
+ *   still unreaped, so it can never refer to a recycled pid.
+ * 
+ * Args:
+ *   pid (int): PID of a child of the shell
+ * 
+ * Returns:
+ *   None
+ */
+void trackChild(int pid){
+  TrackNode_t* node = (TrackNode_t*)malloc(sizeof(TrackNode_t));
+  struct epoll_event ev;
+  sigset_t mask;
+  sigset_t oldMask;
+
+  node->pid = pid;
+  node->timerFd = -1;
+  node->timerPgid = pid;
+  node->timeoutSig = SIGTERM;
+  node->killAfterMs = 0;
+  node->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if(node->pidfd >= 0){
+    fcntl(node->pidfd, F_SETFD, FD_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = node;
+    epoll_ctl(childEpfd, EPOLL_CTL_ADD, node->pidfd, &ev);
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+  node->next = trackList;
+  trackList = node;
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Find a tracked child by pid
+ * 
+ * Args:
+ *   pid (int): PID to look for
+ * 
+ * Returns:
+ *   (TrackNode_t*): Tracking node, or NULL once the child has been reaped
+ */
+TrackNode_t* findTracked(int pid){
+  TrackNode_t* curr = trackList;
+
+  while(curr != NULL){
+    if(curr->pid == pid){
+      return curr;
+    }
+    curr = curr->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Find a tracked child in a process group, the leader first. While one
+ *   is unreaped the pgid cannot have been reused.
+ * 
+ * Args:
+ *   pgid          (int): Process group ID
+ *   skip (TrackNode_t*): Node to pass over, may be NULL
+ * 
+ * Returns:
+ *   (TrackNode_t*): Tracking node, or NULL if the whole group is reaped
+ */
+TrackNode_t* findTrackedInGroup(int pgid, TrackNode_t* skip){
+  TrackNode_t* curr = findTracked(pgid);
+
+  if(curr != NULL && curr != skip){
+    return curr;
+  }
+  for(curr = trackList; curr != NULL; curr = curr->next){
+    if(curr != skip && getpgid(curr->pid) == pgid){
+      return curr;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Stop tracking a reaped child and free its node. A timeout it carries
+ *   moves to another stage of its job that is still running.
+ * 
+ * Args:
+ *   node (TrackNode_t*): Tracking node
+ * 
+ * Returns:
+ *   None
+ */
+void untrackChild(TrackNode_t* node){
+  TrackNode_t** link = &trackList;
+  TrackNode_t* heir = NULL;
+  struct epoll_event ev;
+
+  while(*link != NULL && *link != node){
+    link = &(*link)->next;
+  }
+  if(*link != NULL){
+    *link = node->next;
+  }
+  if(node->pidfd >= 0){
+    epoll_ctl(childEpfd, EPOLL_CTL_DEL, node->pidfd, NULL);
+    close(node->pidfd);
+  }
+  if(node->timerFd >= 0 &&
+     (heir = findTrackedInGroup(node->timerPgid, node)) != NULL &&
+     heir->timerFd < 0){
+    heir->timerFd = node->timerFd;
+    heir->timerPgid = node->timerPgid;
+    heir->timeoutSig = node->timeoutSig;
+    heir->killAfterMs = node->killAfterMs;
+    ev.events = EPOLLIN;
+    ev.data.ptr = heir;
+    epoll_ctl(childEpfd, EPOLL_CTL_MOD, heir->timerFd, &ev);
+  }
+  else if(node->timerFd >= 0){
+    // The whole job is gone, so its timeout is too
+    epoll_ctl(childEpfd, EPOLL_CTL_DEL, node->timerFd, NULL);
+    close(node->timerFd);
+  }
+  free(node);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Record what the reaper learned about a job one of whose stages just
+ *   died: the leader's CPU time, and which limit, if any, killed the stage
+ * 
+ * Args:
+ *   pid              (int): PID of the reaped child
+ *   status           (int): Its waitpid style status
+ *   usage (struct rusage*): Its resource usage
+ * 
+ * Returns:
+ *   None
+ */
+void noteReaped(int pid, int status, struct rusage* usage){
+  JobNode_t* curr = NULL;
+  Job_t* job = NULL;
+  const char* hit = NULL;
+  int stage = 0;
+
+  if(jobStack == NULL){
+    return;
+  }
+  if((job = findJobByPgid(jobStack, pid)) != NULL){
+    job->cpuNs = (int64_t)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) *
+                 1000000000 + (int64_t)(usage->ru_utime.tv_usec +
+                                        usage->ru_stime.tv_usec) * 1000;
+  }
+  for(curr = *jobStack; job == NULL && curr != NULL; curr = curr->next){
+    for(stage = 1; stage < JOB_STAGES; stage++){
+      if(curr->job->stagePids[stage] == pid){
+        job = curr->job;
+        break;
+      }
+    }
+  }
+
+  // Any stage can hit its own limit; the first one hit is kept for the job
+  if(job != NULL && job->limitHit == NULL &&
+     (hit = limitViolated(&job->limits[stage], status, usage)) != NULL){
+    job->limitHit = hit;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Collect a state change of one tracked child, untracking it if it is
+ *   gone. Children without a pidfd (old kernels) fall back to wait4. The
+ *   child's rusage comes back with its status and is checked against the
+ *   limits of its job.
+ * 
+ * Args:
+ *   node (TrackNode_t*): Tracking node
+ *   options      (int): waitid options
+ *   status      (int*): Set to a waitpid style status
+ * 
+ * Returns:
+ *   (int): 1 if a state change was collected, else 0
+ */
+int reapTracked(TrackNode_t* node, int options, int* status){
+  struct rusage usage;
+  siginfo_t info;
+  int ret;
+
+  memset(&usage, 0, sizeof(usage));
+  if(node->pidfd < 0){
+    do{
+      ret = wait4(node->pid, status,
+                  ((options & WSTOPPED) ? WUNTRACED : 0) |
+                  (options & WNOHANG), &usage);
+    }while(ret < 0 && errno == EINTR);
+    if(ret <= 0){
+      return 0;
+    }
+  }
+  else{
+    memset(&info, 0, sizeof(info));
+    // The raw syscall takes the rusage argument the libc wrapper hides
+    do{
+      ret = syscall(SYS_waitid, P_PIDFD, node->pidfd, &info, options,
+                    &usage);
+    }while(ret < 0 && errno == EINTR);
+    if(ret < 0 || info.si_pid == 0){
+      return 0;
+    }
+    *status = siginfoToStatus(&info);
+  }
+
+  if(WIFEXITED(*status) || WIFSIGNALED(*status)){
+    noteReaped(node->pid, *status, &usage);
+    untrackChild(node);
+  }
+
+  return 1;
+}
+
+/**
+ * Purpose:
+ *   Signal a job's process group. Only sent while one of its processes
+ *   is still tracked (unreaped), so the pgid cannot have been reused.
+ * 
+ * Args:
+ *   pgid (int): Process group ID of the job
+ *   sig  (int): Signal number
+ * 
+ * Returns:
+ *   (int): 0 on success, -1 on failure
+ */
+int signalJob(int pgid, int sig){
+  if(findTrackedInGroup(pgid, NULL) == NULL){
+    errno = ESRCH;
+    return -1;
+  }
+
+  return killpg(pgid, sig);
+}
+
+/**
+ * Purpose:
+ *   Arm a one-shot timerfd
+ * 
+ * Args:
+ *   fd  (int): timerfd
+ *   ms (long): Milliseconds until expiry
+ * 
+ * Returns:
+ *   (int): Result of timerfd_settime
+ */
+int armTimerFd(int fd, long ms){
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = ms / 1000;
+  spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+
+  return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+/**
+ * Purpose:
+ *   Arm the pending jobTimeout, if any, on a job that was just started.
+ *   The timerfd joins the child epoll set under the leader's node.
+ * 
+ * Args:
+ *   pgid (int): Process group ID of the job; its leader must be tracked
+ * 
+ * Returns:
+ *   None
+ */
+void armTimeout(int pgid){
+  TrackNode_t* node = findTracked(pgid);
+  struct epoll_event ev;
+
+  if(jobTimeout.durationMs <= 0 || node == NULL){
+    return;
+  }
+
+  node->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(node->timerFd < 0){
+    fprintf(stderr, "yash: timeout: %s\n", strerror(errno));
+    return;
+  }
+  node->timerPgid = pgid;
+  node->timeoutSig = jobTimeout.sig;
+  node->killAfterMs = jobTimeout.killAfterMs;
+  armTimerFd(node->timerFd, jobTimeout.durationMs);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = node;
+  epoll_ctl(childEpfd, EPOLL_CTL_ADD, node->timerFd, &ev);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Signal a job's process group if its timeout has expired, then either
+ *   re-arm for the SIGKILL escalation or disarm
+ * 
+ * Args:
+ *   node (TrackNode_t*): Tracking node carrying the job's timer
+ * 
+ * Returns:
+ *   None
+ */
+void fireTimeout(TrackNode_t* node){
+  uint64_t expirations;
+  Job_t* job = NULL;
+
+  if(node->timerFd < 0 ||
+     read(node->timerFd, &expirations, sizeof(expirations)) <= 0){
+    return;
+  }
+
+  if((job = findJobByPgid(jobStack, node->timerPgid)) != NULL){
+    job->timedOut = 1;
+  }
+  signalJob(node->timerPgid, node->timeoutSig);
+  // A stopped job would not act on the signal until continued
+  signalJob(node->timerPgid, SIGCONT);
+
+  if(node->killAfterMs > 0){
+    node->timeoutSig = SIGKILL;
+    armTimerFd(node->timerFd, node->killAfterMs);
+    node->killAfterMs = 0;
+  }
+  else{
+    epoll_ctl(childEpfd, EPOLL_CTL_DEL, node->timerFd, NULL);
+    close(node->timerFd);
+    node->timerFd = -1;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Reap children whose pidfds are ready and update the job stack. Exits
+ *   cost O(ready). Stops do not wake a pidfd, so every SIGCHLD triggers
+ *   one scan of the tracked children for stops, even when exits were
+ *   reaped: SIGCHLDs coalesce, and a stop may share one with an exit.
+ * 
+ * Args:
+ *   timeoutMs   (int): epoll timeout, -1 to block until something happens
+ *   sawSigchld  (int): 1 if called for a SIGCHLD delivered to the handler
+ *   pids       (int*): Filled with PIDs that changed state, may be NULL
+ *   statuses   (int*): Filled with their statuses, may be NULL
+ *   maxOut      (int): Capacity of pids and statuses
+ * 
+ * Returns:
+ *   (int): Number of state changes stored in pids/statuses, -1 if a
+ *          signal interrupted the wait
+ */
+int reapChildren(int timeoutMs, int sawSigchld, int* pids, int* statuses,
+                 int maxOut){
+  struct epoll_event events[MAX_REAP_EVENTS];
+  struct signalfd_siginfo sigInfo;
+  TrackNode_t* node = NULL;
+  TrackNode_t* next = NULL;
+  int scan = sawSigchld;
+  int numOut = 0;
+  int numEvents;
+  int status;
+  int pid;
+  int index;
+
+  numEvents = epoll_wait(childEpfd, events, MAX_REAP_EVENTS, timeoutMs);
+  if(numEvents < 0){
+    return -1;
+  }
+  for(index = 0; index < numEvents; index++){
+    node = (TrackNode_t*)events[index].data.ptr;
+    if(node == NULL){
+      while(read(sigchldFd, &sigInfo, sizeof(sigInfo)) > 0);
+      scan = 1;
+      continue;
+    }
+
+    // The event is either the pidfd or the leader's timeout timerfd
+    fireTimeout(node);
+    pid = node->pid;
+    if(reapTracked(node, WEXITED | WNOHANG, &status)){
+      updateJobStatus(jobStack, pid, status);
+      if(numOut < maxOut){
+        pids[numOut] = pid;
+        statuses[numOut++] = status;
+      }
+    }
+  }
+
+  if(scan){
+    for(node = trackList; node != NULL; node = next){
+      next = node->next;
+      pid = node->pid;
+      if(reapTracked(node, WEXITED | WSTOPPED | WNOHANG, &status)){
+        updateJobStatus(jobStack, pid, status);
+        if(numOut < maxOut){
+          pids[numOut] = pid;
+          statuses[numOut++] = status;
+        }
+      }
+    }
+  }
+
+  return numOut;
+}
+
+/**
+ * Purpose:
+ *   Wait for exactly one child to exit or stop. SIGCHLD is blocked while
+ *   waiting so the handler cannot collect this child's status. A child
+ *   with a timeout is waited for in the epoll set so the timer can fire.
+ * 
+ * Args:
+ *   pid     (int): PID of a tracked child
+ *   status (int*): Set to a waitpid style status
+ * 
+ * Returns:
+ *   (int): 0 on success, -1 if the child is not tracked
+ */
+int waitForChild(int pid, int* status){
+  TrackNode_t* node = NULL;
+  sigset_t mask;
+  sigset_t oldMask;
+  int pids[MAX_REAP_EVENTS];
+  int statuses[MAX_REAP_EVENTS];
+  int numOut;
+  int index;
+  int ret = -1;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+  if((node = findTracked(pid)) != NULL && node->timerFd < 0){
+    if(reapTracked(node, WEXITED | WSTOPPED, status)){
+      ret = 0;
+    }
+  }
+  else if(node != NULL){
+    // Stops arrive through the signalfd, exits and expiry through epoll
+    while(ret < 0 && findTracked(pid) != NULL){
+      numOut = reapChildren(-1, 0, pids, statuses, MAX_REAP_EVENTS);
+      if(numOut < 0 && errno != EINTR){
+        break;
+      }
+      for(index = 0; index < numOut; index++){
+        if(pids[index] == pid){
+          *status = statuses[index];
+          ret = 0;
+        }
+      }
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   readline event hook, run about ten times a second while the prompt
+ *   waits for input, so a background job's timeout fires on time
+ * 
+ * Args:
+ *   None
+ * 
+ * Returns:
+ *   (int): 0
+ */
+int reapWhileIdle(void){
+  sigset_t mask;
+  sigset_t oldMask;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+  reapChildren(0, 0, NULL, NULL, 0);
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Handler for SIGKILL signal
+ * 
+ * Args:
+ *   sigNum (int): Signal number
+ * 
+ * Returns:
+ *   None
+ */
+static void sigintHandler(int sigNum){
+  const char* PROMPT = "# ";
+  Job_t* fgJob = findFGProc(jobStack);
+
+	if(fgJob != NULL){
+    pgrp = fgJob->pgid;
+    // printf("SIGINT: %d\n", pgrp);
+    signalJob(pgrp, SIGINT);
+	}
+  else{
+    printf("\n%s", PROMPT);
+  }
+
+  // reset handler
+  signal(SIGINT, sigintHandler);
+  return;
+}
+
+/**
+ * Purpose:
+ *   Handler for SIGTSTP signal
+ * 
+ * Args:
+ *   sigNum (int): Signal number
+ * 
+ * Returns:
+ *   None
+ */
+static void sigtstpHandler(int sigNum){
+  const int IN_BG = 0;
+  const char* PROMPT = "# ";
+  Job_t* fgJob = findFGProc(jobStack);
+  // printf("TSTP Handler run!\n");
+
+	if(fgJob != NULL){
+    pgrp = fgJob->pgid;
+    // printf("SIGTSTP: %d\n", pgrp);
+    changeJobFGState(jobStack, pgrp, IN_BG);
+    signalJob(pgrp, SIGTSTP);
+	}
+  else{
+    printf("\n%s", PROMPT);
+  }
+
+  // reset handler
+  signal(SIGTSTP, sigtstpHandler);
+  return;
+}
+
+/**
+ * Purpose:
+ *   Handler for SIGCHLD signals
+ * 
+ * Args:
+ * 
+ * Returns:
+ *   None
+ */
+static void sigchldHandler(int sigNum){
+  if(signal(SIGINT, sigintHandler) == SIG_ERR){
+    printf("signal(SIGINT) error");
+  }
+  if(signal(SIGTSTP, sigtstpHandler) == SIG_ERR){
+    printf("signal(SIGTSTP) error");
+  } 
+  if(signal(SIGCHLD, sigchldHandler) == SIG_ERR){
+    printf("signal(SIGCHLD) error");
+  } 
+
+  // Reaping function
+  reapChildren(0, 1, NULL, NULL, 0);
+
+  // signal(SIGCHLD, sigchldHandler);
+}
+
+/**
+ * Purpose:
+ *   Open the pipes a background job's output goes through when the output
+ *   multiplexer is on (set -o mux)
+ * 
+ * Args:
+ *   back     (int): Boolean var indicating background status
+ *   muxMap  (int*): Set to {STDOUT, write end, STDERR, write end}
+ *   muxRead (int*): Set to the read ends of the stdout and stderr pipes
+ * 
+ * Returns:
+ *   (int): 1 if the job's output is multiplexed, else 0
+ */
+int openMuxPipes(int back, int* muxMap, int* muxRead){
+  int outPipe[2];
+  int errPipe[2];
+
+  if(!back || !muxOutput || mux == NULL){
+    return 0;
+  }
+  if(pipe2(outPipe, O_CLOEXEC) < 0){
+    return 0;
+  }
+  if(pipe2(errPipe, O_CLOEXEC) < 0){
+    close(outPipe[0]);
+    close(outPipe[1]);
+    return 0;
+  }
+
+  muxMap[0] = STDOUT_FILENO;
+  muxMap[1] = outPipe[1];
+  muxMap[2] = STDERR_FILENO;
+  muxMap[3] = errPipe[1];
+  muxRead[0] = outPipe[0];
+  muxRead[1] = errPipe[0];
+
+  return 1;
+}
+
+/**
+ * Purpose:
+ *   Put the multiplexer pipes in front of a job's own redirections, so an
+ *   explicit redirection still wins
+ * 
+ * Args:
+ *   redirs (RedirList_t*): fd operations from parseRedirs
+ *   muxMap         (int*): Map from openMuxPipes
+ * 
+ * Returns:
+ *   (int): 0 on success, -1 if the list is full
+ */
+int muxRedirs(RedirList_t* redirs, int* muxMap){
+  int index;
+
+  if(redirs->numOps + 2 > MAX_REDIRS){
+    return -1;
+  }
+
+  memmove(&redirs->ops[2], &redirs->ops[0],
+          redirs->numOps * sizeof(RedirOp_t));
+  for(index = 0; index < 2; index++){
+    memset(&redirs->ops[index], 0, sizeof(RedirOp_t));
+    redirs->ops[index].type = REDIR_DUP;
+    redirs->ops[index].fd = muxMap[2 * index];
+    redirs->ops[index].srcFd = muxMap[2 * index + 1];
+  }
+  redirs->numOps += 2;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Close the shell's copies of the multiplexer write ends and hand the
+ *   read ends to the multiplexer, or close them if the job did not start
+ * 
+ * Args:
+ *   muxed    (int): Result of openMuxPipes
+ *   muxMap  (int*): Map from openMuxPipes
+ *   muxRead (int*): Read ends from openMuxPipes
+ *   jobId    (int): Job number to prefix lines with, 0 if no job started
+ * 
+ * Returns:
+ *   None
+ */
+void finishMuxPipes(int muxed, int* muxMap, int* muxRead, int jobId){
+  if(!muxed){
+    return;
+  }
+
+  close(muxMap[1]);
+  close(muxMap[3]);
+  if(jobId <= 0 || muxAdd(mux, jobId, muxRead[0], muxRead[1]) < 0){
+    close(muxRead[0]);
+    close(muxRead[1]);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Execute input line with file redirections
+ * 
+ * Args: 
+ *   cmd   (char**): Token array from command input
+ *   input  (char*): Command input C-string
+ *   head  (char**): Pointer to job stack head pointer
+ *   back     (int): Boolean var indicating background status
+ * 
+ * Returns:
+ *   None
+ */
+void executeGeneral(char** cmd, char* input, JobNode_t** head, int back){
+  const int MAX_LINE_LEN = 2001;
+  const int RUNNING = 0;
+
+  const int IN_FG = 1;
+  const int IN_BG = 0;
+  
+  int status = 0;
+  int err;
+  int numToks = 0;
+  int pidCh1;
+  int muxed;
+  int muxMap[4];
+  int muxRead[2];
+
+  char** argv = NULL;
+  char** cmdArgv = NULL;
+  RedirList_t redirs;
+  YashBuiltin_t* builtin = NULL;
+  YashPlace_t place;
+  YashZpipe_t* zpipes = NULL;
+  YashFanout_t* fans = NULL;
+  int cpu;
+  int skip;
+
+  while(cmd[numToks] != NULL){
+    numToks++;
+  }
+  argv = (char**)malloc((numToks + 1) * sizeof(char*));
+  if(parseRedirs(cmd, argv, &redirs) < 0 || argv[0] == NULL ||
+     (skip = placeParse(argv, &place)) < 0){
+    free(argv);
+    return;
+  }
+  cmdArgv = argv + skip;
+  if(place.adjacent && placeAdjacent(1, &cpu) == 0){
+    placePin(&place, cpu);
+  }
+  if(zpipeRedirs(&redirs, &zpipes) < 0 ||
+     fanoutRedirs(&redirs, -1, &fans) < 0){
+    closeRedirs(&redirs);
+    zpipeFinish(zpipes, 1);
+    fanoutFinish(fans, 1);
+    free(argv);
+    return;
+  }
+
+  if(!place.set && (builtin = pluginFind(cmdArgv[0])) != NULL && !back &&
+     !builtin->forked && jobTimeout.durationMs <= 0){
+    // Plain foreground plugin builtin: no process at all
+    lastStatus = pluginRun(builtin, cmdArgv, &redirs);
+    zpipeFinish(zpipes, 1);
+    fanoutFinish(fans, 1);
+    free(argv);
+    return;
+  }
+
+  muxed = openMuxPipes(back, muxMap, muxRead);
+  if(place.set){
+    // Placement has to be applied in the child, so fork here
+    err = placeSpawn(cmdArgv, &redirs, muxMap, muxed ? 2 : 0, 0, &place,
+                     &pidCh1);
+  }
+  else if(builtin != NULL){
+    err = pluginSpawn(builtin, cmdArgv, &redirs, muxMap, muxed ? 2 : 0, 0,
+                      &pidCh1);
+  }
+  else if(zygote == NULL ||
+     (err = zygoteSpawn(zygote, cmdArgv, &redirs, muxMap, muxed ? 2 : 0, 0,
+                        &pidCh1)) < 0){
+    if(muxed && muxRedirs(&redirs, muxMap) < 0){
+      // No room for the pipes; run unmultiplexed
+      finishMuxPipes(muxed, muxMap, muxRead, 0);
+      muxed = 0;
+    }
+    err = spawnCommand(cmdArgv, &redirs, &pidCh1);
+  }
+  // The child has its own copy of any fan-out or codec pipe
+  closeRedirs(&redirs);
+  free(argv);
+  if(err){
+    finishMuxPipes(muxed, muxMap, muxRead, 0);
+    zpipeFinish(zpipes, 1);
+    fanoutFinish(fans, 1);
+    return;
+  }
+  trackChild(pidCh1);
+  armTimeout(pidCh1);
+
+  // parent process
+  // printf("EXEC PID: %d\n", pidCh1);
+  if(fgProc != NULL)
+    free(fgProc);
+
+  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
+  strcpy(fgProc, input);
+  if(!back){
+    pushNode(head, input, pidCh1, RUNNING, IN_FG);
+    (*head)->job->stagePids[0] = pidCh1;
+    (*head)->job->limits[0] = place.limits;
+    if(fgNoWait){
+      zpipeFinish(zpipes, 0);
+      fanoutFinish(fans, 0);
+      return;
+    }
+
+    // wait for signal
+    if(waitForChild(pidCh1, &status) == 0)
+      updateJobStatus(jobStack, pidCh1, status);
+    // A >z or fanned-out file is complete once its thread has flushed; a
+    // stopped job keeps its threads running unwaited
+    zpipeFinish(zpipes, !WIFSTOPPED(status));
+    fanoutFinish(fans, !WIFSTOPPED(status));
+    return;
+  }
+  else{
+    // Add background job to stack
+    pushNode(head, input, pidCh1, RUNNING, IN_BG);
+    (*head)->job->stagePids[0] = pidCh1;
+    (*head)->job->limits[0] = place.limits;
+    finishMuxPipes(muxed, muxMap, muxRead,
+                   findJobByPgid(head, pidCh1)->jobId);
+    zpipeFinish(zpipes, 0);
+    fanoutFinish(fans, 0);
+    return;
+  }
+}
+
+/**
+ * Purpose:
+ *   Execute input line with file redirections and pipes
+ * 
+ * Args: 
+ *   cmd1 (char**): Token array for command before pipe
+ *   cmd2 (char**): Token array for command after pipe
+ *   input (char*): Command input C-string
+ *   head (char**): Pointer to job stack head pointer
+ *   back    (int): Boolean var indicating background status
+ * 
+ * Returns:
+ *   None
+ */
+void executePipe(char** cmd1, char** cmd2, char* input, JobNode_t** head, int back){
+  const int MAX_LINE_LEN = 2001;
+  const int RUNNING = 0;
+  const int METER_WAIT_MS = 100;
+
+  const int IN_FG = 1;
+  const int IN_BG = 0;
+  
+  int status = 0;
+  int status2 = 0;
+
+  int pidCh1;
+  int pidCh2;
+  int pfd[2];
+  int outMap[4] = {STDOUT_FILENO, -1, STDERR_FILENO, -1};
+  int inMap[6] = {STDIN_FILENO, -1, STDOUT_FILENO, -1, STDERR_FILENO, -1};
+  int muxMap[4];
+  int muxRead[2];
+  int muxed;
+  int err = -1;
+  int numToks1 = 0;
+  int numToks2 = 0;
+
+  char** argv1 = NULL;
+  char** argv2 = NULL;
+  RedirList_t redirs1;
+  RedirList_t redirs2;
+  YashBuiltin_t* builtin1 = NULL;
+  YashBuiltin_t* builtin2 = NULL;
+  YashPlace_t place1;
+  YashPlace_t place2;
+  YashMeter_t* meter = NULL;
+  YashZpipe_t* zpipes1 = NULL;
+  YashZpipe_t* zpipes2 = NULL;
+  YashFanout_t* fans1 = NULL;
+  YashFanout_t* fans2 = NULL;
+  int cpus[2];
+  int skip1;
+  int skip2;
+  sigset_t mask;
+  sigset_t oldMask;
+
+  while(cmd1[numToks1] != NULL){
+    numToks1++;
+  }
+  while(cmd2[numToks2] != NULL){
+    numToks2++;
+  }
+  argv1 = (char**)malloc((numToks1 + 1) * sizeof(char*));
+  argv2 = (char**)malloc((numToks2 + 1) * sizeof(char*));
+  if(parseRedirs(cmd1, argv1, &redirs1) < 0 ||
+     parseRedirs(cmd2, argv2, &redirs2) < 0 ||
+     argv1[0] == NULL || argv2[0] == NULL ||
+     (skip1 = placeParse(argv1, &place1)) < 0 ||
+     (skip2 = placeParse(argv2, &place2)) < 0){
+    free(argv1);
+    free(argv2);
+    return;
+  }
+  if((place1.adjacent || place2.adjacent) && placeAdjacent(2, cpus) == 0){
+    // Producer and consumer on cores that share a cache
+    placePin(&place1, cpus[0]);
+    placePin(&place2, cpus[1]);
+  }
+
+  if((pipeMeter || meterNext) && (meter = meterStart(pfd)) == NULL){
+    fprintf(stderr, "yash: pipemeter: %s\n", strerror(errno));
+  }
+  if(meter == NULL){
+    pipe(pfd);
+  }
+  if(zpipeRedirs(&redirs1, &zpipes1) < 0 ||
+     zpipeRedirs(&redirs2, &zpipes2) < 0 ||
+     fanoutRedirs(&redirs1, pfd[1], &fans1) < 0 ||
+     fanoutRedirs(&redirs2, -1, &fans2) < 0){
+    closeRedirs(&redirs1);
+    closeRedirs(&redirs2);
+    close(pfd[0]);
+    close(pfd[1]);
+    meterStop(meter);
+    zpipeFinish(zpipes1, 1);
+    zpipeFinish(zpipes2, 1);
+    fanoutFinish(fans1, 1);
+    fanoutFinish(fans2, 1);
+    free(argv1);
+    free(argv2);
+    return;
+  }
+  outMap[1] = pfd[1];
+  inMap[1] = pfd[0];
+  if((muxed = openMuxPipes(back, muxMap, muxRead))){
+    // stage 1 stderr and stage 2 stdout/stderr go to the multiplexer
+    outMap[3] = muxMap[3];
+    inMap[3] = muxMap[1];
+    inMap[5] = muxMap[3];
+  }
+  // Plugin builtins get a forked stage of their own so both run at once
+  builtin1 = pluginFind(argv1[0]);
+  builtin2 = pluginFind(argv2[0]);
+  if(place1.set){
+    err = placeSpawn(argv1 + skip1, &redirs1, outMap, muxed ? 2 : 1, 0,
+                     &place1, &pidCh1);
+  }
+  else if(builtin1 != NULL){
+    err = pluginSpawn(builtin1, argv1, &redirs1, outMap, muxed ? 2 : 1, 0,
+                      &pidCh1);
+  }
+  else if(zygote != NULL){
+    err = zygoteSpawn(zygote, argv1, &redirs1, outMap, muxed ? 2 : 1, 0,
+                      &pidCh1);
+  }
+  if(err > 0){
+    // first command could not start
+    close(pfd[0]);
+    close(pfd[1]);
+    closeRedirs(&redirs1);
+    closeRedirs(&redirs2);
+    meterStop(meter);
+    finishMuxPipes(muxed, muxMap, muxRead, 0);
+    zpipeFinish(zpipes1, 1);
+    zpipeFinish(zpipes2, 1);
+    fanoutFinish(fans1, 1);
+    fanoutFinish(fans2, 1);
+    free(argv1);
+    free(argv2);
+    return;
+  }
+  else if(err < 0){
+    pidCh1 = fork();
+    if(pidCh1 < 0) {
+      // fork failed; exit
+      exit(EXIT_FAILURE);
+    }
+    else if(pidCh1 == 0){
+      // child 1 (new process)
+      setpgid(0,0);
+      dup2(pfd[1], 1);
+      close(pfd[0]);
+      if(muxed)
+        dup2(muxMap[3], 2);
+      redirectFile(&redirs1);
+      execvp(argv1[0], argv1);
+
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if(fgProc != NULL)
+    free(fgProc);
+
+  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
+  strcpy(fgProc, input);
+  err = -1;
+  if(place2.set){
+    err = placeSpawn(argv2 + skip2, &redirs2, inMap, muxed ? 3 : 1, pidCh1,
+                     &place2, &pidCh2);
+  }
+  else if(builtin2 != NULL){
+    err = pluginSpawn(builtin2, argv2, &redirs2, inMap, muxed ? 3 : 1, pidCh1,
+                      &pidCh2);
+  }
+  else if(zygote != NULL){
+    err = zygoteSpawn(zygote, argv2, &redirs2, inMap, muxed ? 3 : 1, pidCh1,
+                      &pidCh2);
+  }
+  if(err < 0){
+    pidCh2 = fork();
+    if(pidCh2 < 0){
+      // fork failed; exit
+      exit(EXIT_FAILURE);
+    }
+    else if(pidCh2 == 0){
+      // child 2 (new process)
+      setpgid(0, pidCh1);
+      dup2(pfd[0], 0);
+      close(pfd[1]);
+      if(muxed){
+        dup2(muxMap[1], 1);
+        dup2(muxMap[3], 2);
+      }
+      redirectFile(&redirs2);
+      execvp(argv2[0], argv2);
+
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if(err > 0){
+    // second command could not start; stage 1 is not tracked yet, so it
+    // is reaped here
+    kill(pidCh1, SIGKILL);
+    waitpid(pidCh1, NULL, 0);
+    close(pfd[0]);
+    close(pfd[1]);
+    closeRedirs(&redirs1);
+    closeRedirs(&redirs2);
+    meterStop(meter);
+    finishMuxPipes(muxed, muxMap, muxRead, 0);
+    zpipeFinish(zpipes1, 1);
+    zpipeFinish(zpipes2, 1);
+    fanoutFinish(fans1, 1);
+    fanoutFinish(fans2, 1);
+    free(argv1);
+    free(argv2);
+    return;
+  }
+  closeRedirs(&redirs1);
+  closeRedirs(&redirs2);
+  free(argv1);
+  free(argv2);
+  trackChild(pidCh1);
+  trackChild(pidCh2);
+  armTimeout(pidCh1);
+
+  // parent process
+  close(pfd[0]);
+  close(pfd[1]);
+  
+  if(!back){
+    pushNode(head, input, pidCh1, RUNNING, IN_FG);
+    (*head)->job->stagePids[0] = pidCh1;
+    (*head)->job->limits[0] = place1.limits;
+    (*head)->job->stagePids[1] = pidCh2;
+    (*head)->job->limits[1] = place2.limits;
+    if(meter != NULL)
+      addMeter(meter, (*head)->job->jobId, pidCh1);
+    if(fgNoWait){
+      zpipeFinish(zpipes1, 0);
+      zpipeFinish(zpipes2, 0);
+      fanoutFinish(fans1, 0);
+      fanoutFinish(fans2, 0);
+      return;
+    }
+
+    // Both stages are waited for, so a >z or fanned-out file of stage 2 is
+    // complete at the prompt and the job's code is stage 2's, as for a
+    // group pipeline; SIGCHLD stays blocked so the handler does not reap
+    // stage 2 first
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    if(waitForChild(pidCh1, &status) == 0)
+      updateJobStatus(jobStack, pidCh1, status);
+    status2 = status;
+    if(!WIFSTOPPED(status) && waitForChild(pidCh2, &status2) == 0 &&
+       !WIFSTOPPED(status2))
+      lastStatus = groupExitCode(status2);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    zpipeFinish(zpipes1, !WIFSTOPPED(status));
+    zpipeFinish(zpipes2, !WIFSTOPPED(status2));
+    fanoutFinish(fans1, !WIFSTOPPED(status));
+    fanoutFinish(fans2, !WIFSTOPPED(status2));
+    if(meter != NULL && !WIFSTOPPED(status)){
+      // The last bytes may still be on their way to stage 2
+      meterWait(meter, METER_WAIT_MS);
+      reportMeters(0);
+    }
+    return;
+  }
+  else{
+    // Add background job to stack
+    pushNode(head, input, pidCh1, RUNNING, IN_BG);
+    (*head)->job->stagePids[0] = pidCh1;
+    (*head)->job->limits[0] = place1.limits;
+    (*head)->job->stagePids[1] = pidCh2;
+    (*head)->job->limits[1] = place2.limits;
+    if(meter != NULL)
+      addMeter(meter, (*head)->job->jobId, pidCh1);
+    finishMuxPipes(muxed, muxMap, muxRead,
+                   findJobByPgid(head, pidCh1)->jobId);
+    zpipeFinish(zpipes1, 0);
+    zpipeFinish(zpipes2, 0);
+    fanoutFinish(fans1, 0);
+    fanoutFinish(fans2, 0);
+  }
+}
+
+/**
+ * Purpose:
+ *   Bytes execve charges against ARG_MAX for one string and its pointer
+ * 
+ * Args:
+ *   str (char*): Argument or environment string
+ * 
+ * Returns:
+ *   (long): Size in bytes
+ */
+long execArgSize(char* str){
+  return (long)(strlen(str) + 1 + sizeof(char*));
+}
+
+/**
+ * Purpose:
+ *   Pack as many arguments as fit in ARG_MAX into the next batch chunk
+ * 
+ * Args:
+ *   argv   (char**): Exec arguments, argv[0] is the command
+ *   next      (int): Index of the first argument not run yet, from 0
+ *   numItems  (int): Number of arguments after the command
+ *   baseSize (long): Fixed cost of every exec
+ *   argMax   (long): Usable part of ARG_MAX
+ *   chunk  (char**): Filled in after chunk[0] and NULL terminated
+ * 
+ * Returns:
+ *   (int): Number of arguments packed
+ */
+int packBatchChunk(char** argv, int next, int numItems, long baseSize,
+                   long argMax, char** chunk){
+  long chunkSize = baseSize;
+  long itemSize;
+  int count = 0;
+
+  while(next + count < numItems){
+    itemSize = execArgSize(argv[next + count + 1]);
+    if(chunkSize + itemSize > argMax)
+      break;
+    chunkSize += itemSize;
+    chunk[count + 1] = argv[next + count + 1];
+    count++;
+  }
+  chunk[count + 1] = NULL;
+
+  return count;
+}
+
+/**
+ * Purpose:
+ *   Run the chunks of a background batch in a forked driver. The driver
+ *   leads the job's process group and its chunks stay in it, so fg, bg,
+ *   C-z and kill reach all of them. It waits with waitpid, since the
+ *   shell's child tracking is not its own.
+ * 
+ * Args:
+ *   argv        (char**): Exec arguments, argv[0] is the command
+ *   redirs (RedirList_t*): Redirections, already opened
+ *   slots          (int): Chunks run at once
+ *   numItems       (int): Number of arguments after the command
+ *   baseSize      (long): Fixed cost of every exec
+ *   argMax        (long): Usable part of ARG_MAX
+ * 
+ * Returns:
+ *   (int): Exit status of the driver, 0 if every chunk succeeded
+ */
+int driveBatch(char** argv, RedirList_t* redirs, int slots, int numItems,
+               long baseSize, long argMax){
+  char** chunk = NULL;
+  int running = 0;
+  int aborted = 0;
+  int failed = 0;
+  int done = 0;
+  int next = 0;
+  int count;
+  int status;
+  int pid;
+
+  chunk = (char**)malloc((numItems + 2) * sizeof(char*));
+  chunk[0] = argv[0];
+  do{
+    while(running < slots && !aborted && !done){
+      count = packBatchChunk(argv, next, numItems, baseSize, argMax, chunk);
+      if((pid = fork()) < 0){
+        fprintf(stderr, "yash: fork: %s\n", strerror(errno));
+        aborted = 1;
+        break;
+      }
+      else if(pid == 0){
+        redirectFile(redirs);
+        execvp(chunk[0], chunk);
+        fprintf(stderr, "yash: %s: %s\n", chunk[0], strerror(errno));
+        _exit(EXIT_FAILURE);
+      }
+      running++;
+      next += count;
+      done = (next >= numItems);
+    }
+    if(running == 0)
+      break;
+
+    if(waitpid(-1, &status, 0) < 0){
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    running--;
+    if(WIFSIGNALED(status))
+      aborted = 1;
+    else if(WEXITSTATUS(status) != 0)
+      failed = 1;
+  }while(running > 0 || (!aborted && !done));
+
+  if(aborted && !done){
+    fprintf(stderr, "yash: batch: %d arguments not run\n", numItems - next);
+  }
+  free(chunk);
+
+  return (aborted || failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Purpose:
+ *   Run a command over an argument list split into chunks that each fit in
+ *   ARG_MAX, either one at a time or on up to N parallel slots. In the
+ *   foreground each chunk is an ordinary entry in the job stack; in the
+ *   background the chunks run from one driver process, which is the job.
+ *     batch [-j N] cmd args... [&]
+ * 
+ * Args:
+ *   cmd       (char**): Token array, cmd[0] is "batch", without the "&"
+ *   input      (char*): Input C-string
+ *   head (JobNode_t**): Pointer to stack head pointer
+ *   back         (int): 1 to run in the background
+ * 
+ * Returns:
+ *   None
+ */
+void runBatch(char** cmd, char* input, JobNode_t** head, int back){
+  const int MAX_LINE_LEN = 2001;
+  const int RUNNING = 0;
+  const int IN_FG = 1;
+  const int IN_BG = 0;
+  const long HEADROOM = 2048;
+  const long MAX_ARG_STRLEN = 32 * 4096;
+  const char* USAGE = "usage: batch [-j N] cmd args...\n";
+
+  int slots = 1;
+  int start = 1;
+  int numToks = 0;
+  int numItems;
+  int next = 0;
+  int count;
+  int running = 0;
+  int aborted = 0;
+  int done = 0;
+  int status;
+  int pid;
+  int index;
+  int change;
+  int numChanged;
+  int changedPids[MAX_REAP_EVENTS];
+  int changedStatus[MAX_REAP_EVENTS];
+  long argMax;
+  long baseSize;
+
+  char** argv = NULL;
+  char** chunk = NULL;
+  int* pids = NULL;
+  RedirList_t redirs;
+  sigset_t mask;
+  sigset_t oldMask;
+
+  if(cmd[start] != NULL && !strcmp(cmd[start], "-j")){
+    if(cmd[start + 1] == NULL || (slots = atoi(cmd[start + 1])) < 1){
+      fprintf(stderr, "%s", USAGE);
+      return;
+    }
+    start += 2;
+  }
+
+  while(cmd[start + numToks] != NULL){
+    numToks++;
+  }
+  argv = (char**)malloc((numToks + 1) * sizeof(char*));
+  if(parseRedirs(cmd + start, argv, &redirs) < 0 || argv[0] == NULL){
+    if(argv[0] == NULL)
+      fprintf(stderr, "%s", USAGE);
+    free(argv);
+    return;
+  }
+
+  // Fixed cost of every exec: environment, command name and NULL pointers
+  argMax = sysconf(_SC_ARG_MAX) - HEADROOM;
+  baseSize = 2 * sizeof(char*) + execArgSize(argv[0]);
+  for(index = 0; environ[index] != NULL; index++){
+    baseSize += execArgSize(environ[index]);
+  }
+
+  numItems = 0;
+  while(argv[numItems + 1] != NULL){
+    if(strlen(argv[numItems + 1]) + 1 > MAX_ARG_STRLEN ||
+       baseSize + execArgSize(argv[numItems + 1]) > argMax){
+      fprintf(stderr, "yash: batch: argument too long: %.31s...\n",
+              argv[numItems + 1]);
+      free(argv);
+      return;
+    }
+    numItems++;
+  }
+
+  // Chunks share the files so > truncates once rather than per chunk
+  if(openRedirs(&redirs) < 0){
+    free(argv);
+    return;
+  }
+
+  if(back){
+    fflush(stdout);
+    fflush(stderr);
+    if((pid = fork()) < 0){
+      fprintf(stderr, "yash: fork: %s\n", strerror(errno));
+    }
+    else if(pid == 0){
+      setpgid(0, 0);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGTTIN, SIG_DFL);
+      signal(SIGTTOU, SIG_DFL);
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+      _exit(driveBatch(argv, &redirs, slots, numItems, baseSize, argMax));
+    }
+    else{
+      setpgid(pid, pid);
+      trackChild(pid);
+      pushNode(head, input, pid, RUNNING, IN_BG);
+    }
+    closeRedirs(&redirs);
+    free(argv);
+    return;
+  }
+
+  if(fgProc != NULL)
+    free(fgProc);
+  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
+  strcpy(fgProc, input);
+
+  chunk = (char**)malloc((numItems + 2) * sizeof(char*));
+  chunk[0] = argv[0];
+  pids = (int*)malloc(slots * sizeof(int));
+
+  // Reap our chunks here instead of in sigchldHandler
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+  do{
+    while(running < slots && !aborted && !done){
+      count = packBatchChunk(argv, next, numItems, baseSize, argMax, chunk);
+      if(spawnCommand(chunk, &redirs, &pid)){
+        aborted = 1;
+        break;
+      }
+      trackChild(pid);
+      pushNode(head, input, pid, RUNNING, IN_FG);
+      pids[running++] = pid;
+      next += count;
+      done = (next >= numItems);
+    }
+    if(running == 0)
+      break;
+
+    // SIGCHLD is blocked, so its signalfd wakes us for stops as well
+    numChanged = reapChildren(-1, 0, changedPids, changedStatus,
+                              MAX_REAP_EVENTS);
+    for(change = 0; change < numChanged; change++){
+      pid = changedPids[change];
+      status = changedStatus[change];
+      for(index = 0; index < running; index++){
+        if(pids[index] == pid){
+          // A stopped chunk stays in the job stack for fg/bg
+          if(WIFSIGNALED(status) || WIFSTOPPED(status))
+            aborted = 1;
+          pids[index] = pids[--running];
+          break;
+        }
+      }
+    }
+  }while(running > 0 || (!aborted && !done));
+
+  if(aborted && !done){
+    fprintf(stderr, "yash: batch: %d arguments not run\n", numItems - next);
+  }
+
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+  closeRedirs(&redirs);
+  free(pids);
+  free(chunk);
+  free(argv);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Milliseconds left until a CLOCK_MONOTONIC deadline
+ * 
+ * Args:
+ *   deadline (struct timespec*): Deadline, or NULL for none
+ * 
+ * Returns:
+ *   (int): Milliseconds left (0 if passed), -1 if there is no deadline
+ */
+int msUntil(struct timespec* deadline){
+  struct timespec now;
+  long ms;
+
+  if(deadline == NULL){
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+       (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+  return (ms > 0) ? (int)ms : 0;
+}
+
+/**
+ * Purpose:
+ *   Wait for background jobs without polling
+ *     wait [-n] [-t SECONDS] [%job|pid ...]
+ *   With no operands every running background job is waited for. -n
+ *   returns once any one of them finishes, -t gives up at a deadline.
+ *   Finished jobs are reported as Done/Exit at the next prompt.
+ * 
+ * Args:
+ *   cmd       (char**): Token array, cmd[0] is "wait"
+ *   head (JobNode_t**): Pointer to stack head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void waitJobs(char** cmd, JobNode_t** head){
+  const int RUNNING = 0;
+  const int STOPPED = 1;
+  const char* USAGE = "usage: wait [-n] [-t seconds] [%job|pid ...]\n";
+
+  struct timespec deadlineBuf;
+  struct timespec* deadline = NULL;
+  JobNode_t* curr = NULL;
+  TrackNode_t* node = NULL;
+  Job_t* job = NULL;
+  sigset_t mask;
+  sigset_t oldMask;
+  double secs;
+  char* end = NULL;
+  int* pgids = NULL;
+  int numTargets = 0;
+  int pending;
+  int finished;
+  int anyMode = 0;
+  int index = 1;
+  int target;
+  int pid;
+
+  while(cmd[index] != NULL && cmd[index][0] == '-'){
+    if(!strcmp(cmd[index], "-n")){
+      anyMode = 1;
+    }
+    else if(!strcmp(cmd[index], "-t") && cmd[index + 1] != NULL &&
+            (secs = strtod(cmd[index + 1], &end)) >= 0 && *end == '\0'){
+      clock_gettime(CLOCK_MONOTONIC, &deadlineBuf);
+      deadlineBuf.tv_sec += (time_t)secs;
+      deadlineBuf.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+      if(deadlineBuf.tv_nsec >= 1000000000){
+        deadlineBuf.tv_sec++;
+        deadlineBuf.tv_nsec -= 1000000000;
+      }
+      deadline = &deadlineBuf;
+      index++;
+    }
+    else{
+      fprintf(stderr, "%s", USAGE);
+      return;
+    }
+    index++;
+  }
+
+  // Resolve operands to process group leaders, or take every running
+  // background job when there are none, along with the groups of stages
+  // still running after their job's leader was reported
+  if(cmd[index] == NULL){
+    for(curr = *head; curr != NULL; curr = curr->next){
+      numTargets++;
+    }
+    for(node = trackList; node != NULL; node = node->next){
+      numTargets++;
+    }
+    pgids = (int*)malloc((numTargets + 1) * sizeof(int));
+    numTargets = 0;
+    for(curr = *head; curr != NULL; curr = curr->next){
+      if(curr->job->status == RUNNING && !curr->job->inFG){
+        pgids[numTargets++] = curr->job->pgid;
       }
     }
-    else if (WIFSIGNALED(status)) {
-      // Child killed by signal
-      exists = findID(jobStack, waitRet);
-	    if(exists)
-        removeJob(jobStack, waitRet);
+    for(node = trackList; node != NULL; node = node->next){
+      pid = getpgid(node->pid);
+      for(target = 0; target < numTargets && pgids[target] != pid; target++);
+      if(pid > 0 && target == numTargets && findID(head, pid) == 0){
+        pgids[numTargets++] = pid;
+      }
     }
-    else if (WIFSTOPPED(status)) {
-      // Child stopped by signal
-      exists = findID(jobStack, waitRet);
-      if(!exists)
-        pushNode(jobStack, fgProc, waitRet, STOPPED, IN_BG);
-      else
-        changeJobStatus(jobStack, waitRet, STOPPED);
+  }
+  else{
+    for(target = index; cmd[target] != NULL; target++);
+    pgids = (int*)malloc((target - index) * sizeof(int));
+  }
+
+  for(; cmd[index] != NULL; index++){
+    if(cmd[index][0] == '%'){
+      job = findJobById(head, atoi(cmd[index] + 1));
+      pid = (job != NULL) ? job->pgid : -1;
+    }
+    else{
+      pid = atoi(cmd[index]);
+      if(!findID(head, pid) && findTrackedInGroup(pid, NULL) == NULL)
+        pid = -1;
+    }
+
+    if(pid <= 0){
+      fprintf(stderr, "yash: wait: %s: no such job\n", cmd[index]);
+      continue;
     }
-    // printf("SIGCHLD on pgrp: %d\n", pgrp);
+    pgids[numTargets++] = pid;
   }
 
-  // signal(SIGCHLD, sigchldHandler);
+  // SIGCHLD stays blocked so its signalfd, not the handler, sees it
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+  while(numTargets > 0){
+    // A target is finished once every stage is reaped or it has stopped
+    pending = 0;
+    finished = 0;
+    for(target = 0; target < numTargets; target++){
+      job = NULL;
+      for(curr = *head; curr != NULL; curr = curr->next){
+        if(curr->job->pgid == pgids[target])
+          job = curr->job;
+      }
+      if(findTrackedInGroup(pgids[target], NULL) == NULL ||
+         (job != NULL && job->status == STOPPED)){
+        finished++;
+      }
+      else{
+        pending++;
+      }
+    }
+    if(pending == 0 || (anyMode && finished > 0)){
+      break;
+    }
+
+    if(deadline != NULL && msUntil(deadline) == 0){
+      fprintf(stderr, "yash: wait: timed out\n");
+      break;
+    }
+    if(reapChildren(msUntil(deadline), 0, NULL, NULL, 0) < 0 &&
+       errno == EINTR){
+      // Interrupted from the keyboard
+      break;
+    }
+  }
+
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+  free(pgids);
+
+  return;
 }
 
-/** 
+/**
  * Purpose:
- *   Verify that tokens in input line do not exceed maximum token length
+ *   Parse a timeout duration: a number with an optional s, m, h or d suffix
  * 
  * Args:
- *   input      (char*): Input C-string
- *   maxLineLen   (int): Maximum length of input
- *   maxTokenLen  (int): Maximum length of tokens
+ *   str (char*): Duration string, e.g. "1.5", "30s", "2m"
  * 
  * Returns:
- *   (int): Returns 1 if all tokens are within maximum limit
+ *   (long): Duration in milliseconds, or -1 if invalid
  */
-int checkTokens(char* input, int maxLineLen, int maxTokenLen){
-  const int VALID = 1;
-  const int INVALID = 0;
-  const char SPACE_CHAR = ' ';
+long parseDuration(char* str){
+  char* end = NULL;
+  double value = strtod(str, &end);
 
-  int tokenLen = 0;
-  int k = 0;
+  if(end == str || value < 0){
+    return -1;
+  }
 
-  while(k < strlen(input)){
-    if(tokenLen >= maxTokenLen){
-      return INVALID;
-    }
-    else if((tokenLen < maxTokenLen) && (input[k] == SPACE_CHAR)){
-      tokenLen = 0;
-    }
-    else{
-      tokenLen++;
+  if(*end == 'm'){
+    value *= 60;
+    end++;
+  }
+  else if(*end == 'h'){
+    value *= 60 * 60;
+    end++;
+  }
+  else if(*end == 'd'){
+    value *= 24 * 60 * 60;
+    end++;
+  }
+  else if(*end == 's'){
+    end++;
+  }
+
+  return (*end == '\0') ? (long)(value * 1000) : -1;
+}
+
+/**
+ * Purpose:
+ *   Parse a signal given by number or by name, with or without "SIG"
+ * 
+ * Args:
+ *   str (char*): Signal string, e.g. "9", "KILL", "SIGTERM"
+ * 
+ * Returns:
+ *   (int): Signal number, or -1 if unknown
+ */
+int parseSignal(char* str){
+  const char* NAMES[] = {"HUP", "INT", "QUIT", "KILL", "USR1", "USR2",
+                         "ALRM", "TERM", "CONT", "STOP", NULL};
+  const int NUMS[] = {SIGHUP, SIGINT, SIGQUIT, SIGKILL, SIGUSR1, SIGUSR2,
+                      SIGALRM, SIGTERM, SIGCONT, SIGSTOP};
+
+  char* end = NULL;
+  long num = strtol(str, &end, 10);
+  int index;
+
+  if(end != str && *end == '\0'){
+    return (num > 0 && num < NSIG) ? (int)num : -1;
+  }
+
+  if(!strncmp(str, "SIG", 3)){
+    str += 3;
+  }
+  for(index = 0; NAMES[index] != NULL; index++){
+    if(!strcmp(str, NAMES[index])){
+      return NUMS[index];
     }
-    k++;
   }
 
-  return VALID;
+  return -1;
 }
 
 /**
  * Purpose:
- *   Read in a line of input from stdin and verify that input line length and
- *   token length is valid
+ *   Run a command or pipeline with a timeout:
+ *     timeout DURATION [-s SIG] [-k KILL_AFTER] cmd [| cmd2] [&]
+ *   On expiry SIG (default SIGTERM) goes to the job's whole process group,
+ *   then SIGKILL after KILL_AFTER if given. The timer is a timerfd in the
+ *   shell's child epoll set, so no extra process is involved.
  * 
  * Args:
+ *   cmd1      (char**): Tokens of the command starting with "timeout"
+ *   cmd2      (char**): Tokens after the pipe, or NULL
  *   input      (char*): Input C-string
+ *   head (JobNode_t**): Pointer to job stack head pointer
  * 
  * Returns:
- *   (int): Returns 1 if string is valid, 0 if string is invalid
+ *   None
  */
-int checkInput(char* input){
-  // TODO: Protect against these cases < ls, > ls, 2> ls, | ls, & ls
-  // TODO: Add function to ensure file redir goes to a file e.g.:# cat hello.txt >
-  // TODO: Add function to ensure pipe goes to a valid command e.g.:# ls |
-  // TODO: Add input verification to ensure that bg, fg, & are at expected indices
-  const int MAX_LINE_LEN = 2001;
-  const int MAX_TOKEN_LEN = 31;
-  const int INVALID = 0;
-  const int VALID = 1;
+void runTimeout(char** cmd1, char** cmd2, char* input, JobNode_t** head){
+  const char* BACKGROUND = "&";
+  const char* USAGE =
+    "usage: timeout DURATION [-s SIG] [-k KILL_AFTER] command\n";
+
+  char** last = (cmd2 != NULL) ? cmd2 : cmd1;
+  long durationMs = -1;
+  long killAfterMs = 0;
+  int sig = SIGTERM;
+  int back = 0;
+  int lastIndex = 0;
+  int index = 1;
+
+  while(cmd1[index] != NULL){
+    if(!strcmp(cmd1[index], "-s") && cmd1[index + 1] != NULL){
+      if((sig = parseSignal(cmd1[index + 1])) < 0){
+        fprintf(stderr, "yash: timeout: %s: invalid signal\n",
+                cmd1[index + 1]);
+        return;
+      }
+      index += 2;
+    }
+    else if(!strcmp(cmd1[index], "-k") && cmd1[index + 1] != NULL){
+      if((killAfterMs = parseDuration(cmd1[index + 1])) < 0){
+        fprintf(stderr, "yash: timeout: %s: invalid duration\n",
+                cmd1[index + 1]);
+        return;
+      }
+      index += 2;
+    }
+    else if(durationMs < 0 && cmd1[index][0] != '-'){
+      if((durationMs = parseDuration(cmd1[index])) < 0){
+        fprintf(stderr, "yash: timeout: %s: invalid duration\n",
+                cmd1[index]);
+        return;
+      }
+      index++;
+    }
+    else{
+      break;
+    }
+  }
 
-  if(strlen(input) > MAX_LINE_LEN){
-    return INVALID;
+  while(last[lastIndex] != NULL){
+    lastIndex++;
+  }
+  if(lastIndex > 0 && !strcmp(last[lastIndex - 1], BACKGROUND)){
+    back = 1;
+    memFree(MEM_PARSER, last[lastIndex - 1]);
+    last[lastIndex - 1] = NULL;
+  }
+  if(durationMs < 0 || cmd1[index] == NULL || (cmd2 != NULL && !cmd2[0])){
+    fprintf(stderr, "%s", USAGE);
+    return;
   }
-  else if(strlen(input) == 0){
-    return INVALID;
+
+  fromFG = 0;
+  jobTimeout.durationMs = durationMs;
+  jobTimeout.sig = sig;
+  jobTimeout.killAfterMs = killAfterMs;
+  if(cmd2 == NULL){
+    executeGeneral(cmd1 + index, input, head, back);
   }
-  else if(!checkTokens(input, MAX_LINE_LEN, MAX_TOKEN_LEN)){
-    return INVALID;
+  else{
+    executePipe(cmd1 + index, cmd2, input, head, back);
   }
-  return VALID;
+  jobTimeout.durationMs = 0;
+
+  return;
 }
 
 /**
  * Purpose:
- *   Create array of token C-strings from input line split on input delimiter
+ *   Run a command or pipeline again whenever a watched path changes:
+ *     watch-run [-d SECS] [-x GLOB]... [path...] -- cmd [| cmd2]
+ *   Paths (default .) are watched recursively with inotify. A burst of
+ *   changes starts one run once the paths have been quiet for SECS
+ *   (default 0.1); a run still in flight is cancelled first with SIGTERM
+ *   to its process group, then SIGKILL. Each run is an ordinary
+ *   foreground job, so C-c or C-z reaches it and also ends watch-run.
  * 
  * Args:
- *   input (char*): Pointer to input c-string
- *   delim   (int): Delimiter to split on
- *  
- * Returns:
- *   (char**): Returns array of token c-strings
+ *   cmd1      (char**): Tokens of the command starting with "watch-run"
+ *   cmd2      (char**): Tokens after the pipe, or NULL
+ *   input      (char*): Input C-string
+ *   head (JobNode_t**): Pointer to job stack head pointer
  * 
+ * Returns:
+ *   None
  */
-char** splitStrArray(char* input, const char* delim){
-  const int MAX_LINE_LEN = 2001;
-  const int MAX_TOK_LEN = 31;
-  const char PIPE_CHAR = '|';
-  const char SPACE_CHAR = ' ';
-  int allocSize;
-
-  if(delim[0] == PIPE_CHAR){
-    allocSize = MAX_LINE_LEN;
+void runWatch(char** cmd1, char** cmd2, char* input, JobNode_t** head){
+  const char* BACKGROUND = "&";
+  const char* SEPARATOR = "--";
+  const char* USAGE =
+    "usage: watch-run [-d secs] [-x glob]... [path...] -- command\n";
+  const int RUNNING = 0;
+  const long KILL_AFTER_MS = 2000;
+
+  char* here[] = {".", NULL};
+  char** last = (cmd2 != NULL) ? cmd2 : cmd1;
+  char** excludes = NULL;
+  char** paths = NULL;
+  char* sepTok = NULL;
+  YashWatch_t* watch = NULL;
+  Job_t* before = NULL;
+  Job_t* job = NULL;
+  struct pollfd fds[2];
+  struct timespec quietBuf;
+  struct timespec* quiet = NULL;
+  struct timespec killBuf;
+  sigset_t mask;
+  sigset_t oldMask;
+  long debounceMs = 100;
+  int numExcludes = 0;
+  int interrupted = 0;
+  int pending = 1;
+  int runPgid = 0;
+  int killed;
+  int status;
+  int lastIndex = 0;
+  int index = 1;
+  int sep;
+
+  for(sep = 0; cmd1[sep] != NULL; sep++);
+  excludes = (char**)malloc((sep + 1) * sizeof(char*));
+  while(cmd1[index] != NULL && cmd1[index][0] == '-' &&
+        strcmp(cmd1[index], SEPARATOR)){
+    if(!strcmp(cmd1[index], "-d") && cmd1[index + 1] != NULL &&
+       (debounceMs = parseDuration(cmd1[index + 1])) >= 0){
+      index += 2;
+    }
+    else if(!strcmp(cmd1[index], "-x") && cmd1[index + 1] != NULL){
+      excludes[numExcludes++] = cmd1[index + 1];
+      index += 2;
+    }
+    else{
+      fprintf(stderr, "%s", USAGE);
+      free(excludes);
+      return;
+    }
   }
-  else if(delim[0] == SPACE_CHAR){
-    allocSize = MAX_TOK_LEN;
+  excludes[numExcludes] = NULL;
+  for(sep = index; cmd1[sep] != NULL && strcmp(cmd1[sep], SEPARATOR); sep++);
+  while(last[lastIndex] != NULL){
+    lastIndex++;
+  }
+  if(cmd1[sep] == NULL || cmd1[sep + 1] == NULL ||
+     !strcmp(last[lastIndex - 1], BACKGROUND)){
+    fprintf(stderr, "%s", USAGE);
+    free(excludes);
+    return;
   }
 
-  char* inputCopy = (char*)malloc(MAX_LINE_LEN * sizeof(char));
-  strcpy(inputCopy, input);
-  
-  char** splitted = NULL;
-  int numElements = 0;
+  // The separator ends the path list only while the watches are set up,
+  // so the caller can still free every token
+  sepTok = cmd1[sep];
+  cmd1[sep] = NULL;
+  paths = (sep > index) ? cmd1 + index : here;
+  watch = watchOpen(paths, excludes);
+  cmd1[sep] = sepTok;
+  if(watch == NULL){
+    free(excludes);
+    return;
+  }
 
-  char* token = strtok(inputCopy, delim);
-  char* entry = (char*)malloc(allocSize * sizeof(char));
-  strcpy(entry, token);
+  // SIGCHLD stays blocked so its signalfd, not the handler, sees it
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+  fds[0].fd = watchFd(watch);
+  fds[0].events = POLLIN;
+  fds[1].fd = childEpfd;
+  fds[1].events = POLLIN;
+  while(!interrupted){
+    if(pending && msUntil(quiet) <= 0){
+      if(runPgid > 0 && findTracked(runPgid) != NULL){
+        // Cancel the run in flight; a stopped one has to be woken to die
+        signalJob(runPgid, SIGTERM);
+        signalJob(runPgid, SIGCONT);
+        clock_gettime(CLOCK_MONOTONIC, &killBuf);
+        killBuf.tv_sec += KILL_AFTER_MS / 1000;
+        killed = 0;
+        while(!interrupted && findTracked(runPgid) != NULL){
+          if(!killed && msUntil(&killBuf) == 0){
+            signalJob(runPgid, SIGKILL);
+            killed = 1;
+          }
+          interrupted = reapChildren(killed ? -1 : msUntil(&killBuf), 0,
+                                     NULL, NULL, 0) < 0 && errno == EINTR;
+        }
+        if(interrupted){
+          break;
+        }
+      }
 
-  while(token != NULL){
-    numElements++;
-    splitted = realloc(splitted, numElements * sizeof(char*));
-    splitted[numElements - 1] = entry;
+      pending = 0;
+      quiet = NULL;
+      before = (*head != NULL) ? (*head)->job : NULL;
+      fromFG = 0;
+      fgNoWait = 1;
+      if(cmd2 == NULL){
+        executeGeneral(cmd1 + sep + 1, input, head, 0);
+      }
+      else{
+        executePipe(cmd1 + sep + 1, cmd2, input, head, 0);
+      }
+      fgNoWait = 0;
+      runPgid = (*head != NULL && (*head)->job != before) ?
+                (*head)->job->pgid : 0;
+      continue;
+    }
 
-    token = strtok(NULL, delim);
-    if(token != NULL){
-      entry = (char*)malloc(allocSize * sizeof(char));
-      strcpy(entry, token);
+    if(poll(fds, 2, pending ? msUntil(quiet) : -1) < 0){
+      // Interrupted from the keyboard
+      interrupted = (errno == EINTR);
+      continue;
+    }
+    if(fds[1].revents & POLLIN){
+      reapChildren(0, 0, NULL, NULL, 0);
+    }
+    if((fds[0].revents & POLLIN) && watchRead(watch, NULL, 0) > 0){
+      // Every change restarts the quiet period
+      clock_gettime(CLOCK_MONOTONIC, &quietBuf);
+      quietBuf.tv_sec += debounceMs / 1000;
+      quietBuf.tv_nsec += (debounceMs % 1000) * 1000000;
+      if(quietBuf.tv_nsec >= 1000000000){
+        quietBuf.tv_sec++;
+        quietBuf.tv_nsec -= 1000000000;
+      }
+      quiet = &quietBuf;
+      pending = 1;
     }
   }
 
-  // Assign NULL to last index
-  numElements++;
-  splitted = realloc(splitted, numElements * sizeof(char*));
-  splitted[numElements - 1] = 0;
+  // A run the keyboard interrupted is waited for as a foreground job is;
+  // a stopped one is left in the job table
+  job = (runPgid > 0 && findTracked(runPgid) != NULL) ?
+        findJobByPgid(head, runPgid) : NULL;
+  if(job != NULL && job->inFG && job->status == RUNNING &&
+     waitForChild(runPgid, &status) == 0){
+    updateJobStatus(head, runPgid, status);
+  }
+
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+  watchClose(watch);
+  free(excludes);
 
-  if(inputCopy != NULL)
-    free(inputCopy);
-  return splitted;
+  return;
 }
 
 /**
  * Purpose:
- *   Find indices for input, output, and error redirection in a command and
- *   replace tokens with NULL
+ *   Turn a shell option on or off
+ *     set -o NAME    turn NAME on
+ *     set +o NAME    turn NAME off
+ *     set [-o]       list options
+ *   Options:
+ *     mux         background job output goes through the line multiplexer
+ *     board       the job table is mirrored to a shared memory status board
+ *     pipemeter   every pipe is metered as if written |~
  * 
  * Args:
- *   cmd     (char**): Array of tokens from command
- *   inIndex   (int*): Index of input redirection token 
- *   outIndex  (int*): Index of output redirection token 
- *   errIndex  (int*): Index of error redirection token 
- *   
+ *   cmd (char**): Tokens starting with "set"
+ * 
  * Returns:
- *   None  
- */ 
-void changeRedirToks(char** cmd, int* inIndex, int* outIndex, int* errIndex){
-  const char* IN_REDIR = "<";
-  const char* OUT_REDIR = ">";
-  const char* ERR_REDIR = "2>";
-
-  int index = 0;
-
-  while(cmd[index] != NULL){
-    if(!strcmp(cmd[index], IN_REDIR)){
-      *inIndex = index + 1;
-      // Assign NULL to stop exec() from reading file redirection as part of cmd
-      cmd[index] = NULL;
-    }
-    else if(!strcmp(cmd[index], OUT_REDIR)){
-      *outIndex = index + 1;
-      cmd[index] = NULL;
+ *   None
+ */
+void setOption(char** cmd){
+  const char* USAGE = "usage: set [-o|+o option]\n";
+  const char* NAMES[] = {"mux", "board", "pipemeter", NULL};
+  int* flags[] = {&muxOutput, &jobBoard, &pipeMeter};
+
+  char dir[PATH_MAX];
+  int index;
+  int on;
+
+  if(cmd[1] == NULL || (!strcmp(cmd[1], "-o") && cmd[2] == NULL)){
+    for(index = 0; NAMES[index] != NULL; index++){
+      printf("set %co %s\n", *flags[index] ? '-' : '+', NAMES[index]);
     }
-    else if(!strcmp(cmd[index], ERR_REDIR)){
-      *errIndex = index + 1;
-      cmd[index] = NULL;
+    return;
+  }
+  if((strcmp(cmd[1], "-o") && strcmp(cmd[1], "+o")) || cmd[2] == NULL){
+    fprintf(stderr, "%s", USAGE);
+    return;
+  }
+
+  on = (cmd[1][0] == '-');
+  for(index = 0; NAMES[index] != NULL; index++){
+    if(!strcmp(cmd[2], NAMES[index])){
+      break;
     }
-    index++;
   }
+  if(NAMES[index] == NULL){
+    fprintf(stderr, "yash: set: %s: invalid option name\n", cmd[2]);
+    return;
+  }
+
+  if(flags[index] == &muxOutput && on && mux == NULL &&
+     (mux = muxStart(STDOUT_FILENO, STDERR_FILENO)) == NULL){
+    fprintf(stderr, "yash: set: mux: %s\n", strerror(errno));
+    return;
+  }
+  if(flags[index] == &jobBoard && on && board == NULL &&
+     (board = boardOpen(boardDir(dir, sizeof(dir)))) == NULL){
+    fprintf(stderr, "yash: set: board: %s: %s\n", dir, strerror(errno));
+    return;
+  }
+  if(flags[index] == &jobBoard && !on){
+    boardClose(board);
+    board = NULL;
+  }
+  *flags[index] = on;
+  syncBoard(jobStack);
 
   return;
 }
 
 /**
  * Purpose:
- *   Handle file redirect statements
+ *   Load, disable or list plugin builtins
+ *     enable -f lib.so [name...]   load lib.so and enable the named
+ *                                  builtins, or all it registers
+ *     enable -n name...            disable builtins
+ *     enable                       list enabled builtins
  * 
  * Args:
- *   cmd (char**): Command token array
- *   
+ *   cmd (char**): Tokens starting with "enable"
+ * 
  * Returns:
  *   None
  */
-void redirectFile(char** cmd){
-  const int INVALID = -1;
-
-  int inIndex = -1;
-  int outIndex = -1;
-  int errIndex = -1;
-  int fdIn;
-  int fdOut;
-  int fdErr;
+void runEnable(char** cmd){
+  const char* USAGE = "usage: enable [-f lib.so [name...] | -n name...]\n";
 
-  changeRedirToks(cmd, &inIndex, &outIndex, &errIndex);
+  int numNames = 0;
+  int index;
 
-  if(inIndex != INVALID){
-    if((fdIn = open(cmd[inIndex], O_RDONLY, 0)) == INVALID){
-        perror(cmd[inIndex]);
-        exit(EXIT_FAILURE);
-    }
-    dup2(fdIn, STDIN_FILENO);
-    close(fdIn);
+  if(cmd[1] == NULL){
+    pluginList();
+    return;
   }
-  if(outIndex != INVALID){
-    if((fdOut = open(cmd[outIndex], O_CREAT | O_WRONLY | O_TRUNC,
-        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) == INVALID){ 
-      perror(cmd[outIndex]);
-      exit(EXIT_FAILURE);
+  if(!strcmp(cmd[1], "-f") && cmd[2] != NULL){
+    while(cmd[3 + numNames] != NULL){
+      numNames++;
     }
-    dup2(fdOut, STDOUT_FILENO);
-    close(fdOut);
+    pluginLoad(cmd[2], cmd + 3, numNames);
+    return;
   }
-  if(errIndex != INVALID){
-    if((fdErr = open(cmd[errIndex], O_CREAT | O_WRONLY | O_TRUNC,
-        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) == INVALID){ 
-      perror(cmd[errIndex]);
-      exit(EXIT_FAILURE);
+  if(!strcmp(cmd[1], "-n") && cmd[2] != NULL){
+    for(index = 2; cmd[index] != NULL; index++){
+      if(pluginDisable(cmd[index]) < 0){
+        fprintf(stderr, "yash: enable: %s: not a plugin builtin\n",
+                cmd[index]);
+      }
     }
-    dup2(fdErr, STDERR_FILENO);
-    close(fdErr);
+    return;
   }
 
+  fprintf(stderr, "%s", USAGE);
+
   return;
 }
 
 /**
  * Purpose:
- *   Execute input line with file redirections
+ *   Directory of the persistent history: $YASH_HIST_DIR, else
+ *   $XDG_STATE_HOME/yash, else ~/.local/state/yash
  * 
- * Args: 
- *   cmd   (char**): Token array from command input
- *   input  (char*): Command input C-string
- *   head  (char**): Pointer to job stack head pointer
- *   back     (int): Boolean var indicating background status
+ * Args:
+ *   buf  (char*): Buffer for the path
+ *   size (size_t): Size of buf
+ * 
+ * Returns:
+ *   (char*): buf
+ */
+char* histDir(char* buf, size_t size){
+  char* env = NULL;
+
+  if((env = getenv("YASH_HIST_DIR")) != NULL && *env != '\0'){
+    snprintf(buf, size, "%s", env);
+  }
+  else if((env = getenv("XDG_STATE_HOME")) != NULL && *env != '\0'){
+    snprintf(buf, size, "%s/yash", env);
+  }
+  else{
+    env = getenv("HOME");
+    snprintf(buf, size, "%s/.local/state/yash", env != NULL ? env : "/tmp");
+  }
+
+  return buf;
+}
+
+/**
+ * Purpose:
+ *   List or search the persistent history
+ *     history [N]          newest N lines (default 16)
+ *     history -s TEXT...   lines containing TEXT, oldest first
+ *     history -p TEXT...   lines starting with TEXT, oldest first
+ * 
+ * Args:
+ *   cmd (char**): Tokens starting with "history"
  * 
  * Returns:
  *   None
  */
-void executeGeneral(char** cmd, char* input, JobNode_t** head, int back){
+void runHistory(char** cmd){
+  const char* USAGE = "usage: history [N | -s text | -p text]\n";
   const int MAX_LINE_LEN = 2001;
-  const int RUNNING = 0;
-  const int STOPPED = 1;
-  const int DONE = 2;
-
-  const int IN_FG = 1;
-  const int IN_BG = 0;
-  
-  int status;
-  int exists = 0;
+  const long DEFAULT_COUNT = 16;
+
+  char query[MAX_LINE_LEN];
+  const char* text = NULL;
+  long* ids = NULL;
+  long numIds = 0;
+  long capIds = 0;
+  long count;
+  long id;
+  size_t len;
+  int prefix;
+  int index;
+
+  if(hist == NULL){
+    fprintf(stderr, "yash: history: not available\n");
+    return;
+  }
 
-  int pidCh1 = fork();
+  if(cmd[1] == NULL || (cmd[2] == NULL && cmd[1][0] != '-')){
+    count = (cmd[1] != NULL) ? atol(cmd[1]) : DEFAULT_COUNT;
+    if(count <= 0){
+      fprintf(stderr, "%s", USAGE);
+      return;
+    }
+    id = histCount(hist) - count;
+    for(id = id < 0 ? 0 : id; (text = histEntry(hist, id, &len)); id++){
+      printf("%6ld  %.*s\n", id + 1, (int)len, text);
+    }
+    return;
+  }
+  if((strcmp(cmd[1], "-s") && strcmp(cmd[1], "-p")) || cmd[2] == NULL){
+    fprintf(stderr, "%s", USAGE);
+    return;
+  }
 
-  if(pidCh1 < 0){
-    // fork failed; exit
-    exit(EXIT_FAILURE);
+  // The line was split on spaces; put the text back together
+  prefix = (cmd[1][1] == 'p');
+  query[0] = '\0';
+  for(index = 2; cmd[index] != NULL; index++){
+    if(index > 2)
+      strncat(query, " ", sizeof(query) - strlen(query) - 1);
+    strncat(query, cmd[index], sizeof(query) - strlen(query) - 1);
   }
-  else if(pidCh1 == 0){
-    // child (new process)
-    setpgid(0,0);
-    redirectFile(cmd);
-    execvp(cmd[0], cmd);
 
-    // printf("\nEXEC PGID: %d\n", getpgid(0));
-    exit(EXIT_FAILURE);
+  id = -1;
+  while(id != 0 && (id = histSearch(hist, query, prefix, id)) >= 0){
+    if(numIds == capIds){
+      capIds = capIds ? 2 * capIds : 64;
+      ids = (long*)realloc(ids, capIds * sizeof(long));
+    }
+    ids[numIds++] = id;
   }
+  while(numIds > 0){
+    id = ids[--numIds];
+    text = histEntry(hist, id, &len);
+    printf("%6ld  %.*s\n", id + 1, (int)len, text);
+  }
+  free(ids);
 
-  // parent process
-  // printf("EXEC PID: %d\n", pidCh1);
-  if(fgProc != NULL)
-    free(fgProc);
+  return;
+}
 
-  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
-  strcpy(fgProc, input);
-  if(!back){
-    pushNode(head, input, pidCh1, RUNNING, IN_FG);
+/**
+ * Purpose:
+ *   Directory of the result cache: $YASH_CACHE_DIR, else
+ *   $XDG_CACHE_HOME/yash, else ~/.cache/yash
+ * 
+ * Args:
+ *   buf  (char*): Buffer for the path
+ *   size (size_t): Size of buf
+ * 
+ * Returns:
+ *   (char*): buf
+ */
+char* cacheDir(char* buf, size_t size){
+  char* env = NULL;
 
-    // wait for signal
-    waitpid(pidCh1, &status, WCONTINUED | WUNTRACED);
-    if (WIFEXITED(status)){
-      // Child exited normally
-      exists = findID(jobStack, pidCh1);
-	    if(exists){
-        changeJobStatus(jobStack, pidCh1, DONE);
-        if(isInFG(jobStack, pidCh1))
-          removeJob(jobStack, pidCh1);
-      }
-    }
-    else if (WIFSIGNALED(status)) {
-      // Child killed by signal
-      exists = findID(jobStack, pidCh1);
-	    if(exists)
-        removeJob(jobStack, pidCh1);
-    }
-    else if (WIFSTOPPED(status)) {
-      // Child stopped by signal
-      exists = findID(jobStack, pidCh1);
-      if(!exists)
-        pushNode(jobStack, fgProc, pidCh1, STOPPED, IN_BG);
-      else
-        changeJobStatus(jobStack, pidCh1, STOPPED);
-    }
-    return;
+  if((env = getenv("YASH_CACHE_DIR")) != NULL && *env != '\0'){
+    snprintf(buf, size, "%s", env);
+  }
+  else if((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0'){
+    snprintf(buf, size, "%s/yash", env);
   }
   else{
-    // Add background job to stack
-    pushNode(head, input, pidCh1, RUNNING, IN_BG);
-    return;
+    env = getenv("HOME");
+    snprintf(buf, size, "%s/.cache/yash", env != NULL ? env : "/tmp");
   }
+
+  return buf;
 }
 
 /**
  * Purpose:
- *   Execute input line with file redirections and pipes
+ *   Run a deterministic command through the result cache:
+ *     cache [-e VAR]... [-i FILE]... [--] cmd args...
+ *   The key covers argv, the named environment variables and the contents
+ *   of the input files. A hit replays stdout, stderr and the exit status
+ *   without running anything. A miss runs the command with its output
+ *   captured into the store, then replays it. The store is bounded by
+ *   $YASH_CACHE_MB (default CACHE_DEFAULT_MB) with LRU eviction.
  * 
- * Args: 
- *   cmd1 (char**): Token array for command before pipe
- *   cmd2 (char**): Token array for command after pipe
- *   input (char*): Command input C-string
- *   head (char**): Pointer to job stack head pointer
- *   back    (int): Boolean var indicating background status
+ * Args:
+ *   cmd      (char**): Tokens starting with "cache"
+ *   input     (char*): Input C-string
+ *   head (JobNode_t**): Pointer to job stack head pointer
  * 
  * Returns:
- *   None
+ *   (int): Wait status of the (possibly replayed) command, -1 on error
  */
-void executePipe(char** cmd1, char** cmd2, char* input, JobNode_t** head, int back){
+int runCache(char** cmd, char* input, JobNode_t** head){
   const int MAX_LINE_LEN = 2001;
   const int RUNNING = 0;
-  const int STOPPED = 1;
-  const int DONE = 2;
-
   const int IN_FG = 1;
-  const int IN_BG = 0;
-  
-  int status;
-  int exists = 0;
-
-  int pidCh1;
-  int pidCh2;
-  int pfd[2];
-
-  pipe(pfd);
-  pidCh1 = fork();
-  if(pidCh1 < 0) {
-    // fork failed; exit
-    exit(EXIT_FAILURE);
+  const char* USAGE = "usage: cache [-e var]... [-i file]... cmd args...\n";
+
+  char dir[PATH_MAX];
+  char key[CACHE_KEY_LEN + 1];
+  char** envNames = NULL;
+  char** inputs = NULL;
+  char** argv = NULL;
+  char* env = NULL;
+  YashCache_t* cache = NULL;
+  RedirList_t redirs;
+  long maxBytes = (long)CACHE_DEFAULT_MB << 20;
+  int numEnv = 0;
+  int numInputs = 0;
+  int numToks = 0;
+  int status = -1;
+  int outFd = -1;
+  int errFd = -1;
+  int index = 1;
+  int waited = -1;
+  int pid;
+
+  while(cmd[numToks] != NULL){
+    numToks++;
+  }
+  envNames = (char**)malloc(numToks * sizeof(char*));
+  inputs = (char**)malloc(numToks * sizeof(char*));
+  argv = (char**)malloc((numToks + 1) * sizeof(char*));
+
+  while(cmd[index] != NULL && cmd[index][0] == '-'){
+    if(!strcmp(cmd[index], "--")){
+      index++;
+      break;
+    }
+    else if(!strcmp(cmd[index], "-e") && cmd[index + 1] != NULL){
+      envNames[numEnv++] = cmd[index + 1];
+    }
+    else if(!strcmp(cmd[index], "-i") && cmd[index + 1] != NULL){
+      inputs[numInputs++] = cmd[index + 1];
+    }
+    else{
+      break;
+    }
+    index += 2;
   }
-  else if(pidCh1 == 0){
-    // child 1 (new process)
-    setpgid(0,0);
-    dup2(pfd[1], 1);
-    close(pfd[0]);
-    redirectFile(cmd1);
-    execvp(cmd1[0], cmd1);
 
-    exit(EXIT_FAILURE);
+  if(cmd[index] == NULL || cmd[index][0] == '-'){
+    fprintf(stderr, "%s", USAGE);
   }
+  else if(parseRedirs(cmd + index, argv, &redirs) < 0){
+    // message already printed
+  }
+  else if(redirs.numOps > 0 || argv[0] == NULL){
+    fprintf(stderr, "yash: cache: redirections are not cached\n");
+  }
+  else if(cacheKey(argv, envNames, numEnv, inputs, numInputs, key) == 0){
+    if((env = getenv("YASH_CACHE_MB")) != NULL && atol(env) > 0){
+      maxBytes = atol(env) << 20;
+    }
+    if((cache = cacheOpen(cacheDir(dir, sizeof(dir)), maxBytes)) == NULL){
+      fprintf(stderr, "yash: cache: %s: %s\n", dir, strerror(errno));
+    }
+  }
+  free(envNames);
+  free(inputs);
 
-  if(fgProc != NULL)
-    free(fgProc);
-
-  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
-  strcpy(fgProc, input);
-  pidCh2 = fork();
-  if(pidCh2 < 0){
-    // fork failed; exit
-    exit(EXIT_FAILURE);
-  }
-  else if(pidCh2 == 0){\
-    // child 2 (new process)
-    setpgid(0, pidCh1);
-    dup2(pfd[0], 0);
-    close(pfd[1]);
-    redirectFile(cmd2);
-    execvp(cmd2[0], cmd2);
-
-    exit(EXIT_FAILURE);
+  if(cache == NULL){
+    free(argv);
+    return -1;
+  }
+  if(cacheReplay(cache, key, STDOUT_FILENO, STDERR_FILENO, &status)){
+    cacheClose(cache);
+    free(argv);
+    return status;
   }
-  // parent process
-  close(pfd[0]);
-  close(pfd[1]);
-  
-  if(!back){
-    pushNode(head, input, pidCh1, RUNNING, IN_FG);
 
-    waitpid(pidCh1, &status, WCONTINUED | WUNTRACED);
-    if(WIFEXITED(status)){
-      // Child exited normally
-      exists = findID(jobStack, pidCh1);
-	    if(exists){
-        changeJobStatus(jobStack, pidCh1, DONE);
-        if(isInFG(jobStack, pidCh1))
-          removeJob(jobStack, pidCh1);
+  // Miss: run with stdout and stderr going into unnamed store files
+  if((outFd = cacheTempFile(cache)) < 0 || (errFd = cacheTempFile(cache)) < 0){
+    fprintf(stderr, "yash: cache: %s: %s\n", dir, strerror(errno));
+  }
+  else{
+    redirs.ops[0].type = REDIR_DUP;
+    redirs.ops[0].fd = STDOUT_FILENO;
+    redirs.ops[0].srcFd = outFd;
+    redirs.ops[0].both = 0;
+    redirs.ops[0].path = NULL;
+    redirs.ops[1] = redirs.ops[0];
+    redirs.ops[1].fd = STDERR_FILENO;
+    redirs.ops[1].srcFd = errFd;
+    redirs.numOps = 2;
+
+    if(spawnCommand(argv, &redirs, &pid) == 0){
+      if(fgProc != NULL)
+        free(fgProc);
+      fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
+      strcpy(fgProc, input);
+
+      trackChild(pid);
+      pushNode(head, input, pid, RUNNING, IN_FG);
+      // The capture files are read once the command exits, so a stop is
+      // undone rather than leaving them with a job that outlives them
+      while((waited = waitForChild(pid, &status)) == 0 &&
+            WIFSTOPPED(status)){
+        fprintf(stderr, "\nyash: cache: a cached command cannot be stopped\n");
+        changeJobStatus(head, pid, RUNNING);
+        changeJobFGState(head, pid, IN_FG);
+        signalJob(pid, SIGCONT);
       }
+      if(waited == 0)
+        updateJobStatus(head, pid, status);
     }
-    else if(WIFSIGNALED(status)){
-      // Child killed by signal
-      exists = findID(jobStack, pidCh1);
-	    if(exists)
-        removeJob(jobStack, pidCh1);
-    }
-    else if(WIFSTOPPED(status)){
-      // Child stopped by signal
-      exists = findID(jobStack, pidCh1);
-      if(!exists)
-        pushNode(jobStack, fgProc, pidCh1, STOPPED, IN_BG);
-      else
-        changeJobStatus(jobStack, pidCh1, STOPPED);
-    }
-    return;
   }
-  else{
-    // Add background job to stack
-    pushNode(head, input, pidCh1, RUNNING, IN_BG);
+
+  if(status != -1 && WIFEXITED(status) &&
+     cacheStore(cache, key, outFd, errFd, status) == 0){
+    cacheReplay(cache, key, STDOUT_FILENO, STDERR_FILENO, &status);
   }
+  else if(status != -1){
+    // Not cacheable (killed by a signal) or the store failed
+    cacheSend(outFd, STDOUT_FILENO);
+    cacheSend(errFd, STDERR_FILENO);
+  }
+
+  if(outFd >= 0)
+    close(outFd);
+  if(errFd >= 0)
+    close(errFd);
+  cacheClose(cache);
+  free(argv);
+
+  return status;
 }
 
 /**
@@ -1260,10 +3541,12 @@ void runForeground(JobNode_t** head){
     // printf("%s\nFG: %d\n", recent->jobStr, recentPGID);
     changeJobStatus(head, recentPGID, RUNNING);
     changeJobFGState(head, recentPGID, IN_FG);
-    kill(-recentPGID, SIGCONT);
+    signalJob(recentPGID, SIGCONT);
 
-    // wait for signal
-    waitpid(recentPGID, &status, WCONTINUED | WUNTRACED);
+    // wait for signal; an untracked leader has already been reaped
+    if(waitForChild(recentPGID, &status) < 0){
+      return;
+    }
     if (WIFEXITED(status)){
       // Child exited normally
       exists = findID(jobStack, recentPGID);
@@ -1341,7 +3624,7 @@ void runBackground(JobNode_t** head){
   const int IN_BG = 0;
   const int INVALID = -1;
   const int RUNNING = 0;
-  int recentPGID;
+  int recentPGID = INVALID;
 
   Job_t* recent = findRecentStopped(head);
   if(recent != NULL){
@@ -1353,7 +3636,7 @@ void runBackground(JobNode_t** head){
     printBGStr(head, recentPGID);
     changeJobStatus(head, recentPGID, RUNNING);
     changeJobFGState(head, recentPGID, IN_BG);
-    killpg(recentPGID, SIGCONT);
+    signalJob(recentPGID, SIGCONT);
   }
   
 	return;
@@ -1378,6 +3661,17 @@ void manageJobs(char** cmd, char* input, JobNode_t** head){
   const char* BG_TOK = "bg";
   const char* FG_TOK = "fg";
   const char* JOBS_TOK = "jobs";
+  const char* BATCH_TOK = "batch";
+  const char* WAIT_TOK = "wait";
+  const char* TIMEOUT_TOK = "timeout";
+  const char* DAG_TOK = "dag";
+  const char* SET_TOK = "set";
+  const char* CACHE_TOK = "cache";
+  const char* ENABLE_TOK = "enable";
+  const char* HISTORY_TOK = "history";
+  const char* WATCH_TOK = "watch-run";
+  const char* MEMSTAT_TOK = "memstat";
+  const char* CD_TOK = "cd";
 
   int backState = 0;
   int lastIndex = 0;
@@ -1390,7 +3684,7 @@ void manageJobs(char** cmd, char* input, JobNode_t** head){
   if(strcmp(cmd[0], JOBS_TOK) == 0){
     // print job stack
     if((*head) != NULL){
-      printStack(head);
+      printStack(head, cmd[1] != NULL && !strcmp(cmd[1], "-v"));
     }
 
     return;
@@ -1407,9 +3701,90 @@ void manageJobs(char** cmd, char* input, JobNode_t** head){
 
     return;
   }
+  else if(!strcmp(cmd[0], WAIT_TOK)){
+    // wait for background jobs
+    waitJobs(cmd, head);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], TIMEOUT_TOK)){
+    // execute with a timeout on the job's process group
+    runTimeout(cmd, NULL, input, head);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], WATCH_TOK)){
+    // run again on every change to the watched paths
+    runWatch(cmd, NULL, input, head);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], SET_TOK)){
+    // set or list shell options
+    setOption(cmd);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], HISTORY_TOK)){
+    // list or search the persistent history
+    runHistory(cmd);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], CD_TOK)){
+    // change the shell's directory
+    lastStatus = groupCd(cmd);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], MEMSTAT_TOK)){
+    // heap accounting of the shell itself
+    memPrint(stdout);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], ENABLE_TOK)){
+    // load or list plugin builtins
+    runEnable(cmd);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], CACHE_TOK)){
+    // run through the result cache; its output is replayed when the
+    // command exits, so it only runs in the foreground
+    if(lastIndex > 0 && !strcmp(cmd[lastIndex], BACKGROUND)){
+      fprintf(stderr, "yash: cache: cannot run in the background\n");
+
+      return;
+    }
+    fromFG = 0;
+    runCache(cmd, input, head);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], DAG_TOK)){
+    // run a dependency graph of commands in parallel
+    runDag(cmd);
+
+    return;
+  }
+  else if(!strcmp(cmd[0], BATCH_TOK)){
+    // execute with arguments split to fit ARG_MAX, taking the & off first
+    // as for any other job
+    if(lastIndex > 0 && !strcmp(cmd[lastIndex], BACKGROUND)){
+      backState = 1;
+      memFree(MEM_PARSER, cmd[lastIndex]);
+      cmd[lastIndex] = NULL;
+    }
+    fromFG = 0;
+    runBatch(cmd, input, head, backState);
+
+    return;
+  }
   else if(!strcmp(cmd[lastIndex], BACKGROUND)){
     // execute in background
     backState = 1;
+    memFree(MEM_PARSER, cmd[lastIndex]);
     cmd[lastIndex] = NULL;
 
     executeGeneral(cmd, input, head, backState);
@@ -1446,6 +3821,8 @@ void managePipeJobs(char** cmd1, char** cmd2, char* input, JobNode_t** head){
   const char* BG_TOK = "bg";
   const char* FG_TOK = "fg";
   const char* JOBS_TOK = "jobs";
+  const char* TIMEOUT_TOK = "timeout";
+  const char* WATCH_TOK = "watch-run";
   int backState = 0;
 
   int lastIndex = 0;
@@ -1457,7 +3834,7 @@ void managePipeJobs(char** cmd1, char** cmd2, char* input, JobNode_t** head){
   if(strcmp(cmd1[0], JOBS_TOK) == 0){
     // print job stack
     if((*head) != NULL){
-      printStack(head);
+      printStack(head, cmd1[1] != NULL && !strcmp(cmd1[1], "-v"));
     }
 
     return;
@@ -1474,9 +3851,22 @@ void managePipeJobs(char** cmd1, char** cmd2, char* input, JobNode_t** head){
 
     return;
   }
+  else if(!strcmp(cmd1[0], TIMEOUT_TOK)){
+    // execute pipeline with a timeout on its process group
+    runTimeout(cmd1, cmd2, input, head);
+
+    return;
+  }
+  else if(!strcmp(cmd1[0], WATCH_TOK)){
+    // run the pipeline again on every change to the watched paths
+    runWatch(cmd1, cmd2, input, head);
+
+    return;
+  }
   else if(!strcmp(cmd2[lastIndex], BACKGROUND)){
     // execute in background
     backState = 1;
+    memFree(MEM_PARSER, cmd2[lastIndex]);
     cmd2[lastIndex] = NULL;
 
     executePipe(cmd1, cmd2, input, head, backState);
@@ -1493,6 +3883,311 @@ void managePipeJobs(char** cmd1, char** cmd2, char* input, JobNode_t** head){
   }
 }
 
+/**
+ * Purpose:
+ *   Run a pipeline of a group line as one job: every stage is forked into
+ *   the process group of the first, and group stages walk their part of
+ *   the parsed line without an exec of the shell
+ * 
+ * Args:
+ *   pipe (GroupPipe_t*): Pipeline, run in the background if it ended in &
+ *   head  (JobNode_t**): Pointer to job stack head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void runGroupJob(GroupPipe_t* pipe, JobNode_t** head){
+  const int MAX_LINE_LEN = 2001;
+  const int RUNNING = 0;
+
+  const int IN_FG = 1;
+  const int IN_BG = 0;
+
+  int back = (pipe->sep == GROUP_BACK);
+  int* pids = (int*)malloc(pipe->numCmds * sizeof(int));
+  int pfd[2] = {-1, -1};
+  int numPids = 0;
+  int prevIn = -1;
+  int pgid = 0;
+  int status = 0;
+  int last;
+  int index;
+  sigset_t mask;
+  sigset_t oldMask;
+
+  for(index = 0; index < pipe->numCmds; index++){
+    last = (index == pipe->numCmds - 1);
+    if(!last && pipe2(pfd, O_CLOEXEC) < 0){
+      fprintf(stderr, "yash: pipe: %s\n", strerror(errno));
+      break;
+    }
+    if(groupSpawn(pipe->cmds[index], prevIn, last ? -1 : pfd[1],
+                  last ? -1 : pfd[0], pgid, &pids[numPids]) != 0){
+      if(!last){
+        close(pfd[0]);
+        close(pfd[1]);
+      }
+      break;
+    }
+    if(pgid == 0){
+      pgid = pids[0];
+    }
+    trackChild(pids[numPids++]);
+    if(prevIn >= 0){
+      close(prevIn);
+    }
+    prevIn = last ? -1 : pfd[0];
+    if(!last){
+      close(pfd[1]);
+    }
+  }
+  if(prevIn >= 0){
+    close(prevIn);
+  }
+  if(numPids < pipe->numCmds){
+    // A stage could not start; the ones that did go down with it
+    signalJob(pgid, SIGKILL);
+    for(index = 0; index < numPids; index++){
+      waitForChild(pids[index], &status);
+    }
+    free(pids);
+    lastStatus = 1;
+    return;
+  }
+  armTimeout(pgid);
+
+  if(fgProc != NULL)
+    free(fgProc);
+
+  fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
+  strcpy(fgProc, pipe->text);
+  pushNode(head, pipe->text, pgid, RUNNING, back ? IN_BG : IN_FG);
+  if(back || fgNoWait){
+    free(pids);
+    return;
+  }
+
+  // Every stage is waited for, so the prompt returns after the last one
+  // and its code is the job's; SIGCHLD stays blocked so the handler does
+  // not reap them first
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &oldMask);
+  if(waitForChild(pgid, &status) == 0)
+    updateJobStatus(jobStack, pgid, status);
+  for(index = 1; index < numPids && !WIFSTOPPED(status); index++){
+    if(waitForChild(pids[index], &status) == 0 && index == numPids - 1)
+      lastStatus = groupExitCode(status);
+  }
+  sigprocmask(SIG_SETMASK, &oldMask, NULL);
+  free(pids);
+
+  return;
+}
+
+void runGroups(GroupList_t* list, JobNode_t** head);
+
+/**
+ * Purpose:
+ *   Run a brace group in the shell itself: its redirections are applied
+ *   to the shell's fds, which are saved first and restored afterwards, and
+ *   each pipeline in it is a job of its own, as on a line by itself
+ * 
+ * Args:
+ *   cmd  (GroupCmd_t*): Brace group
+ *   head (JobNode_t**): Pointer to job stack head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void runBraceGroup(GroupCmd_t* cmd, JobNode_t** head){
+  int saved[2 * GROUP_MAX_SAVED];
+  int numSaved = -1;
+  int numWords = 0;
+  char** argv = NULL;
+  RedirList_t redirs;
+  YashZpipe_t* zpipes = NULL;
+  YashFanout_t* fans = NULL;
+  YashZygote_t* spawner = zygote;
+
+  while(cmd->words[numWords] != NULL){
+    numWords++;
+  }
+  argv = (char**)malloc((numWords + 1) * sizeof(char*));
+  if(parseRedirs(cmd->words, argv, &redirs) < 0){
+    free(argv);
+    lastStatus = 2;
+    return;
+  }
+  if(argv[0] != NULL){
+    fprintf(stderr, "yash: syntax error near `%s'\n", argv[0]);
+    free(argv);
+    lastStatus = 2;
+    return;
+  }
+  free(argv);
+
+  if(zpipeRedirs(&redirs, &zpipes) == 0 &&
+     fanoutRedirs(&redirs, -1, &fans) == 0){
+    numSaved = groupRedirect(&redirs, saved);
+  }
+  if(numSaved < 0){
+    closeRedirs(&redirs);
+    zpipeFinish(zpipes, 1);
+    fanoutFinish(fans, 1);
+    lastStatus = 1;
+    return;
+  }
+
+  // Children of the fork server get its fds, not the redirected ones
+  if(redirs.numOps > 0){
+    zygote = NULL;
+  }
+  runGroups(cmd->body, head);
+  zygote = spawner;
+
+  groupRestore(saved, numSaved);
+  closeRedirs(&redirs);
+  zpipeFinish(zpipes, 1);
+  fanoutFinish(fans, 1);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Run a parsed group line, or the body of a brace group, in the shell.
+ *   Pipelines of simple commands take the usual paths, so builtins and
+ *   every spawn option work as on a plain line; a lone brace group runs
+ *   here; anything else with a group in it is one job from runGroupJob.
+ *   && and || look at the code of the last foreground job.
+ * 
+ * Args:
+ *   list (GroupList_t*): Pipelines from groupParse
+ *   head  (JobNode_t**): Pointer to job stack head pointer
+ * 
+ * Returns:
+ *   None
+ */
+void runGroups(GroupList_t* list, JobNode_t** head){
+  GroupPipe_t* pipe = NULL;
+  GroupCmd_t** cmds = NULL;
+  int prevSep = GROUP_SEQ;
+  int plain;
+  int index;
+
+  lastStatus = 0;
+  for(index = 0; index < list->numPipes; index++){
+    pipe = list->pipes[index];
+    cmds = pipe->cmds;
+    if(index > 0){
+      prevSep = list->pipes[index - 1]->sep;
+    }
+    if((prevSep == GROUP_AND && lastStatus != 0) ||
+       (prevSep == GROUP_OR && lastStatus == 0)){
+      continue;
+    }
+
+    plain = (pipe->sep != GROUP_BACK);
+    lastStatus = 0;
+    if(plain && pipe->numCmds == 1 && cmds[0]->type == GROUP_SIMPLE){
+      manageJobs(cmds[0]->words, pipe->text, head);
+    }
+    else if(plain && pipe->numCmds == 2 && cmds[0]->type == GROUP_SIMPLE &&
+            cmds[1]->type == GROUP_SIMPLE){
+      managePipeJobs(cmds[0]->words, cmds[1]->words, pipe->text, head);
+    }
+    else if(plain && pipe->numCmds == 1 && cmds[0]->type == GROUP_BRACE){
+      runBraceGroup(cmds[0], head);
+    }
+    else{
+      runGroupJob(pipe, head);
+    }
+
+    if(lastStatus == 128 + SIGINT){
+      // C-c ends the rest of the line, not only the job it reached
+      break;
+    }
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Expand globs in the tokens of a command. The options and paths of
+ *   watch-run, up to its "--", are left as typed, since its -x patterns
+ *   are matched against changed names later, not against the tree now.
+ * 
+ * Args:
+ *   cmd         (char**): NULL terminated token array
+ *   cache (DirCache_t**): Pointer to dirent cache head pointer for this line
+ * 
+ * Returns:
+ *   (char**): New NULL terminated token array
+ */
+char** expandCmdGlobs(char** cmd, DirCache_t** cache){
+  const char* WATCH_TOK = "watch-run";
+  const char* SEPARATOR = "--";
+
+  int from = 0;
+
+  if(cmd[0] != NULL && !strcmp(cmd[0], WATCH_TOK)){
+    while(cmd[from] != NULL && strcmp(cmd[from], SEPARATOR)){
+      from++;
+    }
+  }
+
+  return expandGlobsFrom(cmd, from, cache);
+}
+
+/**
+ * Purpose:
+ *   Count a token array from libyash and its tokens against the parser
+ * 
+ * Args:
+ *   toks (char**): NULL terminated array, may be NULL
+ * 
+ * Returns:
+ *   (char**): toks
+ */
+char** chargeTokens(char** toks){
+  int index;
+
+  if(toks == NULL){
+    return NULL;
+  }
+  for(index = 0; toks[index] != NULL; index++){
+    memCharge(MEM_PARSER, toks[index]);
+  }
+
+  return (char**)memCharge(MEM_PARSER, toks);
+}
+
+/**
+ * Purpose:
+ *   Free a token array counted by chargeTokens
+ * 
+ * Args:
+ *   toks (char**): NULL terminated array, may be NULL
+ * 
+ * Returns:
+ *   None
+ */
+void releaseTokens(char** toks){
+  int index;
+
+  if(toks == NULL){
+    return;
+  }
+  for(index = 0; toks[index] != NULL; index++){
+    memFree(MEM_PARSER, toks[index]);
+  }
+  memFree(MEM_PARSER, toks);
+
+  return;
+}
+
 /**
  * Purpose:
  *   Loops yash shell until user terminates program (CTRL+D)
@@ -1508,10 +4203,18 @@ void shell(void){
   const char* PIPE = "|";
   const char* SPACE_CHAR = " ";
   const char* PROMPT = "# ";
+  const char METER_MARK = '~';
+  static const char* BUILTINS[] = {"bg", "batch", "cache", "cd", "dag",
+                                   "enable", "fg", "history", "jobs",
+                                   "limit", "memstat", "read", "sched",
+                                   "set", "timeout", "wait", "watch-run",
+                                   "while", NULL};
 
   int validInput = 0;
-  int index = -1;
   char* input;
+  char histPath[PATH_MAX];
+  char* boardOn[] = {"set", "-o", "board", NULL};
+  DirCache_t* dirCache = NULL;
   
   // Block signals outside of shell
   signal(SIGINT, SIG_IGN);
@@ -1520,13 +4223,47 @@ void shell(void){
   signal(SIGTTOU, SIG_IGN);
   
   // Initialize job control stack
-  jobStack = (JobNode_t**)malloc(sizeof(JobNode_t*));
+  memInit();
+  jobStack = (JobNode_t**)memAlloc(MEM_JOBS, sizeof(JobNode_t*));
   *jobStack = NULL;
+  initChildTracking();
+
+  // read and while run through the builtin table
+  pluginAddInternal("read", lineReadBuiltin, 0);
+  pluginAddInternal("while", lineWhileBuiltin, 1);
+  // A forked group runs those itself and reports the rest
+  groupShellBuiltins = BUILTINS;
+
+  // Command names for TAB, read on first use and kept fresh by inotify
+  execIndex = execIndexOpen(BUILTINS);
+  execIndexReadlineInit(execIndex);
+  if(isatty(STDIN_FILENO)){
+    // readline cannot see EOF on a pipe while an event hook is set
+    rl_event_hook = reapWhileIdle;
+  }
+
+  // Persistent history; C-r searches it through its index
+  if((hist = histOpen(histDir(histPath, sizeof(histPath)))) == NULL){
+    fprintf(stderr, "yash: history: %s: %s\n", histPath, strerror(errno));
+  }
+  else{
+    histReadlineInit(hist);
+  }
+
+  // Monitoring can ask for the status board in every shell
+  if(getenv("YASH_JOB_BOARD") != NULL){
+    setOption(boardOn);
+  }
 
   // Reset pgrp
   fgProc = (char*)malloc(MAX_LINE_LEN * sizeof(char));
 
-  while((input = readline(PROMPT))){
+  while((input = (char*)memCharge(MEM_PARSER, readline(PROMPT)))){
+    if(*input != '\0'){
+      add_history(input);
+      if(hist != NULL)
+        histAdd(hist, input);
+    }
     if(signal(SIGINT, sigintHandler) == SIG_ERR){
       printf("signal(SIGINT) error");
     }
@@ -1540,72 +4277,78 @@ void shell(void){
     validInput = checkInput(input);
     pgrp = -1;
 
+    // Children that exited before they were tracked did not get a SIGCHLD
+    // of their own; collect them now
+    reapChildren(0, 0, NULL, NULL, 0);
+
     if((*jobStack) != NULL){
       printDoneJobs(jobStack);
       removeDoneJobs(jobStack);
+      syncBoard(jobStack);
+    }
+    reportMeters(0);
+    if(validInput && groupDetect(input)){
+      // ( ) or { }: parsed once into a tree and run from it
+      GroupList_t* groups = groupParse(input);
+
+      if(groups != NULL){
+        runGroups(groups, jobStack);
+        groupFree(groups);
+      }
     }
-    if(validInput){
-      char** pipeArray = splitStrArray(input, PIPE);
+    else if(validInput){
+      char** pipeArray = chargeTokens(splitStrArray(input, PIPE));
+      meterNext = 0;
+      if(pipeArray[1] != NULL && pipeArray[1][0] == METER_MARK){
+        // a |~ b: this pipe is metered
+        pipeArray[1][0] = ' ';
+        meterNext = 1;
+      }
       if(pipeArray[1] == NULL){
         // no pipe
-        char** cmd = splitStrArray(input, SPACE_CHAR);
+        char** cmd = chargeTokens(expandCmdGlobs(splitStrArray(input,
+                                                               SPACE_CHAR),
+                                                 &dirCache));
 
-        manageJobs(cmd, input, jobStack);
-
-        index = 0;
-        if(cmd != NULL){
-          while(cmd[index] != NULL){
-            free(cmd[index]);
-            index++;
-          }
-          free(cmd);
-        }
+        if(cmd[0] != NULL)
+          manageJobs(cmd, input, jobStack);
 
-        if(pipeArray[0] != NULL)
-          free(pipeArray[0]);
+        releaseTokens(cmd);
       }
       else{
         // pipe exists
-        char** cmd1 = splitStrArray(pipeArray[0], SPACE_CHAR);
-        char** cmd2 = splitStrArray(pipeArray[1], SPACE_CHAR);
-
-        managePipeJobs(cmd1, cmd2, input, jobStack);
-        
-        if(cmd1 != NULL){
-          index = 0;
-          while(cmd1[index] != NULL){
-            free(cmd1[index]);
-            index++;
-          }
-          free(cmd1);
-        }
-
-        if(cmd2 != NULL){
-        index = 0;
-        while(cmd2[index] != NULL){
-          free(cmd2[index]);
-          index++;
-        }
-        free(cmd2);
-        }
-
-        if(pipeArray[0] != NULL)
-          free(pipeArray[0]);
-        
-        if(pipeArray[1] != NULL)
-          free(pipeArray[1]);
+        char** cmd1 = chargeTokens(expandCmdGlobs(splitStrArray(pipeArray[0],
+                                                                SPACE_CHAR),
+                                                  &dirCache));
+        char** cmd2 = chargeTokens(expandGlobs(splitStrArray(pipeArray[1],
+                                                             SPACE_CHAR),
+                                               &dirCache));
+
+        if(cmd1[0] != NULL && cmd2[0] != NULL)
+          managePipeJobs(cmd1, cmd2, input, jobStack);
+
+        releaseTokens(cmd1);
+        releaseTokens(cmd2);
       }
-      if(pipeArray != NULL)
-        free(pipeArray);
+      releaseTokens(pipeArray);
+
+      // Directory listings are only valid for one command line
+      freeDirCache(&dirCache);
     }
 
-    if(input != NULL)
-      free(input);
+    memFree(MEM_PARSER, input);
   }
 
   freeJobStack(jobStack);
-  if(jobStack != NULL)
-    free(jobStack);
+  memFree(MEM_JOBS, jobStack);
+
+  histClose(hist);
+  hist = NULL;
+  execIndexClose(execIndex);
+  execIndex = NULL;
+  boardClose(board);
+  board = NULL;
+  reportMeters(1);
 
   if(fgProc != NULL)
     free(fgProc);
@@ -1616,16 +4359,48 @@ void shell(void){
 /**
  * Purpose:
  *   Driver for shell program
+ *     yash                   interactive shell
+ *     yash -d SOCKET [-c N]  command server, N requests per client
+ *     -z                     spawn commands through a fork server
  * 
  * Args:
- *   None
+ *   argc   (int): Number of arguments
+ *   argv (char**): Argument array
  * 
  * Returns:
  *   (int): 0 on exit success
  */
-int main (void){
+int main (int argc, char** argv){
+  const char* USAGE = "usage: yash [-z] [-d socket [-c limit]]\n";
+
+  char* sockPath = NULL;
+  int limit = YASHD_DEFAULT_LIMIT;
+  int opt;
+
+  while((opt = getopt(argc, argv, "zd:c:")) != -1){
+    if(opt == 'z' && zygote == NULL){
+      // Fork the helper now, before history and jobs grow the heap
+      zygote = zygoteStart();
+    }
+    else if(opt == 'd'){
+      sockPath = optarg;
+    }
+    else if(opt == 'c' && atoi(optarg) > 0){
+      limit = atoi(optarg);
+    }
+    else{
+      fprintf(stderr, "%s", USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(sockPath != NULL){
+    yashdServe(sockPath, limit);
+    return EXIT_FAILURE;
+  }
 
   shell();
+  zygoteStop(zygote);
 
   return 0;
 }
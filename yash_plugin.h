@@ -0,0 +1,51 @@
+#ifndef YASH_PLUGIN_H
+#define YASH_PLUGIN_H
+
+#include <stddef.h>
+
+// Plugin ABI for builtins loaded with "enable -f lib.so name". This header
+// is all a plugin needs. Structs only ever grow at the end, and abi is
+// bumped when they do, so a plugin built against an older header keeps
+// working.
+//
+// A plugin exports
+//
+//   int yashPluginInit(YashPluginHost_t* host);
+//
+// which calls host->registerBuiltin once per builtin and returns 0. The
+// shell runs a builtin in-process when it is a foreground command on its
+// own, and in a forked child (without exec) inside pipelines and in the
+// background. Either way it must use the fds and allocator in its
+// context, return its exit status instead of calling exit(), and leave
+// process-wide state (signals, cwd, environment) alone.
+
+#define YASH_PLUGIN_ABI 1
+#define YASH_PLUGIN_INIT "yashPluginInit"
+
+/**
+ * YashBuiltinCtx_t struct, what a builtin gets besides its argv
+ */
+typedef struct YashBuiltinCtx_t{
+  int abi;
+  int inFd;
+  int outFd;
+  int errFd;
+  void* (*alloc)(size_t size);
+  void (*free)(void* ptr);
+}YashBuiltinCtx_t;
+
+typedef int (*YashBuiltinFn_t)(YashBuiltinCtx_t* ctx, int argc, char** argv);
+
+/**
+ * YashPluginHost_t struct, passed to yashPluginInit
+ */
+typedef struct YashPluginHost_t{
+  int abi;
+  int (*registerBuiltin)(struct YashPluginHost_t* host, const char* name,
+                         YashBuiltinFn_t fn);
+  void* hostData;
+}YashPluginHost_t;
+
+typedef int (*YashPluginInitFn_t)(YashPluginHost_t* host);
+
+#endif
@@ -0,0 +1,745 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "libyash_internal.h"
+#include "yashd.h"
+
+#define YASHD_MAX_EVENTS 64
+#define YASHD_MAX_FDS 3
+#define YASHD_MAX_QUEUED (256 * 1024)
+
+/**
+ * Event sources registered with epoll
+ */
+enum{
+  WATCH_LISTEN,
+  WATCH_CLIENT,
+  WATCH_OUT,
+  WATCH_ERR,
+  WATCH_DONE
+};
+
+struct YashdClient_t;
+struct YashdReq_t;
+
+/**
+ * YashdWatch_t struct, epoll user data telling which fd became ready
+ */
+typedef struct YashdWatch_t{
+  int kind;
+  struct YashdClient_t* client;
+  struct YashdReq_t* req;
+}YashdWatch_t;
+
+/**
+ * YashdReq_t struct, one request in flight. outFd/errFd are the read ends
+ * of the output pipes when the client did not pass its own fds.
+ */
+typedef struct YashdReq_t{
+  uint32_t id;
+  int outFd;
+  int errFd;
+  int done;
+  YashPipeline_t* pipeline;
+  YashRun_t* run;
+  YashdWatch_t outWatch;
+  YashdWatch_t errWatch;
+  YashdWatch_t doneWatch;
+  struct YashdClient_t* client;
+
+  struct YashdReq_t* next;
+}YashdReq_t;
+
+/**
+ * YashdOut_t struct, one reply waiting for the client's socket to drain
+ */
+typedef struct YashdOut_t{
+  size_t len;
+  struct YashdOut_t* next;
+  char data[];
+}YashdOut_t;
+
+/**
+ * YashdClient_t struct, one connection and its requests in flight. Replies
+ * the socket cannot take yet wait in order in the out queue; events is
+ * what the socket is registered for, 0 when it is not.
+ */
+typedef struct YashdClient_t{
+  int fd;
+  int active;
+  int paused;
+  int closing;
+  int broken;
+  int events;
+  int throttled;
+  size_t queued;
+  YashdWatch_t watch;
+  YashdReq_t* reqs;
+  YashdOut_t* outHead;
+  YashdOut_t* outTail;
+}YashdClient_t;
+
+/**
+ * YashdServer_t struct, event loop state
+ */
+typedef struct YashdServer_t{
+  int epfd;
+  int listenFd;
+  int maxPerClient;
+  YashdWatch_t listenWatch;
+}YashdServer_t;
+
+/**
+ * Purpose:
+ *   Register an fd with the event loop
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   fd                (int): fd to watch for input
+ *   watch  (YashdWatch_t*): User data returned with its events
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on failure
+ */
+int yashdWatch(YashdServer_t* server, int fd, YashdWatch_t* watch){
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = watch;
+
+  return epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Purpose:
+ *   Register a client's socket for what it currently needs: input unless
+ *   it is paused, output while replies are queued
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client to update
+ *
+ * Returns:
+ *   None
+ */
+void yashdUpdate(YashdServer_t* server, YashdClient_t* client){
+  struct epoll_event ev;
+  int events = 0;
+
+  if(client->closing){
+    return;
+  }
+  if(!client->paused){
+    events |= EPOLLIN;
+  }
+  if(client->outHead != NULL){
+    events |= EPOLLOUT;
+  }
+  if(events == client->events){
+    return;
+  }
+
+  // Removed rather than masked, since a hangup is reported even with no
+  // events requested and would spin the loop
+  ev.events = events;
+  ev.data.ptr = &client->watch;
+  if(events == 0){
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+  }
+  else{
+    epoll_ctl(server->epfd, client->events == 0 ? EPOLL_CTL_ADD :
+              EPOLL_CTL_MOD, client->fd, &ev);
+  }
+  client->events = events;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Stop or resume forwarding the output pipes of a client's requests.
+ *   While its queue is full the pipes fill up instead and the pipelines
+ *   block, rather than the server buffering without bound.
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client to change
+ *   throttled          (int): 1 to stop forwarding, 0 to resume
+ *
+ * Returns:
+ *   None
+ */
+void yashdThrottle(YashdServer_t* server, YashdClient_t* client,
+                   int throttled){
+  YashdReq_t* req = NULL;
+
+  if(client->throttled == throttled){
+    return;
+  }
+  for(req = client->reqs; req != NULL; req = req->next){
+    if(req->outFd >= 0 && throttled){
+      epoll_ctl(server->epfd, EPOLL_CTL_DEL, req->outFd, NULL);
+    }
+    else if(req->outFd >= 0){
+      yashdWatch(server, req->outFd, &req->outWatch);
+    }
+    if(req->errFd >= 0 && throttled){
+      epoll_ctl(server->epfd, EPOLL_CTL_DEL, req->errFd, NULL);
+    }
+    else if(req->errFd >= 0){
+      yashdWatch(server, req->errFd, &req->errWatch);
+    }
+  }
+  client->throttled = throttled;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Drop a client's queued replies
+ *
+ * Args:
+ *   client (YashdClient_t*): Client
+ *
+ * Returns:
+ *   None
+ */
+void yashdDropQueue(YashdClient_t* client){
+  YashdOut_t* next = NULL;
+
+  while(client->outHead != NULL){
+    next = client->outHead->next;
+    free(client->outHead);
+    client->outHead = next;
+  }
+  client->outTail = NULL;
+  client->queued = 0;
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Send queued replies until the socket would block. A failed send means
+ *   the client is gone: its replies are dropped, and it is noticed on its
+ *   next read.
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client with a writable socket
+ *
+ * Returns:
+ *   None
+ */
+void yashdFlush(YashdServer_t* server, YashdClient_t* client){
+  YashdOut_t* out = NULL;
+  ssize_t sent;
+
+  while((out = client->outHead) != NULL){
+    sent = send(client->fd, out->data, out->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(sent < 0 && errno == EINTR){
+      continue;
+    }
+    if(sent < 0 && (errno == EAGAIN || errno == ENOBUFS)){
+      break;
+    }
+    if(sent < 0){
+      client->broken = 1;
+      yashdDropQueue(client);
+      break;
+    }
+    client->outHead = out->next;
+    client->queued -= out->len;
+    free(out);
+  }
+  if(client->outHead == NULL){
+    client->outTail = NULL;
+    yashdThrottle(server, client, 0);
+  }
+  yashdUpdate(server, client);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Send one message to a client without blocking. If the socket is full,
+ *   or earlier replies are still queued, the message is queued behind them
+ *   and sent when the socket drains.
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client
+ *   id           (uint32_t): Request id
+ *   type              (int): Message kind
+ *   status            (int): Exit status or errno
+ *   data       (const char*): Payload, may be NULL
+ *   len            (size_t): Payload length
+ *
+ * Returns:
+ *   None
+ */
+void yashdSend(YashdServer_t* server, YashdClient_t* client, uint32_t id,
+               int type, int status, const char* data, size_t len){
+  YashdMsg_t hdr;
+  YashdOut_t* out = NULL;
+  struct iovec iov[2];
+  struct msghdr msg;
+  ssize_t sent = -1;
+
+  if(client->closing || client->broken){
+    return;
+  }
+
+  hdr.id = id;
+  hdr.type = type;
+  hdr.status = status;
+  if(client->outHead == NULL){
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len > 0) ? 2 : 1;
+    while((sent = sendmsg(client->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0 &&
+          errno == EINTR);
+    if(sent >= 0){
+      return;
+    }
+    if(errno != EAGAIN && errno != ENOBUFS){
+      client->broken = 1;
+      return;
+    }
+  }
+
+  out = (YashdOut_t*)malloc(sizeof(YashdOut_t) + sizeof(hdr) + len);
+  out->len = sizeof(hdr) + len;
+  out->next = NULL;
+  memcpy(out->data, &hdr, sizeof(hdr));
+  if(len > 0){
+    memcpy(out->data + sizeof(hdr), data, len);
+  }
+  if(client->outTail != NULL){
+    client->outTail->next = out;
+  }
+  else{
+    client->outHead = out;
+  }
+  client->outTail = out;
+  client->queued += out->len;
+
+  if(client->queued > YASHD_MAX_QUEUED){
+    yashdThrottle(server, client, 1);
+  }
+  yashdUpdate(server, client);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Stop or resume reading new requests from a client
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client to change
+ *   paused             (int): 1 to stop reading, 0 to resume
+ *
+ * Returns:
+ *   None
+ */
+void yashdPause(YashdServer_t* server, YashdClient_t* client, int paused){
+  if(client->paused == paused || client->closing){
+    return;
+  }
+  client->paused = paused;
+  yashdUpdate(server, client);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Close a client whose connection is gone and that has nothing running
+ *
+ * Args:
+ *   client (YashdClient_t*): Client to free
+ *
+ * Returns:
+ *   None
+ */
+void yashdFreeClient(YashdClient_t* client){
+  yashdDropQueue(client);
+  close(client->fd);
+  free(client);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Finish a request once its stages are reaped and its output pipes are
+ *   drained: report the exit status and release everything it holds
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   req       (YashdReq_t*): Request to check
+ *
+ * Returns:
+ *   None
+ */
+void yashdFinish(YashdServer_t* server, YashdReq_t* req){
+  YashdClient_t* client = req->client;
+  YashdReq_t** link = &client->reqs;
+  int status;
+
+  if(!req->done || req->outFd >= 0 || req->errFd >= 0){
+    return;
+  }
+
+  status = yashWait(req->run, NULL, NULL);
+  yashdSend(server, client, req->id, YASHD_EXIT, status, NULL, 0);
+  epoll_ctl(server->epfd, EPOLL_CTL_DEL, yashRunFd(req->run), NULL);
+  yashFreeRun(req->run);
+  yashFreePipeline(req->pipeline);
+
+  while(*link != req){
+    link = &(*link)->next;
+  }
+  *link = req->next;
+  free(req);
+
+  client->active--;
+  if(client->closing && client->active == 0){
+    yashdFreeClient(client);
+  }
+  else if(client->active < server->maxPerClient){
+    yashdPause(server, client, 0);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Parse and start one request. With client fds the pipeline writes to
+ *   them directly; otherwise its output is piped back through the server.
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Client that sent the request
+ *   id           (uint32_t): Request id
+ *   line            (char*): Command line
+ *   fds              (int*): fds passed with SCM_RIGHTS
+ *   numFds            (int): Number of fds passed
+ *
+ * Returns:
+ *   None
+ */
+void yashdStart(YashdServer_t* server, YashdClient_t* client, uint32_t id,
+                char* line, int* fds, int numFds){
+  const int INVALID = -1;
+
+  YashdReq_t* req = (YashdReq_t*)calloc(1, sizeof(YashdReq_t));
+  int outPipe[2] = {INVALID, INVALID};
+  int errPipe[2] = {INVALID, INVALID};
+  int err = 0;
+  int index;
+
+  req->id = id;
+  req->client = client;
+  req->outFd = INVALID;
+  req->errFd = INVALID;
+
+  if((req->pipeline = yashParse(line)) == NULL){
+    err = EINVAL;
+  }
+  else if(numFds >= 2){
+    req->run = yashStartFds(req->pipeline, numFds > 2 ? fds[2] : INVALID,
+                            fds[0], fds[1]);
+  }
+  else if(pipe2(outPipe, O_CLOEXEC) == 0 && pipe2(errPipe, O_CLOEXEC) == 0){
+    req->run = yashStartFds(req->pipeline, INVALID, outPipe[1], errPipe[1]);
+    close(outPipe[1]);
+    close(errPipe[1]);
+    req->outFd = outPipe[0];
+    req->errFd = errPipe[0];
+  }
+  else{
+    err = errno;
+    if(outPipe[0] != INVALID){
+      close(outPipe[0]);
+      close(outPipe[1]);
+    }
+  }
+  if(!err && req->run == NULL){
+    err = errno;
+  }
+
+  // The children hold their own copies of passed fds
+  for(index = 0; index < numFds; index++){
+    close(fds[index]);
+  }
+
+  if(err){
+    if(req->outFd != INVALID){
+      close(req->outFd);
+      close(req->errFd);
+    }
+    yashFreePipeline(req->pipeline);
+    free(req);
+    yashdSend(server, client, id, YASHD_ERROR, err, NULL, 0);
+    return;
+  }
+
+  req->outWatch = (YashdWatch_t){WATCH_OUT, client, req};
+  req->errWatch = (YashdWatch_t){WATCH_ERR, client, req};
+  req->doneWatch = (YashdWatch_t){WATCH_DONE, client, req};
+  if(req->outFd != INVALID && !client->throttled){
+    yashdWatch(server, req->outFd, &req->outWatch);
+    yashdWatch(server, req->errFd, &req->errWatch);
+  }
+  yashdWatch(server, yashRunFd(req->run), &req->doneWatch);
+
+  req->next = client->reqs;
+  client->reqs = req;
+  client->active++;
+  if(client->active >= server->maxPerClient){
+    yashdPause(server, client, 1);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Read requests from a client until it would block or reaches its
+ *   concurrency limit. On disconnect its running pipelines are terminated.
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   client (YashdClient_t*): Readable client
+ *
+ * Returns:
+ *   None
+ */
+void yashdRead(YashdServer_t* server, YashdClient_t* client){
+  char buf[YASHD_MAX_MSG + 1];
+  char ctrl[CMSG_SPACE(YASHD_MAX_FDS * sizeof(int))];
+  int fds[YASHD_MAX_FDS];
+  int numFds;
+  ssize_t nread;
+  YashdMsg_t hdr;
+  YashdReq_t* req = NULL;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg = NULL;
+
+  while(client->active < server->maxPerClient){
+    iov.iov_base = buf;
+    iov.iov_len = YASHD_MAX_MSG;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    nread = recvmsg(client->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if(nread < 0 && (errno == EAGAIN || errno == EINTR)){
+      return;
+    }
+
+    numFds = 0;
+    for(cmsg = CMSG_FIRSTHDR(&msg); nread >= 0 && cmsg != NULL;
+        cmsg = CMSG_NXTHDR(&msg, cmsg)){
+      if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+        numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), numFds * sizeof(int));
+      }
+    }
+
+    if(nread <= 0){
+      // Client went away; stop its work and free it once reaped
+      if(client->events != 0)
+        epoll_ctl(server->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+      client->events = 0;
+      client->closing = 1;
+      for(req = client->reqs; req != NULL; req = req->next){
+        yashKill(req->run, SIGTERM);
+      }
+      if(client->active == 0){
+        yashdFreeClient(client);
+      }
+      return;
+    }
+
+    if(nread < (ssize_t)sizeof(hdr)){
+      while(numFds > 0)
+        close(fds[--numFds]);
+      continue;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    buf[nread] = '\0';
+    if(hdr.type != YASHD_REQ || (msg.msg_flags & MSG_TRUNC)){
+      // A longer request was cut to fit; running what is left of it could
+      // do something else entirely
+      while(numFds > 0)
+        close(fds[--numFds]);
+      yashdSend(server, client, hdr.id, YASHD_ERROR,
+                (msg.msg_flags & MSG_TRUNC) ? EMSGSIZE : EPROTO, NULL, 0);
+      continue;
+    }
+    yashdStart(server, client, hdr.id, buf + sizeof(hdr), fds, numFds);
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Forward available output of a request to its client
+ *
+ * Args:
+ *   server (YashdServer_t*): Server state
+ *   watch   (YashdWatch_t*): Watch of the readable output pipe
+ *
+ * Returns:
+ *   None
+ */
+void yashdForward(YashdServer_t* server, YashdWatch_t* watch){
+  char buf[YASHD_MAX_MSG - sizeof(YashdMsg_t)];
+  YashdReq_t* req = watch->req;
+  int* fd = (watch->kind == WATCH_OUT) ? &req->outFd : &req->errFd;
+  int type = (watch->kind == WATCH_OUT) ? YASHD_STDOUT : YASHD_STDERR;
+  ssize_t nread;
+
+  nread = read(*fd, buf, sizeof(buf));
+  if(nread < 0 && (errno == EAGAIN || errno == EINTR)){
+    return;
+  }
+  if(nread > 0){
+    yashdSend(server, req->client, req->id, type, 0, buf, nread);
+    return;
+  }
+
+  epoll_ctl(server->epfd, EPOLL_CTL_DEL, *fd, NULL);
+  close(*fd);
+  *fd = -1;
+  yashdFinish(server, req);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Run the command server on a Unix domain socket until a fatal error
+ *
+ * Args:
+ *   path   (const char*): Socket path, replaced if it exists
+ *   maxPerClient   (int): Requests each client may have in flight
+ *
+ * Returns:
+ *   (int): -1 on failure; does not return otherwise
+ */
+int yashdServe(const char* path, int maxPerClient){
+  const int INVALID = -1;
+  const int BACKLOG = 128;
+
+  YashdServer_t server;
+  YashdClient_t* client = NULL;
+  YashdWatch_t* watch = NULL;
+  struct epoll_event events[YASHD_MAX_EVENTS];
+  struct sockaddr_un addr;
+  uint64_t count;
+  int numEvents;
+  int fd;
+  int index;
+
+  if(strlen(path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "yashd: %s: path too long\n", path);
+    return INVALID;
+  }
+
+  memset(&server, 0, sizeof(server));
+  server.maxPerClient = maxPerClient;
+  server.listenWatch.kind = WATCH_LISTEN;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if((server.listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC,
+                               0)) == INVALID ||
+     bind(server.listenFd, (struct sockaddr*)&addr, sizeof(addr)) == INVALID ||
+     chmod(path, S_IRUSR | S_IWUSR) == INVALID ||
+     listen(server.listenFd, BACKLOG) == INVALID ||
+     (server.epfd = epoll_create1(EPOLL_CLOEXEC)) == INVALID ||
+     yashdWatch(&server, server.listenFd, &server.listenWatch) == INVALID){
+    perror("yashd");
+    return INVALID;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  while(1){
+    numEvents = epoll_wait(server.epfd, events, YASHD_MAX_EVENTS, -1);
+    if(numEvents < 0 && errno == EINTR){
+      continue;
+    }
+    else if(numEvents < 0){
+      perror("yashd: epoll_wait");
+      return INVALID;
+    }
+
+    for(index = 0; index < numEvents; index++){
+      watch = (YashdWatch_t*)events[index].data.ptr;
+      if(watch->kind == WATCH_LISTEN){
+        if((fd = accept4(server.listenFd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0){
+          continue;
+        }
+        client = (YashdClient_t*)calloc(1, sizeof(YashdClient_t));
+        client->fd = fd;
+        client->watch.kind = WATCH_CLIENT;
+        client->watch.client = client;
+        yashdUpdate(&server, client);
+      }
+      else if(watch->kind == WATCH_CLIENT){
+        // Flushed first, since a read that finds the client gone frees it
+        client = watch->client;
+        if(events[index].events & EPOLLOUT){
+          yashdFlush(&server, client);
+        }
+        if((events[index].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+           !client->paused){
+          yashdRead(&server, client);
+        }
+      }
+      else if(watch->kind == WATCH_OUT || watch->kind == WATCH_ERR){
+        yashdForward(&server, watch);
+      }
+      else if(watch->kind == WATCH_DONE){
+        read(yashRunFd(watch->req->run), &count, sizeof(count));
+        watch->req->done = 1;
+        yashdFinish(&server, watch->req);
+      }
+    }
+  }
+
+  return INVALID;
+}
@@ -0,0 +1,46 @@
+#ifndef YASHD_H
+#define YASHD_H
+
+#include <stdint.h>
+
+// yashd: command server mode of yash. Clients connect to an AF_UNIX
+// SOCK_SEQPACKET socket, so every send is one message and needs no framing.
+//
+// Request:  YashdMsg_t{id, YASHD_REQ, 0} followed by the command line. The
+//           client may attach stdout and stderr (and optionally stdin) with
+//           SCM_RIGHTS, in which case output goes straight to those fds.
+// Replies:  YASHD_STDOUT / YASHD_STDERR messages carrying output when no fds
+//           were attached, then exactly one YASHD_EXIT with the wait status
+//           or YASHD_ERROR with an errno value. A request longer than
+//           YASHD_MAX_MSG is refused with YASHD_ERROR EMSGSIZE.
+//
+// Replies a client is not reading yet are queued in the server; once a
+// client's queue is full, its pipelines' output is left in their pipes
+// until it reads, so one slow client does not hold up the others.
+
+#define YASHD_MAX_MSG 4096
+#define YASHD_DEFAULT_LIMIT 8
+
+/**
+ * Message kinds
+ */
+enum{
+  YASHD_REQ = 1,
+  YASHD_STDOUT,
+  YASHD_STDERR,
+  YASHD_EXIT,
+  YASHD_ERROR
+};
+
+/**
+ * YashdMsg_t struct, header of every message on the socket
+ */
+typedef struct YashdMsg_t{
+  uint32_t id;
+  uint32_t type;
+  int32_t status;
+}YashdMsg_t;
+
+int yashdServe(const char* path, int maxPerClient);
+
+#endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "yashd.h"
+
+// Load-test client for yashd. Keeps CONCURRENCY requests in flight on one
+// connection until REQUESTS have completed, then prints throughput and
+// latency percentiles. With -f the client's /dev/null is passed for
+// stdout/stderr via SCM_RIGHTS instead of streaming output back.
+//
+//   yashd_load [-f] SOCKET REQUESTS CONCURRENCY COMMAND
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   qsort comparator for latencies
+ */
+int compareDouble(const void* a, const void* b){
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Purpose:
+ *   Send one request, optionally with stdout/stderr fds attached
+ *
+ * Args:
+ *   sock  (int): Connected socket
+ *   id    (int): Request id
+ *   line (char*): Command line
+ *   nullFd (int): fd to pass for stdout and stderr, -1 for none
+ *
+ * Returns:
+ *   (int): Result of sendmsg
+ */
+int sendRequest(int sock, int id, char* line, int nullFd){
+  YashdMsg_t hdr = {id, YASHD_REQ, 0};
+  char ctrl[CMSG_SPACE(2 * sizeof(int))];
+  int fds[2] = {nullFd, nullFd};
+  struct iovec iov[2];
+  struct msghdr msg;
+  struct cmsghdr* cmsg = NULL;
+
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = line;
+  iov[1].iov_len = strlen(line);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  if(nullFd >= 0){
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  }
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+int main(int argc, char** argv){
+  const char* USAGE =
+    "usage: yashd_load [-f] SOCKET REQUESTS CONCURRENCY COMMAND\n";
+
+  char buf[YASHD_MAX_MSG];
+  YashdMsg_t hdr;
+  struct sockaddr_un addr;
+  double* start = NULL;
+  double* latency = NULL;
+  double begin;
+  double elapsed;
+  long outBytes = 0;
+  int passFds = 0;
+  int nullFd = -1;
+  int total;
+  int conc;
+  int sent = 0;
+  int done = 0;
+  int failed = 0;
+  int sock;
+  ssize_t nread;
+
+  if(argc > 1 && !strcmp(argv[1], "-f")){
+    passFds = 1;
+    argv++;
+    argc--;
+  }
+  if(argc != 5 || (total = atoi(argv[2])) < 1 || (conc = atoi(argv[3])) < 1){
+    fprintf(stderr, "%s", USAGE);
+    return EXIT_FAILURE;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+  if((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0 ||
+     connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  if(passFds){
+    nullFd = open("/dev/null", O_WRONLY);
+  }
+
+  start = (double*)calloc(total, sizeof(double));
+  latency = (double*)calloc(total, sizeof(double));
+  begin = nowSec();
+
+  while(done < total){
+    while(sent < total && sent - done < conc){
+      start[sent] = nowSec();
+      if(sendRequest(sock, sent, argv[4], nullFd) < 0){
+        perror("sendmsg");
+        return EXIT_FAILURE;
+      }
+      sent++;
+    }
+
+    if((nread = recv(sock, buf, sizeof(buf), 0)) <= 0){
+      fprintf(stderr, "yashd_load: connection closed\n");
+      return EXIT_FAILURE;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if(hdr.type == YASHD_STDOUT || hdr.type == YASHD_STDERR){
+      outBytes += nread - sizeof(hdr);
+    }
+    else if(hdr.type == YASHD_EXIT || hdr.type == YASHD_ERROR){
+      latency[done++] = nowSec() - start[hdr.id];
+      if(hdr.type == YASHD_ERROR ||
+         !WIFEXITED(hdr.status) || WEXITSTATUS(hdr.status) != 0){
+        failed++;
+      }
+    }
+  }
+
+  elapsed = nowSec() - begin;
+  qsort(latency, total, sizeof(double), compareDouble);
+  printf("requests %d  failed %d  output %ld bytes\n", total, failed,
+         outBytes);
+  printf("%.1f req/s  p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+         total / elapsed, latency[total / 2] * 1e3,
+         latency[(int)(total * 0.99)] * 1e3, latency[total - 1] * 1e3);
+
+  free(start);
+  free(latency);
+  close(sock);
+
+  return failed ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "yash_plugin.h"
+
+// Example plugin with two builtins:
+//
+//   jget KEY     print the top-level KEY of each JSON object line on stdin
+//   fnv [str...] print the 64-bit FNV-1a hash of each string, or of stdin
+//
+// Build and load it with
+//
+//   gcc -Wall -O2 -shared -fPIC -o yashext.so yashext.c
+//   enable -f ./yashext.so jget fnv
+//
+// Built with -DYASH_PLUGIN_MAIN it is a standalone program instead, which
+// plugin_bench runs with fork+exec to compare against the builtin.
+
+#define EXT_BUF_SIZE (64 * 1024)
+
+/**
+ * ExtOut_t struct, buffered output of one builtin call
+ */
+typedef struct ExtOut_t{
+  int fd;
+  char* buf;
+  size_t len;
+}ExtOut_t;
+
+/**
+ * Purpose:
+ *   Write all of a buffer to an fd
+ *
+ * Args:
+ *   fd        (int): Destination
+ *   buf (const char*): Bytes to write
+ *   len    (size_t): Number of bytes
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on a write error
+ */
+static int extWriteAll(int fd, const char* buf, size_t len){
+  ssize_t ret;
+
+  while(len > 0){
+    if((ret = write(fd, buf, len)) < 0){
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Append bytes to the output buffer, flushing it when full
+ *
+ * Args:
+ *   out (ExtOut_t*): Output buffer
+ *   buf (const char*): Bytes to append
+ *   len    (size_t): Number of bytes
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on a write error
+ */
+static int extPut(ExtOut_t* out, const char* buf, size_t len){
+  if(out->len + len > EXT_BUF_SIZE){
+    if(extWriteAll(out->fd, out->buf, out->len) < 0){
+      return -1;
+    }
+    out->len = 0;
+    if(len > EXT_BUF_SIZE){
+      return extWriteAll(out->fd, buf, len);
+    }
+  }
+  memcpy(out->buf + out->len, buf, len);
+  out->len += len;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Skip a JSON string starting at its opening quote
+ *
+ * Args:
+ *   pos (const char*): Opening quote
+ *   end (const char*): End of the line
+ *
+ * Returns:
+ *   (const char*): Closing quote, or end if unterminated
+ */
+static const char* extSkipString(const char* pos, const char* end){
+  for(pos++; pos < end && *pos != '"'; pos++){
+    if(*pos == '\\'){
+      pos++;
+    }
+  }
+
+  return pos < end ? pos : end;
+}
+
+/**
+ * Purpose:
+ *   Find the value of a top-level key in one JSON object
+ *
+ * Args:
+ *   line (const char*): Start of the line
+ *   end  (const char*): End of the line
+ *   key  (const char*): Key to find
+ *   val (const char**): Set to the start of the value
+ *   valLen   (size_t*): Set to the length of the value; strings lose
+ *                       their quotes but keep escapes
+ *
+ * Returns:
+ *   (int): 1 if found, 0 if not
+ */
+static int extFindKey(const char* line, const char* end, const char* key,
+                      const char** val, size_t* valLen){
+  const size_t keyLen = strlen(key);
+
+  const char* pos = line;
+  const char* close = NULL;
+  int depth = 0;
+  int isKey;
+
+  while(pos < end){
+    if(*pos == '"'){
+      close = extSkipString(pos, end);
+      isKey = (depth == 1 && (size_t)(close - pos - 1) == keyLen &&
+               !memcmp(pos + 1, key, keyLen));
+      pos = close + 1;
+      while(pos < end && (*pos == ' ' || *pos == '\t')){
+        pos++;
+      }
+      if(!isKey || pos >= end || *pos != ':'){
+        continue;
+      }
+
+      for(pos++; pos < end && (*pos == ' ' || *pos == '\t'); pos++);
+      if(pos < end && *pos == '"'){
+        close = extSkipString(pos, end);
+        *val = pos + 1;
+        *valLen = close - pos - 1;
+        return 1;
+      }
+      *val = pos;
+      depth = 0;
+      while(pos < end){
+        if(*pos == '"'){
+          pos = extSkipString(pos, end);
+        }
+        else if(*pos == '{' || *pos == '['){
+          depth++;
+        }
+        else if(*pos == '}' || *pos == ']' || *pos == ','){
+          if(depth == 0){
+            break;
+          }
+          if(*pos != ','){
+            depth--;
+          }
+        }
+        pos++;
+      }
+      while(pos > *val && (pos[-1] == ' ' || pos[-1] == '\t')){
+        pos--;
+      }
+      *valLen = pos - *val;
+      return 1;
+    }
+    if(*pos == '{' || *pos == '['){
+      depth++;
+    }
+    else if(*pos == '}' || *pos == ']'){
+      depth--;
+    }
+    pos++;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   jget builtin
+ *
+ * Args:
+ *   ctx (YashBuiltinCtx_t*): Context from the shell
+ *   argc              (int): Argument count
+ *   argv           (char**): Arguments
+ *
+ * Returns:
+ *   (int): 0 if any line had the key, 1 if none did, 2 on error
+ */
+static int extJget(YashBuiltinCtx_t* ctx, int argc, char** argv){
+  const char* USAGE = "usage: jget KEY\n";
+
+  ExtOut_t out;
+  char* in = NULL;
+  char* lineStart = NULL;
+  char* nl = NULL;
+  const char* val = NULL;
+  size_t valLen;
+  size_t have = 0;
+  ssize_t ret;
+  int found = 0;
+  int err = 0;
+
+  if(argc != 2){
+    extWriteAll(ctx->errFd, USAGE, strlen(USAGE));
+    return 2;
+  }
+
+  out.fd = ctx->outFd;
+  out.len = 0;
+  out.buf = (char*)ctx->alloc(EXT_BUF_SIZE);
+  in = (char*)ctx->alloc(EXT_BUF_SIZE);
+  if(out.buf == NULL || in == NULL){
+    ctx->free(out.buf);
+    ctx->free(in);
+    return 2;
+  }
+
+  // Lines longer than the buffer are split
+  while(!err){
+    ret = read(ctx->inFd, in + have, EXT_BUF_SIZE - have);
+    if(ret <= 0){
+      if(ret < 0){
+        err = 1;
+      }
+      if(have == 0){
+        break;
+      }
+      in[have] = '\n';
+      have++;
+    }
+    else{
+      have += ret;
+    }
+
+    lineStart = in;
+    while((nl = memchr(lineStart, '\n', have - (lineStart - in))) != NULL ||
+          (lineStart == in && have == EXT_BUF_SIZE)){
+      if(nl == NULL){
+        nl = in + have;
+      }
+      if(extFindKey(lineStart, nl, argv[1], &val, &valLen)){
+        found = 1;
+        if(extPut(&out, val, valLen) < 0 || extPut(&out, "\n", 1) < 0){
+          err = 1;
+          break;
+        }
+      }
+      lineStart = (nl < in + have) ? nl + 1 : nl;
+    }
+    have -= lineStart - in;
+    memmove(in, lineStart, have);
+    if(ret <= 0){
+      break;
+    }
+  }
+
+  if(!err && extWriteAll(out.fd, out.buf, out.len) < 0){
+    err = 1;
+  }
+  ctx->free(out.buf);
+  ctx->free(in);
+
+  return err ? 2 : !found;
+}
+
+/**
+ * Purpose:
+ *   Add bytes to a 64-bit FNV-1a hash
+ *
+ * Args:
+ *   hash (uint64_t): Hash so far
+ *   buf (const char*): Bytes
+ *   len    (size_t): Number of bytes
+ *
+ * Returns:
+ *   (uint64_t): New hash
+ */
+static uint64_t extFnv(uint64_t hash, const char* buf, size_t len){
+  const uint64_t PRIME = 0x100000001b3ULL;
+
+  size_t index;
+
+  for(index = 0; index < len; index++){
+    hash = (hash ^ (unsigned char)buf[index]) * PRIME;
+  }
+
+  return hash;
+}
+
+/**
+ * Purpose:
+ *   fnv builtin
+ *
+ * Args:
+ *   ctx (YashBuiltinCtx_t*): Context from the shell
+ *   argc              (int): Argument count
+ *   argv           (char**): Arguments
+ *
+ * Returns:
+ *   (int): 0 on success, 1 on error
+ */
+static int extFnvBuiltin(YashBuiltinCtx_t* ctx, int argc, char** argv){
+  const uint64_t OFFSET = 0xcbf29ce484222325ULL;
+
+  char line[32];
+  char* in = NULL;
+  uint64_t hash;
+  ssize_t ret;
+  int len;
+  int index;
+
+  if(argc > 1){
+    for(index = 1; index < argc; index++){
+      hash = extFnv(OFFSET, argv[index], strlen(argv[index]));
+      len = snprintf(line, sizeof(line), "%016llx\n",
+                     (unsigned long long)hash);
+      if(extWriteAll(ctx->outFd, line, len) < 0){
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  if((in = (char*)ctx->alloc(EXT_BUF_SIZE)) == NULL){
+    return 1;
+  }
+  hash = OFFSET;
+  while((ret = read(ctx->inFd, in, EXT_BUF_SIZE)) > 0){
+    hash = extFnv(hash, in, ret);
+  }
+  ctx->free(in);
+  if(ret < 0){
+    return 1;
+  }
+  len = snprintf(line, sizeof(line), "%016llx\n", (unsigned long long)hash);
+
+  return extWriteAll(ctx->outFd, line, len) < 0;
+}
+
+/**
+ * Purpose:
+ *   Plugin entry point
+ *
+ * Args:
+ *   host (YashPluginHost_t*): Host from the shell
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the host is too old
+ */
+int yashPluginInit(YashPluginHost_t* host){
+  if(host->abi < 1){
+    return -1;
+  }
+  host->registerBuiltin(host, "jget", extJget);
+  host->registerBuiltin(host, "fnv", extFnvBuiltin);
+
+  return 0;
+}
+
+#ifdef YASH_PLUGIN_MAIN
+#include <stdlib.h>
+
+/**
+ * Purpose:
+ *   Standalone entry: run the builtin named by argv[0] or argv[1]
+ *
+ * Args:
+ *   argc   (int): Argument count
+ *   argv (char**): jget KEY, fnv [str...], or yashext NAME args...
+ *
+ * Returns:
+ *   (int): Exit status of the builtin
+ */
+int main(int argc, char** argv){
+  YashBuiltinCtx_t ctx = {YASH_PLUGIN_ABI, STDIN_FILENO, STDOUT_FILENO,
+                          STDERR_FILENO, malloc, free};
+  const char* name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1
+                                           : argv[0];
+
+  if(strcmp(name, "jget") && strcmp(name, "fnv")){
+    if(argc < 2){
+      fprintf(stderr, "usage: %s jget|fnv args...\n", name);
+      return 2;
+    }
+    argc--;
+    argv++;
+    name = argv[0];
+  }
+
+  return strcmp(name, "jget") ? extFnvBuiltin(&ctx, argc, argv)
+                              : extJget(&ctx, argc, argv);
+}
+#endif
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "board.h"
+
+// Reader for the job status boards of running shells (set -o board).
+//
+//   gcc -Wall -O2 -o yashjobs yashjobs.c board.c libyash.c
+//   yashjobs [-w SECS] [BOARD...]
+//
+// Without arguments every board in $XDG_RUNTIME_DIR/yash is shown. -w
+// prints again every SECS seconds, reusing the mappings.
+
+#define JOBS_MAX_BOARDS 256
+
+/**
+ * Purpose:
+ *   Print one board
+ *
+ * Args:
+ *   file (const YashBoardFile_t*): Mapped board
+ *
+ * Returns:
+ *   None
+ */
+void printBoard(const YashBoardFile_t* file){
+  const char* STATES[] = {"Running", "Stopped", "Done"};
+
+  YashBoardFile_t* copy = (YashBoardFile_t*)malloc(sizeof(YashBoardFile_t));
+  const YashBoardJob_t* job = NULL;
+  struct timespec now;
+  struct tm start;
+  time_t startSec;
+  char when[16];
+  int numJobs;
+  int index;
+
+  if((numJobs = boardSnapshot(file, copy)) < 0){
+    printf("shell %d: busy\n", file->shellPid);
+    free(copy);
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  printf("shell %d%s, %d job%s, updated %.1fs ago\n", copy->shellPid,
+         kill(copy->shellPid, 0) < 0 && errno == ESRCH ? " (gone)" : "",
+         numJobs, numJobs == 1 ? "" : "s",
+         ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec - copy->updatedNs) /
+         1e9);
+  for(index = numJobs - 1; index >= 0; index--){
+    job = &copy->jobs[index];
+    startSec = job->startNs / 1000000000;
+    localtime_r(&startSec, &start);
+    strftime(when, sizeof(when), "%H:%M:%S", &start);
+    printf("  [%d] %-7d %-7s %s %8.2fs  %.*s\n", job->jobId, job->pgid,
+           job->state >= 0 && job->state <= BOARD_DONE ? STATES[job->state] :
+           "?", when, job->cpuNs / 1e9, BOARD_CMD_LEN, job->cmd);
+  }
+  free(copy);
+
+  return;
+}
+
+int main(int argc, char** argv){
+  const char* USAGE = "usage: yashjobs [-w secs] [board...]\n";
+
+  const YashBoardFile_t* files[JOBS_MAX_BOARDS];
+  char dir[PATH_MAX];
+  char path[PATH_MAX + NAME_MAX + 2];
+  struct dirent* entry = NULL;
+  DIR* dirp = NULL;
+  double every = 0;
+  int numFiles = 0;
+  int opt;
+  int index;
+
+  while((opt = getopt(argc, argv, "w:")) != -1){
+    if(opt == 'w' && (every = atof(optarg)) > 0){
+      continue;
+    }
+    fprintf(stderr, "%s", USAGE);
+    return 1;
+  }
+
+  if(optind < argc){
+    for(index = optind; index < argc && numFiles < JOBS_MAX_BOARDS; index++){
+      if((files[numFiles] = boardMap(argv[index])) == NULL){
+        fprintf(stderr, "yashjobs: %s: not a board\n", argv[index]);
+        continue;
+      }
+      numFiles++;
+    }
+  }
+  else if((dirp = opendir(boardDir(dir, sizeof(dir)))) != NULL){
+    while((entry = readdir(dirp)) != NULL && numFiles < JOBS_MAX_BOARDS){
+      if(strncmp(entry->d_name, "jobs.", 5)){
+        continue;
+      }
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      if((files[numFiles] = boardMap(path)) != NULL){
+        numFiles++;
+      }
+    }
+    closedir(dirp);
+  }
+  if(numFiles == 0){
+    fprintf(stderr, "yashjobs: no boards\n");
+    return 1;
+  }
+
+  do{
+    for(index = 0; index < numFiles; index++){
+      printBoard(files[index]);
+    }
+    if(every > 0){
+      fflush(stdout);
+      usleep((useconds_t)(every * 1e6));
+      printf("\n");
+    }
+  }while(every > 0);
+
+  for(index = 0; index < numFiles; index++){
+    boardUnmap(files[index]);
+  }
+
+  return 0;
+}
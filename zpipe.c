@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "zpipe.h"
+
+/**
+ * ZpipeStream_t struct, what one codec thread works on. Owned and freed
+ * by the thread.
+ */
+typedef struct ZpipeStream_t{
+  int pipeFd;
+  int fileFd;
+  int compress;
+  int level;
+}ZpipeStream_t;
+
+/**
+ * YashZpipe_t struct, a started codec thread the shell may wait for
+ */
+struct YashZpipe_t{
+  pthread_t thread;
+
+  struct YashZpipe_t* next;
+};
+
+/**
+ * Purpose:
+ *   Write all of a buffer, resuming after short writes
+ *
+ * Args:
+ *   fd     (int): Destination fd
+ *   buf (Bytef*): Data
+ *   len (size_t): Bytes to write
+ *
+ * Returns:
+ *   (int): 0 on success, -1 on failure
+ */
+int zpipeWriteAll(int fd, Bytef* buf, size_t len){
+  ssize_t ret;
+
+  while(len > 0){
+    if((ret = write(fd, buf, len)) < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Compress everything read from the pipe into the file as one gzip
+ *   member
+ *
+ * Args:
+ *   stream (ZpipeStream_t*): Stream
+ *   in             (Bytef*): Input buffer of ZPIPE_BUF bytes
+ *   out            (Bytef*): Output buffer of ZPIPE_BUF bytes
+ *
+ * Returns:
+ *   None
+ */
+void zpipeDeflate(ZpipeStream_t* stream, Bytef* in, Bytef* out){
+  const int GZIP_WINDOW = 15 + 16;
+  const int MEM_LEVEL = 8;
+
+  z_stream z;
+  ssize_t len;
+  int flush;
+
+  memset(&z, 0, sizeof(z));
+  if(deflateInit2(&z, stream->level, Z_DEFLATED, GZIP_WINDOW, MEM_LEVEL,
+                  Z_DEFAULT_STRATEGY) != Z_OK){
+    fprintf(stderr, "yash: >z: %s\n", z.msg != NULL ? z.msg : "zlib init");
+    return;
+  }
+
+  do{
+    if((len = read(stream->pipeFd, in, ZPIPE_BUF)) < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      len = 0;
+    }
+    flush = (len == 0) ? Z_FINISH : Z_NO_FLUSH;
+    z.next_in = in;
+    z.avail_in = len;
+    do{
+      z.next_out = out;
+      z.avail_out = ZPIPE_BUF;
+      deflate(&z, flush);
+      if(zpipeWriteAll(stream->fileFd, out, ZPIPE_BUF - z.avail_out) < 0){
+        fprintf(stderr, "yash: >z: %s\n", strerror(errno));
+        flush = Z_FINISH;
+        break;
+      }
+    }while(z.avail_out == 0);
+  }while(flush != Z_FINISH);
+
+  deflateEnd(&z);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Decompress the file into the pipe. Concatenated gzip members (from
+ *   >>z) are read one after another; zlib streams are accepted too.
+ *
+ * Args:
+ *   stream (ZpipeStream_t*): Stream
+ *   in             (Bytef*): Input buffer of ZPIPE_BUF bytes
+ *   out            (Bytef*): Output buffer of ZPIPE_BUF bytes
+ *
+ * Returns:
+ *   None
+ */
+void zpipeInflate(ZpipeStream_t* stream, Bytef* in, Bytef* out){
+  const int AUTO_WINDOW = 15 + 32;
+
+  z_stream z;
+  ssize_t len;
+  int ended = 1;
+  int ret;
+
+  memset(&z, 0, sizeof(z));
+  if(inflateInit2(&z, AUTO_WINDOW) != Z_OK){
+    fprintf(stderr, "yash: <z: %s\n", z.msg != NULL ? z.msg : "zlib init");
+    return;
+  }
+
+  for(;;){
+    if((len = read(stream->fileFd, in, ZPIPE_BUF)) < 0 && errno == EINTR){
+      continue;
+    }
+    if(len <= 0){
+      if(!ended){
+        fprintf(stderr, "yash: <z: unexpected end of file\n");
+      }
+      break;
+    }
+    z.next_in = in;
+    z.avail_in = len;
+    do{
+      z.next_out = out;
+      z.avail_out = ZPIPE_BUF;
+      ret = inflate(&z, Z_NO_FLUSH);
+      if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR){
+        fprintf(stderr, "yash: <z: %s\n",
+                z.msg != NULL ? z.msg : "not in gzip format");
+        inflateEnd(&z);
+        return;
+      }
+      ended = (ret == Z_STREAM_END);
+      if(ended){
+        inflateReset(&z);
+      }
+      if(zpipeWriteAll(stream->pipeFd, out, ZPIPE_BUF - z.avail_out) < 0){
+        // The command stopped reading
+        inflateEnd(&z);
+        return;
+      }
+    }while(z.avail_in > 0 || z.avail_out == 0);
+  }
+
+  inflateEnd(&z);
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Thread body: run one stream's codec, then close its fds
+ *
+ * Args:
+ *   arg (void*): The ZpipeStream_t
+ *
+ * Returns:
+ *   (void*): NULL
+ */
+void* zpipeRun(void* arg){
+  ZpipeStream_t* stream = (ZpipeStream_t*)arg;
+  Bytef* in = (Bytef*)malloc(ZPIPE_BUF);
+  Bytef* out = (Bytef*)malloc(ZPIPE_BUF);
+
+  if(stream->compress){
+    zpipeDeflate(stream, in, out);
+  }
+  else{
+    zpipeInflate(stream, in, out);
+  }
+
+  // Closing the pipe passes EOF or SIGPIPE on to the command
+  close(stream->pipeFd);
+  close(stream->fileFd);
+  free(in);
+  free(out);
+  free(stream);
+
+  return NULL;
+}
+
+/**
+ * Purpose:
+ *   Start a codec thread between a new pipe and a file. The thread owns
+ *   the file and closes it when done.
+ *
+ * Args:
+ *   fileFd              (int): File to compress into or decompress from
+ *   compress            (int): 1 to compress, 0 to decompress
+ *   level               (int): zlib level when compressing
+ *   streams (YashZpipe_t**): Started thread is added here, for
+ *                            zpipeFinish; NULL to detach it
+ *
+ * Returns:
+ *   (int): Close-on-exec pipe end for the command (the write end when
+ *          compressing), -1 with errno set on failure
+ */
+int zpipeStart(int fileFd, int compress, int level, YashZpipe_t** streams){
+  ZpipeStream_t* stream = (ZpipeStream_t*)malloc(sizeof(ZpipeStream_t));
+  YashZpipe_t* node = (YashZpipe_t*)malloc(sizeof(YashZpipe_t));
+  sigset_t allSigs;
+  sigset_t oldMask;
+  int pfd[2];
+  int err;
+
+  if(pipe2(pfd, O_CLOEXEC) < 0){
+    free(stream);
+    free(node);
+    return -1;
+  }
+  stream->pipeFd = compress ? pfd[0] : pfd[1];
+  stream->fileFd = fileFd;
+  stream->compress = compress;
+  stream->level = level;
+
+  // Signals are for the shell's thread only; SIGPIPE stays pending here
+  sigfillset(&allSigs);
+  pthread_sigmask(SIG_BLOCK, &allSigs, &oldMask);
+  err = pthread_create(&node->thread, NULL, zpipeRun, stream);
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  if(err){
+    close(pfd[0]);
+    close(pfd[1]);
+    free(stream);
+    free(node);
+    errno = err;
+    return -1;
+  }
+
+  if(streams != NULL){
+    node->next = *streams;
+    *streams = node;
+  }
+  else{
+    pthread_detach(node->thread);
+    free(node);
+  }
+
+  return compress ? pfd[1] : pfd[0];
+}
+
+/**
+ * Purpose:
+ *   Open the file of every compressed redirection and replace the
+ *   redirection with a dup of a codec pipe. Like openRedirs, the new op
+ *   keeps its path so closeRedirs closes the shell's copy once the child
+ *   has it; it also keeps its codec, so a spawn path that undoes the dup
+ *   refuses the op rather than writing the file uncompressed.
+ *
+ * Args:
+ *   redirs   (RedirList_t*): List of fd operations from parseRedirs
+ *   streams (YashZpipe_t**): Started threads are added here
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if a file could not be opened or a thread not
+ *          started (a message is printed)
+ */
+int zpipeRedirs(RedirList_t* redirs, YashZpipe_t** streams){
+  const mode_t MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+  int index;
+  int fd;
+  int compress;
+  RedirOp_t* op = NULL;
+
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    if(op->type != REDIR_OPEN || op->codec != REDIR_GZIP){
+      continue;
+    }
+    if((fd = open(op->path, op->flags | O_CLOEXEC, MODE)) < 0){
+      perror(op->path);
+      return -1;
+    }
+    compress = ((op->flags & O_ACCMODE) == O_WRONLY);
+    if((op->srcFd = zpipeStart(fd, compress, ZPIPE_LEVEL, streams)) < 0){
+      fprintf(stderr, "yash: %s: %s\n", op->path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    op->type = REDIR_DUP;
+  }
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Wait for or let go of codec threads, and free their handles
+ *
+ * Args:
+ *   streams (YashZpipe_t*): Threads from zpipeRedirs, may be NULL
+ *   wait             (int): 1 to wait until each has finished its file,
+ *                           0 to detach them (background jobs)
+ *
+ * Returns:
+ *   None
+ */
+void zpipeFinish(YashZpipe_t* streams, int wait){
+  YashZpipe_t* next = NULL;
+
+  while(streams != NULL){
+    next = streams->next;
+    if(wait){
+      pthread_join(streams->thread, NULL);
+    }
+    else{
+      pthread_detach(streams->thread);
+    }
+    free(streams);
+    streams = next;
+  }
+
+  return;
+}
@@ -0,0 +1,22 @@
+#ifndef ZPIPE_H
+#define ZPIPE_H
+
+#include "libyash_internal.h"
+
+// Compressed redirections. "cmd >z out.gz", ">>z" and "cmd <z in.gz" are
+// handled by the shell: the command gets one end of a pipe, and a shell
+// thread runs zlib between the pipe and the file, writing or reading the
+// gzip format (concatenated members included), so no gzip process is
+// needed. The shell waits for the threads of a foreground command so the
+// file is complete when the prompt returns.
+
+#define ZPIPE_BUF (128 * 1024)
+#define ZPIPE_LEVEL 6
+
+typedef struct YashZpipe_t YashZpipe_t;
+
+int zpipeStart(int fileFd, int compress, int level, YashZpipe_t** streams);
+int zpipeRedirs(RedirList_t* redirs, YashZpipe_t** streams);
+void zpipeFinish(YashZpipe_t* streams, int wait);
+
+#endif
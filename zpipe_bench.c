@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "zpipe.h"
+
+// Benchmark for compressed redirections. MBYTES of log-like lines are
+// compressed into a temporary file and read back, once through a zpipe
+// thread in this process and once through a gzip process at the same level
+// on the other end of a pipe, as "cmd | gzip > f" and "gzip -dc f | cmd"
+// would. Producer and consumer are the same in both runs, so the rates
+// compare the in-process codec with the external one.
+//
+//   zpipe_bench MBYTES
+
+#define BENCH_CHUNK (64 * 1024)
+#define BENCH_RUNS 3
+
+extern char** environ;
+
+/**
+ * Purpose:
+ *   Current monotonic time in seconds
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (double): Seconds
+ */
+double nowSec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Purpose:
+ *   Fill a buffer with log-like lines: a counter, a level and a few words
+ *   picked at random, which gzip shrinks to about a quarter
+ *
+ * Args:
+ *   buf  (char*): Buffer
+ *   bytes (long): Size of buf
+ *
+ * Returns:
+ *   None
+ */
+void fillData(char* buf, long bytes){
+  const char* WORDS[] = {"request", "served", "cache", "miss", "hit", "user",
+                         "session", "timeout", "retry", "upstream", "ok",
+                         "closed", "GET", "POST", "/index.html", "/api/v1"};
+  const char* LEVELS[] = {"INFO", "WARN", "DEBUG"};
+
+  char line[256];
+  long pos = 0;
+  long seq = 0;
+  int len;
+  int word;
+
+  srand(1);
+  while(pos < bytes){
+    len = snprintf(line, sizeof(line), "%010ld %s", seq++,
+                   LEVELS[rand() % 3]);
+    for(word = 0; word < 6; word++){
+      len += snprintf(line + len, sizeof(line) - len, " %s=%d",
+                      WORDS[rand() % 16], rand() % 1000);
+    }
+    line[len++] = '\n';
+    if(len > bytes - pos){
+      len = bytes - pos;
+    }
+    memcpy(buf + pos, line, len);
+    pos += len;
+  }
+
+  return;
+}
+
+/**
+ * Purpose:
+ *   Fork a producer writing the data to fd
+ *
+ * Args:
+ *   fd     (int): Output fd
+ *   data (char*): Data
+ *   bytes (long): Size of data
+ *
+ * Returns:
+ *   (int): PID of the producer
+ */
+int startProducer(int fd, char* data, long bytes){
+  long pos;
+  ssize_t ret;
+  int pid;
+
+  if((pid = fork()) == 0){
+    for(pos = 0; pos < bytes; pos += ret){
+      if((ret = write(fd, data + pos,
+                      bytes - pos < BENCH_CHUNK ? bytes - pos : BENCH_CHUNK))
+         <= 0){
+        _exit(1);
+      }
+    }
+    _exit(0);
+  }
+
+  return pid;
+}
+
+/**
+ * Purpose:
+ *   Read and discard fd until EOF
+ *
+ * Args:
+ *   fd (int): Input fd
+ *
+ * Returns:
+ *   (long): Bytes read
+ */
+long drain(int fd){
+  char buf[BENCH_CHUNK];
+  long total = 0;
+  ssize_t ret;
+
+  while((ret = read(fd, buf, sizeof(buf))) > 0){
+    total += ret;
+  }
+
+  return total;
+}
+
+/**
+ * Purpose:
+ *   Compress the data into path, through zpipe or a gzip process
+ *
+ * Args:
+ *   path (const char*): Output file
+ *   data       (char*): Data
+ *   bytes       (long): Size of data
+ *   external     (int): 1 for gzip, 0 for zpipe
+ *
+ * Returns:
+ *   (double): Seconds until the file was complete
+ */
+double runCompress(const char* path, char* data, long bytes, int external){
+  char level[8];
+  char* gzipArgv[] = {"gzip", level, "-c", NULL};
+  posix_spawn_file_actions_t actions;
+  YashZpipe_t* streams = NULL;
+  double begin;
+  int pfd[2];
+  int fileFd;
+  int pid;
+
+  snprintf(level, sizeof(level), "-%d", ZPIPE_LEVEL);
+  fileFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  begin = nowSec();
+  if(external){
+    pipe2(pfd, O_CLOEXEC);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pfd[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fileFd, STDOUT_FILENO);
+    posix_spawnp(&pid, "gzip", &actions, NULL, gzipArgv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pfd[0]);
+    close(fileFd);
+    startProducer(pfd[1], data, bytes);
+    close(pfd[1]);
+    while(wait(NULL) > 0);
+  }
+  else{
+    pfd[1] = zpipeStart(fileFd, 1, ZPIPE_LEVEL, &streams);
+    startProducer(pfd[1], data, bytes);
+    close(pfd[1]);
+    while(wait(NULL) > 0);
+    zpipeFinish(streams, 1);
+  }
+
+  return nowSec() - begin;
+}
+
+/**
+ * Purpose:
+ *   Decompress path into a consumer, through zpipe or a gzip process
+ *
+ * Args:
+ *   path (const char*): Compressed file
+ *   bytes       (long): Expected size of the data
+ *   external     (int): 1 for gzip, 0 for zpipe
+ *
+ * Returns:
+ *   (double): Seconds until the consumer saw EOF, -1 if data was lost
+ */
+double runDecompress(const char* path, long bytes, int external){
+  char* gzipArgv[] = {"gzip", "-dc", (char*)path, NULL};
+  posix_spawn_file_actions_t actions;
+  YashZpipe_t* streams = NULL;
+  double begin;
+  long total;
+  int pfd[2];
+  int pid;
+
+  begin = nowSec();
+  if(external){
+    pipe2(pfd, O_CLOEXEC);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pfd[1], STDOUT_FILENO);
+    posix_spawnp(&pid, "gzip", &actions, NULL, gzipArgv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pfd[1]);
+    total = drain(pfd[0]);
+    close(pfd[0]);
+    while(wait(NULL) > 0);
+  }
+  else{
+    pfd[0] = zpipeStart(open(path, O_RDONLY | O_CLOEXEC), 0, ZPIPE_LEVEL,
+                        &streams);
+    total = drain(pfd[0]);
+    close(pfd[0]);
+    zpipeFinish(streams, 1);
+  }
+
+  return total == bytes ? nowSec() - begin : -1;
+}
+
+/**
+ * Purpose:
+ *   Best of BENCH_RUNS runs of one codec, printed
+ *
+ * Args:
+ *   label (const char*): Name of the codec
+ *   data        (char*): Data
+ *   bytes        (long): Size of data
+ *   external      (int): 1 for gzip, 0 for zpipe
+ *
+ * Returns:
+ *   None
+ */
+void report(const char* label, char* data, long bytes, int external){
+  char path[] = "/tmp/zpipe_bench.XXXXXX";
+  double bestIn = 0;
+  double bestOut = 0;
+  double secs;
+  off_t size = 0;
+  int run;
+  int fd;
+
+  close(fd = mkstemp(path));
+  for(run = 0; run < BENCH_RUNS; run++){
+    secs = runCompress(path, data, bytes, external);
+    if(run == 0 || secs < bestOut){
+      bestOut = secs;
+    }
+    if((secs = runDecompress(path, bytes, external)) < 0){
+      fprintf(stderr, "zpipe_bench: %s: data lost\n", label);
+      unlink(path);
+      exit(1);
+    }
+    if(run == 0 || secs < bestIn){
+      bestIn = secs;
+    }
+  }
+  fd = open(path, O_RDONLY);
+  size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  unlink(path);
+
+  printf("%-6s ratio %4.2f  compress %7.1f MB/s  decompress %7.1f MB/s\n",
+         label, (double)bytes / size, bytes / bestOut / 1e6,
+         bytes / bestIn / 1e6);
+
+  return;
+}
+
+int main(int argc, char** argv){
+  char* data = NULL;
+  long bytes;
+
+  if(argc != 2 || (bytes = atol(argv[1]) * 1024 * 1024) <= 0){
+    fprintf(stderr, "usage: zpipe_bench MBYTES\n");
+    return 1;
+  }
+  data = (char*)malloc(bytes);
+  fillData(data, bytes);
+
+  printf("%ld MB per run, level %d\n", bytes >> 20, ZPIPE_LEVEL);
+  report("zpipe", data, bytes, 0);
+  report("gzip", data, bytes, 1);
+  free(data);
+
+  return 0;
+}
@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "zygote.h"
+
+// Received fds are moved at least this high in the child so the fd map and
+// redirections cannot overwrite one that is still needed
+#define ZYGOTE_FD_BASE 100
+
+/**
+ * ZygoteReq_t struct, header of a spawn request. It is followed by
+ * numMap (target, fd index) pairs, numOps redirections of five ints
+ * (type, fd, srcFd, srcIsIndex, both), then argc argv strings and envc
+ * environment strings, each NUL terminated. cwd is the fd index of the
+ * shell's working directory, since the zygote's own stays where the shell
+ * started.
+ */
+typedef struct ZygoteReq_t{
+  int32_t pgid;
+  int32_t cwd;
+  int32_t numMap;
+  int32_t numOps;
+  int32_t argc;
+  int32_t envc;
+}ZygoteReq_t;
+
+/**
+ * Purpose:
+ *   Child side of a spawn: install fds, join the process group and exec.
+ *   Does not return.
+ *
+ * Args:
+ *   buf  (char*): Request message
+ *   fds   (int*): fds received with the request
+ *   numFds (int): Number of received fds
+ *
+ * Returns:
+ *   None
+ */
+void zygoteExec(char* buf, int* fds, int numFds){
+  ZygoteReq_t* req = (ZygoteReq_t*)buf;
+  int32_t* ints = (int32_t*)(buf + sizeof(ZygoteReq_t));
+  int32_t* op = NULL;
+  char* strs = NULL;
+  char** argv = NULL;
+  char** envp = NULL;
+  int index;
+
+  for(index = 0; index < numFds; index++){
+    fds[index] = fcntl(fds[index], F_DUPFD_CLOEXEC, ZYGOTE_FD_BASE);
+  }
+  if(req->cwd >= 0 && fchdir(fds[req->cwd]) < 0){
+    fprintf(stderr, "yash: %s\n", strerror(errno));
+    _exit(EXIT_FAILURE);
+  }
+
+  for(index = 0; index < req->numMap; index++){
+    dup2(fds[ints[2 * index + 1]], ints[2 * index]);
+  }
+
+  op = ints + 2 * req->numMap;
+  for(index = 0; index < req->numOps; index++, op += 5){
+    if(op[0] == REDIR_DUP){
+      if(dup2(op[3] ? fds[op[2]] : op[2], op[1]) < 0){
+        fprintf(stderr, "yash: %d: %s\n", op[2], strerror(errno));
+        _exit(EXIT_FAILURE);
+      }
+      if(op[4]){
+        dup2(op[1], STDERR_FILENO);
+      }
+    }
+    else if(op[0] == REDIR_CLOSE){
+      close(op[1]);
+    }
+  }
+
+  argv = (char**)malloc((req->argc + 1) * sizeof(char*));
+  envp = (char**)malloc((req->envc + 1) * sizeof(char*));
+  strs = (char*)op;
+  for(index = 0; index < req->argc; index++){
+    argv[index] = strs;
+    strs += strlen(strs) + 1;
+  }
+  argv[req->argc] = NULL;
+  for(index = 0; index < req->envc; index++){
+    envp[index] = strs;
+    strs += strlen(strs) + 1;
+  }
+  envp[req->envc] = NULL;
+
+  setpgid(0, req->pgid);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+
+  execvpe(argv[0], argv, envp);
+  fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(errno));
+  _exit(EXIT_FAILURE);
+}
+
+/**
+ * Purpose:
+ *   Fork server loop: receive requests and clone children for the shell
+ *   until the shell closes its end. Does not return.
+ *
+ * Args:
+ *   sock (int): Zygote end of the socketpair
+ *
+ * Returns:
+ *   None
+ */
+void zygoteLoop(int sock){
+  char* buf = (char*)malloc(ZYGOTE_MAX_MSG);
+  char ctrl[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+  int fds[ZYGOTE_MAX_FDS];
+  int numFds;
+  int32_t reply;
+  long pid;
+  ssize_t nread;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg = NULL;
+
+  // The zygote shares the shell's process group, so keyboard signals
+  // reach it too
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+  while(1){
+    iov.iov_base = buf;
+    iov.iov_len = ZYGOTE_MAX_MSG;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    nread = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if(nread < 0 && errno == EINTR){
+      continue;
+    }
+    else if(nread <= 0){
+      _exit(EXIT_SUCCESS);
+    }
+
+    numFds = 0;
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+        cmsg = CMSG_NXTHDR(&msg, cmsg)){
+      if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+        numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), numFds * sizeof(int));
+      }
+    }
+
+    // Fork-like clone whose parent is the shell, not the zygote
+    pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+    if(pid == 0){
+      close(sock);
+      zygoteExec(buf, fds, numFds);
+    }
+
+    reply = (pid < 0) ? -errno : (int32_t)pid;
+    while(numFds > 0){
+      close(fds[--numFds]);
+    }
+    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+  }
+}
+
+/**
+ * Purpose:
+ *   Fork the zygote. Call early, while the shell's address space is small.
+ *
+ * Args:
+ *   None
+ *
+ * Returns:
+ *   (YashZygote_t*): Handle, or NULL if it could not be started
+ */
+YashZygote_t* zygoteStart(void){
+  YashZygote_t* zygote = NULL;
+  int sv[2];
+  int pid;
+
+  if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0){
+    return NULL;
+  }
+
+  if((pid = fork()) < 0){
+    close(sv[0]);
+    close(sv[1]);
+    return NULL;
+  }
+  else if(pid == 0){
+    close(sv[0]);
+    zygoteLoop(sv[1]);
+  }
+
+  close(sv[1]);
+  zygote = (YashZygote_t*)malloc(sizeof(YashZygote_t));
+  zygote->sock = sv[0];
+  zygote->pid = pid;
+
+  return zygote;
+}
+
+/**
+ * Purpose:
+ *   Append a string to a request buffer
+ *
+ * Args:
+ *   buf  (char*): Request buffer
+ *   len (size_t*): Bytes used so far
+ *   str  (char*): String to append with its NUL
+ *
+ * Returns:
+ *   (int): 0 on success, -1 if the request would be too large
+ */
+int zygotePutStr(char* buf, size_t* len, char* str){
+  size_t strLen = strlen(str) + 1;
+
+  if(*len + strLen > ZYGOTE_MAX_MSG){
+    return -1;
+  }
+  memcpy(buf + *len, str, strLen);
+  *len += strLen;
+
+  return 0;
+}
+
+/**
+ * Purpose:
+ *   Spawn a command through the zygote. Redirection files are opened here
+ *   and passed as fds so errors still show the file name.
+ *
+ * Args:
+ *   zygote (YashZygote_t*): Zygote handle
+ *   argv          (char**): Exec arguments
+ *   redirs  (RedirList_t*): fd operations from parseRedirs
+ *   fdMap           (int*): (target, source) fd pairs applied first
+ *   numMap           (int): Number of pairs in fdMap
+ *   pgid             (int): Process group to join, 0 for a new one
+ *   pid             (int*): Set to the PID of the new child
+ *
+ * Returns:
+ *   (int): 0 on success, error number if the command failed to start, or
+ *          -1 if the zygote could not be used and the caller should spawn
+ *          by itself
+ */
+int zygoteSpawn(YashZygote_t* zygote, char** argv, RedirList_t* redirs,
+                int* fdMap, int numMap, int pgid, int* pid){
+  const int UNUSABLE = -1;
+
+  char* buf = NULL;
+  char ctrl[CMSG_SPACE(ZYGOTE_MAX_FDS * sizeof(int))];
+  int fds[ZYGOTE_MAX_FDS];
+  int numFds = 0;
+  int32_t* ints = NULL;
+  int32_t reply;
+  size_t len;
+  ZygoteReq_t* req = NULL;
+  RedirOp_t* op = NULL;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg = NULL;
+  int cwdFd;
+  int ret = 0;
+  int index;
+
+  if(numMap + redirs->numOps + 1 > ZYGOTE_MAX_FDS){
+    return UNUSABLE;
+  }
+  if((cwdFd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0){
+    return UNUSABLE;
+  }
+  if(openRedirs(redirs) < 0){
+    close(cwdFd);
+    return EXIT_FAILURE;
+  }
+
+  buf = (char*)malloc(ZYGOTE_MAX_MSG);
+  req = (ZygoteReq_t*)buf;
+  ints = (int32_t*)(buf + sizeof(ZygoteReq_t));
+  req->pgid = pgid;
+  req->cwd = numFds;
+  fds[numFds++] = cwdFd;
+  req->numMap = numMap;
+  req->numOps = redirs->numOps;
+  req->argc = 0;
+  req->envc = 0;
+
+  for(index = 0; index < numMap; index++){
+    *ints++ = fdMap[2 * index];
+    *ints++ = numFds;
+    fds[numFds++] = fdMap[2 * index + 1];
+  }
+  for(index = 0; index < redirs->numOps; index++){
+    op = &redirs->ops[index];
+    *ints++ = op->type;
+    *ints++ = op->fd;
+    if(op->type == REDIR_DUP && op->path != NULL){
+      // Opened by openRedirs; send the fd itself
+      *ints++ = numFds;
+      *ints++ = 1;
+      fds[numFds++] = op->srcFd;
+    }
+    else{
+      *ints++ = op->srcFd;
+      *ints++ = 0;
+    }
+    *ints++ = op->both;
+  }
+
+  len = (char*)ints - buf;
+  for(index = 0; argv[index] != NULL && !ret; index++, req->argc++){
+    ret = zygotePutStr(buf, &len, argv[index]);
+  }
+  for(index = 0; environ[index] != NULL && !ret; index++, req->envc++){
+    ret = zygotePutStr(buf, &len, environ[index]);
+  }
+
+  if(!ret){
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(numFds > 0){
+      msg.msg_control = ctrl;
+      msg.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+      cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+      memcpy(CMSG_DATA(cmsg), fds, numFds * sizeof(int));
+    }
+
+    if(sendmsg(zygote->sock, &msg, MSG_NOSIGNAL) < 0 ||
+       recv(zygote->sock, &reply, sizeof(reply), 0) != sizeof(reply)){
+      ret = UNUSABLE;
+    }
+    else if(reply < 0){
+      ret = -reply;
+      fprintf(stderr, "yash: %s: %s\n", argv[0], strerror(ret));
+    }
+    else{
+      *pid = reply;
+    }
+  }
+  else{
+    ret = UNUSABLE;
+  }
+
+  closeRedirs(redirs);
+  close(cwdFd);
+  free(buf);
+
+  return ret;
+}
+
+/**
+ * Purpose:
+ *   Stop the zygote and free its handle
+ *
+ * Args:
+ *   zygote (YashZygote_t*): Zygote handle, may be NULL
+ *
+ * Returns:
+ *   None
+ */
+void zygoteStop(YashZygote_t* zygote){
+  if(zygote == NULL){
+    return;
+  }
+  close(zygote->sock);
+  free(zygote);
+
+  return;
+}
@@ -0,0 +1,26 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "libyash_internal.h"
+
+// Fork server: a small helper forked before the shell grows that spawns
+// commands for it. Children are created with CLONE_PARENT, so they are
+// children of the shell and job control works unchanged.
+
+#define ZYGOTE_MAX_MSG (128 * 1024)
+#define ZYGOTE_MAX_FDS 32
+
+/**
+ * YashZygote_t struct, shell side of the fork server
+ */
+typedef struct YashZygote_t{
+  int sock;
+  int pid;
+}YashZygote_t;
+
+YashZygote_t* zygoteStart(void);
+int zygoteSpawn(YashZygote_t* zygote, char** argv, RedirList_t* redirs,
+                int* fdMap, int numMap, int pgid, int* pid);
+void zygoteStop(YashZygote_t* zygote);
+
+#endif
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+
+// Checks for commands spawned through the zygote, as yash -z does. The
+// zygote is started in one directory and the test then changes to another,
+// as cd does in the shell; each case runs a command with its stdout on a
+// pipe and compares what it wrote.
+//
+//   zygote_test
+
+#define TEST_OUT_MAX 4096
+
+/**
+ * Purpose:
+ *   Spawn a command through the zygote and collect its output
+ *
+ * Args:
+ *   zygote (YashZygote_t*): Zygote handle
+ *   argv          (char**): Exec arguments
+ *   out            (char*): Set to the output, NUL terminated
+ *   outLen           (int): Size of out
+ *
+ * Returns:
+ *   (int): Exit status of the command, -1 if it could not be run
+ */
+int runZygote(YashZygote_t* zygote, char** argv, char* out, int outLen){
+  RedirList_t redirs;
+  int fdMap[2];
+  int pfd[2];
+  int status;
+  int total = 0;
+  int pid;
+  ssize_t nread;
+
+  redirs.numOps = 0;
+  if(pipe2(pfd, O_CLOEXEC) < 0){
+    return -1;
+  }
+  fdMap[0] = STDOUT_FILENO;
+  fdMap[1] = pfd[1];
+  if(zygoteSpawn(zygote, argv, &redirs, fdMap, 1, 0, &pid)){
+    close(pfd[0]);
+    close(pfd[1]);
+    return -1;
+  }
+  close(pfd[1]);
+  while(total < outLen - 1 &&
+        (nread = read(pfd[0], out + total, outLen - 1 - total)) > 0){
+    total += nread;
+  }
+  out[total] = '\0';
+  close(pfd[0]);
+  if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status)){
+    return -1;
+  }
+
+  return WEXITSTATUS(status);
+}
+
+/**
+ * Purpose:
+ *   Run one case and compare its output
+ *
+ * Args:
+ *   zygote (YashZygote_t*): Zygote handle
+ *   argv          (char**): Exec arguments
+ *   expect   (const char*): Output it must produce
+ *
+ * Returns:
+ *   (int): 0 if it passed, 1 if not
+ */
+int runCase(YashZygote_t* zygote, char** argv, const char* expect){
+  char out[TEST_OUT_MAX];
+  int status;
+
+  status = runZygote(zygote, argv, out, sizeof(out));
+  if(status != 0 || strcmp(out, expect)){
+    printf("FAIL: %s\n  status %d\n  output \"%s\"\n  want   \"%s\"\n",
+           argv[0], status, out, expect);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(void){
+  char* pwdArgv[] = {"/bin/pwd", NULL};
+  char* lsArgv[] = {"ls", "zygote_test.marker", NULL};
+  char dir[] = "/tmp/zygote_test.XXXXXX";
+  char expect[PATH_MAX + 2];
+  char path[PATH_MAX];
+  YashZygote_t* zygote = NULL;
+  FILE* marker = NULL;
+  int numTests = 0;
+  int failed = 0;
+
+  if((zygote = zygoteStart()) == NULL){
+    printf("FAIL: zygote did not start\n");
+    return EXIT_FAILURE;
+  }
+  if(mkdtemp(dir) == NULL || chdir(dir) < 0 ||
+     getcwd(path, sizeof(path)) == NULL){
+    perror(dir);
+    zygoteStop(zygote);
+    return EXIT_FAILURE;
+  }
+  marker = fopen("zygote_test.marker", "w");
+  fclose(marker);
+
+  // The zygote was forked before the chdir; its children must not be
+  snprintf(expect, sizeof(expect), "%s\n", path);
+  failed += runCase(zygote, pwdArgv, expect);
+  numTests++;
+  failed += runCase(zygote, lsArgv, "zygote_test.marker\n");
+  numTests++;
+
+  zygoteStop(zygote);
+  unlink("zygote_test.marker");
+  chdir("/");
+  rmdir(dir);
+  printf("%d of %d passed\n", numTests - failed, numTests);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}